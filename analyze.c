@@ -1,8 +1,18 @@
 #include "nolli.h"
 #include "ast.h"
 #include "type.h"
+#include "typetab.h"
+#include "instance.h"
 #include "strtab.h"
+#include "builtins.h"
 #include "symtable.h"
+#include "pool.h"
+#include "msgbuf.h"
+#include "walk.h"
+#include "stats.h"
+#include "trace.h"
+#include "mem.h"
+#include "arena.h"
 #include "debug.h"
 
 /* FIXME: need lexer.h to look up tokens */
@@ -37,6 +47,9 @@
  *     Analyze global initializations
  *     Analyze function/method bodies
  *
+ * Analysis is repeated whenever units are replaced. Declarations are
+ * collected again each time, but a body is only analyzed again if a
+ * package-level name it used now resolves differently (see nl_deps).
  */
 
 /*
@@ -73,7 +86,12 @@
 /* Analysis State */
 struct analysis {
     struct nl_context *ctx;
-    struct nl_symtable *packages;
+    struct nl_symtable *packages;   /* Package names -> package table */
+    struct pkgtable **order;        /* package tables by first appearance */
+    unsigned int package_count;
+    struct nl_ast **fragments;      /* package nodes of all units, by package */
+    unsigned int fragment_count;
+    struct nl_deps *deps;           /* of the body being analyzed, if any */
 };
 
 /* Collection of types/symbols for a package */
@@ -81,6 +99,8 @@ struct pkgtable {
     struct nl_symtable *type_names;     /* Typenames -> types */
     struct nl_symtable *type_tables;    /* Typenames -> typetable */
     struct nl_symtable *symbols;        /* Symbols -> types */
+    struct nl_ast **fragments;          /* package nodes of this name, in order */
+    unsigned int fragment_count;
 };
 
 struct func_info {
@@ -88,6 +108,31 @@ struct func_info {
     bool inloop;
 };
 
+/* Kinds of package-level names a body can refer to */
+enum dep_kind {
+    DEP_SYMBOL,
+    DEP_TYPE,
+    DEP_PACKAGE
+};
+
+/* A package-level name a body resolved, and what it resolved to */
+struct dep {
+    enum dep_kind kind;
+    nl_string_t name;
+    const void *value;          /* symbol or type found, or NULL */
+    const void *shape;          /* signature, if `value` is a generic function */
+};
+
+/* Kept with a function, class or package node between analyses. A body
+ * whose names all resolve the same way again can't have changed, so it
+ * is skipped and its messages are reported again instead. */
+struct nl_deps {
+    struct dep *deps;
+    unsigned int count;
+    unsigned int size;
+    struct nl_msgbuf messages;
+};
+
 const char *NL_GLOBAL_PACKAGE_NAME = "";
 
 #define ANALYSIS_ERRORF(A, n, fmt, ...) \
@@ -95,11 +140,12 @@ const char *NL_GLOBAL_PACKAGE_NAME = "";
 #define ANALYSIS_ERROR(A, n, ...) ANALYSIS_ERRORF(A, n, "%s", __VA_ARGS__)
 
 
+static struct nl_type *set_type(struct nl_ast *node,
+        struct nl_symtable *types, struct analysis *analysis);
+static struct nl_symtable *make_tmpl_table(struct nl_ast *tmpl, struct nl_type *owner,
+        struct nl_symtable *types, struct analysis *analysis);
 static struct nl_type *expr_set_type(struct nl_ast *node,
         struct nl_symtable *symbols, struct nl_symtable *types, struct analysis *analysis);
-static void analyze_statement(struct nl_ast *stmt,
-        struct nl_symtable *symbols, struct nl_symtable *types,
-        struct func_info *func_info, struct analysis *analysis);
 
 
 static int analysis_init(struct analysis *analysis, struct nl_context *ctx)
@@ -115,6 +161,145 @@ static int analysis_init(struct analysis *analysis, struct nl_context *ctx)
     return NL_NO_ERR;
 }
 
+static void destroy_package_table(struct pkgtable *tab, struct analysis *analysis)
+{
+    /* class and interface tables are owned by their package */
+    unsigned int idx = 0;
+    nl_string_t name = NULL;
+    void *value = NULL;
+    while (nl_symtable_iter(tab->type_tables, &idx, &name, &value)) {
+        nl_symtable_destroy(analysis->ctx, value);
+    }
+
+    /* as are the template scopes of its generic classes and functions */
+    idx = 0;
+    while (nl_symtable_iter(tab->type_names, &idx, &name, &value)) {
+        struct nl_type *tp = value;
+        if (tp != NULL && NL_TYPE_CLASS == tp->tag && tp->clss.tmpl_types != NULL) {
+            nl_symtable_destroy(analysis->ctx, tp->clss.tmpl_types);
+            tp->clss.tmpl_types = NULL;
+        }
+    }
+    idx = 0;
+    while (nl_symtable_iter(tab->symbols, &idx, &name, &value)) {
+        struct nl_type *tp = value;
+        if (tp != NULL && NL_TYPE_GENERIC == tp->tag && tp->generic.tmpl_types != NULL) {
+            nl_symtable_destroy(analysis->ctx, tp->generic.tmpl_types);
+            tp->generic.tmpl_types = NULL;
+        }
+    }
+
+    nl_symtable_destroy(analysis->ctx, tab->type_names);
+    nl_symtable_destroy(analysis->ctx, tab->type_tables);
+    nl_symtable_destroy(analysis->ctx, tab->symbols);
+    nl_free(analysis->ctx, tab, sizeof(*tab));
+}
+
+/* Once declarations are collected and resolved, a package's tables are
+ * only ever read, so they are compacted into immutable snapshots that
+ * function bodies can be analyzed against independently */
+static void freeze_package_table(struct pkgtable *tab, struct analysis *analysis)
+{
+    unsigned int idx = 0;
+    nl_string_t name = NULL;
+    void *value = NULL;
+    while (nl_symtable_iter(tab->type_tables, &idx, &name, &value)) {
+        nl_symtable_freeze(analysis->ctx, value);
+    }
+
+    nl_symtable_freeze(analysis->ctx, tab->type_names);
+    nl_symtable_freeze(analysis->ctx, tab->type_tables);
+    nl_symtable_freeze(analysis->ctx, tab->symbols);
+}
+
+static void analysis_deinit(struct analysis *analysis)
+{
+    unsigned int idx = 0;
+    nl_string_t name = NULL;
+    void *value = NULL;
+    while (nl_symtable_iter(analysis->packages, &idx, &name, &value)) {
+        destroy_package_table((struct pkgtable*)value, analysis);
+    }
+    nl_symtable_destroy(analysis->ctx, analysis->packages);
+    analysis->packages = NULL;
+
+    /* room was made for every package node, plus the global package */
+    nl_free(analysis->ctx, analysis->order,
+            (analysis->fragment_count + 1) * sizeof(*analysis->order));
+    analysis->order = NULL;
+    nl_free(analysis->ctx, analysis->fragments,
+            analysis->fragment_count * sizeof(*analysis->fragments));
+    analysis->fragments = NULL;
+}
+
+/* Generic functions are reused while their declaration is unchanged,
+ * so their signature is compared as well */
+static const void *shape_of(enum dep_kind kind, const void *value)
+{
+    const struct nl_type *tp = value;
+    if (DEP_SYMBOL == kind && tp != NULL && NL_TYPE_GENERIC == tp->tag) {
+        return tp->generic.func;
+    }
+    return NULL;
+}
+
+static void add_dep(enum dep_kind kind, nl_string_t name, const void *value,
+        struct analysis *analysis)
+{
+    struct nl_deps *deps = analysis->deps;
+    if (deps->count == deps->size) {
+        unsigned int size = deps->size ? deps->size * 2 : 8;
+        deps->deps = nl_arena_realloc(analysis->ctx,
+                nl_arena(analysis->ctx, NL_ARENA_ANALYSIS), deps->deps,
+                deps->size * sizeof(*deps->deps), size * sizeof(*deps->deps));
+        deps->size = size;
+    }
+    deps->deps[deps->count++] = (struct dep){
+        .kind=kind, .name=name, .value=value, .shape=shape_of(kind, value)
+    };
+}
+
+/* Searches `tab` like nl_symtable_search. Names found in (or missing
+ * from) the frozen package tables are recorded as dependencies of the
+ * body being analyzed; local scopes and template parameters aren't. */
+static void *lookup(struct nl_symtable *tab, nl_string_t name,
+        enum dep_kind kind, struct analysis *analysis)
+{
+    const struct nl_symtable *owner = NULL;
+    void *value = nl_symtable_find(tab, name, &owner);
+    if (analysis->deps != NULL && (NULL == owner || owner->frozen != NULL)) {
+        add_dep(kind, name, value, analysis);
+    }
+    return value;
+}
+
+static bool deps_changed(const struct nl_deps *deps, const struct pkgtable *pkgtable,
+        const struct analysis *analysis)
+{
+    unsigned int i;
+    for (i = 0; i < deps->count; i++) {
+        const struct dep *dep = &deps->deps[i];
+        const void *value = NULL;
+        switch (dep->kind) {
+            case DEP_SYMBOL:
+                value = nl_symtable_search(pkgtable->symbols, dep->name);
+                break;
+            case DEP_TYPE:
+                value = nl_symtable_search(pkgtable->type_names, dep->name);
+                break;
+            case DEP_PACKAGE:
+                if (nl_symtable_get(analysis->packages, dep->name) != NULL) {
+                    value = dep->name;
+                }
+                break;
+        }
+        if (value != dep->value || shape_of(dep->kind, value) != dep->shape) {
+            return true;
+        }
+    }
+    return false;
+}
+
 
 static struct nl_type *expr_get_type_bool_lit(struct nl_ast *node,
         struct nl_symtable *symbols, struct nl_symtable *types, struct analysis *analysis)
@@ -173,7 +358,7 @@ static struct nl_type *expr_get_type_class_lit(struct nl_ast *node,
 static struct nl_type *expr_get_type_ident(struct nl_ast *node,
         struct nl_symtable *symbols, struct nl_symtable *types, struct analysis *analysis)
 {
-    struct nl_type *tp = nl_symtable_search(symbols, node->s);
+    struct nl_type *tp = lookup(symbols, node->s, DEP_SYMBOL, analysis);
     if (NULL == tp) {
         ANALYSIS_ERRORF(analysis, node, "Unknown symbol %s", node->s);
         return NULL;
@@ -184,14 +369,14 @@ static struct nl_type *expr_get_type_ident(struct nl_ast *node,
 static struct nl_type *expr_get_type_unexpr(struct nl_ast *node,
         struct nl_symtable *symbols, struct nl_symtable *types, struct analysis *analysis)
 {
-    return expr_set_type(node->unexpr.expr, symbols, types, analysis);
+    return node->unexpr.expr->type;
 }
 
 static struct nl_type *expr_get_type_binexpr(struct nl_ast *node,
         struct nl_symtable *symbols, struct nl_symtable *types, struct analysis *analysis)
 {
-    struct nl_type *lhs_type = expr_set_type(node->binexpr.lhs, symbols, types, analysis);
-    struct nl_type *rhs_type = expr_set_type(node->binexpr.rhs, symbols, types, analysis);
+    struct nl_type *lhs_type = node->binexpr.lhs->type;
+    struct nl_type *rhs_type = node->binexpr.rhs->type;
 
     if (!nl_types_equal(lhs_type, rhs_type)) {
         /* FIXME: this is a hack to allow binary expressions on mixed number types */
@@ -214,41 +399,115 @@ static struct nl_type *expr_get_type_binexpr(struct nl_ast *node,
     return tp;
 }
 
+/* Infers the type arguments of a call to a generic function from its
+ * argument types and returns the matching instance */
+static struct nl_instance *instantiate_call(struct nl_ast *node, struct nl_type *generic,
+        struct nl_type **arg_types, struct analysis *analysis)
+{
+    struct nl_context* ctx = analysis->ctx;
+    struct nl_type *func = generic->generic.func;
+    unsigned int count = generic->generic.tmpl_count;
+    struct nl_type **bindings = nl_alloc_tagged(ctx,
+            count * sizeof(*bindings), NL_MEM_TYPES);
+
+    bool ok = true;
+    unsigned int i;
+    for (i = 0; ok && i < func->func.param_count; i++) {
+        ok = arg_types[i] != NULL &&
+            nl_type_unify(generic, func->func.param_types[i], arg_types[i], bindings);
+    }
+
+    struct nl_instance *inst = NULL;
+    if (ok) {
+        inst = nl_instantiate(ctx, ctx->instances, generic, bindings);
+    } else {
+        ANALYSIS_ERRORF(analysis, node, "Can't infer template arguments for %s",
+                generic->repr);
+    }
+    nl_free(ctx, bindings, count * sizeof(*bindings));
+    return inst;
+}
+
+static bool is_callable(const struct nl_type *tp)
+{
+    return tp != NULL && (tp->tag == NL_TYPE_FUNC || tp->tag == NL_TYPE_GENERIC);
+}
+
+/* Checks the function being called, once it is typed and before any
+ * of the arguments are. Returns false if the arguments needn't be typed. */
+static bool check_callee(struct nl_ast *node, struct analysis *analysis)
+{
+    struct nl_type *tp = node->call.func->type;
+    if (!is_callable(tp)) {
+        /* TODO ?? invalid function in "call" */
+        ANALYSIS_ERROR(analysis, node, "attempt to call something that isn't a function");
+
+        /* the arguments still need their types (e.g. for calls to generics) */
+        return true;
+    }
+
+    struct nl_type *functype = tp;
+    if (NL_TYPE_GENERIC == tp->tag) {
+        functype = tp->generic.func;
+    }
+    unsigned int param_count = functype->func.param_count;
+    unsigned int arg_count = node->call.args->list.count;
+    if (param_count != arg_count) {
+        ANALYSIS_ERRORF(analysis, node, "incorrect number of arguments"
+                " (expected %d, found %d)", param_count, arg_count);
+        return false;
+    }
+    return true;
+}
+
 static struct nl_type *expr_get_type_call(struct nl_ast *node,
         struct nl_symtable *symbols, struct nl_symtable *types, struct analysis *analysis)
 {
     assert(NL_AST_CALL == node->tag || NL_AST_CALL_STMT == node->tag);
 
-    struct nl_type *tp = expr_set_type(node->call.func, symbols, types, analysis);
-    if (NULL == tp || tp->tag != NL_TYPE_FUNC) {
-        /* TODO ?? invalid function in "call" */
-        ANALYSIS_ERROR(analysis, node, "attempt to call something that isn't a function");
-    } else {
-        struct nl_ast* args = node->call.args;
-        struct nl_ast* arg = args->list.head;
-        unsigned int arg_count = args->list.count;
-        unsigned int param_count = tp->func.param_count;
-        if (param_count != args->list.count) {
-            ANALYSIS_ERRORF(analysis, node, "incorrect number of arguments"
-                    " (expected %d, found %d)", param_count, arg_count);
-            return NULL;
-        }
+    /* check_callee has already reported any problem with the callee */
+    struct nl_type *tp = node->call.func->type;
+    if (!is_callable(tp)) {
+        return NULL;
+    }
+
+    struct nl_ast* args = node->call.args;
+    unsigned int arg_count = args->list.count;
+    struct nl_type *functype = tp;
+    if (NL_TYPE_GENERIC == tp->tag) {
+        functype = tp->generic.func;
+    }
+    if (functype->func.param_count != arg_count) {
+        return NULL;
+    }
+
+    struct nl_type **arg_types = NULL;
+    if (arg_count > 0) {
+        arg_types = nl_malloc_tagged(analysis->ctx,
+                arg_count * sizeof(*arg_types), NL_MEM_TYPES);
+    }
+    unsigned int i = 0;
+    struct nl_ast* arg = args->list.head;
+    while (arg) {
+        arg_types[i++] = arg->type;
+        arg = arg->next;
+    }
 
-        struct nl_type* param_type = tp->func.param_types_head;
-        while (arg) {
-            assert(param_type != NULL);
-            struct nl_type* arg_type = expr_set_type(arg, symbols, types, analysis);
-            if (!nl_types_equal(param_type, arg_type)) {
+    if (NL_TYPE_GENERIC == tp->tag) {
+        node->call.instance = instantiate_call(node, tp, arg_types, analysis);
+        functype = node->call.instance ? node->call.instance->type : NULL;
+    }
+
+    if (functype != NULL) {
+        for (i = 0; i < arg_count; i++) {
+            if (!nl_types_equal(functype->func.param_types[i], arg_types[i])) {
                 ANALYSIS_ERROR(analysis, node, "Mismatch of types in function call");
             }
-            /* printf("checked param_type for function %s\n", node->call.func->s); */
-            param_type = param_type->next;
-            arg = arg->next;
         }
-
-        tp = tp->func.ret_type;
     }
-    return tp;
+    nl_free(analysis->ctx, arg_types, arg_count * sizeof(*arg_types));
+
+    return functype ? functype->func.ret_type : NULL;
 }
 
 static struct nl_type *expr_get_type_keyval(struct nl_ast *node,
@@ -281,11 +540,14 @@ static struct nl_type *expr_get_type_function(struct nl_ast *node,
     return NULL;
 }
 
-static struct nl_type *expr_set_type(struct nl_ast *node,
-        struct nl_symtable *symbols, struct nl_symtable *types, struct analysis *analysis)
-{
-    assert(node != NULL);
+struct expr_typing {
+    struct nl_symtable *symbols;
+    struct nl_symtable *types;
+    struct analysis *analysis;
+};
 
+static void type_expression(struct nl_ast *node, struct expr_typing *typing)
+{
     typedef struct nl_type* (*expression_typer)(struct nl_ast*, struct nl_symtable*,
             struct nl_symtable*, struct analysis*);
 
@@ -312,13 +574,157 @@ static struct nl_type *expr_set_type(struct nl_ast *node,
 
     struct nl_type *tp = NULL;
 
-    tp = typers[node->tag - NL_AST_BOOL_LIT](node, symbols, types, analysis);
+    tp = typers[node->tag - NL_AST_BOOL_LIT](node, typing->symbols, typing->types,
+            typing->analysis);
 
     if (tp == NULL) {
-        ANALYSIS_ERROR(analysis, node, "Bad type in expression");
+        ANALYSIS_ERROR(typing->analysis, node, "Bad type in expression");
     }
 
     node->type = tp;
+}
+
+/* Operators and calls are typed after their operands; every other
+ * expression is typed as soon as it's reached */
+static bool enter_expression(struct nl_walk *walk, struct nl_walk_frame *frame)
+{
+    struct nl_ast *node = frame->node;
+    switch (node->tag) {
+    case NL_AST_CALL:
+    case NL_AST_CALL_STMT:
+        node->call.instance = NULL;
+        return true;
+    case NL_AST_UNEXPR:
+    case NL_AST_BINEXPR:
+    case NL_AST_LIST_ARGS:
+        return true;
+    default:
+        type_expression(node, walk->data);
+        return false;
+    }
+}
+
+static bool enter_operand(struct nl_walk *walk, struct nl_walk_frame *frame,
+        unsigned int index)
+{
+    struct nl_ast *node = frame->node;
+    if ((NL_AST_CALL == node->tag || NL_AST_CALL_STMT == node->tag) && index == 0) {
+        struct expr_typing *typing = walk->data;
+        return check_callee(node, typing->analysis);
+    }
+    return true;
+}
+
+static void leave_expression(struct nl_walk *walk, struct nl_walk_frame *frame)
+{
+    struct nl_ast *node = frame->node;
+    struct expr_typing *typing = walk->data;
+    if (NL_AST_CALL_STMT == node->tag) {
+        /* just treat the call statement as a call expression */
+        expr_get_type_call(node, typing->symbols, typing->types, typing->analysis);
+    } else if (NL_AST_LIST_ARGS != node->tag) {
+        type_expression(node, typing);
+    }
+}
+
+/* Types an expression and all of its operands */
+static struct nl_type *expr_set_type(struct nl_ast *node,
+        struct nl_symtable *symbols, struct nl_symtable *types, struct analysis *analysis)
+{
+    assert(node != NULL);
+
+    struct expr_typing typing = {symbols, types, analysis};
+    struct nl_walk walk;
+    nl_walk_init(&walk, analysis->ctx, &typing);
+    walk.pre = enter_expression;
+    walk.child = enter_operand;
+    walk.post = leave_expression;
+    nl_walk(&walk, node);
+    nl_walk_deinit(&walk);
+
+    return node->type;
+}
+
+/* Interns the function type described by a NL_AST_FUNC_TYPE node */
+static struct nl_type *func_type_of(struct nl_ast *node,
+        struct nl_symtable *types, struct analysis *analysis)
+{
+    struct nl_context* ctx = analysis->ctx;
+
+    struct nl_type *ret_type = NULL;
+    if (node->func_type.ret_type != NULL) {
+        ret_type = set_type(node->func_type.ret_type, types, analysis);
+    }
+
+    struct nl_ast *params = node->func_type.params;
+    assert(NL_AST_LIST_PARAMS == params->tag);
+    unsigned int count = params->list.count;
+    struct nl_type **param_types = NULL;
+    if (count > 0) {
+        param_types = nl_malloc_tagged(ctx, count * sizeof(*param_types), NL_MEM_TYPES);
+    }
+
+    unsigned int i = 0;
+    struct nl_ast *param = params->list.head;
+    while (param) {
+        assert(NL_AST_DECL == param->tag);
+        param_types[i++] = set_type(param->decl.type, types, analysis);
+        param = param->next;
+    }
+
+    struct nl_type *tp = nl_typetab_func(ctx, ctx->typetab, ret_type, param_types, count);
+    nl_free(ctx, param_types, count * sizeof(*param_types));
+    return tp;
+}
+
+/* Interns an instance of a generic class, or returns NULL if the
+ * template or any of its arguments can't be resolved yet */
+static struct nl_type *tmpl_instance_of(struct nl_ast *node,
+        struct nl_symtable *types, struct analysis *analysis)
+{
+    struct nl_context* ctx = analysis->ctx;
+
+    struct nl_ast *name = node->tmpl_type.name;
+    if (NL_AST_IDENT != name->tag) {
+        return NULL;
+    }
+    struct nl_type *tmpl = lookup(types, name->s, DEP_TYPE, analysis);
+    if (NULL == tmpl || NL_TYPE_CLASS != tmpl->tag || NULL == tmpl->clss.tmpl_types) {
+        return NULL;
+    }
+
+    struct nl_ast *tmpls = node->tmpl_type.tmpls;
+    assert(NL_AST_LIST_TYPES == tmpls->tag);
+    unsigned int count = tmpls->list.count;
+    if (count != tmpl->clss.tmpl_types->count) {
+        ANALYSIS_ERRORF(analysis, node, "Wrong number of template arguments for %s",
+                name->s);
+        return NULL;
+    }
+    struct nl_type **args = nl_malloc_tagged(ctx, count * sizeof(*args), NL_MEM_TYPES);
+
+    struct nl_type *tp = NULL;
+    unsigned int i = 0;
+    struct nl_ast *arg = tmpls->list.head;
+    while (arg) {
+        struct nl_type *arg_type = NULL;
+        if (NL_AST_IDENT == arg->tag) {
+            arg_type = lookup(types, arg->s, DEP_TYPE, analysis);
+        } else if (NL_AST_TMPL_TYPE == arg->tag) {
+            arg_type = tmpl_instance_of(arg, types, analysis);
+        }
+        if (NULL == arg_type) {
+            break;
+        }
+        arg->type = arg_type;
+        args[i++] = arg_type;
+        arg = arg->next;
+    }
+
+    if (i == count) {
+        tp = nl_typetab_tmpl_instance(ctx, ctx->typetab, tmpl, args, count);
+    }
+    nl_free(ctx, args, count * sizeof(*args));
     return tp;
 }
 
@@ -333,13 +739,16 @@ static struct nl_type *set_type(struct nl_ast *node,
 
     switch(node->tag) {
         case NL_AST_IDENT:
-            tp = nl_symtable_search(types, node->s);
+            tp = lookup(types, node->s, DEP_TYPE, analysis);
             if (NULL == tp) {
                 ANALYSIS_ERRORF(analysis, node, "Unknown type %s", node->s);
             }
             break;
         case NL_AST_TMPL_TYPE:
-            tp = &nl_tmpl_placeholder_type;  /* FIXME */
+            tp = tmpl_instance_of(node, types, analysis);
+            if (NULL == tp) {
+                tp = &nl_tmpl_placeholder_type;  /* FIXME */
+            }
             break;
         case NL_AST_QUAL_TYPE: {
             struct nl_ast *pkgname = node->package_ref.package;
@@ -348,20 +757,32 @@ static struct nl_type *set_type(struct nl_ast *node,
             assert(NL_AST_IDENT == name->tag);
 
             struct pkgtable *pkgtable = nl_symtable_get(analysis->packages, pkgname->s);
+            if (analysis->deps != NULL) {
+                add_dep(DEP_PACKAGE, pkgname->s, pkgtable ? pkgname->s : NULL, analysis);
+            }
             if (NULL == pkgtable) {
                 ANALYSIS_ERRORF(analysis, node, "Unknown package %s", pkgname->s);
                 /* FIXME */
             } else {
-                tp = nl_symtable_search(types, name->s);
+                tp = lookup(types, name->s, DEP_TYPE, analysis);
                 if (NULL == tp) {
                     printf("Making new type reference %s:%s\n", pkgname->s, name->s);
-                    tp = nl_type_new_reference(analysis->ctx, pkgname->s, name->s);
+                    tp = nl_typetab_reference(analysis->ctx, analysis->ctx->typetab,
+                            pkgname->s, name->s);
                 }
             }
             break;
         }
         case NL_AST_FUNC_TYPE:
-            tp = nl_type_new_func(analysis->ctx, NULL, NULL, 0);  /* FIXME! */
+            if (node->func_type.tmpl != NULL) {
+                /* FIXME: generic function types can't be instantiated yet */
+                struct nl_symtable *tmpl_types = make_tmpl_table(node->func_type.tmpl,
+                        NULL, types, analysis);
+                tp = func_type_of(node, tmpl_types, analysis);
+                nl_symtable_destroy(analysis->ctx, tmpl_types);
+            } else {
+                tp = func_type_of(node, types, analysis);
+            }
             break;
         case NL_AST_CLASS:
             tp = nl_type_new_class(analysis->ctx, node->classdef.name->s, NULL, NULL, NULL);  /* FIXME! */
@@ -379,7 +800,7 @@ static struct nl_type *set_type(struct nl_ast *node,
     return tp;
 }
 
-static void analyze_decl(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_decl(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
     assert(NL_AST_DECL == node->tag);
@@ -392,14 +813,16 @@ static void analyze_decl(struct nl_ast *node, struct nl_symtable *parent_symbols
 
     /* printf("adding decl %s:%p to %p\n", rhs->s, tp, parent_symbols); */
     nl_symtable_add(analysis->ctx, parent_symbols, rhs->s, tp);
+    return false;
 }
 
-static void analyze_init(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_init(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
+    return false;
 }
 
-static void analyze_bind(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_bind(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
     assert(NL_AST_BIND == node->tag);
@@ -416,9 +839,10 @@ static void analyze_bind(struct nl_ast *node, struct nl_symtable *parent_symbols
         struct nl_type *tp = expr_set_type(expr, parent_symbols, types, analysis);
         nl_symtable_add(analysis->ctx, parent_symbols, name->s, tp);
     }
+    return false;
 }
 
-static void analyze_assign(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_assign(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
     assert(NL_AST_ASSIGN == node->tag);
@@ -430,7 +854,7 @@ static void analyze_assign(struct nl_ast *node, struct nl_symtable *parent_symbo
 
     /* Check if name is in current scope's symbol table.
         If NOT, it can't be assigned to! */
-    struct nl_type *expr_type = nl_symtable_search(parent_symbols, lhs->s);
+    struct nl_type *expr_type = lookup(parent_symbols, lhs->s, DEP_SYMBOL, analysis);
     if (NULL == expr_type) {
         ANALYSIS_ERRORF(analysis, lhs, "Can't assign to undeclared symbol %s", lhs->s);
     } else {
@@ -439,9 +863,10 @@ static void analyze_assign(struct nl_ast *node, struct nl_symtable *parent_symbo
             ANALYSIS_ERROR(analysis, node, "Mismatch of types in assignment");
         }
     }
+    return false;
 }
 
-static void analyze_while(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_while(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
     assert(NL_AST_WHILE == node->tag);
@@ -454,21 +879,15 @@ static void analyze_while(struct nl_ast *node, struct nl_symtable *parent_symbol
     struct nl_type *cond_type = expr_set_type(cond, parent_symbols, types, analysis);
     if (cond_type != &nl_bool_type) {
         ANALYSIS_ERROR(analysis, cond, "While-loop requires boolean conditional expression");
-        return;
+        return false;
     }
 
-    struct nl_symtable *symbols = nl_symtable_create(analysis->ctx, parent_symbols);
-
+    /* the body gets its own scope (see enter_statement) */
     func_info->inloop = true;
-    struct nl_ast *stmt = body->list.head;
-    while (stmt) {
-        analyze_statement(stmt, symbols, types, func_info, analysis);
-        stmt = stmt->next;
-    }
-    func_info->inloop = false;
+    return true;
 }
 
-static void analyze_for(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_for(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
     assert(NL_AST_FOR == node->tag);
@@ -485,19 +904,15 @@ static void analyze_for(struct nl_ast *node, struct nl_symtable *parent_symbols,
     struct nl_type *range_type = expr_set_type(range, parent_symbols, types, analysis);
     /* TODO: check that range type is a container?? */
 
-    struct nl_symtable *symbols = nl_symtable_create(analysis->ctx, parent_symbols);
-    nl_symtable_add(analysis->ctx, symbols, var->s, range_type);
+    /* the loop variable is scoped to the body (see leave_statement) */
+    nl_symtable_enter_scope(analysis->ctx, parent_symbols);
+    nl_symtable_add(analysis->ctx, parent_symbols, var->s, range_type);
 
     func_info->inloop = true;
-    struct nl_ast *stmt = body->list.head;
-    while (stmt) {
-        analyze_statement(stmt, symbols, types, func_info, analysis);
-        stmt = stmt->next;
-    }
-    func_info->inloop = false;
+    return true;
 }
 
-static void analyze_ifelse(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_ifelse(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
     assert(NL_AST_IFELSE == node->tag);
@@ -508,67 +923,28 @@ static void analyze_ifelse(struct nl_ast *node, struct nl_symtable *parent_symbo
 
     assert(if_body != NULL);
     assert(NL_AST_LIST_STATEMENTS == if_body->tag);
+    assert(else_body == NULL || NL_AST_LIST_STATEMENTS == else_body->tag);
 
     struct nl_type *cond_type = expr_set_type(cond, parent_symbols, types, analysis);
     if (cond_type != &nl_bool_type) {
         ANALYSIS_ERROR(analysis, cond, "If statement requires boolean conditional expression");
-        return;
+        return false;
     }
 
-    struct nl_symtable *if_symbols = nl_symtable_create(analysis->ctx, parent_symbols);
-    struct nl_ast *true_stmt = if_body->list.head;
-    while (true_stmt) {
-        analyze_statement(true_stmt, if_symbols, types, func_info, analysis);
-        true_stmt = true_stmt->next;
-    }
-
-    if (else_body != NULL) {
-        assert(NL_AST_LIST_STATEMENTS == else_body->tag);
-
-        struct nl_symtable *else_symbols = nl_symtable_create(analysis->ctx, parent_symbols);
-        struct nl_ast *false_stmt = else_body->list.head;
-        while (false_stmt) {
-            analyze_statement(false_stmt, else_symbols, types, func_info, analysis);
-            false_stmt = false_stmt->next;
-        }
-    }
+    /* each branch gets its own scope (see enter_statement) */
+    return true;
 }
 
-static void analyze_call_stmt(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_call_stmt(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
     assert(NL_AST_CALL_STMT == node->tag);
 
-    /* just treat the call statement as a call expression and set its type */
-    expr_get_type_call(node, parent_symbols, types, analysis);
-
-    /* struct nl_ast *func = node->call.func; */
-    /* struct nl_ast *args = node->call.args; */
-    /* assert(func != NULL); */
-    /* assert(args != NULL); */
-    /* assert(NL_AST_LIST_ARGS == args->tag); */
-
-    /* struct nl_type *callee_type = expr_set_type(func, parent_symbols, types, analysis); */
-    /* if (callee_type->tag != NL_TYPE_FUNC) { */
-    /*     ANALYSIS_ERROR(analysis, func, "Attempt to call something that isn't a function"); */
-    /*     return; */
-    /* } */
-
-    /* /1* TODO: ensure the number of args matches the number of parameters *1/ */
-    /* struct nl_ast *arg = args->list.head; */
-    /* struct nl_type *param_type = callee_type->func.param_types_head; */
-    /* while (arg && param_type) { */
-    /*     struct nl_type *arg_type = expr_set_type(arg, parent_symbols, types, analysis); */
-    /*     if (!nl_types_equal(arg_type, param_type)) { */
-    /*         ANALYSIS_ERROR(analysis, node, "Mismatch of types in return"); */
-    /*     } */
-
-    /*     arg = arg->next; */
-    /*     param_type = param_type->next; */
-    /* } */
+    expr_set_type(node, parent_symbols, types, analysis);
+    return false;
 }
 
-static void analyze_return(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_return(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
     if (node->ret.expr != NULL) {
@@ -577,33 +953,54 @@ static void analyze_return(struct nl_ast *node, struct nl_symtable *parent_symbo
             ANALYSIS_ERROR(analysis, node, "Mismatch of types in return");
         }
     }
+    return false;
 }
 
-static void analyze_break(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_break(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
     if (!func_info->inloop) {
         ANALYSIS_ERROR(analysis, node, "Cannot `break` outside of a loop");
     }
+    return false;
 }
 
-static void analyze_continue(struct nl_ast *node, struct nl_symtable *parent_symbols,
+static bool analyze_continue(struct nl_ast *node, struct nl_symtable *parent_symbols,
         struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
 {
     if (!func_info->inloop) {
         ANALYSIS_ERROR(analysis, node, "Cannot `continue` outside of a loop");
     }
+    return false;
 }
 
-static void analyze_statement(struct nl_ast *stmt, struct nl_symtable *symbols,
-        struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
+struct statement_analysis {
+    struct nl_symtable *symbols;
+    struct nl_symtable *types;
+    struct func_info *func_info;
+    struct analysis *analysis;
+};
+
+/* Statements that contain blocks return true from their analyzer so
+ * the blocks are walked next. Their expressions are typed by the
+ * analyzers, so the walk doesn't descend into them. */
+static bool enter_statement(struct nl_walk *walk, struct nl_walk_frame *frame)
 {
-    assert(stmt != NULL);
-    assert(symbols != NULL);
-    assert(types != NULL);
-    assert(func_info != NULL);
+    struct statement_analysis *sa = walk->data;
+    struct nl_ast *stmt = frame->node;
+
+    if (NL_AST_LIST_STATEMENTS == stmt->tag) {
+        struct nl_walk_frame *parent = nl_walk_parent(walk, frame);
+        if (parent != NULL && (NL_AST_IFELSE == parent->node->tag ||
+                    NL_AST_WHILE == parent->node->tag)) {
+            nl_symtable_enter_scope(sa->analysis->ctx, sa->symbols);
+        }
+        return true;
+    } else if (stmt->tag < NL_AST_DECL) {
+        return false;
+    }
 
-    typedef void (*statement_analyzer)(struct nl_ast*, struct nl_symtable*,
+    typedef bool (*statement_analyzer)(struct nl_ast*, struct nl_symtable*,
             struct nl_symtable*, struct func_info*, struct analysis*);
 
     static statement_analyzer analyzers[] = {
@@ -623,7 +1020,51 @@ static void analyze_statement(struct nl_ast *stmt, struct nl_symtable *symbols,
 
     assert(stmt->tag >= NL_AST_DECL && stmt->tag <= NL_AST_RETURN);
     size_t idx = stmt->tag - NL_AST_DECL;
-    analyzers[idx](stmt, symbols, types, func_info, analysis);
+    return analyzers[idx](stmt, sa->symbols, sa->types, sa->func_info, sa->analysis);
+}
+
+static void leave_statement(struct nl_walk *walk, struct nl_walk_frame *frame)
+{
+    struct statement_analysis *sa = walk->data;
+    struct nl_ast *stmt = frame->node;
+    struct nl_walk_frame *parent = nl_walk_parent(walk, frame);
+
+    switch (stmt->tag) {
+    case NL_AST_LIST_STATEMENTS:
+        if (parent != NULL && (NL_AST_IFELSE == parent->node->tag ||
+                    NL_AST_WHILE == parent->node->tag)) {
+            nl_symtable_leave_scope(sa->analysis->ctx, sa->symbols);
+        }
+        break;
+    case NL_AST_WHILE:
+        sa->func_info->inloop = false;
+        break;
+    case NL_AST_FOR:
+        sa->func_info->inloop = false;
+        nl_symtable_leave_scope(sa->analysis->ctx, sa->symbols);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Analyzes a block of statements, however deeply nested */
+static void analyze_statements(struct nl_ast *block, struct nl_symtable *symbols,
+        struct nl_symtable *types, struct func_info *func_info, struct analysis *analysis)
+{
+    assert(block != NULL);
+    assert(NL_AST_LIST_STATEMENTS == block->tag);
+    assert(symbols != NULL);
+    assert(types != NULL);
+    assert(func_info != NULL);
+
+    struct statement_analysis sa = {symbols, types, func_info, analysis};
+    struct nl_walk walk;
+    nl_walk_init(&walk, analysis->ctx, &sa);
+    walk.pre = enter_statement;
+    walk.post = leave_statement;
+    nl_walk(&walk, block);
+    nl_walk_deinit(&walk);
 }
 
 #if 0
@@ -655,7 +1096,7 @@ static struct pkgtable *make_package_table(nl_string_t name,
     struct pkgtable *tab = nl_symtable_get(analysis->packages, name);
     assert(NULL == tab);
     NL_DEBUGF(analysis->ctx, "Making package table %s", name);
-    tab = nl_alloc(analysis->ctx, sizeof(*tab));
+    tab = nl_alloc_tagged(analysis->ctx, sizeof(*tab), NL_MEM_ANALYSIS);
     if (parent != NULL) {
         tab->type_names = nl_symtable_create(analysis->ctx, parent->type_names);
         tab->type_tables = nl_symtable_create(analysis->ctx, parent->type_tables);
@@ -669,11 +1110,12 @@ static struct pkgtable *make_package_table(nl_string_t name,
     return tab;
 }
 
-static void collect_class_type(struct nl_ast_class *classdef,
+static void collect_class_type(struct nl_ast *node,
         struct nl_symtable *typetable, struct analysis *analysis)
 {
-    assert(classdef != NULL);
+    assert(NL_AST_CLASS == node->tag);
     assert(typetable != NULL);
+    struct nl_ast_class *classdef = &node->classdef;
 
     struct nl_ast *name = classdef->name;
     assert(NL_AST_IDENT == name->tag);
@@ -686,34 +1128,40 @@ static void collect_class_type(struct nl_ast_class *classdef,
         ANALYSIS_ERRORF(analysis, name, "Re-defined class %s", name->s);
         /* FIXME */
     } else {
-        struct nl_type *tp = nl_type_new_class(analysis->ctx, name->s, NULL, NULL, NULL);
+        /* the type outlives the analysis while its declaration is unchanged */
+        struct nl_type *tp = node->type;
+        if (NULL == tp || NL_TYPE_CLASS != tp->tag) {
+            tp = nl_type_new_class(analysis->ctx, name->s, NULL, NULL, NULL);
+            node->type = tp;
+        }
         nl_symtable_add(analysis->ctx, typetable, name->s, tp); /* FIXME */
     }
 }
 
-static void collect_interface_type(struct nl_ast_class *interface,
+static void collect_interface_type(struct nl_ast *node,
         struct nl_symtable *typetable, struct analysis *analysis)
 {
-    assert(interface != NULL);
+    assert(NL_AST_INTERFACE == node->tag);
     assert(typetable != NULL);
-    struct nl_ast *name = interface->name;
+    struct nl_ast *name = node->interface.name;
     assert(NL_AST_IDENT == name->tag);
     if (nl_symtable_get(typetable, name->s) != NULL) {
         ANALYSIS_ERRORF(analysis, name, "Re-defined interface %s", name->s);
         /* FIXME */
     } else {
-        struct nl_type *tp = nl_type_new_interface(analysis->ctx, name->s, NULL);
+        struct nl_type *tp = node->type;
+        if (NULL == tp || NL_TYPE_INTERFACE != tp->tag) {
+            tp = nl_type_new_interface(analysis->ctx, name->s, NULL);
+            node->type = tp;
+        }
         nl_symtable_add(analysis->ctx, typetable, name->s, tp); /* FIXME */
     }
 }
 
-static void collect_types(struct nl_ast *node, struct analysis *analysis)
+static void collect_types(struct nl_ast *node, struct pkgtable *pkgtable,
+        struct analysis *analysis)
 {
     assert(NL_AST_PACKAGE == node->tag);
-    struct nl_ast *name = node->package.name;
-    assert(NL_AST_IDENT == name->tag);
-
-    struct pkgtable *pkgtable = nl_symtable_get(analysis->packages, name->s);
     assert(pkgtable != NULL);
 
     struct nl_ast *globals = node->package.globals;
@@ -721,10 +1169,10 @@ static void collect_types(struct nl_ast *node, struct analysis *analysis)
     while (global) {
         switch (global->tag) {
             case NL_AST_CLASS:
-                collect_class_type(&global->classdef, pkgtable->type_names, analysis);
+                collect_class_type(global, pkgtable->type_names, analysis);
                 break;
             case NL_AST_INTERFACE:
-                collect_interface_type(&global->classdef, pkgtable->type_names, analysis);
+                collect_interface_type(global, pkgtable->type_names, analysis);
                 break;
             default: break;
         }
@@ -755,14 +1203,11 @@ static void collect_alias(struct nl_ast_alias *alias,
     }
 }
 
-static void collect_aliases(struct nl_ast *node, struct analysis *analysis)
+static void collect_aliases(struct nl_ast *node, struct pkgtable *pkgtable,
+        struct analysis *analysis)
 {
     assert(NL_AST_PACKAGE == node->tag);
 
-    struct nl_ast *name = node->package.name;
-    assert(NL_AST_IDENT == name->tag);
-
-    struct pkgtable *pkgtable = nl_symtable_get(analysis->packages, name->s);
     assert(pkgtable != NULL);
 
     struct nl_ast *globals = node->package.globals;
@@ -775,6 +1220,36 @@ static void collect_aliases(struct nl_ast *node, struct analysis *analysis)
     }
 }
 
+/* Makes a scope binding each template parameter name to a placeholder
+ * owned by `owner` */
+static struct nl_symtable *make_tmpl_table(struct nl_ast *tmpl, struct nl_type *owner,
+        struct nl_symtable *types, struct analysis *analysis)
+{
+    assert(NL_AST_LIST_TYPES == tmpl->tag);
+    struct nl_symtable *tmpl_types = nl_symtable_create(analysis->ctx, types);
+
+    unsigned int index = 0;
+    struct nl_ast *param = tmpl->list.head;
+    while (param) {
+        if (NL_AST_IDENT != param->tag) {
+            ANALYSIS_ERROR(analysis, param, "Invalid template parameter");
+        } else if (nl_symtable_get(tmpl_types, param->s) != NULL) {
+            ANALYSIS_ERRORF(analysis, param, "Duplicate template parameter %s", param->s);
+        } else {
+            struct nl_type *tp = param->type;
+            if (NULL == tp || NL_TYPE_TMPL_PLACEHOLDER != tp->tag ||
+                    tp->placeholder.owner != owner || tp->placeholder.index != index) {
+                tp = nl_type_new_placeholder(analysis->ctx, param->s, owner, index);
+            }
+            index++;
+            nl_symtable_add(analysis->ctx, tmpl_types, param->s, tp);
+            param->type = tp;
+        }
+        param = param->next;
+    }
+    return tmpl_types;
+}
+
 static void collect_class_definition(struct nl_ast_class *classdef,
         struct pkgtable *pkgtable, struct analysis *analysis)
 {
@@ -792,20 +1267,21 @@ static void collect_class_definition(struct nl_ast_class *classdef,
     struct nl_symtable *class_symbols = nl_symtable_create(analysis->ctx, NULL);
     nl_symtable_add(analysis->ctx, type_tables, classname->s, class_symbols); /* FIXME */
 
+    /* members and methods of a generic class see its template parameters */
+    struct nl_symtable *types = pkgtable->type_names;
     if (classdef->tmpl != NULL) {
-        struct nl_ast *tmpl = classdef->tmpl->list.head;
-        while (tmpl) {
-            assert(NL_AST_IDENT == tmpl->tag);
-            /* TODO: handle templates on class */
-            tmpl = tmpl->next;
-        }
+        struct nl_type *class_type = nl_symtable_get(types, classname->s);
+        assert(class_type != NULL && NL_TYPE_CLASS == class_type->tag);
+        class_type->clss.tmpl_types = make_tmpl_table(classdef->tmpl,
+                class_type, types, analysis);
+        types = class_type->clss.tmpl_types;
     }
 
     struct nl_ast *member = classdef->members->list.head;
     while (member) {
         assert(NL_AST_DECL == member->tag);
         struct nl_ast *decltype = member->decl.type;
-        struct nl_type *tp = set_type(decltype, pkgtable->type_names, analysis);
+        struct nl_type *tp = set_type(decltype, types, analysis);
 
         struct nl_ast *rhs = member->decl.rhs;
         if (NL_AST_IDENT == rhs->tag) {
@@ -840,7 +1316,7 @@ static void collect_class_definition(struct nl_ast_class *classdef,
         assert(NL_AST_FUNCTION == method->tag);
         struct nl_ast *name = method->function.name;
         assert(NL_AST_IDENT == name->tag);
-        struct nl_type *tp = set_type(method->function.type, pkgtable->type_names, analysis);
+        struct nl_type *tp = set_type(method->function.type, types, analysis);
         if (nl_symtable_get(class_symbols, name->s) != NULL) {
             ANALYSIS_ERRORF(analysis, name,
                     "Re-defined method %s in class %s", name->s, classname->s);
@@ -890,14 +1366,11 @@ static void collect_interface_definition(struct nl_ast_interface *interface,
     }
 }
 
-static void collect_type_definitions(struct nl_ast *node, struct analysis *analysis)
+static void collect_type_definitions(struct nl_ast *node, struct pkgtable *pkgtable,
+        struct analysis *analysis)
 {
     assert(NL_AST_PACKAGE == node->tag);
 
-    struct nl_ast *name = node->package.name;
-    assert(NL_AST_IDENT == name->tag);
-
-    struct pkgtable *pkgtable = nl_symtable_get(analysis->packages, name->s);
     assert(pkgtable != NULL);
 
     struct nl_ast *globals = node->package.globals;
@@ -916,9 +1389,51 @@ static void collect_type_definitions(struct nl_ast *node, struct analysis *analy
     }
 }
 
-static void collect_function_signature(struct nl_ast_function *func,
+static struct nl_type *collect_generic_signature(struct nl_ast *node,
     struct pkgtable *pkgtable, struct analysis *analysis)
 {
+    struct nl_ast *name = node->function.name;
+    struct nl_ast *ft = node->function.type;
+    struct nl_ast *tmpl = ft->func_type.tmpl;
+
+    struct nl_type *generic = node->type;
+    if (NULL == generic || NL_TYPE_GENERIC != generic->tag) {
+        generic = nl_type_new_generic(analysis->ctx, name->s, node,
+                NULL, tmpl->list.count);
+        node->type = generic;
+    }
+    generic->generic.tmpl_types = make_tmpl_table(tmpl, generic,
+            pkgtable->type_names, analysis);
+    generic->generic.func = func_type_of(ft, generic->generic.tmpl_types, analysis);
+    ft->type = generic->generic.func;
+
+    /* type arguments are inferred from the call's arguments */
+    struct nl_type *func = generic->generic.func;
+    struct nl_type **bindings = nl_alloc_tagged(analysis->ctx,
+            generic->generic.tmpl_count * sizeof(*bindings), NL_MEM_TYPES);
+    unsigned int i;
+    for (i = 0; i < func->func.param_count; i++) {
+        nl_type_unify(generic, func->func.param_types[i],
+                func->func.param_types[i], bindings);
+    }
+    struct nl_ast *param = tmpl->list.head;
+    while (param) {
+        struct nl_type *tp = param->type;
+        if (tp != NULL && NULL == bindings[tp->placeholder.index]) {
+            ANALYSIS_ERRORF(analysis, param, "Template parameter %s of %s"
+                    " isn't used by its parameters", param->s, name->s);
+        }
+        param = param->next;
+    }
+    nl_free(analysis->ctx, bindings, generic->generic.tmpl_count * sizeof(*bindings));
+
+    return generic;
+}
+
+static void collect_function_signature(struct nl_ast *node,
+    struct pkgtable *pkgtable, struct analysis *analysis)
+{
+    struct nl_ast_function *func = &node->function;
     struct nl_ast *name = func->name;
     assert(NL_AST_IDENT == name->tag);
 
@@ -933,53 +1448,28 @@ static void collect_function_signature(struct nl_ast_function *func,
         struct nl_ast *ft = func->type;
         assert(NL_AST_FUNC_TYPE == ft->tag);
 
+        struct nl_type *functype = NULL;
         if (ft->func_type.tmpl != NULL) {
-            printf("found template function %s\n", name->s);
-        }
-
-        struct nl_type *rt = set_type(ft->func_type.ret_type, pkgtable->type_names, analysis);
-
-        /* this is one (ugly) way of building a list of nl_types from a list of nl_asts */
-        struct nl_ast* params = ft->func_type.params;
-        struct nl_ast* param = params->list.head;
-        struct nl_type* param_types_head = NULL;
-        struct nl_type* param_type = NULL;
-        while (param) {
-            assert(param->tag == NL_AST_DECL);
-            struct nl_ast* decl_type = param->decl.type;
-            struct nl_type* tmp = set_type(decl_type, pkgtable->type_names, analysis);
-            if (param_type == NULL) {
-                param_types_head = param_type = tmp;
-            } else {
-                param_type->next = tmp;
-                param_type = tmp;
-            }
-            /* printf("added param_type for function %s\n", name->s); */
-            param = param->next;
+            functype = collect_generic_signature(node, pkgtable, analysis);
+        } else {
+            functype = set_type(ft, pkgtable->type_names, analysis);
         }
-
-        unsigned int count = params->list.count;
-        /* create the actual "function type" */
-        struct nl_type *functype = nl_type_new_func(analysis->ctx, rt, param_types_head, count);
         nl_symtable_add(analysis->ctx, pkgtable->symbols, name->s, functype);
     }
 }
 
-static void collect_function_signatures(struct nl_ast *node, struct analysis *analysis)
+static void collect_function_signatures(struct nl_ast *node, struct pkgtable *pkgtable,
+        struct analysis *analysis)
 {
     assert(NL_AST_PACKAGE == node->tag);
 
-    struct nl_ast *name = node->package.name;
-    assert(NL_AST_IDENT == name->tag);
-
-    struct pkgtable *pkgtable = nl_symtable_get(analysis->packages, name->s);
     assert(pkgtable != NULL);
 
     struct nl_ast *globals = node->package.globals;
     struct nl_ast *global = globals->list.head;
     while (global) {
         if (NL_AST_FUNCTION == global->tag) {
-            collect_function_signature(&global->function, pkgtable, analysis);
+            collect_function_signature(global, pkgtable, analysis);
         }
         global = global->next;
     }
@@ -1017,14 +1507,11 @@ static void collect_global_declaration(struct nl_ast_decl *decl,
     }
 }
 
-static void collect_global_declarations(struct nl_ast *node, struct analysis *analysis)
+static void collect_global_declarations(struct nl_ast *node, struct pkgtable *pkgtable,
+        struct analysis *analysis)
 {
     assert(NL_AST_PACKAGE == node->tag);
 
-    struct nl_ast *name = node->package.name;
-    assert(NL_AST_IDENT == name->tag);
-
-    struct pkgtable *pkgtable = nl_symtable_get(analysis->packages, name->s);
     assert(pkgtable != NULL);
 
     struct nl_ast *globals = node->package.globals;
@@ -1037,36 +1524,30 @@ static void collect_global_declarations(struct nl_ast *node, struct analysis *an
     }
 }
 
-static void resolve_references(struct nl_ast *node, struct analysis *analysis)
+static void resolve_references(struct pkgtable *pkgtable, struct analysis *analysis)
 {
-    assert(NL_AST_PACKAGE == node->tag);
-
-    struct nl_ast *name = node->package.name;
-    assert(NL_AST_IDENT == name->tag);
-
-    struct pkgtable *pkgtable = nl_symtable_get(analysis->packages, name->s);
     assert(pkgtable != NULL);
 
     struct nl_symtable *type_names = pkgtable->type_names;
     assert(type_names != NULL);
 
-    struct nl_symbol *sym = type_names->head;
-    while (sym != NULL) {
-        nl_string_t name = sym->name;
-        struct nl_type *ref_type = (struct nl_type*)sym->value;
+    unsigned int idx = 0;
+    nl_string_t type_alias = NULL;
+    void *value = NULL;
+    while (nl_symtable_iter(type_names, &idx, &type_alias, &value)) {
+        struct nl_type *ref_type = (struct nl_type*)value;
         if (ref_type != NULL && NL_TYPE_REFERENCE == ref_type->tag) {
             nl_string_t package_name = ref_type->reference.package_name;
             nl_string_t type_name = ref_type->reference.type_name;
-            printf("Resolving type %s from %s::%s\n", name, package_name, type_name);
+            printf("Resolving type %s from %s::%s\n", type_alias, package_name, type_name);
             struct pkgtable *ref_pkgtable = nl_symtable_get(analysis->packages, package_name);
             assert(ref_pkgtable != NULL);   /* FIXME: if NULL then package doesn't exist */
             struct nl_type *tp = nl_symtable_search(ref_pkgtable->type_names, type_name);
             /* FIXME: resolve indirect reference etc. */
             assert(tp != NULL && NL_TYPE_REFERENCE != tp->tag);
             /* TODO: cleanup reference */
-            nl_symtable_add(analysis->ctx, pkgtable->type_names, name, tp);
+            nl_symtable_add(analysis->ctx, pkgtable->type_names, type_alias, tp);
         }
-        sym = (struct nl_symbol *)sym->next;
     }
 }
 
@@ -1085,7 +1566,7 @@ static void analyze_global_initialization(struct nl_ast_decl *decl,
         struct nl_ast *name = rhs->init.ident;
         assert(NL_AST_IDENT == name->tag);
 
-        struct nl_type *tp = nl_symtable_search(symbols, name->s);
+        struct nl_type *tp = lookup(symbols, name->s, DEP_SYMBOL, analysis);
         assert(tp != NULL);
 
         /* Analyze the entire right-hand-side of the initialization */
@@ -1098,14 +1579,11 @@ static void analyze_global_initialization(struct nl_ast_decl *decl,
     }
 }
 
-static void analyze_global_initializations(struct nl_ast *node, struct analysis *analysis)
+static void analyze_global_initializations(struct nl_ast *node, struct pkgtable *pkgtable,
+        struct analysis *analysis)
 {
     assert(NL_AST_PACKAGE == node->tag);
 
-    struct nl_ast *name = node->package.name;
-    assert(NL_AST_IDENT == name->tag);
-
-    struct pkgtable *pkgtable = nl_symtable_get(analysis->packages, name->s);
     assert(pkgtable != NULL);
 
     struct nl_ast *globals = node->package.globals;
@@ -1124,14 +1602,20 @@ static void analyze_function(struct nl_ast_function *func,
     assert(pkgtable != NULL);
     assert(pkgtable->symbols != NULL);
 
-    /* TODO: create new symbol table for function scope */
     struct nl_symtable *symbols = nl_symtable_create(analysis->ctx, pkgtable->symbols);
     struct nl_symtable *types = pkgtable->type_names;
 
+    /* a generic body is checked once, against its placeholder types */
+    struct nl_type *functype = lookup(pkgtable->symbols, func->name->s,
+            DEP_SYMBOL, analysis);
+    if (functype != NULL && NL_TYPE_GENERIC == functype->tag) {
+        types = functype->generic.tmpl_types;
+    }
+
     struct nl_ast *ft = func->type;
     assert(NL_AST_FUNC_TYPE == ft->tag);
 
-    struct nl_type *ret_type = set_type(ft->func_type.ret_type, pkgtable->type_names, analysis);
+    struct nl_type *ret_type = set_type(ft->func_type.ret_type, types, analysis);
     struct func_info func_info = {.ret_type=ret_type, .inloop=false};
 
     assert(ft->func_type.params != NULL);
@@ -1140,20 +1624,16 @@ static void analyze_function(struct nl_ast_function *func,
         assert(NL_AST_DECL == param->tag);
         struct nl_ast *rhs = param->decl.rhs;
         assert(NL_AST_IDENT == rhs->tag);   /* FIXME - parameters can be "init"s too */
-        struct nl_type *tp = set_type(param->decl.type, pkgtable->type_names, analysis);
+        struct nl_type *tp = set_type(param->decl.type, types, analysis);
         /* printf("analyzed argument %s with type %s (%d)\n", rhs->s, param->decl.type->s, param->decl.type->type->tag); */
         /* printf("adding symbol %s to table %p for function %s\n", rhs->s, symbols, func->name->s); */
         nl_symtable_add(analysis->ctx, symbols, rhs->s, tp);
         param = param->next;
     }
 
-    struct nl_ast *body = func->body;
-    assert(NL_AST_LIST_STATEMENTS == body->tag);
-    struct nl_ast *stmt = body->list.head;
-    while (stmt) {
-        analyze_statement(stmt, symbols, types, &func_info, analysis);
-        stmt = stmt->next;
-    }
+    analyze_statements(func->body, symbols, types, &func_info, analysis);
+
+    nl_symtable_destroy(analysis->ctx, symbols);
 }
 
 static void analyze_class_methods(struct nl_ast_class *classdef,
@@ -1168,181 +1648,337 @@ static void analyze_class_methods(struct nl_ast_class *classdef,
     /* Make scope for function... its symbols should include the class's members/methods. */
 }
 
-static void analyze_methods_and_functions(struct nl_ast *node, struct analysis *analysis)
-{
-    assert(NL_AST_PACKAGE == node->tag);
+/* Global initializers and function bodies only read the (frozen)
+ * package tables and annotate their own nodes, so each one is analyzed
+ * as an independent task */
+struct body_task {
+    struct nl_ast *node;        /* package (for its globals), function or class */
+    struct pkgtable *pkgtable;
+    struct nl_deps *deps;
+    bool fresh;                 /* never analyzed before */
+    bool checked;               /* analyzed this time rather than skipped */
+};
 
-    struct nl_ast *name = node->package.name;
-    assert(NL_AST_IDENT == name->tag);
+struct body_tasks {
+    struct body_task *tasks;
+    unsigned int count;
+    bool concurrent;
+    struct analysis *analysis;
+};
 
-    struct pkgtable *pkgtable = nl_symtable_get(analysis->packages, name->s);
+static struct nl_deps **deps_of(struct nl_ast *node)
+{
+    switch (node->tag) {
+        case NL_AST_PACKAGE:
+            return &node->package.deps;
+        case NL_AST_FUNCTION:
+            return &node->function.deps;
+        case NL_AST_CLASS:
+            return &node->classdef.deps;
+        default:
+            assert(false);
+            return NULL;
+    }
+}
+
+/* Appends the tasks of a package in source order (or only counts them
+ * if `tasks` is NULL) */
+static unsigned int collect_bodies(struct nl_ast *node, struct pkgtable *pkgtable,
+        struct body_task *tasks)
+{
+    assert(NL_AST_PACKAGE == node->tag);
     assert(pkgtable != NULL);
 
+    unsigned int count = 0;
+    if (tasks != NULL) {
+        tasks[count] = (struct body_task){.node=node, .pkgtable=pkgtable};
+    }
+    count++;
+
     struct nl_ast *globals = node->package.globals;
     struct nl_ast *global = globals->list.head;
     while (global) {
-        switch (global->tag) {
-            case NL_AST_FUNCTION:
-                analyze_function(&global->function, pkgtable, analysis);
-                break;
-            case NL_AST_CLASS:
-                analyze_class_methods(&global->classdef, pkgtable, analysis);
-                break;
-            default:break;
+        if (NL_AST_FUNCTION == global->tag || NL_AST_CLASS == global->tag) {
+            if (tasks != NULL) {
+                tasks[count] = (struct body_task){.node=global, .pkgtable=pkgtable};
+            }
+            count++;
         }
         global = global->next;
     }
+    return count;
 }
 
-static void join_packages(struct nl_ast *packages, struct analysis *analysis)
+static void analyze_body(void *data, unsigned int idx)
 {
-    assert(NL_AST_LIST_PACKAGES == packages->tag);
-
-    /* Join packages of the same name */
-    struct nl_ast *pkg = packages->list.head;
-    while (pkg && pkg->next) {
-        struct nl_ast *pkg_name = pkg->package.name;
-        assert(NL_AST_IDENT == pkg_name->tag);
-        struct nl_ast *pkg_globals = pkg->package.globals;
-        assert(NL_AST_LIST_GLOBALS == pkg_globals->tag);
-
-        struct nl_ast *prev = pkg;
-        struct nl_ast *cur = pkg->next;
-        while (cur) {
-            struct nl_ast *cur_name = cur->package.name;
-            assert(NL_AST_IDENT == cur_name->tag);
-            if (pkg_name->s == cur_name->s) {
-                NL_DEBUGF(analysis->ctx, "Joining package %s", pkg_name->s);
-                struct nl_ast *cur_globals = cur->package.globals;
-                assert(NL_AST_LIST_GLOBALS == cur_globals->tag);
-                if (cur_globals->list.head != NULL) {
-                    nl_ast_list_append(pkg_globals, cur_globals->list.head);
-                    /* TODO: cleanup next_pkg->package.globals */
-                }
+    struct body_tasks *bodies = data;
+    struct body_task *task = &bodies->tasks[idx];
+    struct nl_deps *deps = task->deps;
 
-                prev->next = cur->next;
-                /* TODO: cleanup cur */
-                cur = prev->next;
-            } else {
-                prev = cur;
-                cur = cur->next;
-            }
+    if (!task->fresh && !deps_changed(deps, task->pkgtable, bodies->analysis)) {
+        if (!bodies->concurrent) {
+            nl_msgbuf_replay(&deps->messages);
         }
-        pkg = pkg->next;
+        return;
+    }
+    task->checked = true;
+    deps->count = 0;
+    nl_msgbuf_clear(&deps->messages);
+
+    /* messages are kept for when the body is skipped; concurrent tasks
+     * also hold them back, to be reported in source order */
+    struct analysis analysis = *bodies->analysis;
+    struct nl_context shadow;
+    nl_msgbuf_init(&deps->messages, analysis.ctx, &shadow);
+    deps->messages.arena = nl_arena(analysis.ctx, NL_ARENA_ANALYSIS);
+    deps->messages.echo = !bodies->concurrent;
+    analysis.ctx = &shadow;
+    analysis.deps = deps;
+
+    double start = nl_trace_begin(&shadow);
+    const char *name = NULL;
+    struct nl_ast *node = task->node;
+    switch (node->tag) {
+        case NL_AST_PACKAGE:
+            analyze_global_initializations(node, task->pkgtable, &analysis);
+            name = node->package.name->s;
+            break;
+        case NL_AST_FUNCTION:
+            analyze_function(&node->function, task->pkgtable, &analysis);
+            name = node->function.name->s;
+            break;
+        case NL_AST_CLASS:
+            analyze_class_methods(&node->classdef, task->pkgtable, &analysis);
+            name = node->classdef.name->s;
+            break;
+        default:
+            assert(false);
+            break;
     }
+    nl_trace_end(&shadow, "analyze", name, NULL, NULL, start);
 }
 
-static struct nl_ast *find_global_package(struct nl_ast *packages)
+static void analyze_bodies(struct analysis *analysis)
 {
-    assert(NL_AST_LIST_PACKAGES == packages->tag);
+    struct nl_context *ctx = analysis->ctx;
+
+    unsigned int count = 0;
+    unsigned int i, j;
+    for (i = 0; i < analysis->package_count; i++) {
+        struct pkgtable *tab = analysis->order[i];
+        for (j = 0; j < tab->fragment_count; j++) {
+            count += collect_bodies(tab->fragments[j], tab, NULL);
+        }
+    }
 
-    struct nl_ast *cur = packages->list.head;
-    struct nl_ast *ret = NULL;
-    while (cur != NULL) {
-        struct nl_ast *cur_name = cur->package.name;
-        assert(NL_AST_IDENT == cur_name->tag);
+    struct body_tasks bodies = {.count=count, .analysis=analysis};
+    bodies.tasks = nl_malloc_tagged(ctx, count * sizeof(*bodies.tasks), NL_MEM_ANALYSIS);
+    unsigned int idx = 0;
+    for (i = 0; i < analysis->package_count; i++) {
+        struct pkgtable *tab = analysis->order[i];
+        for (j = 0; j < tab->fragment_count; j++) {
+            idx += collect_bodies(tab->fragments[j], tab, bodies.tasks + idx);
+        }
+    }
 
-        if (strcmp(cur_name->s, NL_GLOBAL_PACKAGE_NAME) == 0) {
-            ret = cur;
-            break;
+    for (idx = 0; idx < count; idx++) {
+        struct body_task *task = &bodies.tasks[idx];
+        struct nl_deps **deps = deps_of(task->node);
+        if (NULL == *deps) {
+            *deps = nl_arena_alloc(ctx, nl_arena(ctx, NL_ARENA_ANALYSIS), sizeof(**deps));
+            task->fresh = true;
+        }
+        task->deps = *deps;
+    }
+
+    unsigned int threads = ctx->threads ? ctx->threads : nl_pool_default_threads();
+    bodies.concurrent = threads > 1 && count > 1;
+    nl_pool_run(ctx, threads, count, analyze_body, &bodies);
+
+    /* report in source order, as if the tasks had run one by one */
+    unsigned int checked = 0;
+    for (idx = 0; idx < count; idx++) {
+        if (bodies.concurrent) {
+            nl_msgbuf_replay(&bodies.tasks[idx].deps->messages);
+        }
+        if (bodies.tasks[idx].checked) {
+            checked++;
         }
-        cur = cur->next;
     }
-    return ret;
+    NL_DEBUGF(ctx, "Checked %u of %u bodies", checked, count);
+
+    nl_free(ctx, bodies.tasks, count * sizeof(*bodies.tasks));
 }
 
-static struct nl_ast* analyze(struct nl_ast *node, struct analysis *analysis)
+/* Indexes the package nodes of every unit by name, in one pass over
+ * the units. Packages of the same name are joined by sharing a table,
+ * which keeps its fragments in order; the units themselves are left
+ * intact so one can later be replaced by a new version of its source. */
+static void index_packages(struct nl_ast *units, struct pkgtable *gpkgtable,
+        struct analysis *analysis)
 {
-    /* Collect all globals and packages from each unit */
-    struct nl_ast *packages = nl_ast_make_list(analysis->ctx, NL_AST_LIST_PACKAGES, -1);
+    assert(NL_AST_LIST_UNITS == units->tag);
+    struct nl_context *ctx = analysis->ctx;
 
-    assert(NL_AST_LIST_UNITS == node->tag);
-
-    struct nl_ast *unit = node->list.head;
+    unsigned int total = 0;
+    struct nl_ast *unit = units->list.head;
     while (unit) {
         struct nl_ast *ps = unit->unit.packages;
         assert(ps != NULL);
         assert(NL_AST_LIST_PACKAGES == ps->tag);
+        total += ps->list.count;
+        unit = unit->next;
+    }
+
+    analysis->fragment_count = total;
 
-        struct nl_ast *p = ps->list.head;
-        packages = nl_ast_list_append(packages, p);
+    /* at most one table per package node, plus the global package */
+    analysis->order = nl_alloc_tagged(ctx,
+            (total + 1) * sizeof(*analysis->order), NL_MEM_ANALYSIS);
+    analysis->order[analysis->package_count++] = gpkgtable;
 
-        /* TODO: cleanup unit->unit.packages */
-        unit->unit.packages = NULL;
+    /* count each package's fragments... */
+    unit = units->list.head;
+    while (unit) {
+        struct nl_ast *pkg = unit->unit.packages->list.head;
+        while (pkg) {
+            assert(NL_AST_PACKAGE == pkg->tag);
+            struct nl_ast *name = pkg->package.name;
+            assert(NL_AST_IDENT == name->tag);
+            struct pkgtable *tab = nl_symtable_get(analysis->packages, name->s);
+            if (NULL == tab) {
+                tab = make_package_table(name->s, gpkgtable, analysis);
+                analysis->order[analysis->package_count++] = tab;
+            }
+            tab->fragment_count++;
+            pkg = pkg->next;
+        }
         unit = unit->next;
     }
 
-    join_packages(packages, analysis);
+    /* ...then give each a slice of one array and fill it in order */
+    if (total > 0) {
+        analysis->fragments = nl_alloc_tagged(ctx,
+                total * sizeof(*analysis->fragments), NL_MEM_ANALYSIS);
+    }
+    unsigned int offset = 0;
+    unsigned int i;
+    for (i = 0; i < analysis->package_count; i++) {
+        struct pkgtable *tab = analysis->order[i];
+        tab->fragments = analysis->fragments + offset;
+        offset += tab->fragment_count;
+        tab->fragment_count = 0;
+    }
 
-    struct nl_ast *gpkg = find_global_package(packages);
-    struct pkgtable *gpkgtable = NULL;
-    assert(gpkg != NULL);
-    assert(NL_AST_PACKAGE == gpkg->tag);
-    struct nl_ast *name = gpkg->package.name;
-    assert(NL_AST_IDENT == name->tag);
-    gpkgtable = make_package_table(name->s, NULL, analysis);
+    unit = units->list.head;
+    while (unit) {
+        struct nl_ast *pkg = unit->unit.packages->list.head;
+        while (pkg) {
+            struct pkgtable *tab = nl_symtable_get(analysis->packages,
+                    pkg->package.name->s);
+            tab->fragments[tab->fragment_count++] = pkg;
+            pkg = pkg->next;
+        }
+        unit = unit->next;
+    }
+}
+
+typedef void (*collector)(struct nl_ast *node, struct pkgtable *pkgtable,
+        struct analysis *analysis);
+
+/* Passes over the fragments of a package, in the order they must run */
+static const struct {
+    const char *name;
+    collector collect;
+} collectors[] = {
+    {"collect_types", collect_types},
+    {"collect_aliases", collect_aliases},
+    {"collect_type_definitions", collect_type_definitions},
+    {"collect_function_signatures", collect_function_signatures},
+    {"collect_global_declarations", collect_global_declarations},
+};
+
+static struct nl_ast* analyze(struct nl_ast *node, struct analysis *analysis)
+{
+    struct nl_context* ctx = analysis->ctx; /* convenience */
+
+    /* instances are made again by the bodies that are checked again */
+    nl_instance_cache_retire(ctx, ctx->instances);
+
+    struct pkgtable *gpkgtable = make_package_table(
+            nl_builtin_str(NL_BUILTIN_GLOBAL_PACKAGE), NULL, analysis);
     /* Add builtin types to the global package table */
     NL_DEBUG(analysis->ctx, "Adding builtin types");
     struct nl_symtable *builtin_types = gpkgtable->type_names;
     assert(builtin_types != NULL);
-    struct nl_context* ctx = analysis->ctx; /* convenience */
-    nl_symtable_add(ctx, builtin_types, nl_strtab_wrap(ctx, ctx->strtab, "bool"), &nl_bool_type);
-    nl_symtable_add(ctx, builtin_types, nl_strtab_wrap(ctx, ctx->strtab, "char"), &nl_char_type);
-    nl_symtable_add(ctx, builtin_types, nl_strtab_wrap(ctx, ctx->strtab, "int"), &nl_int_type);
-    nl_symtable_add(ctx, builtin_types, nl_strtab_wrap(ctx, ctx->strtab, "real"), &nl_real_type);
-    nl_symtable_add(ctx, builtin_types, nl_strtab_wrap(ctx, ctx->strtab, "str"), &nl_str_type);
+    nl_symtable_add(ctx, builtin_types, nl_builtin_str(NL_BUILTIN_BOOL), &nl_bool_type);
+    nl_symtable_add(ctx, builtin_types, nl_builtin_str(NL_BUILTIN_CHAR), &nl_char_type);
+    nl_symtable_add(ctx, builtin_types, nl_builtin_str(NL_BUILTIN_INT), &nl_int_type);
+    nl_symtable_add(ctx, builtin_types, nl_builtin_str(NL_BUILTIN_REAL), &nl_real_type);
+    nl_symtable_add(ctx, builtin_types, nl_builtin_str(NL_BUILTIN_STR), &nl_str_type);
 
     /*  Make remaining package tables */
-    struct nl_ast *pkg = packages->list.head;
-    while (pkg) {
-        if (pkg != gpkg) {
-            struct nl_ast *name = pkg->package.name;
-            assert(NL_AST_IDENT == name->tag);
-            make_package_table(name->s, gpkgtable, analysis);
+    index_packages(node, gpkgtable, analysis);
+
+    /* Collect classes, interfaces, aliases, function signatures, then
+     * declarations, each from every fragment of a package in turn */
+    unsigned int i, j, k;
+    for (i = 0; i < analysis->package_count; i++) {
+        struct pkgtable *tab = analysis->order[i];
+        if (0 == tab->fragment_count) {
+            continue;   /* the global package only holds builtins */
+        }
+        const char *pkgname = tab->fragments[0]->package.name->s;
+        for (k = 0; k < sizeof(collectors) / sizeof(*collectors); k++) {
+            double start = nl_trace_begin(ctx);
+            for (j = 0; j < tab->fragment_count; j++) {
+                collectors[k].collect(tab->fragments[j], tab, analysis);
+            }
+            nl_trace_end(ctx, "analyze", collectors[k].name, "package", pkgname, start);
         }
-        pkg = pkg->next;
     }
 
-    /* Collect classes, interfaces, aliases, function signatures, then declarations */
-    pkg = packages->list.head;
-    while (pkg) {
-        collect_types(pkg, analysis);
-        collect_aliases(pkg, analysis);
-        collect_type_definitions(pkg, analysis);
-        collect_function_signatures(pkg, analysis);
-        collect_global_declarations(pkg, analysis);
-        pkg = pkg->next;
+    /* Resolve package references */
+    double start = nl_trace_begin(ctx);
+    for (i = 0; i < analysis->package_count; i++) {
+        resolve_references(analysis->order[i], analysis);
     }
+    nl_trace_end(ctx, "analyze", "resolve_references", NULL, NULL, start);
 
-    /* Resolve package references */
-    pkg = packages->list.head;
-    while (pkg) {
-        resolve_references(pkg, analysis);
-        pkg = pkg->next;
+    for (i = 0; i < analysis->package_count; i++) {
+        freeze_package_table(analysis->order[i], analysis);
     }
+    nl_symtable_freeze(ctx, analysis->packages);
 
     /* Analyze code */
-    pkg = packages->list.head;
-    while (pkg) {
-        analyze_global_initializations(pkg, analysis);
-        analyze_methods_and_functions(pkg, analysis);
-        pkg = pkg->next;
-    }
+    start = nl_trace_begin(ctx);
+    analyze_bodies(analysis);
+    nl_trace_end(ctx, "analyze", "bodies", NULL, NULL, start);
 
-    return packages;
+    return node;
 }
 
 int nl_analyze(struct nl_context *ctx, struct nl_ast** packages)
 {
     assert(ctx);
 
+    int phase = nl_stats_enter(ctx, NL_PHASE_ANALYZE);
+    double start = nl_trace_begin(ctx);
+
     struct analysis analysis;
     int err = analysis_init(&analysis, ctx);
     if (err) {
+        nl_trace_end(ctx, "analyze", "analyze", NULL, NULL, start);
+        nl_stats_enter(ctx, phase);
         return err;
     }
 
     *packages = analyze(ctx->ast_list, &analysis);
 
+    /* the AST now carries every type annotation codegen needs */
+    analysis_deinit(&analysis);
+
+    nl_trace_end(ctx, "analyze", "analyze", NULL, NULL, start);
+    nl_stats_enter(ctx, phase);
     return NL_NO_ERR;
 }
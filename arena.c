@@ -0,0 +1,141 @@
+#include "arena.h"
+#include "mem.h"
+
+#include <stdalign.h>
+#include <string.h>
+#include <assert.h>
+
+struct nl_chunk {
+    struct nl_chunk *next;
+    size_t size;                /**< bytes of `data` */
+    alignas(NL_ALIGN_DEFAULT) unsigned char data[];
+};
+
+enum {
+    NL_ARENA_MIN_CHUNK = 64 * 1024,
+    NL_ARENA_MAX_CHUNK = 1024 * 1024
+};
+
+static size_t round_up(size_t bytes)
+{
+    return (bytes + NL_ALIGN_DEFAULT - 1) & ~(size_t)(NL_ALIGN_DEFAULT - 1);
+}
+
+static void free_chunk(struct nl_context* ctx, struct nl_chunk *chunk)
+{
+    nl_mem_free(ctx, chunk, sizeof(*chunk) + chunk->size, NL_ALIGN_DEFAULT);
+}
+
+/* Chunks double in size up to a limit. A block too big for the next one
+ * gets a chunk of its own, placed behind the newest so that what's left
+ * of that isn't wasted. */
+static void *new_chunk(struct nl_context* ctx, struct nl_arena *arena, size_t bytes)
+{
+    struct nl_chunk *head = arena->chunks;
+    size_t size = NL_ARENA_MIN_CHUNK;
+    if (head != NULL) {
+        size = head->size < NL_ARENA_MAX_CHUNK ? head->size * 2 : head->size;
+    }
+
+    if (bytes > size && head != NULL) {
+        struct nl_chunk *chunk = nl_mem_alloc(ctx, NULL, 0, sizeof(*chunk) + bytes,
+                NL_ALIGN_DEFAULT, 0, arena->tag);
+        chunk->size = bytes;
+        chunk->next = head->next;
+        head->next = chunk;
+        return chunk->data;
+    }
+
+    if (bytes > size) {
+        size = bytes;
+    }
+    struct nl_chunk *chunk = nl_mem_alloc(ctx, NULL, 0, sizeof(*chunk) + size,
+            NL_ALIGN_DEFAULT, 0, arena->tag);
+    chunk->size = size;
+    chunk->next = head;
+    arena->chunks = chunk;
+    arena->used = bytes;
+    return chunk->data;
+}
+
+void nl_arena_init(struct nl_arena *arena, int tag)
+{
+    arena->chunks = NULL;
+    arena->used = 0;
+    arena->tag = tag;
+    pthread_mutex_init(&arena->lock, NULL);
+}
+
+void nl_arena_deinit(struct nl_context* ctx, struct nl_arena *arena)
+{
+    struct nl_chunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        struct nl_chunk *next = chunk->next;
+        free_chunk(ctx, chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena->used = 0;
+    pthread_mutex_destroy(&arena->lock);
+}
+
+void *nl_arena_alloc(struct nl_context* ctx, struct nl_arena *arena, size_t bytes)
+{
+    bytes = round_up(bytes);
+
+    pthread_mutex_lock(&arena->lock);
+    void *block = NULL;
+    struct nl_chunk *head = arena->chunks;
+    if (head != NULL && head->size - arena->used >= bytes) {
+        block = head->data + arena->used;
+        arena->used += bytes;
+    } else {
+        block = new_chunk(ctx, arena, bytes);
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+    memset(block, 0, bytes);
+    return block;
+}
+
+void *nl_arena_realloc(struct nl_context* ctx, struct nl_arena *arena,
+        void *memory, size_t old_bytes, size_t bytes)
+{
+    if (NULL == memory) {
+        return nl_arena_alloc(ctx, arena, bytes);
+    }
+    old_bytes = round_up(old_bytes);
+
+    pthread_mutex_lock(&arena->lock);
+    struct nl_chunk *head = arena->chunks;
+    assert(head != NULL);
+    size_t offset = arena->used - old_bytes;
+    if (arena->used >= old_bytes && (unsigned char*)memory == head->data + offset &&
+            round_up(bytes) <= head->size - offset) {
+        arena->used = offset + round_up(bytes);
+        pthread_mutex_unlock(&arena->lock);
+        return memory;
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+    void *block = nl_arena_alloc(ctx, arena, bytes);
+    memcpy(block, memory, old_bytes < bytes ? old_bytes : bytes);
+    return block;
+}
+
+void nl_arena_reset(struct nl_context* ctx, struct nl_arena *arena)
+{
+    pthread_mutex_lock(&arena->lock);
+    struct nl_chunk *head = arena->chunks;
+    if (head != NULL) {
+        struct nl_chunk *chunk = head->next;
+        while (chunk != NULL) {
+            struct nl_chunk *next = chunk->next;
+            free_chunk(ctx, chunk);
+            chunk = next;
+        }
+        head->next = NULL;
+    }
+    arena->used = 0;
+    pthread_mutex_unlock(&arena->lock);
+}
@@ -0,0 +1,56 @@
+#ifndef NOLLI_ARENA_H
+#define NOLLI_ARENA_H
+
+#include "nolli.h"
+
+#include <stddef.h>
+#include <pthread.h>
+
+/** A context's arenas, one per phase whose objects share a lifetime */
+enum {
+    NL_ARENA_FRONTEND,      /**< AST nodes and interned strings */
+    NL_ARENA_ANALYSIS,      /**< types, instances and body dependencies */
+    NL_ARENA_CODEGEN,       /**< scratch space of one call to nl_jit or nl_run */
+    NL_ARENA_COUNT
+};
+
+struct nl_chunk;
+
+/**
+ * Bump allocator for objects that are never freed one at a time.
+ *
+ * Everything allocated from an arena is released at once by
+ * nl_arena_reset, which keeps the newest chunk so that a context
+ * compiling again doesn't have to grow the arena again. Chunks are
+ * charged to subsystem `tag` when the context tracks memory. An arena
+ * may be allocated from several threads at once.
+ */
+struct nl_arena {
+    struct nl_chunk *chunks;    /**< newest first */
+    size_t used;                /**< bytes handed out from the newest chunk */
+    int tag;
+    pthread_mutex_t lock;
+};
+
+#define nl_arena(ctx, which) (&(ctx)->arenas[(which)])
+
+void nl_arena_init(struct nl_arena *arena, int tag);
+
+/** Frees every chunk of the arena */
+void nl_arena_deinit(struct nl_context* ctx, struct nl_arena *arena);
+
+/** Returns `bytes` zero-filled bytes, aligned like nl_alloc's */
+void *nl_arena_alloc(struct nl_context* ctx, struct nl_arena *arena, size_t bytes);
+
+/**
+ * Resizes a block of `old_bytes` bytes allocated from the arena. The
+ * newest block is grown in place when its chunk has room; otherwise its
+ * contents are copied and the old block is left for the next reset.
+ */
+void *nl_arena_realloc(struct nl_context* ctx, struct nl_arena *arena,
+        void *memory, size_t old_bytes, size_t bytes);
+
+/** Releases everything allocated from the arena */
+void nl_arena_reset(struct nl_context* ctx, struct nl_arena *arena);
+
+#endif /* NOLLI_ARENA_H */
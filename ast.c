@@ -1,5 +1,7 @@
 #include "ast.h"
 #include "nolli.h"
+#include "stats.h"
+#include "arena.h"
 
 #include <assert.h>
 
@@ -8,7 +10,9 @@
  */
 static void *make_node(struct nl_context* ctx, int tag, int lineno)
 {
-    struct nl_ast *node = nl_alloc(ctx, sizeof(*node));
+    struct nl_ast *node = nl_arena_alloc(ctx,
+            nl_arena(ctx, NL_ARENA_FRONTEND), sizeof(*node));
+    NL_STATS_ADD(ctx, nodes, 1);
     node->tag = tag;
     node->lineno = lineno;
     return node;
@@ -188,22 +192,21 @@ struct nl_ast *nl_ast_list_append(struct nl_ast *node, struct nl_ast *elem)
 
     if (node->list.head == NULL || node->list.tail == NULL) {
         node->list.head = elem;
-
-        /* in the case that `elem` is a list itself, make `tail` the tail of `elem` */
-        struct nl_ast *prev = elem;
-        while (elem) {
-            prev = elem;
-            elem = elem->next;
-        }
-        node->list.tail = prev;
     } else {
         assert(node->tag > NL_AST_LIST_SENTINEL ||
                 NL_AST_LIST_LIT == node->tag || NL_AST_MAP_LIT == node->tag);
         assert(node->tag < NL_AST_LAST);
         node->list.tail->next = elem;
-        node->list.tail = elem;
     }
-    node->list.count++;
+
+    /* in the case that `elem` is a list itself, make `tail` the tail of `elem` */
+    struct nl_ast *prev = elem;
+    while (elem) {
+        prev = elem;
+        elem = elem->next;
+        node->list.count++;
+    }
+    node->list.tail = prev;
     return node;
 }
 
@@ -99,6 +99,7 @@ struct nl_ast_classlit {
 
 struct nl_ast_function {
     struct nl_ast *name, *type, *body;
+    struct nl_deps *deps;           /**< what analysis of the body resolved */
 };
 
 struct nl_ast_init {
@@ -117,6 +118,7 @@ struct nl_ast_binexpr {
 
 struct nl_ast_call {
     struct nl_ast *func, *args;
+    struct nl_instance *instance;   /**< set when calling a generic function */
 };
 
 struct nl_ast_bind {
@@ -172,6 +174,7 @@ struct nl_ast_interface {
 
 struct nl_ast_class {
     struct nl_ast *name, *tmpl, *members, *methods;
+    struct nl_deps *deps;           /**< what analysis of the methods resolved */
 };
 
 struct nl_ast_alias {
@@ -190,10 +193,12 @@ struct nl_ast_using {
 
 struct nl_ast_package {
     struct nl_ast *name, *globals;
+    struct nl_deps *deps;           /**< what analysis of the initializers resolved */
 };
 
 struct nl_ast_unit {
     struct nl_ast *packages;
+    nl_string_t src;                /**< source identifier, or NULL */
 };
 
 struct nl_ast {
@@ -0,0 +1,25 @@
+#include "builtins.h"
+
+const char nl_builtin_storage[NL_BUILTIN_COUNT][NL_BUILTIN_MAX_LEN] = {
+#define NL_BUILTIN_STRING(id, s, h) [NL_BUILTIN_##id] = s,
+    NL_BUILTIN_STRINGS(NL_BUILTIN_STRING)
+#undef NL_BUILTIN_STRING
+};
+
+const unsigned int nl_builtin_hashes[NL_BUILTIN_COUNT] = {
+#define NL_BUILTIN_HASH(id, s, h) [NL_BUILTIN_##id] = h,
+    NL_BUILTIN_STRINGS(NL_BUILTIN_HASH)
+#undef NL_BUILTIN_HASH
+};
+
+int nl_builtin_index(const char *s)
+{
+    /* builtin strings live in one fixed-width array, so membership
+     * and index are a range check and a division */
+    const char *first = nl_builtin_storage[0];
+    const char *last = nl_builtin_storage[NL_BUILTIN_COUNT - 1];
+    if (s < first || s > last) {
+        return -1;
+    }
+    return (s - first) / NL_BUILTIN_MAX_LEN;
+}
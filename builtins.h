@@ -0,0 +1,69 @@
+#ifndef NOLLI_BUILTINS_H
+#define NOLLI_BUILTINS_H
+
+#include "strtab.h"
+
+/**
+ * Strings known at compile-time: keywords, literal names, builtin
+ * type names and common runtime names.
+ *
+ * Each entry is (identifier, string, djb2 hash of string). The keyword
+ * entries must stay contiguous and in the same order as the keyword
+ * tokens in lexer.h (TOK_PACKAGE...TOK_IN).
+ */
+#define NL_BUILTIN_STRINGS(X) \
+    X(PACKAGE,          "package",      0x9aba6791u) \
+    X(USING,            "using",        0x10850febu) \
+    X(NEW,              "new",          0x0b88944fu) \
+    X(ALIAS,            "alias",        0x0f174d8fu) \
+    X(CLASS,            "class",        0x0f3b5edbu) \
+    X(INTERFACE,        "interface",    0x12b56d96u) \
+    X(FUNC,             "func",         0x7c96fe71u) \
+    X(RETURN,           "return",       0x19306425u) \
+    X(BREAK,            "break",        0x0f2c9f4au) \
+    X(CONTINUE,         "continue",     0x42aefb8au) \
+    X(VAR,              "var",          0x0b88b5ceu) \
+    X(CONST,            "const",        0x0f3d3b4cu) \
+    X(IF,               "if",           0x00597834u) \
+    X(ELSE,             "else",         0x7c964c6eu) \
+    X(WHILE,            "while",        0x10a3387eu) \
+    X(FOR,              "for",          0x0b88738cu) \
+    X(IN,               "in",           0x0059783cu) \
+    X(TRUE,             "true",         0x7c9e9fe5u) \
+    X(FALSE,            "false",        0x0f6bcef0u) \
+    X(BOOL,             "bool",         0x7c94b391u) \
+    X(CHAR,             "char",         0x7c952063u) \
+    X(INT,              "int",          0x0b888030u) \
+    X(REAL,             "real",         0x7c9d4d49u) \
+    X(STR,              "str",          0x0b88ab7eu) \
+    X(GLOBAL_PACKAGE,   "",             0x00001505u) \
+    X(MAIN,             "main",         0x7c9a7f6au) \
+    X(PRINTF,           "printf",       0x156b2bb8u)
+
+enum {
+#define NL_BUILTIN_ENUM(id, s, h) NL_BUILTIN_##id,
+    NL_BUILTIN_STRINGS(NL_BUILTIN_ENUM)
+#undef NL_BUILTIN_ENUM
+    NL_BUILTIN_COUNT,
+
+    NL_BUILTIN_FIRST_KEYWORD = NL_BUILTIN_PACKAGE,
+    NL_BUILTIN_LAST_KEYWORD = NL_BUILTIN_IN
+};
+
+/** maximum length (including nul terminator) of a builtin string */
+enum { NL_BUILTIN_MAX_LEN = 16 };
+
+extern const char nl_builtin_storage[NL_BUILTIN_COUNT][NL_BUILTIN_MAX_LEN];
+extern const unsigned int nl_builtin_hashes[NL_BUILTIN_COUNT];
+
+/**
+ * Constant handle to a builtin string. Every context's string table is
+ * preloaded with these exact pointers, so they compare equal to any
+ * `nl_string_t` wrapped from the same characters.
+ */
+#define nl_builtin_str(id) ((nl_string_t)nl_builtin_storage[(id)])
+
+/** Returns the builtin index of an interned string, or -1 */
+int nl_builtin_index(const char *s);
+
+#endif /* NOLLI_BUILTINS_H */
@@ -0,0 +1,724 @@
+#include "bytecode.h"
+#include "vm.h"
+#include "type.h"
+#include "instance.h"
+#include "symtable.h"
+#include "walk.h"
+#include "stats.h"
+#include "trace.h"
+#include "mem.h"
+#include "arena.h"
+#include "debug.h"
+
+/* FIXME: need lexer.h to look up tokens */
+#include "lexer.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#define BC_ERRORF(C, n, fmt, ...) do { \
+    NL_ERRORF((C)->ctx, NL_ERR_JIT, fmt " near line %d", __VA_ARGS__, (n)->lineno); \
+    (C)->failed = true; \
+} while (0)
+#define BC_ERROR(C, n, ...) BC_ERRORF(C, n, "%s", __VA_ARGS__)
+
+/* Registers are allocated like a stack: locals keep theirs until their
+ * block ends, and an expression's temporaries are released once its
+ * statement is compiled */
+struct compiler {
+    struct nl_context* ctx;
+    struct nl_arena* arena;
+    struct nl_vm_program* program;
+    struct nl_vm_function* func;
+    struct nl_code* code;
+    unsigned int insn_size;
+    unsigned int constant_size;
+    unsigned int callee_size;
+    unsigned int slot_size;
+    unsigned int loop_size;
+
+    struct nl_symtable* locals;     /**< name -> register + 1 */
+    unsigned int top;               /**< first free register */
+    unsigned int mark;              /**< first temporary of the statement */
+    bool failed;
+};
+
+/* Grows an array of the code by doubling, in the arena */
+static void* grow(struct compiler* c, void* array, unsigned int* size, size_t elem)
+{
+    unsigned int new_size = *size ? *size * 2 : 8;
+    array = nl_arena_realloc(c->ctx, c->arena, array, *size * elem, new_size * elem);
+    *size = new_size;
+    return array;
+}
+
+static unsigned int emit(struct compiler* c, int op, unsigned int a,
+        unsigned int b, unsigned int cc)
+{
+    struct nl_code* code = c->code;
+    if (code->insn_count == c->insn_size) {
+        code->insns = grow(c, code->insns, &c->insn_size, sizeof(*code->insns));
+    }
+    struct nl_insn* insn = &code->insns[code->insn_count];
+    insn->op = op;
+    insn->a = a;
+    insn->b = b;
+    insn->c = cc;
+    return code->insn_count++;
+}
+
+static unsigned int emit_jump(struct compiler* c, int op, unsigned int a,
+        unsigned int target)
+{
+    unsigned int at = emit(c, op, a, 0, 0);
+    c->code->insns[at].target = target;
+    return at;
+}
+
+/* Points the jump at `at` to the next instruction */
+static void patch(struct compiler* c, unsigned int at)
+{
+    c->code->insns[at].target = c->code->insn_count;
+}
+
+static unsigned int new_register(struct compiler* c, struct nl_ast* node)
+{
+    if (c->top == UINT16_MAX) {
+        BC_ERROR(c, node, "function needs too many registers");
+        return 0;
+    }
+    unsigned int reg = c->top++;
+    if (c->top > c->code->register_count) {
+        c->code->register_count = c->top;
+    }
+    return reg;
+}
+
+static void emit_constant(struct compiler* c, unsigned int reg, union nl_value value)
+{
+    struct nl_code* code = c->code;
+    if (code->constant_count == c->constant_size) {
+        code->constants = grow(c, code->constants, &c->constant_size,
+                sizeof(*code->constants));
+    }
+    code->constants[code->constant_count] = value;
+    unsigned int at = emit(c, NL_OP_LOADK, reg, 0, 0);
+    code->insns[at].index = code->constant_count++;
+}
+
+static unsigned int load_constant(struct compiler* c, struct nl_ast* node,
+        union nl_value value)
+{
+    unsigned int reg = new_register(c, node);
+    emit_constant(c, reg, value);
+    return reg;
+}
+
+/* Binds `name` to a new register for the rest of the block, and
+ * records where `decl` lives for the native tier */
+static unsigned int add_local(struct compiler* c, struct nl_ast* decl,
+        nl_string_t name)
+{
+    unsigned int reg = new_register(c, decl);
+    nl_symtable_add(c->ctx, c->locals, name, (void*)(uintptr_t)(reg + 1));
+
+    struct nl_code* code = c->code;
+    if (code->slot_count == c->slot_size) {
+        unsigned int size = c->slot_size;
+        code->slot_decls = grow(c, code->slot_decls, &size, sizeof(*code->slot_decls));
+        code->slots = grow(c, code->slots, &c->slot_size, sizeof(*code->slots));
+    }
+    code->slot_decls[code->slot_count] = decl;
+    code->slots[code->slot_count] = reg;
+    code->slot_count++;
+    return reg;
+}
+
+/* Resolves the placeholders of the generic being compiled */
+static struct nl_type* concrete(struct compiler* c, struct nl_type* tp)
+{
+    struct nl_instance* inst = c->func->instance;
+    if (inst != NULL) {
+        tp = nl_type_substitute(c->ctx, tp, inst->generic, inst->args);
+    }
+    return tp;
+}
+
+static union nl_value default_value(struct compiler* c, struct nl_ast* node,
+        struct nl_type* tp)
+{
+    union nl_value value = {.i=0};
+    switch (concrete(c, tp)->tag) {
+    case NL_TYPE_BOOL:
+    case NL_TYPE_INT:
+        break;
+    case NL_TYPE_REAL:
+        value.r = 0.0;
+        break;
+    case NL_TYPE_STR:
+        value.s = "";
+        break;
+    default:
+        BC_ERROR(c, node, "type not yet supported");
+    }
+    return value;
+}
+
+/* Returns the function called by `node`, or NULL for `printf` */
+static struct nl_vm_function* callee_of(struct compiler* c, struct nl_ast* node)
+{
+    struct nl_instance* inst = node->call.instance;
+    if (NULL == inst) {
+        nl_string_t name = node->call.func->s;
+        if (name == c->program->printf_name) {
+            return NULL;
+        }
+        struct nl_vm_function* callee = nl_vm_function(c->program, name);
+        if (NULL == callee) {
+            BC_ERROR(c, node, "unknown function reference");
+        }
+        return callee;
+    }
+
+    /* a call made from a generic body depends on the enclosing instance */
+    if (inst->open && c->func->instance != NULL) {
+        unsigned int count = inst->generic->generic.tmpl_count;
+        struct nl_type** args = nl_arena_alloc(c->ctx, c->arena, count * sizeof(*args));
+        unsigned int i;
+        for (i = 0; i < count; i++) {
+            args[i] = concrete(c, inst->args[i]);
+        }
+        inst = nl_instantiate(c->ctx, c->ctx->instances, inst->generic, args);
+    }
+    if (inst->open) {
+        BC_ERROR(c, node, "unresolved template arguments");
+        return NULL;
+    }
+    /* calls in bodies that weren't re-analyzed may hold retired instances */
+    inst = nl_instance_canonical(c->ctx, c->ctx->instances, inst);
+    return nl_vm_instance(c->program, inst);
+}
+
+static unsigned int add_callee(struct compiler* c, struct nl_ast* node,
+        struct nl_vm_function* callee)
+{
+    struct nl_code* code = c->code;
+    unsigned int i;
+    for (i = 0; i < code->callee_count; i++) {
+        if (code->callees[i] == callee) {
+            return i;
+        }
+    }
+    if (code->callee_count == UINT16_MAX) {
+        BC_ERROR(c, node, "function calls too many functions");
+        return 0;
+    }
+    if (code->callee_count == c->callee_size) {
+        code->callees = grow(c, code->callees, &c->callee_size, sizeof(*code->callees));
+    }
+    code->callees[code->callee_count] = callee;
+    return code->callee_count++;
+}
+
+/* Expressions are compiled in postorder: each one pops the registers
+ * holding its operands and pushes the one holding its value */
+struct expr_compile {
+    struct compiler* c;
+    unsigned int* regs;
+    unsigned int count;
+    unsigned int size;
+    unsigned int inline_regs[16];
+};
+
+static void push_register(struct expr_compile* ec, unsigned int reg)
+{
+    if (ec->count == ec->size) {
+        unsigned int size = ec->size * 2;
+        unsigned int* regs;
+        if (ec->regs == ec->inline_regs) {
+            regs = nl_malloc_tagged(ec->c->ctx, size * sizeof(*regs), NL_MEM_JIT);
+            memcpy(regs, ec->regs, ec->size * sizeof(*regs));
+        } else {
+            regs = nl_realloc_tagged(ec->c->ctx, ec->regs, ec->size * sizeof(*regs),
+                    size * sizeof(*regs), NL_MEM_JIT);
+        }
+        ec->regs = regs;
+        ec->size = size;
+    }
+    ec->regs[ec->count++] = reg;
+}
+
+/* Returns the last `count` registers pushed, oldest first */
+static unsigned int* pop_registers(struct expr_compile* ec, unsigned int count)
+{
+    assert(ec->count >= count);
+    ec->count -= count;
+    return &ec->regs[ec->count];
+}
+
+static int binary_op(struct compiler* c, struct nl_ast* node)
+{
+    static const int ops[] = {
+        TOK_ADD, TOK_SUB, TOK_MUL, TOK_DIV,
+        TOK_LT, TOK_LTE, TOK_GT, TOK_GTE, TOK_EQ, TOK_NEQ,
+    };
+    unsigned int i;
+    for (i = 0; i < sizeof(ops) / sizeof(*ops); i++) {
+        if (ops[i] == node->binexpr.op) {
+            break;
+        }
+    }
+
+    struct nl_type* lhs_type = concrete(c, node->binexpr.lhs->type);
+    if (i == sizeof(ops) / sizeof(*ops)) {
+        BC_ERROR(c, node, "unsupported binary operation");
+        return NL_OP_ADDI;
+    }
+    switch (lhs_type->tag) {
+    case NL_TYPE_INT:
+        return NL_OP_ADDI + i;
+    case NL_TYPE_REAL:
+        return NL_OP_ADDR + i;
+    default:
+        BC_ERROR(c, node, "unsupported binary operand type");
+        return NL_OP_ADDI;
+    }
+}
+
+static bool enter_expr(struct nl_walk* walk, struct nl_walk_frame* frame)
+{
+    struct expr_compile* ec = walk->data;
+    struct compiler* c = ec->c;
+    struct nl_ast* node = frame->node;
+
+    /* a callee is resolved by its call (see callee_of) */
+    struct nl_walk_frame* parent = nl_walk_parent(walk, frame);
+    if (parent != NULL && (NL_AST_CALL == parent->node->tag ||
+                NL_AST_CALL_STMT == parent->node->tag) &&
+            parent->node->call.func == node) {
+        return false;
+    }
+
+    unsigned int reg = 0;
+    switch (node->tag) {
+    case NL_AST_BOOL_LIT:
+        reg = load_constant(c, node, (union nl_value){.i=node->b});
+        break;
+    case NL_AST_INT_LIT:
+        reg = load_constant(c, node, (union nl_value){.i=node->l});
+        break;
+    case NL_AST_REAL_LIT:
+        reg = load_constant(c, node, (union nl_value){.r=node->d});
+        break;
+    case NL_AST_STR_LIT:
+        reg = load_constant(c, node, (union nl_value){.s=node->s});
+        break;
+    case NL_AST_IDENT: {
+        uintptr_t local = (uintptr_t)nl_symtable_search(c->locals, node->s);
+        if (0 == local) {
+            BC_ERRORF(c, node, "no such variable: %s", node->s);
+        } else {
+            reg = local - 1;
+        }
+        break;
+    }
+    case NL_AST_BINEXPR:
+    case NL_AST_LIST_ARGS:
+        return true;
+    case NL_AST_CALL:
+    case NL_AST_CALL_STMT:
+        frame->state[0] = callee_of(c, node);
+        return true;
+    default:
+        BC_ERROR(c, node, "expression not yet supported");
+    }
+
+    push_register(ec, reg);
+    return false;
+}
+
+/* Frees the register of an operand if it's the newest temporary, so
+ * that long expressions don't need a register per term */
+static void release(struct compiler* c, unsigned int reg)
+{
+    if (reg >= c->mark && reg + 1 == c->top) {
+        c->top--;
+    }
+}
+
+/* Calls take their arguments in consecutive registers, and return their
+ * value in the first of them */
+static unsigned int compile_call(struct compiler* c, struct nl_ast* node,
+        struct nl_vm_function* callee, const unsigned int* args)
+{
+    unsigned int count = node->call.args->list.count;
+    unsigned int base = c->top - count;
+    unsigned int i;
+    bool in_place = c->top >= count && base >= c->mark;
+    for (i = 0; i < count && in_place; i++) {
+        in_place = args[i] == base + i;
+    }
+    if (!in_place || 0 == count) {
+        base = new_register(c, node);
+        for (i = 1; i < count; i++) {
+            new_register(c, node);
+        }
+        for (i = 0; i < count; i++) {
+            emit(c, NL_OP_MOVE, base + i, args[i], 0);
+        }
+    }
+
+    if (NULL == callee) {
+        emit(c, NL_OP_PRINTF, base, 0, count);
+    } else {
+        emit(c, NL_OP_CALL, base, add_callee(c, node, callee), count);
+    }
+    c->top = base + 1;
+    return base;
+}
+
+static void leave_expr(struct nl_walk* walk, struct nl_walk_frame* frame)
+{
+    struct expr_compile* ec = walk->data;
+    struct compiler* c = ec->c;
+    struct nl_ast* node = frame->node;
+
+    unsigned int* operands = NULL;
+    switch (node->tag) {
+    case NL_AST_BINEXPR: {
+        operands = pop_registers(ec, 2);
+        int op = binary_op(c, node);
+        release(c, operands[1]);
+        release(c, operands[0]);
+        unsigned int reg = new_register(c, node);
+        emit(c, op, reg, operands[0], operands[1]);
+        push_register(ec, reg);
+        break;
+    }
+    case NL_AST_CALL:
+    case NL_AST_CALL_STMT:
+        operands = pop_registers(ec, node->call.args->list.count);
+        push_register(ec, compile_call(c, node, frame->state[0], operands));
+        break;
+    default:
+        break;
+    }
+}
+
+/* Returns the register holding the value of `node`. Its temporaries are
+ * released by the statement (see compile_node) */
+static unsigned int compile_expr(struct compiler* c, struct nl_ast* node)
+{
+    struct expr_compile ec = {.c=c, .count=0};
+    ec.regs = ec.inline_regs;
+    ec.size = sizeof(ec.inline_regs) / sizeof(*ec.inline_regs);
+
+    struct nl_walk walk;
+    nl_walk_init(&walk, c->ctx, &ec);
+    walk.pre = enter_expr;
+    walk.post = leave_expr;
+    nl_walk(&walk, node);
+    nl_walk_deinit(&walk);
+
+    assert(ec.count == 1);
+    unsigned int reg = ec.regs[0];
+    if (ec.regs != ec.inline_regs) {
+        nl_free(c->ctx, ec.regs, ec.size * sizeof(*ec.regs));
+    }
+    return reg;
+}
+
+/* Stores the value of a statement's expression, in `reg`, to `dest`.
+ * The instruction that computed a temporary writes `dest` directly. */
+static void store(struct compiler* c, unsigned int dest, unsigned int reg)
+{
+    if (dest == reg) {
+        return;
+    }
+    struct nl_code* code = c->code;
+    if (reg >= c->mark && code->insn_count > 0) {
+        struct nl_insn* last = &code->insns[code->insn_count - 1];
+        if (last->a == reg && last->op <= NL_OP_NER) {
+            last->a = dest;
+            return;
+        }
+    }
+    emit(c, NL_OP_MOVE, dest, reg, 0);
+}
+
+static void compile_decl(struct compiler* c, struct nl_ast* node)
+{
+    struct nl_ast* rhs = node->decl.rhs;
+    if (rhs->tag == NL_AST_LIST_DECLS) {
+        return;     /* TODO: decl list */
+    }
+    assert(rhs->tag == NL_AST_IDENT);
+
+    struct nl_ast* decl_type = node->decl.type;
+    union nl_value value = default_value(c, decl_type, decl_type->type);
+    unsigned int reg = add_local(c, node, rhs->s);
+    c->mark = c->top;
+    emit_constant(c, reg, value);
+}
+
+static void compile_bind(struct compiler* c, struct nl_ast* node)
+{
+    unsigned int value = compile_expr(c, node->bind.expr);
+    c->top = c->mark;
+    unsigned int reg = add_local(c, node, node->bind.ident->s);
+    c->mark = c->top;
+    store(c, reg, value);
+}
+
+static void compile_assign(struct compiler* c, struct nl_ast* node)
+{
+    struct nl_ast* lhs = node->assignment.lhs;
+    assert(lhs->tag == NL_AST_IDENT); /* only variable assignments for now */
+
+    uintptr_t local = (uintptr_t)nl_symtable_search(c->locals, lhs->s);
+    if (0 == local) {
+        BC_ERRORF(c, node, "no such variable: %s", lhs->s);
+        return;
+    }
+    unsigned int dest = local - 1;
+
+    unsigned int value = compile_expr(c, node->assignment.expr);
+    if (node->assignment.op == TOK_ASS) {
+        store(c, dest, value);
+        return;
+    }
+
+    int op;
+    switch (node->assignment.op) {
+    case TOK_IADD:
+        op = NL_OP_ADDI;
+        break;
+    case TOK_ISUB:
+        op = NL_OP_SUBI;
+        break;
+    case TOK_IMUL:
+        op = NL_OP_MULI;
+        break;
+    case TOK_IDIV:
+        op = NL_OP_DIVI;
+        break;
+    default:
+        BC_ERROR(c, node, "unsupported assignment operator");
+        return;
+    }
+    if (NL_TYPE_REAL == concrete(c, node->assignment.expr->type)->tag) {
+        op += NL_OP_ADDR - NL_OP_ADDI;
+    }
+    emit(c, op, dest, dest, value);
+}
+
+static void enter_ifelse(struct compiler* c, struct nl_walk_frame* frame)
+{
+    struct nl_ast* node = frame->node;
+    unsigned int cond = compile_expr(c, node->ifelse.cond);
+    frame->value = emit_jump(c, NL_OP_JMPF, cond, 0);
+}
+
+static void ifelse_branch(struct compiler* c, struct nl_walk_frame* frame,
+        unsigned int index)
+{
+    if (index == 1 && frame->node->ifelse.else_body != NULL) {
+        frame->state[0] = (void*)(uintptr_t)emit_jump(c, NL_OP_JMP, 0, 0);
+        patch(c, frame->value);
+    } else if (index == 2) {
+        patch(c, (uintptr_t)frame->state[0]);
+    }
+}
+
+static void leave_ifelse(struct compiler* c, struct nl_walk_frame* frame)
+{
+    if (NULL == frame->node->ifelse.else_body) {
+        patch(c, frame->value);
+    }
+}
+
+static void enter_while(struct compiler* c, struct nl_walk_frame* frame)
+{
+    struct nl_ast* node = frame->node;
+    struct nl_code* code = c->code;
+
+    if (code->loop_count == c->loop_size) {
+        code->loops = grow(c, code->loops, &c->loop_size, sizeof(*code->loops));
+    }
+    code->loops[code->loop_count++] = node;
+
+    unsigned int head = code->insn_count;
+    unsigned int cond = compile_expr(c, node->while_loop.cond);
+    frame->value = emit_jump(c, NL_OP_JMPF, cond, 0);
+    frame->state[0] = (void*)(uintptr_t)head;
+    frame->state[1] = (void*)(uintptr_t)code->loop_count;
+}
+
+static void leave_while(struct compiler* c, struct nl_walk_frame* frame)
+{
+    emit_jump(c, NL_OP_LOOP, (uintptr_t)frame->state[1], (uintptr_t)frame->state[0]);
+    patch(c, frame->value);
+}
+
+static bool is_list(const struct nl_ast* node)
+{
+    return node->tag > NL_AST_LIST_SENTINEL;
+}
+
+/* Opens a scope for each branch of an if-else and each loop body */
+static bool is_block(struct nl_walk* walk, struct nl_walk_frame* frame)
+{
+    struct nl_walk_frame* parent = nl_walk_parent(walk, frame);
+    return NL_AST_LIST_STATEMENTS == frame->node->tag && parent != NULL &&
+        (NL_AST_IFELSE == parent->node->tag || NL_AST_WHILE == parent->node->tag);
+}
+
+static bool enter_node(struct nl_walk* walk, struct nl_walk_frame* frame)
+{
+    struct compiler* c = walk->data;
+    struct nl_ast* node = frame->node;
+
+    /* the walk only descends into lists; other children (conditions,
+     * names, ...) are compiled by their parent */
+    struct nl_walk_frame* parent = nl_walk_parent(walk, frame);
+    if (parent != NULL && !is_list(parent->node) && !is_list(node)) {
+        return false;
+    }
+
+    if (is_block(walk, frame)) {
+        nl_symtable_enter_scope(c->ctx, c->locals);
+        frame->value = c->top;
+    }
+    c->mark = c->top;
+
+    switch (node->tag) {
+    case NL_AST_DECL:
+        compile_decl(c, node);
+        break;
+    case NL_AST_BIND:
+        compile_bind(c, node);
+        break;
+    case NL_AST_ASSIGN:
+        compile_assign(c, node);
+        break;
+    case NL_AST_IFELSE:
+        enter_ifelse(c, frame);
+        c->top = c->mark;
+        return true;
+    case NL_AST_WHILE:
+        enter_while(c, frame);
+        c->top = c->mark;
+        return true;
+    case NL_AST_CALL_STMT:
+        compile_expr(c, node);
+        break;
+    case NL_AST_RETURN:
+        emit(c, NL_OP_RET, compile_expr(c, node->ret.expr), 0, 0);
+        break;
+    case NL_AST_LIST_STATEMENTS:
+        return true;
+    default:
+        BC_ERRORF(c, node, "interpreter doesn't support %s yet", nl_ast_name(node));
+        break;
+    }
+    c->top = c->mark;
+    return false;
+}
+
+static bool child_node(struct nl_walk* walk, struct nl_walk_frame* frame,
+        unsigned int index)
+{
+    if (NL_AST_IFELSE == frame->node->tag) {
+        ifelse_branch(walk->data, frame, index);
+    }
+    return true;
+}
+
+static void leave_node(struct nl_walk* walk, struct nl_walk_frame* frame)
+{
+    struct compiler* c = walk->data;
+
+    if (is_block(walk, frame)) {
+        nl_symtable_leave_scope(c->ctx, c->locals);
+        c->top = frame->value;
+    }
+
+    switch (frame->node->tag) {
+    case NL_AST_IFELSE:
+        leave_ifelse(c, frame);
+        break;
+    case NL_AST_WHILE:
+        leave_while(c, frame);
+        break;
+    default:
+        break;
+    }
+}
+
+struct nl_code* nl_bytecode_compile(struct nl_context* ctx,
+        struct nl_vm_program* program, struct nl_vm_function* func)
+{
+    struct nl_ast* node = func->decl;
+    assert(NL_AST_FUNCTION == node->tag);
+    double start = nl_trace_begin(ctx);
+
+    struct compiler c = {
+        .ctx=ctx,
+        .arena=nl_arena(ctx, NL_ARENA_CODEGEN),
+        .program=program,
+        .func=func,
+        .locals=nl_symtable_create(ctx, NULL),
+    };
+    c.code = nl_arena_alloc(ctx, c.arena, sizeof(*c.code));
+
+    /* parameters are the first registers of the frame */
+    struct nl_ast* function_type = node->function.type;
+    struct nl_ast* param = function_type->func_type.params->list.head;
+    for (; param != NULL; param = param->next) {
+        assert(param->tag == NL_AST_DECL);
+        assert(param->decl.rhs->tag == NL_AST_IDENT);
+        add_local(&c, param, param->decl.rhs->s);
+        c.code->param_count++;
+    }
+
+    struct nl_walk walk;
+    nl_walk_init(&walk, ctx, &c);
+    walk.pre = enter_node;
+    walk.child = child_node;
+    walk.post = leave_node;
+    nl_walk(&walk, node->function.body);
+    nl_walk_deinit(&walk);
+
+    /* falling off the end returns the zero value */
+    struct nl_ast* ret_type = function_type->func_type.ret_type;
+    c.mark = c.top;
+    emit(&c, NL_OP_RET, load_constant(&c, ret_type,
+                default_value(&c, ret_type, ret_type->type)), 0, 0);
+
+    nl_symtable_destroy(ctx, c.locals);
+    nl_trace_end(ctx, "vm", "bytecode", "function", func->name, start);
+    return c.failed ? NULL : c.code;
+}
+
+int nl_code_slot(const struct nl_code* code, const struct nl_ast* decl)
+{
+    unsigned int i;
+    for (i = 0; i < code->slot_count; i++) {
+        if (code->slot_decls[i] == decl) {
+            return code->slots[i];
+        }
+    }
+    return -1;
+}
+
+unsigned int nl_code_loop(const struct nl_code* code, const struct nl_ast* loop)
+{
+    unsigned int i;
+    for (i = 0; i < code->loop_count; i++) {
+        if (code->loops[i] == loop) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+#ifndef NOLLI_BYTECODE_H
+#define NOLLI_BYTECODE_H
+
+#include "nolli.h"
+#include "ast.h"
+
+#include <stdint.h>
+
+/** Contents of a register: `bool`s are 0 or 1 */
+union nl_value {
+    int64_t i;
+    double r;
+    const char* s;
+};
+
+/**
+ * Instructions of the interpreter. Operands A, B and C are registers of
+ * the running function's frame unless noted otherwise.
+ */
+enum {
+    NL_OP_MOVE,     /**< A = B */
+    NL_OP_LOADK,    /**< A = constant `index` */
+
+    NL_OP_ADDI,     /**< A = B op C, on `int`s */
+    NL_OP_SUBI,
+    NL_OP_MULI,
+    NL_OP_DIVI,
+    NL_OP_LTI,
+    NL_OP_LEI,
+    NL_OP_GTI,
+    NL_OP_GEI,
+    NL_OP_EQI,
+    NL_OP_NEI,
+
+    NL_OP_ADDR,     /**< A = B op C, on `real`s */
+    NL_OP_SUBR,
+    NL_OP_MULR,
+    NL_OP_DIVR,
+    NL_OP_LTR,
+    NL_OP_LER,
+    NL_OP_GTR,
+    NL_OP_GER,
+    NL_OP_EQR,
+    NL_OP_NER,
+
+    NL_OP_JMP,      /**< continue at `target` */
+    NL_OP_JMPF,     /**< continue at `target` if A is false */
+    NL_OP_LOOP,     /**< back edge of loop number A, to `target` */
+    NL_OP_CALL,     /**< A = callee B (A, ..., A+C-1) */
+    NL_OP_PRINTF,   /**< A = printf(A, ..., A+C-1) */
+    NL_OP_RET,      /**< return A */
+    NL_OP_COUNT
+};
+
+struct nl_insn {
+    uint8_t op;
+    uint16_t a;
+    union {
+        struct {
+            uint16_t b, c;
+        };
+        uint32_t target;    /**< index of an instruction */
+        uint32_t index;     /**< of a constant */
+    };
+};
+
+struct nl_vm_function;
+struct nl_vm_program;
+
+/**
+ * Bytecode of one function.
+ *
+ * Parameters are the first registers of a frame, and each local has a
+ * register of its own for its whole scope, so the native tier can take
+ * over a frame halfway through (see nl_jit_session_lower_entry).
+ */
+struct nl_code {
+    struct nl_insn* insns;
+    unsigned int insn_count;
+    union nl_value* constants;
+    unsigned int constant_count;
+    struct nl_vm_function** callees;    /**< of NL_OP_CALL, by operand B */
+    unsigned int callee_count;
+    unsigned int param_count;
+    unsigned int register_count;        /**< size of a frame */
+
+    struct nl_ast** slot_decls;         /**< parameters, declarations and bindings */
+    uint16_t* slots;                    /**< and their registers */
+    unsigned int slot_count;
+    struct nl_ast** loops;              /**< `while` loops, by number - 1 */
+    unsigned int loop_count;
+};
+
+/**
+ * Compiles a function of `program` to bytecode, in the context's
+ * code generation arena. Returns NULL after reporting an error if the
+ * function uses something the interpreter can't run.
+ */
+struct nl_code* nl_bytecode_compile(struct nl_context* ctx,
+        struct nl_vm_program* program, struct nl_vm_function* func);
+
+/** Returns the register of a parameter, declaration or binding, or -1 */
+int nl_code_slot(const struct nl_code* code, const struct nl_ast* decl);
+
+/** Returns the number of a `while` loop, counting from 1, or 0 */
+unsigned int nl_code_loop(const struct nl_code* code, const struct nl_ast* loop);
+
+#endif /* NOLLI_BYTECODE_H */
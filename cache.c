@@ -0,0 +1,101 @@
+#include "cache.h"
+#include "mem.h"
+#include "debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Two lanes of 64-bit FNV-1a with different offset bases */
+static const uint64_t offset_bases[2] = {
+    0xcbf29ce484222325ULL,
+    0x84222325cbf29ce4ULL,
+};
+static const uint64_t fnv_prime = 0x100000001b3ULL;
+
+void nl_cache_key_init(struct nl_cache_key* key)
+{
+    key->hash[0] = offset_bases[0];
+    key->hash[1] = offset_bases[1];
+}
+
+void nl_cache_key_add(struct nl_cache_key* key, const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
+    uint64_t h0 = key->hash[0];
+    uint64_t h1 = key->hash[1];
+    size_t i;
+    for (i = 0; i < size; i++) {
+        h0 = (h0 ^ bytes[i]) * fnv_prime;
+        h1 = (h1 ^ (bytes[i] ^ 0x5c)) * fnv_prime;
+    }
+    key->hash[0] = h0;
+    key->hash[1] = h1;
+}
+
+void nl_cache_key_add_string(struct nl_cache_key* key, const char* s)
+{
+    nl_cache_key_add(key, s, strlen(s) + 1);
+}
+
+bool nl_cache_path(const struct nl_context* ctx, const struct nl_cache_key* key,
+        char* path, size_t size)
+{
+    assert(ctx->cache_dir != NULL);
+    int len = snprintf(path, size, "%s/%016llx%016llx.o", ctx->cache_dir,
+            (unsigned long long)key->hash[0], (unsigned long long)key->hash[1]);
+    return len > 0 && (size_t)len < size;
+}
+
+void nl_cache_store(const struct nl_context* ctx, const struct nl_cache_key* key,
+        const void* data, size_t size)
+{
+    char path[NL_CACHE_PATH_MAX];
+    char tmp[NL_CACHE_PATH_MAX + 8];
+    if (!nl_cache_path(ctx, key, path, sizeof(path))) {
+        return;
+    }
+
+    /* written aside, then renamed over the final name in one step */
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        return;
+    }
+    FILE* fp = fdopen(fd, "wb");
+    if (NULL == fp) {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    bool written = fwrite(data, 1, size, fp) == size;
+    if (fclose(fp) != 0 || !written || rename(tmp, path) != 0) {
+        unlink(tmp);
+    }
+}
+
+int nl_set_cache_dir(struct nl_context* ctx, const char* path)
+{
+    assert(ctx != NULL);
+
+    if (ctx->cache_dir != NULL) {
+        nl_free(ctx, ctx->cache_dir, strlen(ctx->cache_dir) + 1);
+        ctx->cache_dir = NULL;
+    }
+    if (NULL == path) {
+        return NL_NO_ERR;
+    }
+
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        NL_ERRORF(ctx, NL_ERR_IO, "Can't create cache directory %s", path);
+        return NL_ERR_IO;
+    }
+    size_t len = strlen(path);
+    ctx->cache_dir = nl_malloc_tagged(ctx, len + 1, NL_MEM_JIT);
+    memcpy(ctx->cache_dir, path, len + 1);
+    return NL_NO_ERR;
+}
@@ -0,0 +1,42 @@
+#ifndef NOLLI_CACHE_H
+#define NOLLI_CACHE_H
+
+#include "nolli.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum { NL_CACHE_PATH_MAX = 4096 };
+
+/**
+ * Identifies a compiled object file by everything that went into it:
+ * the IR of its module, the target and the code generation settings.
+ */
+struct nl_cache_key {
+    uint64_t hash[2];
+};
+
+void nl_cache_key_init(struct nl_cache_key* key);
+
+void nl_cache_key_add(struct nl_cache_key* key, const void* data, size_t size);
+
+/** Adds `s` and its terminator, so consecutive strings can't run together */
+void nl_cache_key_add_string(struct nl_cache_key* key, const char* s);
+
+/**
+ * Writes the path of the object file for `key`, in the context's cache
+ * directory, to `path`. Returns false if it doesn't fit.
+ */
+bool nl_cache_path(const struct nl_context* ctx, const struct nl_cache_key* key,
+        char* path, size_t size);
+
+/**
+ * Stores an object file under `key`. Concurrent readers see either the
+ * whole file or none; failures are silent and just miss the next time.
+ * Safe to call from any thread.
+ */
+void nl_cache_store(const struct nl_context* ctx, const struct nl_cache_key* key,
+        const void* data, size_t size);
+
+#endif /* NOLLI_CACHE_H */
@@ -1,18 +1,41 @@
 #include "nolli.h"
+#include "gen.h"
 #include "ast.h"
 #include "type.h"
+#include "instance.h"
 #include "symtable.h"
+#include "walk.h"
+#include "stats.h"
+#include "trace.h"
+#include "mem.h"
+#include "arena.h"
+#include "builtins.h"
+#include "cache.h"
+#include "pool.h"
+#include "ssa.h"
+#include "target.h"
 #include "debug.h"
 
 /* FIXME: need lexer.h to look up tokens */
 #include "lexer.h"
 
 #include <llvm-c/Core.h>
-#include <llvm-c/ExecutionEngine.h>
 #include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Orc.h>
+#include <llvm-c/LLJIT.h>
 #include <llvm-c/Analysis.h>
 #include <llvm-c/BitWriter.h>
-
+#include <llvm-c/Linker.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+#include <llvm-c/Error.h>
+
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
@@ -24,44 +47,86 @@
     NL_ERRORF((J)->ctx, NL_ERR_JIT, fmt " near line %d", __VA_ARGS__, (n)->lineno)
 #define JIT_ERROR(J, n, ...) JIT_ERRORF(J, n, "%s", __VA_ARGS__)
 
+/* Each function is lowered into a module of its own, so that it can be
+ * compiled on its first call (see nl_jit) */
 struct jit {
     struct nl_context* ctx;
-    LLVMModuleRef mod;
+    struct nl_arena* arena;         /**< lives as long as the lowered code */
+    LLVMContextRef llvm;
+    LLVMModuleRef mod;              /**< module of the function being lowered */
     LLVMBuilderRef builder;
-    struct nl_symtable* named_values;
+    struct nl_ssa_block* block;     /**< the builder is at the end of */
+    struct nl_ssa ssa;
+    struct nl_symtable* named_values; /**< name -> struct nl_ssa_var* */
+    struct nl_symtable* prototypes; /**< function name -> struct nl_type* */
+    struct nl_instance* instance;   /**< generic instance being lowered */
+    nl_string_t printf_name;
+    const char* triple;
+    const char* data_layout;
+    bool big_endian;
+
+    /* set while lowering a native entry (see jit_entry_as) */
+    const struct nl_code* code;     /**< whose frame holds the locals */
+    LLVMValueRef frame;             /**< the frame's first slot */
+    LLVMValueRef ret;               /**< where the result is stored */
+    LLVMBuilderRef entry_builder;   /**< inserts before `osr` */
+    LLVMValueRef osr;               /**< switch to the loop resumed */
+
+    /* set while lowering a program to compile ahead (see compile_ahead) */
+    LLVMContextRef* contexts;       /**< of each partition, the first is `llvm` */
+    LLVMBuilderRef* builders;
+    unsigned int partition_count;
+
+    LLVMModuleRef* modules;         /**< one per function, in lowering order */
+    const char** names;             /**< the functions they define */
+    const char** bodies;            /**< and the names of their bodies */
+    unsigned int module_count;
+    unsigned int module_size;
 };
 
 static void jit_node(struct jit*, struct nl_ast*);
 static LLVMValueRef jit_expr(struct jit* jit, struct nl_ast* node);
 
 
-/* static void jit_unit(struct jit* jit, struct nl_ast* node) */
-/* { */
-/*     assert(node->tag == NL_AST_UNIT); */
-/*     JIT_DEBUG(jit, "JITing unit"); */
+static bool jit_unit(struct jit* jit, struct nl_ast* node)
+{
+    assert(node->tag == NL_AST_UNIT);
+    JIT_DEBUG(jit, "JITing unit");
 
-/*     if (node->unit.packages == NULL) { */
-/*         JIT_ERROR(jit, node, "unit's packages are NULL"); */
-/*     } */
-/*     jit_node(jit, node->unit.packages); */
-/* } */
+    if (node->unit.packages == NULL) {
+        JIT_ERROR(jit, node, "unit's packages are NULL");
+        return false;
+    }
+    return true;
+}
+
+/* Resolves the placeholders of the generic being lowered */
+static struct nl_type* concrete(struct jit* jit, struct nl_type* tp)
+{
+    if (jit->instance != NULL) {
+        tp = nl_type_substitute(jit->ctx, tp, jit->instance->generic,
+                jit->instance->args);
+    }
+    return tp;
+}
 
 static LLVMTypeRef llvm_typeof(struct jit* jit, struct nl_ast* node, struct nl_type* tp)
 {
     LLVMTypeRef type = NULL;
+    tp = concrete(jit, tp);
 
     switch (tp->tag) {
     case NL_TYPE_BOOL:
-        type = LLVMInt1Type();
+        type = LLVMInt1TypeInContext(jit->llvm);
         break;
     case NL_TYPE_INT:
-        type = LLVMInt64Type();
+        type = LLVMInt64TypeInContext(jit->llvm);
         break;
     case NL_TYPE_REAL:
-        type = LLVMDoubleType();
+        type = LLVMDoubleTypeInContext(jit->llvm);
         break;
     case NL_TYPE_STR:
-        type = LLVMPointerType(LLVMInt8Type(), 0);
+        type = LLVMPointerType(LLVMInt8TypeInContext(jit->llvm), 0);
         break;
     default:
         JIT_ERROR(jit, node, "type not yet supported");
@@ -74,6 +139,7 @@ static LLVMValueRef llvm_default_value(struct jit* jit, struct nl_ast* node,
 {
     LLVMValueRef value = NULL;
     LLVMTypeRef type = llvm_typeof(jit, node, tp);
+    tp = concrete(jit, tp);
 
     switch (tp->tag) {
     case NL_TYPE_BOOL:
@@ -98,12 +164,15 @@ static LLVMValueRef jit_ident(struct jit* jit, struct nl_ast* node)
 {
     assert(node->tag == NL_AST_IDENT);
 
-    LLVMValueRef val = nl_symtable_search(jit->named_values, node->s);
-    if (NULL == val) {
+    void* local = nl_symtable_search(jit->named_values, node->s);
+    if (NULL == local) {
         JIT_ERRORF(jit, node, "no such variable: %s", node->s);
         return NULL; /* TODO: exit JIT */
     }
-    return LLVMBuildLoad(jit->builder, val, node->s);
+    if (jit->frame != NULL) {
+        return LLVMBuildLoad(jit->builder, local, node->s);
+    }
+    return nl_ssa_read(&jit->ssa, local, jit->block);
 }
 
 static LLVMValueRef jit_bin_int_expr(struct jit* jit, struct nl_ast* node,
@@ -165,6 +234,24 @@ static LLVMValueRef jit_bin_real_expr(struct jit* jit, struct nl_ast* node,
         case TOK_DIV:
             result = LLVMBuildFDiv(jit->builder, lhs, rhs, "tmp.fdiv");
             break;
+        case TOK_LT:
+            result = LLVMBuildFCmp(jit->builder, LLVMRealOLT, lhs, rhs, "tmp.flt");
+            break;
+        case TOK_LTE:
+            result = LLVMBuildFCmp(jit->builder, LLVMRealOLE, lhs, rhs, "tmp.fle");
+            break;
+        case TOK_GT:
+            result = LLVMBuildFCmp(jit->builder, LLVMRealOGT, lhs, rhs, "tmp.fgt");
+            break;
+        case TOK_GTE:
+            result = LLVMBuildFCmp(jit->builder, LLVMRealOGE, lhs, rhs, "tmp.fge");
+            break;
+        case TOK_EQ:
+            result = LLVMBuildFCmp(jit->builder, LLVMRealOEQ, lhs, rhs, "tmp.feq");
+            break;
+        case TOK_NEQ:
+            result = LLVMBuildFCmp(jit->builder, LLVMRealONE, lhs, rhs, "tmp.fne");
+            break;
         default:
             JIT_ERROR(jit, node, "unsupported real binary operation");
             result = NULL;
@@ -172,14 +259,12 @@ static LLVMValueRef jit_bin_real_expr(struct jit* jit, struct nl_ast* node,
     return result;
 }
 
-static LLVMValueRef jit_bin_expr(struct jit* jit, struct nl_ast* node)
+static LLVMValueRef jit_bin_expr(struct jit* jit, struct nl_ast* node,
+        LLVMValueRef lhs, LLVMValueRef rhs)
 {
     assert(node->tag == NL_AST_BINEXPR);
 
-    LLVMValueRef lhs = jit_expr(jit, node->binexpr.lhs);
-    LLVMValueRef rhs = jit_expr(jit, node->binexpr.rhs);
-
-    struct nl_type* lhs_type = node->binexpr.lhs->type;
+    struct nl_type* lhs_type = concrete(jit, node->binexpr.lhs->type);
 
     LLVMValueRef result;
     switch (lhs_type->tag) {
@@ -197,46 +282,174 @@ static LLVMValueRef jit_bin_expr(struct jit* jit, struct nl_ast* node)
     return result;
 }
 
-static LLVMValueRef jit_call(struct jit* jit, struct nl_ast* node)
+static LLVMTypeRef llvm_function_type(struct jit* jit, struct nl_ast* node,
+        struct nl_type* tp)
+{
+    assert(NL_TYPE_FUNC == tp->tag);
+    LLVMTypeRef ret_type = llvm_typeof(jit, node, tp->func.ret_type);
+
+    unsigned int param_count = tp->func.param_count;
+    LLVMTypeRef* param_types = nl_arena_alloc(jit->ctx,
+            jit->arena, sizeof(*param_types) * param_count);
+    unsigned int i;
+    for (i = 0; i < param_count; i++) {
+        param_types[i] = llvm_typeof(jit, node, tp->func.param_types[i]);
+    }
+
+    return LLVMFunctionType(ret_type, param_types, param_count, false);
+}
+
+/* Returns the function for a generic instance, declaring it if needed.
+ * Bodies are lowered later, from the instance cache (see jit_instances) */
+static LLVMValueRef declare_instance(struct jit* jit, struct nl_ast* node,
+        struct nl_instance* inst)
+{
+    /* a call made from a generic body depends on the enclosing instance */
+    if (inst->open && jit->instance != NULL) {
+        unsigned int count = inst->generic->generic.tmpl_count;
+        struct nl_type** args = nl_arena_alloc(jit->ctx,
+                jit->arena, count * sizeof(*args));
+        unsigned int i;
+        for (i = 0; i < count; i++) {
+            args[i] = concrete(jit, inst->args[i]);
+        }
+        inst = nl_instantiate(jit->ctx, jit->ctx->instances, inst->generic, args);
+    }
+    if (inst->open) {
+        JIT_ERROR(jit, node, "unresolved template arguments");
+        return NULL;
+    }
+    /* calls in bodies that weren't re-analyzed may hold retired instances */
+    inst = nl_instance_canonical(jit->ctx, jit->ctx->instances, inst);
+
+    LLVMValueRef func = LLVMGetNamedFunction(jit->mod, inst->name);
+    if (NULL == func) {
+        LLVMTypeRef func_type = llvm_function_type(jit, node, inst->type);
+        func = LLVMAddFunction(jit->mod, inst->name, func_type);
+    }
+    return func;
+}
+
+/* Returns a function lowered earlier (or `printf`), declaring it in the
+ * module being lowered if needed */
+static LLVMValueRef declare_function(struct jit* jit, struct nl_ast* node,
+        const char* name)
+{
+    LLVMValueRef func = LLVMGetNamedFunction(jit->mod, name);
+    if (func != NULL) {
+        return func;
+    }
+
+    if (name == jit->printf_name) {
+        /* FIXME: add C `printf` prototype */
+        LLVMTypeRef ret_type = LLVMInt32TypeInContext(jit->llvm);
+        LLVMTypeRef param_types[] = { LLVMPointerType(LLVMInt8TypeInContext(jit->llvm), 0) };
+        LLVMTypeRef printf_type = LLVMFunctionType(ret_type, param_types, 1, true);
+        return LLVMAddFunction(jit->mod, name, printf_type);
+    }
+
+    /* types are looked up by name, since the module may be in another
+     * LLVM context than the one the function was lowered in */
+    struct nl_type* tp = nl_symtable_get(jit->prototypes, (nl_string_t)name);
+    if (tp != NULL) {
+        func = LLVMAddFunction(jit->mod, name, llvm_function_type(jit, node, tp));
+    }
+    return func;
+}
+
+/* Returns the function called by `node`, before its arguments are lowered */
+static LLVMValueRef jit_callee(struct jit* jit, struct nl_ast* node)
 {
     assert(NL_AST_CALL == node->tag || NL_AST_CALL_STMT == node->tag);
 
     const char* name = node->call.func->s;
-    LLVMValueRef callee = LLVMGetNamedFunction(jit->mod, name);
+    LLVMValueRef callee = NULL;
+    if (node->call.instance != NULL) {
+        callee = declare_instance(jit, node, node->call.instance);
+    } else {
+        callee = declare_function(jit, node, name);
+    }
     if (!callee) {
         JIT_ERROR(jit, node, "unknown function reference");
         return NULL;    // TODO: exit JIT
     }
+    return callee;
+}
 
-    struct nl_ast_list* args_list = &node->call.args->list;
+static LLVMValueRef jit_call(struct jit* jit, struct nl_ast* node,
+        LLVMValueRef callee, LLVMValueRef* args)
+{
+    assert(NL_AST_CALL == node->tag || NL_AST_CALL_STMT == node->tag);
 
-    LLVMValueRef *args = nl_alloc(jit->ctx, sizeof(*args) * args_list->count);
-    struct nl_ast *arg = args_list->head;
-    int i = 0;
-    while (arg != NULL) {
-        args[i++] = jit_expr(jit, arg);
-        arg = arg->next;
+    return LLVMBuildCall(jit->builder, callee, args, node->call.args->list.count, "tmp");
+}
+
+/* Expressions are lowered in postorder: each one pops the values of
+ * its operands and pushes its own */
+struct expr_lowering {
+    struct jit* jit;
+    LLVMValueRef* values;
+    unsigned int count;
+    unsigned int size;
+    LLVMValueRef inline_values[16];
+};
+
+static void push_value(struct expr_lowering* lowering, LLVMValueRef value)
+{
+    if (lowering->count == lowering->size) {
+        unsigned int size = lowering->size * 2;
+        LLVMValueRef* values;
+        if (lowering->values == lowering->inline_values) {
+            values = nl_malloc_tagged(lowering->jit->ctx,
+                    size * sizeof(*values), NL_MEM_JIT);
+            memcpy(values, lowering->values, lowering->size * sizeof(*values));
+        } else {
+            values = nl_realloc_tagged(lowering->jit->ctx, lowering->values,
+                    lowering->size * sizeof(*values), size * sizeof(*values),
+                    NL_MEM_JIT);
+        }
+        lowering->values = values;
+        lowering->size = size;
     }
+    lowering->values[lowering->count++] = value;
+}
 
-    return LLVMBuildCall(jit->builder, callee, args, args_list->count, "tmp");
+/* Returns the last `count` values pushed, oldest first */
+static LLVMValueRef* pop_values(struct expr_lowering* lowering, unsigned int count)
+{
+    assert(lowering->count >= count);
+    lowering->count -= count;
+    return &lowering->values[lowering->count];
 }
 
-static LLVMValueRef jit_expr(struct jit* jit, struct nl_ast* node)
+static bool enter_expr(struct nl_walk* walk, struct nl_walk_frame* frame)
 {
+    struct expr_lowering* lowering = walk->data;
+    struct jit* jit = lowering->jit;
+    struct nl_ast* node = frame->node;
+
+    /* a callee is resolved by its call (see jit_callee) */
+    struct nl_walk_frame* parent = nl_walk_parent(walk, frame);
+    if (parent != NULL && (NL_AST_CALL == parent->node->tag ||
+                NL_AST_CALL_STMT == parent->node->tag) &&
+            parent->node->call.func == node) {
+        return false;
+    }
+
     LLVMValueRef expr;
     switch (node->tag) {
     case NL_AST_BOOL_LIT:
         if (node->b) {
-            expr = LLVMConstInt(LLVMInt1Type(), 1, false);
+            expr = LLVMConstInt(LLVMInt1TypeInContext(jit->llvm), 1, false);
         } else {
-            expr = LLVMConstInt(LLVMInt1Type(), 0, false);
+            expr = LLVMConstInt(LLVMInt1TypeInContext(jit->llvm), 0, false);
         }
         break;
     case NL_AST_INT_LIT:
-        expr = LLVMConstInt(LLVMInt64Type(), node->l, true);
+        expr = LLVMConstInt(LLVMInt64TypeInContext(jit->llvm), node->l, true);
         break;
     case NL_AST_REAL_LIT:
-        expr = LLVMConstReal(LLVMDoubleType(), node->d);
+        expr = LLVMConstReal(LLVMDoubleTypeInContext(jit->llvm), node->d);
         break;
     case NL_AST_STR_LIT:
         expr = LLVMBuildGlobalStringPtr(jit->builder, node->s, "str");
@@ -245,20 +458,140 @@ static LLVMValueRef jit_expr(struct jit* jit, struct nl_ast* node)
         expr = jit_ident(jit, node);
         break;
     case NL_AST_BINEXPR:
-        expr = jit_bin_expr(jit, node);
-        break;
+    case NL_AST_LIST_ARGS:
+        return true;
     case NL_AST_CALL:
-        expr = jit_call(jit, node);
+    case NL_AST_CALL_STMT:
+        expr = jit_callee(jit, node);
+        if (expr != NULL) {
+            frame->state[0] = expr;
+            return true;
+        }
         break;
     default:
         JIT_ERROR(jit, node, "expression not yet supported");
-        return NULL;
+        expr = NULL;
+    }
+
+    push_value(lowering, expr);
+    return false;
+}
+
+static void leave_expr(struct nl_walk* walk, struct nl_walk_frame* frame)
+{
+    struct expr_lowering* lowering = walk->data;
+    struct jit* jit = lowering->jit;
+    struct nl_ast* node = frame->node;
+
+    LLVMValueRef* operands = NULL;
+    switch (node->tag) {
+    case NL_AST_BINEXPR:
+        operands = pop_values(lowering, 2);
+        push_value(lowering, jit_bin_expr(jit, node, operands[0], operands[1]));
+        break;
+    case NL_AST_CALL:
+    case NL_AST_CALL_STMT:
+        operands = pop_values(lowering, node->call.args->list.count);
+        push_value(lowering, jit_call(jit, node, frame->state[0], operands));
+        break;
+    default:
+        break;
     }
+}
 
+static LLVMValueRef jit_expr(struct jit* jit, struct nl_ast* node)
+{
+    struct expr_lowering lowering = {.jit=jit, .count=0};
+    lowering.values = lowering.inline_values;
+    lowering.size = sizeof(lowering.inline_values) / sizeof(*lowering.inline_values);
+
+    struct nl_walk walk;
+    nl_walk_init(&walk, jit->ctx, &lowering);
+    walk.pre = enter_expr;
+    walk.post = leave_expr;
+    nl_walk(&walk, node);
+    nl_walk_deinit(&walk);
+
+    assert(lowering.count == 1);
+    LLVMValueRef expr = lowering.values[0];
+    if (lowering.values != lowering.inline_values) {
+        nl_free(jit->ctx, lowering.values, lowering.size * sizeof(*lowering.values));
+    }
     return expr;
 }
 
-static void jit_decl(struct jit* jit, struct nl_ast* node)
+/* Returns the address of the frame slot that the bytecode keeps `decl`
+ * in, computed up front so that it's available at every loop head the
+ * entry resumes at (see jit_entry_as) */
+static LLVMValueRef frame_slot(struct jit* jit, struct nl_ast* decl,
+        LLVMTypeRef type, const char* name)
+{
+    int slot = nl_code_slot(jit->code, decl);
+    assert(slot >= 0);
+
+    /* a `bool` is the low byte of its slot */
+    unsigned long long offset = slot * sizeof(union nl_value);
+    if (jit->big_endian && LLVMGetTypeKind(type) == LLVMIntegerTypeKind &&
+            LLVMGetIntTypeWidth(type) == 1) {
+        offset += sizeof(union nl_value) - 1;
+    }
+    LLVMTypeRef byte = LLVMInt8TypeInContext(jit->llvm);
+    LLVMValueRef index = LLVMConstInt(LLVMInt64TypeInContext(jit->llvm), offset, false);
+    LLVMValueRef bytes = LLVMBuildBitCast(jit->entry_builder, jit->frame,
+            LLVMPointerType(byte, 0), "frame");
+    LLVMValueRef addr = LLVMBuildInBoundsGEP2(jit->entry_builder, byte, bytes,
+            &index, 1, "slot");
+    return LLVMBuildBitCast(jit->entry_builder, addr, LLVMPointerType(type, 0), name);
+}
+
+/* Appends a block to the function being lowered */
+static struct nl_ssa_block* append_block(struct jit* jit, const char* name)
+{
+    LLVMValueRef function = LLVMGetBasicBlockParent(jit->block->bb);
+    return nl_ssa_block(&jit->ssa,
+            LLVMAppendBasicBlockInContext(jit->llvm, function, name));
+}
+
+static void position_at(struct jit* jit, struct nl_ssa_block* block)
+{
+    LLVMPositionBuilderAtEnd(jit->builder, block->bb);
+    jit->block = block;
+}
+
+/* Falls through to `target`, unless the current block already returned */
+static void branch_to(struct jit* jit, struct nl_ssa_block* target)
+{
+    if (NULL == LLVMGetBasicBlockTerminator(jit->block->bb)) {
+        LLVMBuildBr(jit->builder, target->bb);
+        nl_ssa_add_pred(&jit->ssa, target, jit->block);
+    }
+}
+
+static void cond_branch_to(struct jit* jit, LLVMValueRef cond,
+        struct nl_ssa_block* then_block, struct nl_ssa_block* else_block)
+{
+    LLVMBuildCondBr(jit->builder, cond, then_block->bb, else_block->bb);
+    nl_ssa_add_pred(&jit->ssa, then_block, jit->block);
+    nl_ssa_add_pred(&jit->ssa, else_block, jit->block);
+}
+
+/* Locals are SSA values, except in native entries, which keep them in
+ * the interpreter's frame (see jit_entry_as) */
+static void define_local(struct jit* jit, struct nl_ast* decl, LLVMTypeRef type,
+        const char* name, LLVMValueRef value)
+{
+    void* local = NULL;
+    if (jit->frame != NULL) {
+        local = frame_slot(jit, decl, type, name);
+        LLVMBuildStore(jit->builder, value, local);
+    } else {
+        local = nl_ssa_var(&jit->ssa, type, name);
+        nl_ssa_write(&jit->ssa, local, jit->block, value);
+    }
+    nl_symtable_add(jit->ctx, jit->named_values, (nl_string_t)name, local);
+}
+
+static bool jit_decl(struct jit* jit, struct nl_ast* node)
 {
     assert(node->tag == NL_AST_DECL);
     /*
@@ -279,16 +612,12 @@ static void jit_decl(struct jit* jit, struct nl_ast* node)
 
         LLVMTypeRef type = llvm_typeof(jit, decl_type, decl_type->type);
         LLVMValueRef value = llvm_default_value(jit, decl_type, decl_type->type);
-
-        LLVMValueRef alloca = LLVMBuildAlloca(jit->builder, type, varname);
-        LLVMBuildStore(jit->builder, value, alloca);
-
-        /* save this variable binding */
-        nl_symtable_add(jit->ctx, jit->named_values, (nl_string_t)varname, alloca);
+        define_local(jit, node, type, varname, value);
     }
+    return false;
 }
 
-static void jit_bind(struct jit* jit, struct nl_ast* node)
+static bool jit_bind(struct jit* jit, struct nl_ast* node)
 {
     assert(node->tag == NL_AST_BIND);
 
@@ -298,15 +627,11 @@ static void jit_bind(struct jit* jit, struct nl_ast* node)
     struct nl_type* expr_type = node->bind.expr->type;
 
     LLVMTypeRef type = llvm_typeof(jit, node->bind.expr, expr_type);
-
-    LLVMValueRef alloca = LLVMBuildAlloca(jit->builder, type, varname);
-    LLVMBuildStore(jit->builder, bind_value, alloca);
-
-    /* save this variable binding */
-    nl_symtable_add(jit->ctx, jit->named_values, (nl_string_t)varname, alloca);
+    define_local(jit, node, type, varname, bind_value);
+    return false;
 }
 
-static void jit_assign(struct jit* jit, struct nl_ast* node)
+static bool jit_assign(struct jit* jit, struct nl_ast* node)
 {
     assert(node->tag == NL_AST_ASSIGN);
 
@@ -334,81 +659,89 @@ static void jit_assign(struct jit* jit, struct nl_ast* node)
             break;
         default:
             JIT_ERROR(jit, node, "unsupported assignment operator");
-            return;     /* TODO: exit JIT */
+            return false;     /* TODO: exit JIT */
         }
     }
 
-    LLVMValueRef alloca = nl_symtable_search(jit->named_values, lhs->s);
-    if (NULL == alloca) {
+    void* local = nl_symtable_search(jit->named_values, lhs->s);
+    if (NULL == local) {
         JIT_ERRORF(jit, node, "no such variable: %s", lhs->s);
-        return; /* TODO: exit JIT */
+        return false; /* TODO: exit JIT */
     }
 
-    LLVMBuildStore(jit->builder, rhs, alloca);
+    if (jit->frame != NULL) {
+        LLVMBuildStore(jit->builder, rhs, local);
+    } else {
+        nl_ssa_write(&jit->ssa, local, jit->block, rhs);
+    }
+    return false;
 }
 
-static void jit_ifelse(struct jit* jit, struct nl_ast* node)
+/* The branches of an if-else are lowered by the walk, between
+ * enter_ifelse, ifelse_branch and leave_ifelse */
+static bool enter_ifelse(struct jit* jit, struct nl_walk_frame* frame)
 {
+    struct nl_ast* node = frame->node;
     assert(node->tag == NL_AST_IFELSE);
 
-    struct nl_ast* if_body = node->ifelse.if_body;
     struct nl_ast* else_body = node->ifelse.else_body;
 
     LLVMValueRef cond = jit_expr(jit, node->ifelse.cond);
 
-    LLVMBasicBlockRef insert_block = LLVMGetInsertBlock(jit->builder);
-    LLVMValueRef function = LLVMGetBasicBlockParent(insert_block);
-
-    LLVMBasicBlockRef then_block = LLVMAppendBasicBlock(function, "if.then");
-    LLVMBasicBlockRef else_block;
+    struct nl_ssa_block* then_block = append_block(jit, "if.then");
+    struct nl_ssa_block* else_block = NULL;
     if (else_body != NULL) {
-        else_block = LLVMAppendBasicBlock(function, "if.else");
+        else_block = append_block(jit, "if.else");
     }
-    LLVMBasicBlockRef end_block = LLVMAppendBasicBlock(function, "if.end");
+    struct nl_ssa_block* end_block = append_block(jit, "if.end");
 
     if (else_body != NULL) {
-        LLVMBuildCondBr(jit->builder, cond, then_block, else_block);
+        cond_branch_to(jit, cond, then_block, else_block);
+        nl_ssa_seal(&jit->ssa, else_block);
     } else {
-        LLVMBuildCondBr(jit->builder, cond, then_block, end_block);
+        cond_branch_to(jit, cond, then_block, end_block);
     }
+    nl_ssa_seal(&jit->ssa, then_block);
 
-    LLVMPositionBuilderAtEnd(jit->builder, then_block);
+    position_at(jit, then_block);
 
-    // TODO: maybe a cleaner method of introducing new scope
-    jit->named_values = nl_symtable_create(jit->ctx, jit->named_values);
-    jit_node(jit, if_body);
-    jit->named_values = nl_symtable_destroy(jit->ctx, jit->named_values);
+    frame->state[0] = then_block;
+    frame->state[1] = else_block;
+    frame->state[2] = end_block;
+    return true;
+}
 
-    if (!LLVMGetBasicBlockTerminator(then_block)) {
-        /* only emit branch if block doesn't already have a terminator (e.g. return) */
-        LLVMBuildBr(jit->builder, end_block);
+static void ifelse_branch(struct jit* jit, struct nl_walk_frame* frame, unsigned int index)
+{
+    struct nl_ssa_block* branch_block = NULL;
+    if (index == 1) {
+        branch_block = frame->state[0];
+    } else if (index == 2) {
+        branch_block = frame->state[1];
+    } else {
+        return;     /* the condition */
     }
+    struct nl_ssa_block* end_block = frame->state[2];
+    LLVMValueRef function = LLVMGetBasicBlockParent(end_block->bb);
 
-    LLVMMoveBasicBlockAfter(then_block, LLVMGetLastBasicBlock(function));
-
-    /* update then_block to current insert block, which may have changed */
-    /* then_block = LLVMGetInsertBlock(jit->builder); */
-
-    if (else_body != NULL) {
-        LLVMPositionBuilderAtEnd(jit->builder, else_block);
-
-        // TODO: maybe a cleaner method of introducing new scope
-        jit->named_values = nl_symtable_create(jit->ctx, jit->named_values);
-        jit_node(jit, node->ifelse.else_body);
-        jit->named_values = nl_symtable_destroy(jit->ctx, jit->named_values);
+    /* from wherever the branch ended, which may be a nested block */
+    branch_to(jit, end_block);
 
-        if (!LLVMGetBasicBlockTerminator(else_block)) {
-            /* only emit branch if block doesn't already have a terminator */
-            LLVMBuildBr(jit->builder, end_block);
-        }
+    LLVMMoveBasicBlockAfter(branch_block->bb, LLVMGetLastBasicBlock(function));
 
-        LLVMMoveBasicBlockAfter(else_block, LLVMGetLastBasicBlock(function));
-        /* update else_block to current insert block, which may have changed */
-        /* else_block = LLVMGetInsertBlock(jit->builder); */
+    if (index == 1 && frame->state[1] != NULL) {
+        position_at(jit, frame->state[1]);
     }
+}
+
+static void leave_ifelse(struct jit* jit, struct nl_walk_frame* frame)
+{
+    struct nl_ssa_block* end_block = frame->state[2];
+    LLVMValueRef function = LLVMGetBasicBlockParent(end_block->bb);
 
-    LLVMMoveBasicBlockAfter(end_block, LLVMGetLastBasicBlock(function));
-    LLVMPositionBuilderAtEnd(jit->builder, end_block);
+    LLVMMoveBasicBlockAfter(end_block->bb, LLVMGetLastBasicBlock(function));
+    nl_ssa_seal(&jit->ssa, end_block);
+    position_at(jit, end_block);
 
     /* the following is for if-else *expressions* */
     /* LLVMValueRef phi = LLVMBuildPhi(jit->builder, LLVMInt1Type(), "iftmp"); */
@@ -419,73 +752,175 @@ static void jit_ifelse(struct jit* jit, struct nl_ast* node)
     /* LLVMAddIncoming(phi, values, blocks, 2); */
 }
 
-static void jit_while(struct jit* jit, struct nl_ast* node)
+static bool enter_while(struct jit* jit, struct nl_walk_frame* frame)
 {
+    struct nl_ast* node = frame->node;
     assert(node->tag == NL_AST_WHILE);
 
-    LLVMBasicBlockRef insert_block = LLVMGetInsertBlock(jit->builder);
-    LLVMValueRef function = LLVMGetBasicBlockParent(insert_block);
+    struct nl_ssa_block* loop_block = append_block(jit, "while.loop");
+    struct nl_ssa_block* body_block = append_block(jit, "while.body");
+    struct nl_ssa_block* end_block = append_block(jit, "while.end");
 
-    LLVMBasicBlockRef loop_block = LLVMAppendBasicBlock(function, "while.loop");
-    LLVMBasicBlockRef body_block = LLVMAppendBasicBlock(function, "while.body");
-    LLVMBasicBlockRef end_block = LLVMAppendBasicBlock(function, "while.end");
+    if (jit->osr != NULL) {
+        /* the interpreter can hand the loop over at its head */
+        unsigned int loop = nl_code_loop(jit->code, node);
+        LLVMAddCase(jit->osr, LLVMConstInt(LLVMInt32TypeInContext(jit->llvm), loop, false),
+                loop_block->bb);
+    }
 
     /* insert an explicit fallthrough from current block to loop block */
-    LLVMBuildBr(jit->builder, loop_block);
-    LLVMPositionBuilderAtEnd(jit->builder, loop_block);
+    branch_to(jit, loop_block);
+    position_at(jit, loop_block);
 
+    /* the loop's head is sealed once the body has branched back to it */
     LLVMValueRef cond = jit_expr(jit, node->while_loop.cond);
-    LLVMBuildCondBr(jit->builder, cond, body_block, end_block);
+    cond_branch_to(jit, cond, body_block, end_block);
+    nl_ssa_seal(&jit->ssa, body_block);
+    nl_ssa_seal(&jit->ssa, end_block);
 
-    LLVMPositionBuilderAtEnd(jit->builder, body_block);
+    position_at(jit, body_block);
 
-    // TODO: maybe a cleaner method of introducing new scope
-    jit->named_values = nl_symtable_create(jit->ctx, jit->named_values);
-    jit_node(jit, node->while_loop.body);
-    jit->named_values = nl_symtable_destroy(jit->ctx, jit->named_values);
+    frame->state[0] = loop_block;
+    frame->state[1] = end_block;
+    return true;
+}
 
-    if (!LLVMGetBasicBlockTerminator(loop_block)) {
-        LLVMBuildBr(jit->builder, loop_block);
-    }
+static void leave_while(struct jit* jit, struct nl_walk_frame* frame)
+{
+    struct nl_ssa_block* loop_block = frame->state[0];
+    struct nl_ssa_block* end_block = frame->state[1];
+    LLVMValueRef function = LLVMGetBasicBlockParent(end_block->bb);
 
-    LLVMBuildBr(jit->builder, loop_block);
+    branch_to(jit, loop_block);
+    nl_ssa_seal(&jit->ssa, loop_block);
 
-    LLVMMoveBasicBlockAfter(end_block, LLVMGetLastBasicBlock(function));
-    LLVMPositionBuilderAtEnd(jit->builder, end_block);
+    LLVMMoveBasicBlockAfter(end_block->bb, LLVMGetLastBasicBlock(function));
+    position_at(jit, end_block);
 }
 
-static void jit_call_stmt(struct jit* jit, struct nl_ast* node)
+static bool jit_call_stmt(struct jit* jit, struct nl_ast* node)
 {
     assert(node->tag == NL_AST_CALL_STMT);
 
-    jit_call(jit, node);
+    jit_expr(jit, node);
+    return false;
 }
 
-static void jit_return(struct jit* jit, struct nl_ast* node)
+static bool jit_return(struct jit* jit, struct nl_ast* node)
 {
     assert(node->tag == NL_AST_RETURN);
     JIT_DEBUG(jit, "JITing return statement");
 
     JIT_DEBUGF(jit, "ret expr: %s", nl_ast_name(node->ret.expr));
     LLVMValueRef ret = jit_expr(jit, node->ret.expr);
-    LLVMBuildRet(jit->builder, ret);
+    if (NULL == jit->ret) {
+        LLVMBuildRet(jit->builder, ret);
+        return false;
+    }
+
+    /* a native entry stores its result like the interpreter would */
+    LLVMTypeRef type = LLVMTypeOf(ret);
+    LLVMValueRef addr = jit->ret;
+    if (LLVMGetTypeKind(type) == LLVMIntegerTypeKind && LLVMGetIntTypeWidth(type) == 1) {
+        ret = LLVMBuildZExt(jit->builder, ret, LLVMInt64TypeInContext(jit->llvm), "ret");
+    } else {
+        addr = LLVMBuildBitCast(jit->builder, addr, LLVMPointerType(type, 0), "ret");
+    }
+    LLVMBuildStore(jit->builder, ret, addr);
+    LLVMBuildRetVoid(jit->builder);
+    return false;
 }
 
-static void jit_package(struct jit* jit, struct nl_ast* node)
+static bool jit_package(struct jit* jit, struct nl_ast* node)
 {
     assert(node->tag == NL_AST_PACKAGE);
     JIT_DEBUGF(jit, "JITing package %s", node->package.name->s);
 
-    /* jit_node(node->package.name); */
-    jit_node(jit, node->package.globals);
+    /* only the globals are walked (see enter_node) */
+    return true;
 }
 
-static void jit_function(struct jit* jit, struct nl_ast* node)
+static void jit_function_as(struct jit* jit, struct nl_ast* node, const char* func_name);
+
+/* A function's body is lowered by its own walk (see jit_function_as) */
+static bool jit_function(struct jit* jit, struct nl_ast* node)
 {
     assert(node->tag == NL_AST_FUNCTION);
 
-    const char* func_name = node->function.name->s;
+    /* generic functions are only lowered once instantiated, and a
+     * session keeps the functions it already has */
+    if (node->function.type->func_type.tmpl != NULL ||
+            nl_symtable_get(jit->prototypes, node->function.name->s) != NULL) {
+        return false;
+    }
+    jit_function_as(jit, node, node->function.name->s);
+    return false;
+}
+
+/* Lowers every instance of a generic function that was called. Lowering
+ * an instance can create more instances, which are appended to the
+ * cache and picked up by the same walk. */
+static void jit_instances(struct jit* jit)
+{
+    struct nl_instance* inst = jit->ctx->instances->head;
+    while (inst != NULL) {
+        if (!inst->open) {
+            struct nl_ast* decl = inst->generic->generic.decl;
+            if (NULL == nl_symtable_get(jit->prototypes, inst->name)) {
+                jit->instance = inst;
+                jit_function_as(jit, decl, inst->name);
+                jit->instance = NULL;
+            }
+        }
+        inst = inst->next;
+    }
+}
+
+/* Starts a module of its own for function `name`, and returns the body
+ * defined in it. Calls, even recursive ones, go through `name`'s stub
+ * (see nl_jit), which compiles the body on first use. */
+static LLVMValueRef define_function(struct jit* jit, const char* name,
+        struct nl_type* tp, LLVMTypeRef func_type)
+{
+    struct nl_arena* arena = jit->arena;
+    if (jit->module_count == jit->module_size) {
+        unsigned int size = jit->module_size ? jit->module_size * 2 : 16;
+        jit->modules = nl_arena_realloc(jit->ctx, arena, jit->modules,
+                jit->module_size * sizeof(*jit->modules), size * sizeof(*jit->modules));
+        jit->names = nl_arena_realloc(jit->ctx, arena, jit->names,
+                jit->module_size * sizeof(*jit->names), size * sizeof(*jit->names));
+        jit->bodies = nl_arena_realloc(jit->ctx, arena, jit->bodies,
+                jit->module_size * sizeof(*jit->bodies), size * sizeof(*jit->bodies));
+        jit->module_size = size;
+    }
+
+    char* body = nl_arena_alloc(jit->ctx, arena, strlen(name) + sizeof(".body"));
+    sprintf(body, "%s.body", name);
+
+    jit->mod = LLVMModuleCreateWithNameInContext(name, jit->llvm);
+    LLVMSetTarget(jit->mod, jit->triple);
+    LLVMSetDataLayout(jit->mod, jit->data_layout);
+    jit->modules[jit->module_count] = jit->mod;
+    jit->names[jit->module_count] = name;
+    jit->bodies[jit->module_count] = body;
+    jit->module_count++;
+
+    nl_symtable_add(jit->ctx, jit->prototypes, (nl_string_t)name, tp);
+    return LLVMAddFunction(jit->mod, body, func_type);
+}
+
+static void jit_function_as(struct jit* jit, struct nl_ast* node, const char* func_name)
+{
+    assert(node->tag == NL_AST_FUNCTION);
     JIT_DEBUGF(jit, "JITing function %s", func_name);
+    double start = nl_trace_begin(jit->ctx);
+
+    if (jit->partition_count > 1) {
+        /* functions are dealt to the partitions in turn */
+        unsigned int partition = jit->module_count % jit->partition_count;
+        jit->llvm = jit->contexts[partition];
+        jit->builder = jit->builders[partition];
+    }
 
     // TODO: param types
     struct nl_ast* function_type = node->function.type;
@@ -495,7 +930,8 @@ static void jit_function(struct jit* jit, struct nl_ast* node)
     LLVMTypeRef ret_type = llvm_typeof(jit, function_type->func_type.ret_type, return_type);
 
     unsigned int param_count = function_type->func_type.params->list.count;
-    LLVMTypeRef* param_types = nl_alloc(jit->ctx, sizeof(*param_types) * param_count);
+    LLVMTypeRef* param_types = nl_arena_alloc(jit->ctx,
+            jit->arena, sizeof(*param_types) * param_count);
 
     struct nl_ast* param = function_type->func_type.params->list.head;
     unsigned int idx = 0;
@@ -510,15 +946,18 @@ static void jit_function(struct jit* jit, struct nl_ast* node)
     // TODO: variable argument functions
     LLVMTypeRef func_type = LLVMFunctionType(ret_type, param_types, param_count, false);
 
-    LLVMValueRef func = LLVMAddFunction(jit->mod, func_name, func_type);
+    struct nl_type* tp = jit->instance != NULL ? jit->instance->type : function_type->type;
+    LLVMValueRef func = define_function(jit, func_name, tp, func_type);
 
-    LLVMBasicBlockRef entry = LLVMAppendBasicBlock(func, "entry");
-    LLVMPositionBuilderAtEnd(jit->builder, entry);
+    nl_ssa_begin(&jit->ssa, jit->builder);
+    struct nl_ssa_block* entry = nl_ssa_block(&jit->ssa,
+            LLVMAppendBasicBlockInContext(jit->llvm, func, "entry"));
+    nl_ssa_seal(&jit->ssa, entry);
+    position_at(jit, entry);
 
-    // TODO: maybe a cleaner method of introducing new scope
-    jit->named_values = nl_symtable_create(jit->ctx, jit->named_values);
+    nl_symtable_enter_scope(jit->ctx, jit->named_values);
 
-    /* create argument allocas */
+    /* arguments are the first definitions of their variables */
     /* struct nl_ast* */ param = function_type->func_type.params->list.head;
     /* unsigned int */ idx = 0;
     while (param) {
@@ -533,42 +972,129 @@ static void jit_function(struct jit* jit, struct nl_ast* node)
 
         LLVMValueRef arg = LLVMGetParam(func, idx);
         LLVMSetValueName(arg, param_name);
-
-        LLVMValueRef alloca = LLVMBuildAlloca(jit->builder, param_type, param_name);
-        LLVMBuildStore(jit->builder, arg, alloca);
-
-        /* add argument to symbol table */
-        nl_symtable_add(jit->ctx, jit->named_values, (nl_string_t)param_name, alloca);
+        define_local(jit, param, param_type, param_name, arg);
 
         idx++;
         param = param->next;
     }
 
     jit_node(jit, node->function.body);
-    jit->named_values = nl_symtable_destroy(jit->ctx, jit->named_values);
+    nl_symtable_leave_scope(jit->ctx, jit->named_values);
+    nl_ssa_end(&jit->ssa);
+    jit->block = NULL;
+    nl_trace_end(jit->ctx, "jit", func_name, NULL, NULL, start);
 }
 
-static void jit_list(struct jit* jit, struct nl_ast* node)
+/* Lowers `node` as the native entry `symbol` of the interpreter's frames.
+ * Parameters and locals live in the slots the bytecode gave them instead
+ * of allocas, so the entry can start where the interpreter left off: at
+ * the top, or at the head of any loop, picked by its second argument. */
+static void jit_entry_as(struct jit* jit, struct nl_ast* node, const char* symbol)
 {
-    struct nl_ast *elem = node->list.head;
-    while (elem) {
-        jit_node(jit, elem);
-        elem = elem->next;
+    assert(node->tag == NL_AST_FUNCTION);
+    JIT_DEBUGF(jit, "JITing native entry %s", symbol);
+    double start = nl_trace_begin(jit->ctx);
+
+    LLVMTypeRef slots = LLVMPointerType(LLVMInt64TypeInContext(jit->llvm), 0);
+    LLVMTypeRef param_types[] = { slots, LLVMInt32TypeInContext(jit->llvm), slots };
+    LLVMTypeRef func_type = LLVMFunctionType(LLVMVoidTypeInContext(jit->llvm),
+            param_types, 3, false);
+    LLVMValueRef func = LLVMAddFunction(jit->mod, symbol, func_type);
+    jit->frame = LLVMGetParam(func, 0);
+    jit->ret = LLVMGetParam(func, 2);
+    LLVMSetValueName(jit->frame, "frame");
+    LLVMSetValueName(LLVMGetParam(func, 1), "loop");
+    LLVMSetValueName(jit->ret, "ret");
+
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(jit->llvm, func, "entry");
+    LLVMBasicBlockRef body = LLVMAppendBasicBlockInContext(jit->llvm, func, "start");
+    jit->entry_builder = LLVMCreateBuilderInContext(jit->llvm);
+    LLVMPositionBuilderAtEnd(jit->entry_builder, entry);
+    jit->osr = LLVMBuildSwitch(jit->entry_builder, LLVMGetParam(func, 1), body,
+            jit->code->loop_count);
+    LLVMPositionBuilderBefore(jit->entry_builder, jit->osr);
+
+    /* blocks are still tracked, but nothing is read from them */
+    nl_ssa_begin(&jit->ssa, jit->builder);
+    position_at(jit, nl_ssa_block(&jit->ssa, body));
+
+    nl_symtable_enter_scope(jit->ctx, jit->named_values);
+
+    struct nl_ast* param = node->function.type->func_type.params->list.head;
+    for (; param != NULL; param = param->next) {
+        assert(param->tag == NL_AST_DECL);
+        LLVMTypeRef param_type = llvm_typeof(jit, param->decl.type, param->decl.type->type);
+        const char *param_name = param->decl.rhs->s;
+        LLVMValueRef slot = frame_slot(jit, param, param_type, param_name);
+        nl_symtable_add(jit->ctx, jit->named_values, (nl_string_t)param_name, slot);
     }
+
+    jit_node(jit, node->function.body);
+    nl_symtable_leave_scope(jit->ctx, jit->named_values);
+    nl_ssa_end(&jit->ssa);
+    jit->block = NULL;
+
+    LLVMDisposeBuilder(jit->entry_builder);
+    jit->entry_builder = NULL;
+    jit->osr = NULL;
+    jit->frame = NULL;
+    jit->ret = NULL;
+    nl_trace_end(jit->ctx, "jit", symbol, NULL, NULL, start);
+}
+
+/* Lists are walked element by element */
+static bool jit_list(struct jit* jit, struct nl_ast* node)
+{
+    return true;
 }
 
 /* TODO: eliminate this function */
-static void jit_fake(struct jit* jit, struct nl_ast* node)
+static bool jit_fake(struct jit* jit, struct nl_ast* node)
 {
     JIT_ERRORF(jit, node, "JIT not yet supported for %s", nl_ast_name(node));
+    return false;
 }
 
 
-typedef void (*jiter) (struct jit*, struct nl_ast*);
+typedef bool (*jiter) (struct jit*, struct nl_ast*);
 
-static void jit_node(struct jit* jit, struct nl_ast* node)
+static bool is_list(const struct nl_ast* node)
 {
-    assert(node);
+    return node->tag > NL_AST_LIST_SENTINEL;
+}
+
+/* Opens a scope for each branch of an if-else and each loop body */
+static bool is_block(struct nl_walk* walk, struct nl_walk_frame* frame)
+{
+    struct nl_walk_frame* parent = nl_walk_parent(walk, frame);
+    return NL_AST_LIST_STATEMENTS == frame->node->tag && parent != NULL &&
+        (NL_AST_IFELSE == parent->node->tag || NL_AST_WHILE == parent->node->tag);
+}
+
+static bool enter_node(struct nl_walk* walk, struct nl_walk_frame* frame)
+{
+    struct jit* jit = walk->data;
+    struct nl_ast* node = frame->node;
+
+    /* the walk only descends into lists; other children (conditions,
+     * names, ...) are lowered by their parent's jiter */
+    struct nl_walk_frame* parent = nl_walk_parent(walk, frame);
+    if (parent != NULL && !is_list(parent->node) && !is_list(node)) {
+        return false;
+    }
+
+    if (is_block(walk, frame)) {
+        nl_symtable_enter_scope(jit->ctx, jit->named_values);
+    }
+
+    switch (node->tag) {
+    case NL_AST_IFELSE:
+        return enter_ifelse(jit, frame);
+    case NL_AST_WHILE:
+        return enter_while(jit, frame);
+    default:
+        break;
+    }
 
     static jiter jiters[] = {
         NULL,   /* sentinel */
@@ -599,8 +1125,8 @@ static void jit_node(struct jit* jit, struct nl_ast* node)
         jit_fake /* jit_init */,
         jit_bind,
         jit_assign,
-        jit_ifelse,
-        jit_while,
+        NULL /* enter_ifelse */,
+        NULL /* enter_while */,
         jit_fake /* jit_for */,
         jit_call_stmt,
         jit_return,
@@ -613,7 +1139,7 @@ static void jit_node(struct jit* jit, struct nl_ast* node)
         jit_fake /* jit_class */,
         jit_fake /* jit_interface */,
         jit_package,
-        NULL, /* units have been deconstructed into packages */
+        jit_unit,
 
         NULL,   /* sentinel separator */
 
@@ -630,7 +1156,7 @@ static void jit_node(struct jit* jit, struct nl_ast* node)
         jit_fake /* jit_list */,
         jit_list,
         jit_list,
-        NULL, /* units have been deconstructed into packages */
+        jit_list,
 
         NULL /* sentinel */
     };
@@ -642,75 +1168,1194 @@ static void jit_node(struct jit* jit, struct nl_ast* node)
     /* assert(j); */
     if (j == NULL) {
         JIT_ERROR(jit, node, "undefined JIT function");
+        return false;
+    }
+    return j(jit, node);
+}
+
+static bool child_node(struct nl_walk* walk, struct nl_walk_frame* frame,
+        unsigned int index)
+{
+    if (NL_AST_IFELSE == frame->node->tag) {
+        ifelse_branch(walk->data, frame, index);
+    }
+    return true;
+}
+
+static void leave_node(struct nl_walk* walk, struct nl_walk_frame* frame)
+{
+    struct jit* jit = walk->data;
+
+    if (is_block(walk, frame)) {
+        nl_symtable_leave_scope(jit->ctx, jit->named_values);
+    }
+
+    switch (frame->node->tag) {
+    case NL_AST_IFELSE:
+        leave_ifelse(jit, frame);
+        break;
+    case NL_AST_WHILE:
+        leave_while(jit, frame);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Lowers a tree of statements (or units, packages, ...), however deeply
+ * nested, on an explicit stack */
+static void jit_node(struct jit* jit, struct nl_ast* node)
+{
+    assert(node);
+
+    struct nl_walk walk;
+    nl_walk_init(&walk, jit->ctx, jit);
+    walk.pre = enter_node;
+    walk.child = child_node;
+    walk.post = leave_node;
+    nl_walk(&walk, node);
+    nl_walk_deinit(&walk);
+}
+
+/* The C API can't set fast-math flags on instructions, so defined
+ * functions get the equivalent attributes instead, which code
+ * generation and the passes that consult them honor */
+static void enable_fast_math(LLVMModuleRef mod)
+{
+    static const char* attrs[] = {
+        "unsafe-fp-math",
+        "no-infs-fp-math",
+        "no-nans-fp-math",
+        "no-signed-zeros-fp-math",
+        "approx-func-fp-math",
+    };
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+
+    LLVMValueRef func = LLVMGetFirstFunction(mod);
+    for (; func != NULL; func = LLVMGetNextFunction(func)) {
+        if (LLVMIsDeclaration(func)) {
+            continue;
+        }
+        unsigned int i;
+        for (i = 0; i < sizeof(attrs) / sizeof(*attrs); i++) {
+            LLVMAttributeRef attr = LLVMCreateStringAttribute(context,
+                    attrs[i], strlen(attrs[i]), "true", 4);
+            LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex, attr);
+        }
+    }
+}
+
+/* Runs the standard pipeline for the context's optimization level */
+static LLVMErrorRef optimize(struct nl_context* ctx, LLVMModuleRef mod,
+        LLVMTargetMachineRef machine)
+{
+    if (ctx->fast_math) {
+        enable_fast_math(mod);
+    }
+    if (0 == ctx->opt_level) {
+        return NULL;
+    }
+
+    char pipeline[16];
+    snprintf(pipeline, sizeof(pipeline), "default<O%u>", ctx->opt_level);
+    bool vectorize = ctx->opt_level >= 2;
+    LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+    LLVMPassBuilderOptionsSetLoopVectorization(options, vectorize);
+    LLVMPassBuilderOptionsSetSLPVectorization(options, vectorize);
+    LLVMPassBuilderOptionsSetLoopInterleaving(options, vectorize);
+    LLVMErrorRef error = LLVMRunPasses(mod, pipeline, machine, options);
+    LLVMDisposePassBuilderOptions(options);
+    return error;
+}
+
+/* Reports errors of compilation triggered by a call */
+static void report_error(void* data, LLVMErrorRef error)
+{
+    struct nl_context* ctx = data;
+    char *msg = LLVMGetErrorMessage(error);
+    NL_ERRORF(ctx, NL_ERR_JIT, "failed to compile function: %s", msg);
+    LLVMDisposeErrorMessage(msg);
+}
+
+/* Functions are optimized and compiled one at a time, when the program
+ * first calls them, or when the interpreter promotes them */
+struct nl_jit_session {
+    struct nl_context* ctx;
+    struct nl_arena* arena;         /**< of the session and its code */
+    LLVMOrcLLJITRef lljit;
+    LLVMOrcJITDylibRef dylib;
+    LLVMOrcThreadSafeContextRef ts_context;
+    LLVMTargetMachineRef machine;   /**< for the passes' cost models */
+    LLVMOrcLazyCallThroughManagerRef call_through;
+    LLVMOrcIndirectStubsManagerRef stubs;
+    pthread_mutex_t compile_lock;   /**< see materialize_module */
+    unsigned int added;             /**< modules the JIT took */
+    struct nl_cache_key cache_base; /**< target and settings, if caching */
+    const struct nl_cache_key* storing; /**< of the module being compiled */
+    struct jit jit;
+};
+
+struct nl_jit_entry {
+    const char* name;               /**< of the function */
+    char* symbol;
+    LLVMModuleRef mod;
+    LLVMOrcThreadSafeContextRef ts_context;
+};
+
+struct lazy_module {
+    struct nl_jit_session* session;
+    const char* name;               /**< of the function */
+    LLVMModuleRef mod;
+    LLVMOrcThreadSafeModuleRef module;  /**< which owns `mod` */
+    bool entry;                     /**< compiled on the tier's thread */
+};
+
+/* Hands the JIT a cached object file of the module instead of compiling
+ * it, if there is one. Fills in the module's key either way. */
+static bool load_object(struct nl_jit_session* session, struct lazy_module* lazy,
+        LLVMOrcMaterializationResponsibilityRef responsibility,
+        struct nl_cache_key* key)
+{
+    struct nl_context* ctx = session->ctx;
+    double start = nl_trace_begin(ctx);
+
+    *key = session->cache_base;
+    LLVMMemoryBufferRef bitcode = LLVMWriteBitcodeToMemoryBuffer(lazy->mod);
+    nl_cache_key_add(key, LLVMGetBufferStart(bitcode), LLVMGetBufferSize(bitcode));
+    LLVMDisposeMemoryBuffer(bitcode);
+
+    char path[NL_CACHE_PATH_MAX];
+    LLVMMemoryBufferRef object = NULL;
+    char* msg = NULL;
+    if (!nl_cache_path(ctx, key, path, sizeof(path)) ||
+            LLVMCreateMemoryBufferWithContentsOfFile(path, &object, &msg)) {
+        LLVMDisposeMessage(msg);
+        nl_trace_end(ctx, "jit", "cache-miss", "function", lazy->name, start);
+        return false;
+    }
+
+    LLVMOrcObjectLayerEmit(LLVMOrcLLJITGetObjLinkingLayer(session->lljit),
+            responsibility, object);
+    LLVMOrcDisposeThreadSafeModule(lazy->module);
+    nl_trace_end(ctx, "jit", "cache-hit", "function", lazy->name, start);
+    return true;
+}
+
+/* Stores the object file of the module being compiled, if it's cached */
+static LLVMErrorRef store_object(void* data, LLVMMemoryBufferRef* object)
+{
+    struct nl_jit_session* session = data;
+    if (session->storing != NULL) {
+        nl_cache_store(session->ctx, session->storing,
+                LLVMGetBufferStart(*object), LLVMGetBufferSize(*object));
+    }
+    return NULL;
+}
+
+/* The JIT's compiler and the passes' machine are shared, and native
+ * entries are compiled on a thread of their own, so one module is
+ * compiled at a time. Only the session's thread measures phases and
+ * reports errors. */
+static void materialize_module(void* data,
+        LLVMOrcMaterializationResponsibilityRef responsibility)
+{
+    struct lazy_module* lazy = data;
+    struct nl_jit_session* session = lazy->session;
+    struct nl_context* ctx = session->ctx;
+
+    pthread_mutex_lock(&session->compile_lock);
+    int phase = lazy->entry ? NL_PHASE_NONE : nl_stats_enter(ctx, NL_PHASE_CODEGEN);
+    struct nl_cache_key key;
+    bool cached = ctx->cache_dir != NULL;
+    if (cached && load_object(session, lazy, responsibility, &key)) {
+        if (!lazy->entry) {
+            nl_stats_enter(ctx, phase);
+        }
+        pthread_mutex_unlock(&session->compile_lock);
+        return;
+    }
+
+    if (!lazy->entry) {
+        nl_stats_enter(ctx, NL_PHASE_OPTIMIZE);
+    }
+    double start = nl_trace_begin(ctx);
+    LLVMErrorRef error = optimize(ctx, lazy->mod, session->machine);
+    nl_trace_end(ctx, "jit", "optimize", "function", lazy->name, start);
+    if (error != NULL) {
+        if (lazy->entry) {
+            LLVMConsumeError(error);
+        } else {
+            report_error(ctx, error);
+            nl_stats_enter(ctx, phase);
+        }
+        LLVMOrcMaterializationResponsibilityFailMaterialization(responsibility);
+        LLVMOrcDisposeMaterializationResponsibility(responsibility);
+        LLVMOrcDisposeThreadSafeModule(lazy->module);
+        pthread_mutex_unlock(&session->compile_lock);
         return;
     }
-    j(jit, node);
+
+    if (!lazy->entry) {
+        nl_stats_enter(ctx, NL_PHASE_CODEGEN);
+    }
+    /* compiled right here, through store_object */
+    start = nl_trace_begin(ctx);
+    session->storing = cached ? &key : NULL;
+    LLVMOrcIRTransformLayerEmit(LLVMOrcLLJITGetIRTransformLayer(session->lljit),
+            responsibility, lazy->module);
+    session->storing = NULL;
+    nl_trace_end(ctx, "jit", "codegen", "function", lazy->name, start);
+    if (!lazy->entry) {
+        nl_stats_enter(ctx, phase);
+    }
+    pthread_mutex_unlock(&session->compile_lock);
 }
 
-int nl_jit(struct nl_context *ctx, struct nl_ast* packages, int* return_code)
+static void discard_module(void* data, LLVMOrcJITDylibRef dylib,
+        LLVMOrcSymbolStringPoolEntryRef symbol)
 {
-    assert(ctx);
-    assert(ctx->ast_list);
+}
+
+/* Bodies that were never called are dropped with the JIT */
+static void destroy_module(void* data)
+{
+    struct lazy_module* lazy = data;
+    LLVMOrcDisposeThreadSafeModule(lazy->module);
+}
+
+/* Defines `symbol` of function `name`, compiled from `mod` once looked
+ * up. The JIT takes `mod` either way. */
+static LLVMErrorRef define_module(struct nl_jit_session* session,
+        LLVMOrcThreadSafeContextRef ts_context, LLVMModuleRef mod,
+        const char* name, const char* symbol, bool entry)
+{
+    struct lazy_module* lazy = nl_arena_alloc(session->ctx, session->arena,
+            sizeof(*lazy));
+    lazy->session = session;
+    lazy->name = name;
+    lazy->mod = mod;
+    lazy->module = LLVMOrcCreateNewThreadSafeModule(mod, ts_context);
+    lazy->entry = entry;
+
+    LLVMOrcCSymbolFlagsMapPair flags = {
+        .Name = LLVMOrcLLJITMangleAndIntern(session->lljit, symbol),
+        .Flags = {LLVMJITSymbolGenericFlagsExported | LLVMJITSymbolGenericFlagsCallable, 0},
+    };
+    LLVMOrcMaterializationUnitRef unit = LLVMOrcCreateCustomMaterializationUnit(name,
+            lazy, &flags, 1, NULL, materialize_module, discard_module, destroy_module);
+    LLVMErrorRef error = LLVMOrcJITDylibDefine(session->dylib, unit);
+    if (error != NULL) {
+        LLVMOrcDisposeMaterializationUnit(unit);
+    }
+    return error;
+}
+
+/* Called instead of a function that failed to compile, which the
+ * program can't do without */
+static void compile_failed(void)
+{
+    abort();
+}
+
+static int jit_failed(struct nl_context* ctx, const char* what, LLVMErrorRef error)
+{
+    char *msg = LLVMGetErrorMessage(error);
+    NL_ERRORF(ctx, NL_ERR_JIT, "%s: %s", what, msg);
+    LLVMDisposeErrorMessage(msg);
+    return NL_ERR_JIT;
+}
+
+/* Reports the first of the context's target CPU and features that
+ * `triple`'s target doesn't know */
+static bool check_target(struct nl_context* ctx, const char* triple)
+{
+    if (ctx->target_cpu != NULL && !nl_target_has_cpu(triple, ctx->target_cpu)) {
+        NL_ERRORF(ctx, NL_ERR_JIT, "unknown CPU %s for %s", ctx->target_cpu, triple);
+        return false;
+    }
+
+    const char* feature = ctx->target_features;
+    while (feature != NULL && *feature != '\0') {
+        size_t len = strcspn(feature, ",");
+        if (len > 0 && feature[0] != '+' && feature[0] != '-') {
+            NL_ERRORF(ctx, NL_ERR_JIT, "CPU feature %.*s needs a + or - prefix",
+                    (int)len, feature);
+            return false;
+        } else if (len > 0) {
+            char name[64];
+            bool known = len - 1 < sizeof(name);
+            if (known) {
+                memcpy(name, feature + 1, len - 1);
+                name[len - 1] = '\0';
+                known = nl_target_has_feature(triple, name);
+            }
+            if (!known) {
+                NL_ERRORF(ctx, NL_ERR_JIT, "unknown CPU feature %.*s for %s",
+                        (int)len, feature, triple);
+                return false;
+            }
+        }
+        feature += len;
+        if (',' == *feature) {
+            feature++;
+        }
+    }
+    return true;
+}
+
+/* Returns a machine for the context's target CPU, the host's by default,
+ * generating code at the context's optimization level */
+static LLVMTargetMachineRef host_machine(struct nl_context* ctx,
+        LLVMRelocMode reloc, LLVMCodeModel code_model)
+{
+    static const LLVMCodeGenOptLevel levels[] = {
+        LLVMCodeGenLevelNone,
+        LLVMCodeGenLevelLess,
+        LLVMCodeGenLevelDefault,
+        LLVMCodeGenLevelAggressive,
+    };
+
+    char* triple = LLVMGetDefaultTargetTriple();
+    LLVMTargetRef target;
+    char* error = NULL;
+    LLVMTargetMachineRef machine = NULL;
+    if (LLVMGetTargetFromTriple(triple, &target, &error)) {
+        NL_ERRORF(ctx, NL_ERR_JIT, "no target for %s: %s", triple, error);
+        LLVMDisposeMessage(error);
+    } else {
+        /* fall back to the host for good, so that's reported just once */
+        if (!check_target(ctx, triple)) {
+            NL_ERROR(ctx, NL_ERR_JIT, "generating code for the host's CPU instead");
+            nl_set_target(ctx, NULL, NULL);
+        }
+
+        /* the host's features only apply to the host's CPU */
+        char* host_cpu = NULL;
+        char* host_features = NULL;
+        const char* cpu = ctx->target_cpu;
+        const char* features = ctx->target_features;
+        if (NULL == cpu) {
+            cpu = host_cpu = LLVMGetHostCPUName();
+            if (NULL == features) {
+                features = host_features = LLVMGetHostCPUFeatures();
+            }
+        }
+        machine = LLVMCreateTargetMachine(target, triple, cpu,
+                features != NULL ? features : "",
+                levels[ctx->opt_level], reloc, code_model);
+        LLVMDisposeMessage(host_features);
+        LLVMDisposeMessage(host_cpu);
+    }
+    LLVMDisposeMessage(triple);
+    return machine;
+}
 
+/* The target is set up once per process and kept across contexts */
+static pthread_once_t target_once = PTHREAD_ONCE_INIT;
 
+static void init_target(void)
+{
     LLVMInitializeNativeTarget();
     LLVMInitializeNativeAsmPrinter();
     LLVMInitializeNativeAsmParser();
-    LLVMLinkInMCJIT();
+}
 
-    LLVMModuleRef mod = LLVMModuleCreateWithName("nolli");
+/* Verifies the modules from `first` on */
+static int verify_modules(struct jit* jit, unsigned int first)
+{
+    int err = NL_NO_ERR;
+    double start = nl_trace_begin(jit->ctx);
+    unsigned int i;
+    for (i = first; i < jit->module_count; i++) {
+        char* msg = NULL;
+        if (LLVMVerifyModule(jit->modules[i], LLVMReturnStatusAction, &msg)) {
+            NL_ERRORF(jit->ctx, NL_ERR_JIT, "LLVM module failed verification: %s", msg);
+            err = NL_ERR_JIT;
+        }
+        LLVMDisposeMessage(msg);    /* empty on success, but allocated all the same */
+    }
+    nl_trace_end(jit->ctx, "jit", "verify", NULL, NULL, start);
+    return err;
+}
 
-    char *error = NULL;
-    struct LLVMMCJITCompilerOptions options;
-    LLVMInitializeMCJITCompilerOptions(&options, sizeof(options));
-    LLVMExecutionEngineRef engine;
-    if (LLVMCreateMCJITCompilerForModule(&engine, mod, &options,
-                sizeof(options), &error)) {
-        NL_ERRORF(ctx, NL_ERR_JIT, "failed to create execution engine: %s", error);
-        LLVMDisposeMessage(error);
-        return NL_ERR_JIT;
+/* Functions compiled ahead are split into partitions, each lowered in an
+ * LLVM context of its own, so that they can be compiled concurrently */
+static void create_partitions(struct nl_jit_session* session, unsigned int count)
+{
+    struct nl_context* ctx = session->ctx;
+    struct nl_arena* arena = session->arena;
+    struct jit* jit = &session->jit;
+
+    jit->contexts = nl_arena_alloc(ctx, arena, count * sizeof(*jit->contexts));
+    jit->builders = nl_arena_alloc(ctx, arena, count * sizeof(*jit->builders));
+    jit->contexts[0] = jit->llvm;
+    jit->builders[0] = jit->builder;
+    unsigned int i;
+    for (i = 1; i < count; i++) {
+        jit->contexts[i] = LLVMContextCreate();
+        jit->builders[i] = LLVMCreateBuilderInContext(jit->contexts[i]);
     }
+    jit->partition_count = count;
+}
 
-    LLVMBuilderRef builder = LLVMCreateBuilder();
+struct partition {
+    struct nl_jit_session* session;
+    LLVMTargetMachineRef machine;   /**< of its own */
+    LLVMMemoryBufferRef object;     /**< NULL if empty, or on error */
+    char error[256];
+};
 
-    struct nl_symtable* named_values = nl_symtable_create(ctx, NULL);
-    struct jit jit = {
+struct compile_ahead {
+    struct nl_jit_session* session;
+    unsigned int first;             /**< module, the ones before are compiled */
+    struct partition* partitions;
+};
+
+/* Links the functions of a partition into one module, optimizes it and
+ * compiles it to an object file, on a thread of the pool. Like the
+ * tier's thread, it doesn't report errors itself. */
+static void compile_partition(void* data, unsigned int idx)
+{
+    struct compile_ahead* ahead = data;
+    struct nl_jit_session* session = ahead->session;
+    struct nl_context* ctx = session->ctx;
+    struct jit* jit = &session->jit;
+    struct partition* part = &ahead->partitions[idx];
+    double start = nl_trace_begin(ctx);
+
+    char name[32];
+    snprintf(name, sizeof(name), "nolli.%u", idx);
+    LLVMModuleRef mod = LLVMModuleCreateWithNameInContext(name, jit->contexts[idx]);
+    LLVMSetTarget(mod, jit->triple);
+    LLVMSetDataLayout(mod, jit->data_layout);
+    bool empty = true;
+    unsigned int i;
+    for (i = ahead->first; i < jit->module_count; i++) {
+        if (i % jit->partition_count != idx) {
+            continue;
+        }
+        if (LLVMLinkModules2(mod, jit->modules[i]) && '\0' == part->error[0]) {
+            snprintf(part->error, sizeof(part->error), "failed to link %s", jit->names[i]);
+        }
+        empty = false;
+    }
+    if (empty || part->error[0] != '\0') {
+        LLVMDisposeModule(mod);
+        return;
+    }
+
+    struct nl_cache_key key;
+    char path[NL_CACHE_PATH_MAX];
+    bool cached = ctx->cache_dir != NULL;
+    if (cached) {
+        key = session->cache_base;
+        LLVMMemoryBufferRef bitcode = LLVMWriteBitcodeToMemoryBuffer(mod);
+        nl_cache_key_add(&key, LLVMGetBufferStart(bitcode), LLVMGetBufferSize(bitcode));
+        LLVMDisposeMemoryBuffer(bitcode);
+        char* msg = NULL;
+        if (nl_cache_path(ctx, &key, path, sizeof(path)) &&
+                !LLVMCreateMemoryBufferWithContentsOfFile(path, &part->object, &msg)) {
+            LLVMDisposeModule(mod);
+            nl_trace_end(ctx, "jit", "cache-hit", "partition", name, start);
+            return;
+        }
+        LLVMDisposeMessage(msg);
+        part->object = NULL;
+    }
+
+    LLVMErrorRef error = optimize(ctx, mod, part->machine);
+    char* msg = NULL;
+    if (error != NULL) {
+        msg = LLVMGetErrorMessage(error);
+        snprintf(part->error, sizeof(part->error), "%s", msg);
+        LLVMDisposeErrorMessage(msg);
+    } else if (LLVMTargetMachineEmitToMemoryBuffer(part->machine, mod, LLVMObjectFile,
+                &msg, &part->object)) {
+        snprintf(part->error, sizeof(part->error), "%s", msg);
+        LLVMDisposeMessage(msg);
+        part->object = NULL;
+    } else if (cached) {
+        nl_cache_store(ctx, &key, LLVMGetBufferStart(part->object),
+                LLVMGetBufferSize(part->object));
+    }
+    LLVMDisposeModule(mod);
+    nl_trace_end(ctx, "jit", "compile-ahead", "partition", name, start);
+}
+
+/* Compiles the functions from module `first` on on the context's
+ * threads, one partition each, and hands the object files to the JIT */
+static int compile_ahead(struct nl_jit_session* session, unsigned int first)
+{
+    struct nl_context* ctx = session->ctx;
+    struct jit* jit = &session->jit;
+    unsigned int count = jit->partition_count;
+    int err = NL_NO_ERR;
+
+    struct compile_ahead ahead = {
+        .session=session,
+        .first=first,
+        .partitions=nl_arena_alloc(ctx, session->arena,
+                count * sizeof(*ahead.partitions)),
+    };
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+        ahead.partitions[i].session = session;
+        ahead.partitions[i].machine = host_machine(ctx, LLVMRelocDefault,
+                LLVMCodeModelJITDefault);
+        if (NULL == ahead.partitions[i].machine) {
+            err = NL_ERR_JIT;
+        }
+    }
+
+    if (NL_NO_ERR == err) {
+        nl_pool_run(ctx, count, count, compile_partition, &ahead);
+        session->added = jit->module_count;     /* linked into the partitions */
+    }
+
+    for (i = 0; i < count; i++) {
+        struct partition* part = &ahead.partitions[i];
+        if (part->error[0] != '\0') {
+            NL_ERRORF(ctx, NL_ERR_JIT, "failed to compile partition %u: %s", i, part->error);
+            err = NL_ERR_JIT;
+        } else if (part->object != NULL) {
+            LLVMErrorRef error = LLVMOrcLLJITAddObjectFile(session->lljit,
+                    session->dylib, part->object);
+            if (error != NULL) {
+                err = jit_failed(ctx, "failed to add object file", error);
+            }
+        }
+        if (part->machine != NULL) {
+            LLVMDisposeTargetMachine(part->machine);
+        }
+    }
+    return err;
+}
+
+/* Forgets the modules from `first` on, which failed to lower */
+static void drop_modules(struct jit* jit, unsigned int first)
+{
+    unsigned int i;
+    for (i = first; i < jit->module_count; i++) {
+        LLVMDisposeModule(jit->modules[i]);
+        nl_symtable_add(jit->ctx, jit->prototypes, (nl_string_t)jit->names[i], NULL);
+    }
+    jit->module_count = first;
+}
+
+int nl_jit_session_add(struct nl_jit_session* session, struct nl_ast* packages,
+        bool eager)
+{
+    struct nl_context* ctx = session->ctx;
+    struct jit* jit = &session->jit;
+    int err = NL_NO_ERR;
+    int phase = nl_stats_enter(ctx, NL_PHASE_IRGEN);
+
+    if (eager && 0 == jit->partition_count) {
+        create_partitions(session, ctx->threads ? ctx->threads : nl_pool_default_threads());
+    }
+
+    /* generate code for the functions the session doesn't have yet */
+    unsigned int first = jit->module_count;
+    double start = nl_trace_begin(ctx);
+    jit_node(jit, packages);
+    jit_instances(jit);
+    if (jit->partition_count > 1) {
+        jit->llvm = jit->contexts[0];
+        jit->builder = jit->builders[0];
+    }
+    nl_trace_end(ctx, "jit", "irgen", NULL, NULL, start);
+
+    /* ensure modules are valid */
+    nl_stats_enter(ctx, NL_PHASE_VERIFY);
+    err = verify_modules(jit, first);
+    if (err) {
+        drop_modules(jit, first);
+        nl_stats_enter(ctx, phase);
+        return err;
+    }
+
+    nl_stats_enter(ctx, NL_PHASE_CODEGEN);
+
+    /* dump modules to a file, if asked to */
+    unsigned int i;
+    FILE* dump = ctx->dump ? fopen("dump.llc", "w") : NULL;
+    if (ctx->dump && NULL == dump) {
+        NL_ERROR(ctx, NL_ERR_JIT, "failed to dump LLVM modules to dump.llc");
+    } else if (dump != NULL) {
+        for (i = first; i < jit->module_count; i++) {
+            char* ir = LLVMPrintModuleToString(jit->modules[i]);
+            fputs(ir, dump);
+            LLVMDisposeMessage(ir);
+        }
+        fclose(dump);
+    }
+
+    if (eager) {
+        err = compile_ahead(session, first);
+        if (err) {
+            nl_stats_enter(ctx, phase);
+            return err;
+        }
+    }
+
+    /* define a stub for each function that has it compiled on first call */
+    start = nl_trace_begin(ctx);
+    LLVMErrorRef error = NULL;
+    while (session->added < jit->module_count && NULL == error) {
+        unsigned int added = session->added++;
+        error = define_module(session, session->ts_context, jit->modules[added],
+                jit->names[added], jit->bodies[added], false);
+    }
+    unsigned int count = jit->module_count - first;
+    if (NULL == error && count > 0) {
+        LLVMOrcCSymbolAliasMapPairs aliases = nl_arena_alloc(ctx, session->arena,
+                count * sizeof(*aliases));
+        for (i = 0; i < count; i++) {
+            aliases[i].Name = LLVMOrcLLJITMangleAndIntern(session->lljit,
+                    jit->names[first + i]);
+            aliases[i].Entry.Name = LLVMOrcLLJITMangleAndIntern(session->lljit,
+                    jit->bodies[first + i]);
+            aliases[i].Entry.Flags.GenericFlags =
+                LLVMJITSymbolGenericFlagsExported | LLVMJITSymbolGenericFlagsCallable;
+            aliases[i].Entry.Flags.TargetFlags = 0;
+        }
+        LLVMOrcMaterializationUnitRef reexports = LLVMOrcLazyReexports(
+                session->call_through, session->stubs, session->dylib,
+                aliases, count);
+        error = LLVMOrcJITDylibDefine(session->dylib, reexports);
+        if (error != NULL) {
+            LLVMOrcDisposeMaterializationUnit(reexports);
+        }
+    }
+    nl_trace_end(ctx, "jit", "codegen", NULL, NULL, start);
+    nl_stats_enter(ctx, phase);
+    if (error != NULL) {
+        return jit_failed(ctx, "failed to define functions", error);
+    }
+    return NL_NO_ERR;
+}
+
+struct nl_jit_session* nl_jit_session_create(struct nl_context* ctx,
+        struct nl_arena* arena)
+{
+    pthread_once(&target_once, init_target);
+
+    /* the JIT takes one machine, the optimizer gets the other */
+    LLVMTargetMachineRef machine = host_machine(ctx, LLVMRelocDefault,
+            LLVMCodeModelJITDefault);
+    if (NULL == machine) {
+        return NULL;
+    }
+
+    LLVMOrcLLJITBuilderRef jit_builder = LLVMOrcCreateLLJITBuilder();
+    LLVMOrcLLJITBuilderSetJITTargetMachineBuilder(jit_builder,
+            LLVMOrcJITTargetMachineBuilderCreateFromTargetMachine(machine));
+    LLVMOrcLLJITRef lljit;
+    LLVMErrorRef error = LLVMOrcCreateLLJIT(&lljit, jit_builder);
+    if (error != NULL) {
+        jit_failed(ctx, "failed to create JIT", error);
+        return NULL;
+    }
+
+    struct nl_jit_session* session = nl_arena_alloc(ctx, arena, sizeof(*session));
+    session->ctx = ctx;
+    session->arena = arena;
+    session->lljit = lljit;
+    session->dylib = LLVMOrcLLJITGetMainJITDylib(lljit);
+    session->machine = host_machine(ctx, LLVMRelocDefault, LLVMCodeModelJITDefault);
+    pthread_mutex_init(&session->compile_lock, NULL);
+
+    const char* triple = LLVMOrcLLJITGetTripleString(lljit);
+    const char* data_layout = LLVMOrcLLJITGetDataLayoutStr(lljit);
+    LLVMTargetDataRef target_data = LLVMCreateTargetData(data_layout);
+    bool big_endian = LLVMByteOrder(target_data) == LLVMBigEndian;
+    LLVMDisposeTargetData(target_data);
+
+    LLVMOrcExecutionSessionRef es = LLVMOrcLLJITGetExecutionSession(lljit);
+    LLVMOrcExecutionSessionSetErrorReporter(es, report_error, ctx);
+
+    if (ctx->cache_dir != NULL) {
+        char* cpu = LLVMGetTargetMachineCPU(session->machine);
+        char* features = LLVMGetTargetMachineFeatureString(session->machine);
+        nl_cache_key_init(&session->cache_base);
+        nl_cache_key_add_string(&session->cache_base, triple);
+        nl_cache_key_add_string(&session->cache_base, cpu);
+        nl_cache_key_add_string(&session->cache_base, features);
+        unsigned int settings[] = {ctx->opt_level, ctx->fast_math};
+        nl_cache_key_add(&session->cache_base, settings, sizeof(settings));
+        LLVMDisposeMessage(features);
+        LLVMDisposeMessage(cpu);
+        LLVMOrcObjectTransformLayerSetTransform(LLVMOrcLLJITGetObjTransformLayer(lljit),
+                store_object, session);
+    }
+
+    /* `printf` and the like are the process's own */
+    LLVMOrcDefinitionGeneratorRef process;
+    error = LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(&process,
+            LLVMOrcLLJITGetGlobalPrefix(lljit), NULL, NULL);
+    if (error != NULL) {
+        jit_failed(ctx, "failed to search process for symbols", error);
+        nl_jit_session_destroy(session);
+        return NULL;
+    }
+    LLVMOrcJITDylibAddGenerator(session->dylib, process);
+
+    error = LLVMOrcCreateLocalLazyCallThroughManager(triple, es,
+            (LLVMOrcJITTargetAddress)(uintptr_t)compile_failed, &session->call_through);
+    if (error != NULL) {
+        jit_failed(ctx, "failed to create lazy call-through manager", error);
+        nl_jit_session_destroy(session);
+        return NULL;
+    }
+    session->stubs = LLVMOrcCreateLocalIndirectStubsManager(triple);
+
+    session->ts_context = LLVMOrcCreateNewThreadSafeContext();
+    LLVMContextRef llvm = LLVMOrcThreadSafeContextGetContext(session->ts_context);
+    session->jit = (struct jit){
         .ctx=ctx,
-        .mod=mod,
-        .builder=builder,
-        .named_values=named_values,
+        .arena=arena,
+        .llvm=llvm,
+        .builder=LLVMCreateBuilderInContext(llvm),
+        .named_values=nl_symtable_create(ctx, NULL),
+        .prototypes=nl_symtable_create(ctx, NULL),
+        .printf_name=nl_builtin_str(NL_BUILTIN_PRINTF),
+        .triple=triple,
+        .data_layout=data_layout,
+        .big_endian=big_endian,
     };
+    nl_ssa_init(&session->jit.ssa, ctx);
+    return session;
+}
 
-    /* FIXME: add C `printf` prototype */
-    LLVMTypeRef ret_type = LLVMInt32Type();
-    LLVMTypeRef param_types[] = { LLVMPointerType(LLVMInt8Type(), 0) };
-    LLVMTypeRef printf_type = LLVMFunctionType(ret_type, param_types, 1, true);
-    LLVMValueRef func = LLVMAddFunction(jit.mod, "printf", printf_type);
+uintptr_t nl_jit_session_lookup(struct nl_jit_session* session, const char* name)
+{
+    struct nl_context* ctx = session->ctx;
+    int phase = nl_stats_enter(ctx, NL_PHASE_CODEGEN);
+    double start = nl_trace_begin(ctx);
+    LLVMOrcJITTargetAddress addr = 0;
+    LLVMErrorRef error = LLVMOrcLLJITLookup(session->lljit, &addr, name);
+    nl_trace_end(ctx, "jit", "lookup", "function", name, start);
+    nl_stats_enter(ctx, phase);
+    if (error != NULL) {
+        char what[128];
+        snprintf(what, sizeof(what), "failed to look up %s", name);
+        jit_failed(ctx, what, error);
+        return 0;
+    }
+    return addr;
+}
 
-    /* generate code */
-    jit_node(&jit, packages);
+int nl_jit_session_destroy(struct nl_jit_session* session)
+{
+    struct nl_context* ctx = session->ctx;
+    struct jit* jit = &session->jit;
+    int err = NL_NO_ERR;
+
+    if (jit->named_values != NULL) {
+        nl_symtable_destroy(ctx, jit->named_values);
+        nl_symtable_destroy(ctx, jit->prototypes);
+        LLVMDisposeBuilder(jit->builder);
+        nl_ssa_deinit(&jit->ssa);
+    }
+    unsigned int i;
+    for (i = session->added; i < jit->module_count; i++) {
+        LLVMDisposeModule(jit->modules[i]);      /* the JIT owns the others */
+    }
+    for (i = 1; i < jit->partition_count; i++) {
+        LLVMDisposeBuilder(jit->builders[i]);
+        LLVMContextDispose(jit->contexts[i]);
+    }
+    if (session->ts_context != NULL) {
+        LLVMOrcDisposeThreadSafeContext(session->ts_context);
+    }
+    if (session->stubs != NULL) {
+        LLVMOrcDisposeIndirectStubsManager(session->stubs);
+    }
+    if (session->call_through != NULL) {
+        LLVMOrcDisposeLazyCallThroughManager(session->call_through);
+    }
+    LLVMErrorRef error = LLVMOrcDisposeLLJIT(session->lljit);
+    if (error != NULL) {
+        err = jit_failed(ctx, "failed to dispose of JIT", error);
+    }
+    if (session->machine != NULL) {
+        LLVMDisposeTargetMachine(session->machine);
+    }
+    pthread_mutex_destroy(&session->compile_lock);
+    return err;
+}
 
-    /* ensure module is valid */
-    error = NULL;
-    if (LLVMVerifyModule(mod, LLVMReturnStatusAction, &error)) {
-        NL_ERRORF(ctx, NL_ERR_JIT, "LLVM module failed verification: %s", error);
-        LLVMDisposeMessage(error);
-        return NL_ERR_JIT;
+struct nl_jit_entry* nl_jit_session_lower_entry(struct nl_jit_session* session,
+        const char* name, struct nl_ast* decl, struct nl_instance* instance,
+        const struct nl_code* code)
+{
+    struct nl_context* ctx = session->ctx;
+    struct nl_arena* arena = session->arena;
+    struct jit* jit = &session->jit;
+
+    struct nl_jit_entry* entry = nl_arena_alloc(ctx, arena, sizeof(*entry));
+    entry->name = name;
+    entry->symbol = nl_arena_alloc(ctx, arena, strlen(name) + sizeof(".tier"));
+    sprintf(entry->symbol, "%s.tier", name);
+
+    /* the entry gets an LLVM context of its own, since the session's
+     * may be compiling a function meanwhile */
+    int phase = nl_stats_enter(ctx, NL_PHASE_IRGEN);
+    LLVMContextRef shared = jit->llvm;
+    LLVMBuilderRef shared_builder = jit->builder;
+    entry->ts_context = LLVMOrcCreateNewThreadSafeContext();
+    jit->llvm = LLVMOrcThreadSafeContextGetContext(entry->ts_context);
+    jit->builder = LLVMCreateBuilderInContext(jit->llvm);
+    jit->mod = entry->mod = LLVMModuleCreateWithNameInContext(entry->symbol, jit->llvm);
+    LLVMSetTarget(jit->mod, jit->triple);
+    LLVMSetDataLayout(jit->mod, jit->data_layout);
+
+    jit->instance = instance;
+    jit->code = code;
+    jit_entry_as(jit, decl, entry->symbol);
+    jit->instance = NULL;
+    jit->code = NULL;
+
+    LLVMDisposeBuilder(jit->builder);
+    jit->builder = shared_builder;
+    jit->llvm = shared;
+    jit->mod = NULL;
+
+    /* a function that can't be compiled keeps being interpreted */
+    nl_stats_enter(ctx, NL_PHASE_VERIFY);
+    char* msg = NULL;
+    bool invalid = LLVMVerifyModule(entry->mod, LLVMReturnStatusAction, &msg);
+    if (invalid) {
+        JIT_DEBUGF(jit, "native entry %s failed verification: %s", entry->symbol, msg);
+    }
+    LLVMDisposeMessage(msg);
+    nl_stats_enter(ctx, phase);
+    if (invalid) {
+        nl_jit_session_discard_entry(entry);
+        return NULL;
     }
+    return entry;
+}
 
-    /* dump module to a file */
-    error = NULL;
-    if (LLVMPrintModuleToFile(mod, "dump.llc", &error)) {
-        NL_ERRORF(ctx, NL_ERR_JIT, "failed to dump LLVM module: %s", error);
-        LLVMDisposeMessage(error);
+nl_native_entry nl_jit_session_compile_entry(struct nl_jit_session* session,
+        struct nl_jit_entry* entry)
+{
+    double start = nl_trace_begin(session->ctx);
+    LLVMErrorRef error = define_module(session, entry->ts_context, entry->mod,
+            entry->name, entry->symbol, true);
+    LLVMOrcDisposeThreadSafeContext(entry->ts_context);     /* the module holds it */
+
+    LLVMOrcJITTargetAddress addr = 0;
+    if (NULL == error) {
+        error = LLVMOrcLLJITLookup(session->lljit, &addr, entry->symbol);
+    }
+    if (error != NULL) {
+        LLVMConsumeError(error);    /* the function keeps being interpreted */
+        addr = 0;
+    }
+    nl_trace_end(session->ctx, "jit", "tier-up", "function", entry->name, start);
+    return (nl_native_entry)(uintptr_t)addr;
+}
+
+void nl_jit_session_discard_entry(struct nl_jit_entry* entry)
+{
+    LLVMDisposeModule(entry->mod);
+    LLVMOrcDisposeThreadSafeContext(entry->ts_context);
+}
+
+int nl_jit(struct nl_context *ctx, struct nl_ast* packages, int* return_code)
+{
+    assert(ctx);
+    assert(ctx->ast_list);
+
+    int err = NL_NO_ERR;
+    struct nl_jit_session* session = nl_jit_session_create(ctx,
+            nl_arena(ctx, NL_ARENA_CODEGEN));
+    if (NULL == session) {
+        err = NL_ERR_JIT;
+        goto reset;
+    }
+    err = nl_jit_session_add(session, packages, ctx->compile_ahead);
+    if (err) {
+        nl_jit_session_destroy(session);
+        goto reset;
+    }
+
+    uintptr_t addr = nl_jit_session_lookup(session, "main");
+    if (0 == addr) {
+        err = NL_ERR_JIT;
+    } else {
+        /* execute code by calling main, which compiles as it goes */
+        double start = nl_trace_begin(ctx);
+        int32_t (*fp)() = (int32_t (*)())addr;
+        *return_code = fp();
+        nl_trace_end(ctx, "run", "main", NULL, NULL, start);
+
+        NL_DEBUGF(ctx, "main evaluated to: %d", *return_code);
+    }
+
+    if (nl_jit_session_destroy(session) != NL_NO_ERR) {
+        err = NL_ERR_JIT;
+    }
+reset:
+    nl_arena_reset(ctx, nl_arena(ctx, NL_ARENA_CODEGEN));
+    return err;
+}
+
+struct nl_session {
+    struct nl_context* ctx;
+    struct nl_arena arena;          /**< the JIT's, kept until it's destroyed */
+    struct nl_jit_session* jit;
+};
+
+struct nl_session* nl_session_create(struct nl_context* ctx)
+{
+    assert(ctx);
+
+    struct nl_session* session = nl_alloc_tagged(ctx, sizeof(*session), NL_MEM_JIT);
+    session->ctx = ctx;
+    nl_arena_init(&session->arena, NL_MEM_JIT);
+    session->jit = nl_jit_session_create(ctx, &session->arena);
+    if (NULL == session->jit) {
+        nl_arena_deinit(ctx, &session->arena);
+        nl_free(ctx, session, sizeof(*session));
+        return NULL;
+    }
+    return session;
+}
+
+int nl_session_add(struct nl_session* session, struct nl_ast* packages)
+{
+    assert(session);
+    return nl_jit_session_add(session->jit, packages, session->ctx->compile_ahead);
+}
+
+void* nl_session_lookup(struct nl_session* session, const char* name)
+{
+    assert(session);
+    return (void*)nl_jit_session_lookup(session->jit, name);
+}
+
+int nl_session_destroy(struct nl_session* session)
+{
+    if (NULL == session) {
+        return NL_NO_ERR;
+    }
+    struct nl_context* ctx = session->ctx;
+    int err = nl_jit_session_destroy(session->jit);
+    nl_arena_deinit(ctx, &session->arena);
+    nl_free(ctx, session, sizeof(*session));
+    return err;
+}
+
+/* Links the program's modules into one, in which functions call each
+ * other's bodies directly. Bodies are named after their functions with
+ * an `nl_` prefix, so that none stands in for a C library function of
+ * the same name, and get `linkage`. */
+static LLVMModuleRef link_program(struct jit* jit, LLVMLinkage linkage)
+{
+    LLVMModuleRef program = LLVMModuleCreateWithNameInContext("nolli", jit->llvm);
+    LLVMSetTarget(program, jit->triple);
+    LLVMSetDataLayout(program, jit->data_layout);
+
+    unsigned int i;
+    for (i = 0; i < jit->module_count; i++) {
+        if (LLVMLinkModules2(program, jit->modules[i])) {
+            NL_ERRORF(jit->ctx, NL_ERR_JIT, "failed to link function %s", jit->names[i]);
+            for (i++; i < jit->module_count; i++) {
+                LLVMDisposeModule(jit->modules[i]);
+            }
+            jit->module_count = 0;
+            LLVMDisposeModule(program);
+            return NULL;
+        }
     }
 
-    /* execute code by extracting and calling main function */
-    uint64_t addr = LLVMGetFunctionAddress(engine, "main");
-    int32_t (*fp)() = (int32_t (*)())addr;
-    *return_code = fp();
+    for (i = 0; i < jit->module_count; i++) {
+        LLVMValueRef body = LLVMGetNamedFunction(program, jit->bodies[i]);
+        LLVMValueRef stub = LLVMGetNamedFunction(program, jit->names[i]);
+        if (stub != NULL) {
+            LLVMReplaceAllUsesWith(stub, body);
+            LLVMDeleteFunction(stub);
+        }
+    }
+    /* renamed once every stub is gone, so no new name is taken */
+    for (i = 0; i < jit->module_count; i++) {
+        LLVMValueRef body = LLVMGetNamedFunction(program, jit->bodies[i]);
+        char* name = nl_arena_alloc(jit->ctx, jit->arena,
+                strlen(jit->names[i]) + sizeof("nl_"));
+        sprintf(name, "nl_%s", jit->names[i]);
+        LLVMSetValueName2(body, name, strlen(name));
+        LLVMSetLinkage(body, linkage);
+    }
+    jit->module_count = 0;          /* the program owns them */
+    return program;
+}
 
-    JIT_DEBUGF(&jit, "main evaluated to: %d", *return_code);
+/* Adds the C `main` of an executable, returning what nolli's returns */
+static bool add_c_main(struct jit* jit, LLVMModuleRef program)
+{
+    LLVMValueRef nl_main = LLVMGetNamedFunction(program, "nl_main");
+    if (NULL == nl_main) {
+        NL_ERROR(jit->ctx, NL_ERR_JIT, "no main function");
+        return false;
+    }
+
+    LLVMTypeRef int_type = LLVMInt32TypeInContext(jit->llvm);
+    LLVMValueRef func = LLVMAddFunction(program, "main",
+            LLVMFunctionType(int_type, NULL, 0, false));
+    LLVMPositionBuilderAtEnd(jit->builder,
+            LLVMAppendBasicBlockInContext(jit->llvm, func, "entry"));
+    LLVMTypeRef main_type = LLVMGlobalGetValueType(nl_main);
+    LLVMValueRef result = LLVMBuildCall2(jit->builder, main_type, nl_main, NULL, 0, "");
+    if (LLVMGetTypeKind(LLVMGetReturnType(main_type)) == LLVMIntegerTypeKind) {
+        result = LLVMBuildIntCast2(jit->builder, result, int_type, true, "");
+    } else {
+        result = LLVMConstInt(int_type, 0, false);
+    }
+    LLVMBuildRet(jit->builder, result);
+    return true;
+}
+
+/* Creates an empty file in $TMPDIR, or /tmp, for the object file of an
+ * executable, and returns its name, or NULL after reporting an error */
+static char* temp_object(struct nl_context* ctx)
+{
+    const char* dir = getenv("TMPDIR");
+    if (NULL == dir || '\0' == *dir) {
+        dir = "/tmp";
+    }
+    char* name = nl_arena_alloc(ctx, nl_arena(ctx, NL_ARENA_CODEGEN),
+            strlen(dir) + sizeof("/nolli-XXXXXX"));
+    sprintf(name, "%s/nolli-XXXXXX", dir);
+    int fd = mkstemp(name);
+    if (fd < 0) {
+        NL_ERRORF(ctx, NL_ERR_IO, "Can't create a temporary file in %s", dir);
+        return NULL;
+    }
+    close(fd);
+    return name;
+}
 
+/* Links an object file into an executable with the system's compiler */
+static int link_executable(struct nl_context* ctx, const char* object, const char* path)
+{
+    extern char** environ;
+    const char* cc = getenv("CC");
+    if (NULL == cc || '\0' == *cc) {
+        cc = "cc";
+    }
+    char* argv[] = {(char*)cc, "-o", (char*)path, (char*)object, "-lm", NULL};
+
+    pid_t pid;
+    int status = 0;
+    if (posix_spawnp(&pid, cc, NULL, NULL, argv, environ) != 0 ||
+            waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+        NL_ERRORF(ctx, NL_ERR_IO, "failed to link %s with %s", path, cc);
+        return NL_ERR_IO;
+    }
     return NL_NO_ERR;
 }
+
+int nl_build(struct nl_context* ctx, struct nl_ast* packages, const char* path, int kind)
+{
+    assert(ctx);
+    assert(ctx->ast_list);
+    assert(NL_BUILD_EXECUTABLE == kind || NL_BUILD_OBJECT == kind);
+
+    pthread_once(&target_once, init_target);
+    LLVMTargetMachineRef machine = host_machine(ctx, LLVMRelocPIC, LLVMCodeModelDefault);
+    if (NULL == machine) {
+        return NL_ERR_JIT;
+    }
+
+    int err = NL_NO_ERR;
+    int phase = nl_stats_enter(ctx, NL_PHASE_IRGEN);
+    char* triple = LLVMGetTargetMachineTriple(machine);
+    LLVMTargetDataRef target_data = LLVMCreateTargetDataLayout(machine);
+    char* data_layout = LLVMCopyStringRepOfTargetData(target_data);
+    LLVMContextRef llvm = LLVMContextCreate();
+    struct jit jit = {
+        .ctx=ctx,
+        .arena=nl_arena(ctx, NL_ARENA_CODEGEN),
+        .llvm=llvm,
+        .builder=LLVMCreateBuilderInContext(llvm),
+        .named_values=nl_symtable_create(ctx, NULL),
+        .prototypes=nl_symtable_create(ctx, NULL),
+        .printf_name=nl_builtin_str(NL_BUILTIN_PRINTF),
+        .triple=triple,
+        .data_layout=data_layout,
+        .big_endian=LLVMByteOrder(target_data) == LLVMBigEndian,
+    };
+    nl_ssa_init(&jit.ssa, ctx);
+    LLVMDisposeTargetData(target_data);
+
+    double start = nl_trace_begin(ctx);
+    jit_node(&jit, packages);
+    jit_instances(&jit);
+    nl_trace_end(ctx, "build", "irgen", NULL, NULL, start);
+
+    nl_stats_enter(ctx, NL_PHASE_VERIFY);
+    err = verify_modules(&jit, 0);
+    LLVMModuleRef program = NULL;
+    if (NL_NO_ERR == err) {
+        /* an executable only exports its C `main` */
+        program = link_program(&jit, NL_BUILD_EXECUTABLE == kind ?
+                LLVMInternalLinkage : LLVMExternalLinkage);
+        if (NULL == program || (NL_BUILD_EXECUTABLE == kind && !add_c_main(&jit, program))) {
+            err = NL_ERR_JIT;
+        }
+    }
+
+    /* the whole program is optimized at once, so calls can be inlined */
+    if (NL_NO_ERR == err) {
+        nl_stats_enter(ctx, NL_PHASE_OPTIMIZE);
+        start = nl_trace_begin(ctx);
+        LLVMErrorRef error = optimize(ctx, program, machine);
+        nl_trace_end(ctx, "build", "optimize", NULL, NULL, start);
+        if (error != NULL) {
+            err = jit_failed(ctx, "failed to optimize program", error);
+        }
+    }
+
+    if (NL_NO_ERR == err) {
+        nl_stats_enter(ctx, NL_PHASE_CODEGEN);
+        start = nl_trace_begin(ctx);
+        char* object = NL_BUILD_OBJECT == kind ? (char*)path : temp_object(ctx);
+        char* msg = NULL;
+        if (NULL == object) {
+            err = NL_ERR_IO;
+        } else if (LLVMTargetMachineEmitToFile(machine, program, object,
+                    LLVMObjectFile, &msg)) {
+            NL_ERRORF(ctx, NL_ERR_JIT, "failed to write %s: %s", object, msg);
+            LLVMDisposeMessage(msg);
+            err = NL_ERR_JIT;
+        } else if (NL_BUILD_EXECUTABLE == kind) {
+            err = link_executable(ctx, object, path);
+        }
+        if (object != NULL && object != path) {
+            unlink(object);
+        }
+        nl_trace_end(ctx, "build", "codegen", NULL, NULL, start);
+    }
+    nl_stats_enter(ctx, phase);
+
+    unsigned int i;
+    for (i = 0; i < jit.module_count; i++) {
+        LLVMDisposeModule(jit.modules[i]);
+    }
+    if (program != NULL) {
+        LLVMDisposeModule(program);
+    }
+    nl_symtable_destroy(ctx, jit.named_values);
+    nl_symtable_destroy(ctx, jit.prototypes);
+    LLVMDisposeBuilder(jit.builder);
+    nl_ssa_deinit(&jit.ssa);
+    LLVMContextDispose(llvm);
+    LLVMDisposeMessage(data_layout);
+    LLVMDisposeMessage(triple);
+    LLVMDisposeTargetMachine(machine);
+    nl_arena_reset(ctx, nl_arena(ctx, NL_ARENA_CODEGEN));
+    return err;
+}
@@ -0,0 +1,72 @@
+#ifndef NOLLI_GEN_H
+#define NOLLI_GEN_H
+
+#include "nolli.h"
+#include "ast.h"
+#include "arena.h"
+#include "bytecode.h"
+#include "instance.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * A program lowered to LLVM, whose functions are compiled on their
+ * first call through a stub (see nl_jit). A session also compiles the
+ * native tier of functions the interpreter finds hot.
+ */
+struct nl_jit_session;
+
+/** Native tier of a function lowered for the interpreter's frames */
+struct nl_jit_entry;
+
+/**
+ * Native code taking over a function's bytecode frame: at its start if
+ * `loop` is 0, or else at the head of that loop (see nl_code_loop).
+ * Stores the function's result at `ret`.
+ */
+typedef void (*nl_native_entry)(union nl_value* frame, int32_t loop,
+        union nl_value* ret);
+
+/**
+ * Starts a JIT, which allocates from `arena` until it's destroyed.
+ * Returns NULL after reporting an error.
+ */
+struct nl_jit_session* nl_jit_session_create(struct nl_context* ctx,
+        struct nl_arena* arena);
+
+/**
+ * Lowers the functions of `packages` the session doesn't have yet, and
+ * compiles them all right away if `eager`, or else each on its first
+ * call. Returns an error code; the functions that failed aren't added.
+ */
+int nl_jit_session_add(struct nl_jit_session* session, struct nl_ast* packages,
+        bool eager);
+
+/** Returns the address of function `name`, compiling it first if needed, or 0 */
+uintptr_t nl_jit_session_lookup(struct nl_jit_session* session, const char* name);
+
+/** Returns an error code once the JIT and all of its code are freed */
+int nl_jit_session_destroy(struct nl_jit_session* session);
+
+/**
+ * Lowers function `decl` (an `instance` of it, if not NULL), named
+ * `name`, as a native entry keeping its parameters and locals where
+ * `code` keeps them. Returns NULL if it can't be lowered.
+ */
+struct nl_jit_entry* nl_jit_session_lower_entry(struct nl_jit_session* session,
+        const char* name, struct nl_ast* decl, struct nl_instance* instance,
+        const struct nl_code* code);
+
+/**
+ * Optimizes and compiles an entry, which may be done on another thread
+ * than the session's, and returns its code, or NULL if that failed.
+ * Takes the entry either way.
+ */
+nl_native_entry nl_jit_session_compile_entry(struct nl_jit_session* session,
+        struct nl_jit_entry* entry);
+
+/** Frees an entry that won't be compiled */
+void nl_jit_session_discard_entry(struct nl_jit_entry* entry);
+
+#endif /* NOLLI_GEN_H */
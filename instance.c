@@ -0,0 +1,350 @@
+#include "instance.h"
+#include "typetab.h"
+#include "nolli.h"
+#include "mem.h"
+#include "arena.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+
+enum {
+    NL_INSTANCE_CACHE_MIN_SIZE = 16,
+    NL_MANGLED_NAME_MAX = 256
+};
+
+static unsigned int slot_of(const struct nl_instance_cache *cache,
+        const struct nl_type *key)
+{
+    uint64_t h = (uint64_t)(uintptr_t)key * 0x9E3779B97F4A7C15ull;
+    return (unsigned int)(h >> 32) & (cache->size - 1);
+}
+
+static unsigned int find_slot(const struct nl_instance_cache *cache,
+        const struct nl_type *key)
+{
+    unsigned int mask = cache->size - 1;
+    unsigned int idx = slot_of(cache, key);
+    while (cache->slots[idx] != NULL && cache->slots[idx]->key != key) {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+static void grow(struct nl_context* ctx, struct nl_instance_cache *cache)
+{
+    unsigned int old_size = cache->size;
+    struct nl_instance **old_slots = cache->slots;
+
+    cache->size = old_size * 2;
+    cache->slots = nl_alloc_tagged(ctx,
+            cache->size * sizeof(*cache->slots), NL_MEM_TYPES);
+
+    unsigned int i;
+    for (i = 0; i < old_size; i++) {
+        struct nl_instance *inst = old_slots[i];
+        if (inst != NULL) {
+            cache->slots[find_slot(cache, inst->key)] = inst;
+        }
+    }
+
+    nl_free(ctx, old_slots, old_size * sizeof(*old_slots));
+}
+
+static bool is_open(const struct nl_type *tp)
+{
+    if (NULL == tp) {
+        return false;
+    }
+
+    unsigned int i;
+    switch (tp->tag) {
+        case NL_TYPE_TMPL_PLACEHOLDER:
+            return true;
+        case NL_TYPE_FUNC:
+            for (i = 0; i < tp->func.param_count; i++) {
+                if (is_open(tp->func.param_types[i])) {
+                    return true;
+                }
+            }
+            return is_open(tp->func.ret_type);
+        case NL_TYPE_TMPL_INSTANCE:
+            for (i = 0; i < tp->instance.arg_count; i++) {
+                if (is_open(tp->instance.args[i])) {
+                    return true;
+                }
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+static bool append(char *buf, size_t *len, const char *s)
+{
+    size_t n = strlen(s);
+    if (*len + n >= NL_MANGLED_NAME_MAX) {
+        return false;
+    }
+    memcpy(buf + *len, s, n + 1);
+    *len += n;
+    return true;
+}
+
+static bool mangle_list(char *buf, size_t *len, struct nl_type **types,
+        unsigned int count);
+
+/* Appends the mangled form of `tp` to `buf`, returning false once the
+ * name would no longer fit */
+static bool mangle(char *buf, size_t *len, const struct nl_type *tp)
+{
+    if (NULL == tp) {
+        return append(buf, len, "void");
+    }
+
+    switch (tp->tag) {
+        case NL_TYPE_FUNC:
+            return append(buf, len, "func(") &&
+                mangle_list(buf, len, tp->func.param_types, tp->func.param_count) &&
+                append(buf, len, ")") &&
+                mangle(buf, len, tp->func.ret_type);
+        case NL_TYPE_TMPL_INSTANCE:
+            return append(buf, len, tp->repr) &&
+                append(buf, len, "<") &&
+                mangle_list(buf, len, tp->instance.args, tp->instance.arg_count) &&
+                append(buf, len, ">");
+        default:
+            return append(buf, len, tp->repr);
+    }
+}
+
+static bool mangle_list(char *buf, size_t *len, struct nl_type **types,
+        unsigned int count)
+{
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+        if ((i > 0 && !append(buf, len, ",")) || !mangle(buf, len, types[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static nl_string_t mangled_name(struct nl_context* ctx,
+        struct nl_instance_cache *cache, const struct nl_type *generic,
+        struct nl_type **args)
+{
+    char buf[NL_MANGLED_NAME_MAX];
+    size_t len = 0;
+    buf[0] = '\0';
+
+    if (!(append(buf, &len, generic->repr) && append(buf, &len, "<") &&
+            mangle_list(buf, &len, args, generic->generic.tmpl_count) &&
+            append(buf, &len, ">"))) {
+        /* very long names fall back to being numbered */
+        snprintf(buf, sizeof(buf), "%s<#%u>", generic->repr, cache->count);
+    }
+    return nl_strtab_wrap(ctx, ctx->strtab, buf);
+}
+
+int nl_instance_cache_init(struct nl_context* ctx, struct nl_instance_cache *cache)
+{
+    cache->size = NL_INSTANCE_CACHE_MIN_SIZE;
+    cache->count = 0;
+    cache->slots = nl_alloc_tagged(ctx,
+            cache->size * sizeof(*cache->slots), NL_MEM_TYPES);
+    cache->head = cache->tail = NULL;
+    cache->retired = NULL;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return NL_NO_ERR;
+}
+
+void nl_instance_cache_reset(struct nl_context* ctx, struct nl_instance_cache *cache)
+{
+    /* the instances themselves are freed with the analysis arena */
+    memset(cache->slots, 0, cache->size * sizeof(*cache->slots));
+    cache->count = 0;
+    cache->head = cache->tail = NULL;
+    cache->retired = NULL;
+}
+
+void nl_instance_cache_deinit(struct nl_context* ctx, struct nl_instance_cache *cache)
+{
+    nl_free(ctx, cache->slots, cache->size * sizeof(*cache->slots));
+    cache->slots = NULL;
+    cache->size = cache->count = 0;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+void nl_instance_cache_retire(struct nl_context* ctx, struct nl_instance_cache *cache)
+{
+    pthread_mutex_lock(&cache->lock);
+    if (cache->head != NULL) {
+        cache->tail->next = cache->retired;
+        cache->retired = cache->head;
+    }
+    cache->head = cache->tail = NULL;
+    memset(cache->slots, 0, cache->size * sizeof(*cache->slots));
+    cache->count = 0;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+struct nl_instance *nl_instantiate(struct nl_context* ctx,
+        struct nl_instance_cache *cache, struct nl_type *generic,
+        struct nl_type **args)
+{
+    assert(NL_TYPE_GENERIC == generic->tag);
+    unsigned int count = generic->generic.tmpl_count;
+
+    struct nl_type *key = nl_typetab_tmpl_instance(ctx, ctx->typetab,
+            generic, args, count);
+
+    pthread_mutex_lock(&cache->lock);
+
+    unsigned int idx = find_slot(cache, key);
+    if (cache->slots[idx] != NULL) {
+        struct nl_instance *inst = cache->slots[idx];
+        pthread_mutex_unlock(&cache->lock);
+        return inst;
+    }
+
+    struct nl_instance *inst = nl_arena_alloc(ctx, nl_arena(ctx, NL_ARENA_ANALYSIS),
+            sizeof(*inst));
+    inst->key = key;
+    inst->generic = generic;
+    inst->args = key->instance.args;
+    inst->type = nl_type_substitute(ctx, generic->generic.func, generic, inst->args);
+    inst->name = mangled_name(ctx, cache, generic, inst->args);
+    inst->open = false;
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+        inst->open = inst->open || is_open(inst->args[i]);
+    }
+
+    cache->slots[idx] = inst;
+    cache->count++;
+    if (cache->tail != NULL) {
+        cache->tail->next = inst;
+    } else {
+        cache->head = inst;
+    }
+    cache->tail = inst;
+
+    if (cache->count * 4 > cache->size * 3) {
+        grow(ctx, cache);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return inst;
+}
+
+struct nl_instance *nl_instance_canonical(struct nl_context* ctx,
+        struct nl_instance_cache *cache, struct nl_instance *inst)
+{
+    return nl_instantiate(ctx, cache, inst->generic, inst->args);
+}
+
+bool nl_type_unify(struct nl_type *owner, struct nl_type *param,
+        struct nl_type *arg, struct nl_type **bindings)
+{
+    if (NULL == param || NULL == arg) {
+        return param == arg;
+    }
+
+    if (NL_TYPE_TMPL_PLACEHOLDER == param->tag && param->placeholder.owner == owner) {
+        struct nl_type **bound = &bindings[param->placeholder.index];
+        if (NULL == *bound) {
+            *bound = arg;
+        }
+        return *bound == arg;
+    }
+
+    if (param->tag != arg->tag) {
+        return false;
+    }
+
+    unsigned int i;
+    switch (param->tag) {
+        case NL_TYPE_FUNC:
+            if (param->func.param_count != arg->func.param_count ||
+                    !nl_type_unify(owner, param->func.ret_type,
+                        arg->func.ret_type, bindings)) {
+                return false;
+            }
+            for (i = 0; i < param->func.param_count; i++) {
+                if (!nl_type_unify(owner, param->func.param_types[i],
+                            arg->func.param_types[i], bindings)) {
+                    return false;
+                }
+            }
+            return true;
+        case NL_TYPE_TMPL_INSTANCE:
+            if (param->instance.tmpl != arg->instance.tmpl ||
+                    param->instance.arg_count != arg->instance.arg_count) {
+                return false;
+            }
+            for (i = 0; i < param->instance.arg_count; i++) {
+                if (!nl_type_unify(owner, param->instance.args[i],
+                            arg->instance.args[i], bindings)) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return param == arg;
+    }
+}
+
+static struct nl_type **substitute_list(struct nl_context* ctx,
+        struct nl_type **types, unsigned int count,
+        struct nl_type *owner, struct nl_type **args)
+{
+    if (count == 0) {
+        return NULL;
+    }
+    struct nl_type **list = nl_malloc_tagged(ctx, count * sizeof(*list), NL_MEM_TYPES);
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+        list[i] = nl_type_substitute(ctx, types[i], owner, args);
+    }
+    return list;
+}
+
+struct nl_type *nl_type_substitute(struct nl_context* ctx, struct nl_type *tp,
+        struct nl_type *owner, struct nl_type **args)
+{
+    if (NULL == tp || !is_open(tp)) {
+        return tp;
+    }
+
+    struct nl_type **list = NULL;
+    unsigned int count = 0;
+    struct nl_type *result = tp;
+    switch (tp->tag) {
+        case NL_TYPE_TMPL_PLACEHOLDER:
+            if (tp->placeholder.owner == owner) {
+                result = args[tp->placeholder.index];
+            }
+            break;
+        case NL_TYPE_FUNC:
+            count = tp->func.param_count;
+            list = substitute_list(ctx, tp->func.param_types, count, owner, args);
+            result = nl_typetab_func(ctx, ctx->typetab,
+                    nl_type_substitute(ctx, tp->func.ret_type, owner, args),
+                    list, tp->func.param_count);
+            break;
+        case NL_TYPE_TMPL_INSTANCE:
+            count = tp->instance.arg_count;
+            list = substitute_list(ctx, tp->instance.args, count, owner, args);
+            result = nl_typetab_tmpl_instance(ctx, ctx->typetab,
+                    tp->instance.tmpl, list, tp->instance.arg_count);
+            break;
+        default:
+            break;
+    }
+
+    nl_free(ctx, list, count * sizeof(*list));
+    return result;
+}
@@ -0,0 +1,71 @@
+#ifndef NOLLI_INSTANCE_H
+#define NOLLI_INSTANCE_H
+
+#include "type.h"
+
+#include <pthread.h>
+
+/** A generic function specialized for one list of type arguments */
+struct nl_instance {
+    struct nl_type *key;        /**< interned (generic, type arguments) */
+    struct nl_type *generic;
+    struct nl_type **args;      /**< one type per template parameter */
+    struct nl_type *type;       /**< signature with the arguments substituted */
+    nl_string_t name;           /**< mangled symbol name */
+    bool open;                  /**< arguments still refer to placeholders */
+    struct nl_instance *next;   /**< next instance in order of creation */
+};
+
+/**
+ * Monomorphization cache.
+ *
+ * Instances are keyed on the interned template instance type of
+ * (generic, arguments), so each specialization is created once per
+ * context. Instances are also kept in creation order, which lets the
+ * code generator use the list as its worklist. Instances may be
+ * requested from several threads at once.
+ */
+struct nl_instance_cache {
+    struct nl_instance **slots;
+    unsigned int size;          /**< number of slots (a power of two) */
+    unsigned int count;
+    struct nl_instance *head, *tail;
+    struct nl_instance *retired;    /**< instances of earlier analyses */
+    pthread_mutex_t lock;
+};
+
+int nl_instance_cache_init(struct nl_context* ctx, struct nl_instance_cache *cache);
+
+/** Forgets every instance, current or retired */
+void nl_instance_cache_reset(struct nl_context* ctx, struct nl_instance_cache *cache);
+
+void nl_instance_cache_deinit(struct nl_context* ctx, struct nl_instance_cache *cache);
+
+/**
+ * Empties the cache before the program is analyzed again. The records
+ * stay allocated, since calls in bodies that aren't re-checked still
+ * point at them (see nl_instance_canonical).
+ */
+void nl_instance_cache_retire(struct nl_context* ctx, struct nl_instance_cache *cache);
+
+/** Returns the current instance equivalent to a possibly retired one */
+struct nl_instance *nl_instance_canonical(struct nl_context* ctx,
+        struct nl_instance_cache *cache, struct nl_instance *inst);
+
+/** Returns the unique instance of `generic` for `args` */
+struct nl_instance *nl_instantiate(struct nl_context* ctx,
+        struct nl_instance_cache *cache, struct nl_type *generic,
+        struct nl_type **args);
+
+/**
+ * Binds the placeholders of `owner` appearing in `param` so that it
+ * matches `arg`. Returns false if the types can't be made equal.
+ */
+bool nl_type_unify(struct nl_type *owner, struct nl_type *param,
+        struct nl_type *arg, struct nl_type **bindings);
+
+/** Replaces the placeholders of `owner` in `tp` with `args` */
+struct nl_type *nl_type_substitute(struct nl_context* ctx, struct nl_type *tp,
+        struct nl_type *owner, struct nl_type **args);
+
+#endif /* NOLLI_INSTANCE_H */
@@ -1,6 +1,9 @@
 #include "lexer.h"
+#include "builtins.h"
 #include "debug.h"
 #include "nolli.h"
+#include "stats.h"
+#include "mem.h"
 
 #include <stdlib.h>
 #include <stdbool.h>
@@ -53,17 +56,6 @@ static const char *token_names[] = {
     "while", "for", "in"
 };
 
-static const char *keywords[] = {
-    "package", "using",
-    "new", "alias",
-    "class", "interface",
-    "func", "return",
-    "break", "continue",
-    "var", "const",
-    "if", "else",
-    "while", "for", "in",
-};
-
 /* returns former length of string in buffer */
 static int rotate_buffers(struct nl_lexer *lex)
 {
@@ -76,6 +68,9 @@ static int rotate_buffers(struct nl_lexer *lex)
 
     memset(lex->curbuff, 0, lex->balloc);
 
+    lex->lastsym = lex->cursym;
+    lex->cursym = NULL;
+
     size_t len = lex->blen;
     lex->blen = 0;
 
@@ -94,8 +89,10 @@ static int appendc(struct nl_lexer *lex, int c)
         size_t new_alloc = old_alloc * 2;
 
         /* realloc the buffer */
-        lex->curbuff = nl_realloc(lex->ctx, lex->curbuff, new_alloc);
-        lex->lastbuff = nl_realloc(lex->ctx, lex->lastbuff, new_alloc);
+        lex->curbuff = nl_realloc_tagged(lex->ctx,
+                lex->curbuff, old_alloc, new_alloc, NL_MEM_LEXER);
+        lex->lastbuff = nl_realloc_tagged(lex->ctx,
+                lex->lastbuff, old_alloc, new_alloc, NL_MEM_LEXER);
         lex->balloc = new_alloc;
 
         /* memory for strings must always be zeroed */
@@ -237,12 +234,15 @@ static int lex_string(struct nl_lexer *lex)
 
 static int lookup_keyword(struct nl_lexer *lex)
 {
-    /* TODO: use hash-table or similar O(1) lookup */
-    unsigned int kidx = 0;
-    for (kidx = 0; kidx < sizeof(keywords) / sizeof(*keywords); kidx++) {
-        if (strncmp(lex->curbuff, keywords[kidx], 16) == 0) {
-            return TOK_PACKAGE + kidx;
-        }
+    /* keywords are preloaded in the string table, so wrapping the
+     * identifier yields the builtin handle for any keyword */
+    lex->cursym = nl_strtab_wrap(lex->ctx, lex->ctx->strtab, lex->curbuff);
+
+    int idx = nl_builtin_index(lex->cursym);
+    if (idx >= NL_BUILTIN_FIRST_KEYWORD && idx <= NL_BUILTIN_LAST_KEYWORD) {
+        return TOK_PACKAGE + (idx - NL_BUILTIN_FIRST_KEYWORD);
+    } else if (idx == NL_BUILTIN_TRUE || idx == NL_BUILTIN_FALSE) {
+        return TOK_BOOL;
     }
     return 0;
 }
@@ -267,12 +267,6 @@ static int lex_ident(struct nl_lexer *lex)
         return keyword;
     }
 
-    /* this sucks */
-    if ((strcmp(lex->curbuff, "true") == 0) ||
-            (strcmp(lex->curbuff, "false") == 0)) {
-        return TOK_BOOL;
-    }
-
     /* otherwise, it's an identifier */
     return TOK_IDENT;
 }
@@ -343,6 +337,9 @@ static int lex_symbol(struct nl_lexer *lex)
 
 int nl_gettok(struct nl_lexer *lex)
 {
+    int phase = nl_stats_enter(lex->ctx, NL_PHASE_LEX);
+    const char *start = lex->sptr;
+
     rotate_buffers(lex);    /* clear the lexer's current string buffer */
     int tok = TOK_EOF;
 nexttok:
@@ -416,6 +413,10 @@ nexttok:
         tok = lex_symbol(lex);
     }
 
+    NL_STATS_ADD(lex->ctx, tokens, 1);
+    NL_STATS_ADD(lex->ctx, bytes, lex->sptr - start);
+    nl_stats_enter(lex->ctx, phase);
+
     /* return the scanned token */
     lex->lasttok = tok;
     return tok;
@@ -438,8 +439,8 @@ void nl_lexer_init(struct nl_lexer *lexer, struct nl_context *ctx, const char *b
     lexer->ctx = ctx;
 
     size_t bufsize = 16;
-    lexer->curbuff = nl_alloc(lexer->ctx, bufsize);
-    lexer->lastbuff = nl_alloc(lexer->ctx, bufsize);
+    lexer->curbuff = nl_alloc_tagged(lexer->ctx, bufsize, NL_MEM_LEXER);
+    lexer->lastbuff = nl_alloc_tagged(lexer->ctx, bufsize, NL_MEM_LEXER);
     lexer->blen = 0;
     lexer->balloc = bufsize;
 
@@ -453,6 +454,13 @@ void nl_lexer_init(struct nl_lexer *lexer, struct nl_context *ctx, const char *b
     next(lexer);
 }
 
+void nl_lexer_deinit(struct nl_lexer *lexer)
+{
+    nl_free(lexer->ctx, lexer->curbuff, lexer->balloc);
+    nl_free(lexer->ctx, lexer->lastbuff, lexer->balloc);
+    lexer->curbuff = lexer->lastbuff = NULL;
+}
+
 int nl_lexer_scan_all(struct nl_lexer *lex)
 {
     int good = 1;
@@ -1,6 +1,8 @@
 #ifndef NOLLI_LEXER_H
 #define NOLLI_LEXER_H
 
+#include "strtab.h"
+
 #include <stddef.h>
 
 enum {
@@ -48,6 +50,9 @@ struct nl_lexer {
     size_t blen;
     size_t balloc;
 
+    nl_string_t cursym;     /**< interned string of current identifier */
+    nl_string_t lastsym;    /**< interned string of previous identifier */
+
     int lasttok;
 
     int line;
@@ -56,6 +61,7 @@ struct nl_lexer {
 };
 
 void nl_lexer_init(struct nl_lexer *, struct nl_context *ctx, const char *);
+void nl_lexer_deinit(struct nl_lexer *);
 
 int nl_gettok(struct nl_lexer *lex);
 const char *nl_get_tok_name(int tok);
@@ -3,6 +3,35 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+static void report_memory(struct nl_context *ctx)
+{
+    struct nl_mem_stats stats;
+    nl_get_memory_stats(ctx, &stats);
+
+    fprintf(stderr, "%-10s %12s %12s %12s %10s %10s\n",
+            "memory", "live", "peak", "total", "allocs", "frees");
+    int tag;
+    for (tag = 0; tag <= NL_MEM_COUNT; tag++) {
+        const struct nl_mem_usage *usage =
+            tag < NL_MEM_COUNT ? &stats.tags[tag] : &stats.total;
+        fprintf(stderr, "%-10s %12lu %12lu %12lu %10lu %10lu\n",
+                tag < NL_MEM_COUNT ? nl_mem_tag_name(tag) : "total",
+                usage->live, usage->peak, usage->bytes, usage->allocs, usage->frees);
+    }
+}
+
+/* closes the trace, if any, prints the memory report, if asked for,
+ * and frees the context */
+static void finish(struct nl_context *ctx, int mem_report)
+{
+    nl_set_trace_file(ctx, NULL);
+    if (mem_report) {
+        report_memory(ctx);
+    }
+    nl_destroy(ctx);
+}
 
 int main(int argc, char **argv)
 {
@@ -15,18 +44,109 @@ int main(int argc, char **argv)
     nl_init(&ctx);
 
     int err = 0;
+    int mem_report = 0;
+    int dump = 0;
 
+    /* `nolli build` compiles ahead of time instead of running */
     int i = 1;
-    for (i = 1; i < argc; i++) {
+    int build = 0;
+    int build_kind = NL_BUILD_EXECUTABLE;
+    const char* output = NULL;
+    const char* cpu = NULL;
+    const char* features = NULL;
+    if (strcmp(argv[i], "build") == 0) {
+        build = 1;
+        i++;
+    }
+
+    /* options come first, so that they apply to every file */
+    while (i < argc && argv[i][0] == '-') {
+        if (build && strcmp(argv[i], "-c") == 0) {
+            build_kind = NL_BUILD_OBJECT;
+            i++;
+        } else if (build && strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            err = nl_set_trace_file(&ctx, argv[i + 1]);
+            if (err) {
+                goto early_exit;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            err = nl_set_cache_dir(&ctx, argv[i + 1]);
+            if (err) {
+                goto early_exit;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            cpu = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--features") == 0 && i + 1 < argc) {
+            features = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--dump") == 0) {
+            nl_set_dump(&ctx, 1);
+            dump = 1;
+            i++;
+        } else if (strcmp(argv[i], "--mem-report") == 0) {
+            err = nl_set_memory_tracking(&ctx, 1);
+            if (err) {
+                goto early_exit;
+            }
+            mem_report = 1;
+            i++;
+        } else if (strncmp(argv[i], "-O", 2) == 0 && argv[i][2] >= '0' &&
+                argv[i][2] <= '3' && argv[i][3] == '\0') {
+            nl_set_opt_level(&ctx, argv[i][2] - '0');
+            i++;
+        } else if (strcmp(argv[i], "--fast-math") == 0) {
+            nl_set_fast_math(&ctx, 1);
+            i++;
+        } else if (strcmp(argv[i], "--compile-ahead") == 0) {
+            nl_set_compile_ahead(&ctx, 1);
+            i++;
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc &&
+                strcmp(argv[i + 1], "tiered") == 0) {
+            nl_set_backend(&ctx, NL_BACKEND_TIERED);
+            i += 2;
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc &&
+                strcmp(argv[i + 1], "jit") == 0) {
+            nl_set_backend(&ctx, NL_BACKEND_JIT);
+            i += 2;
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc &&
+                strcmp(argv[i + 1], "vm") == 0) {
+            nl_set_backend(&ctx, NL_BACKEND_VM);
+            i += 2;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            fprintf(stderr, "usage: %s [-O0|-O1|-O2|-O3] [--fast-math] [--compile-ahead] "
+                    "[--backend tiered|jit|vm] [--cpu NAME] [--features LIST] "
+                    "[--cache DIR] [--trace FILE] [--dump] [--mem-report] SOURCE...\n", argv[0]);
+            fprintf(stderr, "       %s build [-c] [-o FILE] [OPTIONS] SOURCE...\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (i == argc) {
+        fprintf(stderr, "%s\n", "Nothing to compile :(");
+        return EXIT_FAILURE;
+    }
+    nl_set_target(&ctx, cpu, features);
+
+    for (; i < argc; i++) {
         int err = nl_compile_file(&ctx, argv[i]);
         if (err) {
             goto early_exit;
         }
     }
 
-    err = nl_graph_ast(&ctx);
-    if (err) {
-        goto early_exit;
+    /* debug dumps of the AST and the generated IR */
+    if (dump) {
+        err = nl_graph_ast(&ctx);
+        if (err) {
+            goto early_exit;
+        }
     }
 
     struct nl_ast* packages = NULL;
@@ -35,15 +155,29 @@ int main(int argc, char **argv)
         goto early_exit;
     }
 
+    if (build) {
+        if (NULL == output) {
+            output = NL_BUILD_OBJECT == build_kind ? "a.o" : "a.out";
+        }
+        err = nl_build(&ctx, packages, output, build_kind);
+        if (err) {
+            goto early_exit;
+        }
+        finish(&ctx, mem_report);
+        return EXIT_SUCCESS;
+    }
+
     int return_code = 0;
-    err = nl_jit(&ctx, packages, &return_code);
+    err = nl_run(&ctx, packages, &return_code);
     if (err) {
         goto early_exit;
     }
 
+    finish(&ctx, mem_report);
     return return_code;
 
 early_exit:
+    finish(&ctx, mem_report);
     fprintf(stderr, "%s\n", "Stopping early.");
     return EXIT_FAILURE;
 }
@@ -0,0 +1,243 @@
+#include "mem.h"
+#include "debug.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+struct block {
+    const void *ptr;        /**< NULL if the slot is free */
+    size_t bytes;
+    int tag;
+};
+
+/* Live blocks are kept in an open-addressed table keyed by address, so
+ * that their sizes are known when they're freed. The table itself is
+ * allocated straight from the context's allocator, and isn't counted. */
+struct nl_memtrack {
+    pthread_mutex_t lock;
+    nl_allocator allocator;
+    nl_deallocator deallocator;
+    void *user_data;
+
+    struct block *blocks;
+    size_t size;            /**< a power of two */
+    size_t count;
+
+    struct nl_mem_stats stats;
+};
+
+enum { NL_MEMTRACK_INITIAL_SIZE = 1024 };
+
+static size_t slot_of(const struct nl_memtrack *track, const void *ptr)
+{
+    uint64_t h = (uintptr_t)ptr >> 4;
+    h *= 0x9E3779B97F4A7C15ull;
+    return (size_t)(h >> 32) & (track->size - 1);
+}
+
+static struct block *alloc_blocks(struct nl_memtrack *track, size_t size)
+{
+    return track->allocator(track->user_data, NULL, 0, size * sizeof(struct block),
+            NL_ALIGN_DEFAULT, NL_ALLOC_ZERO);
+}
+
+static void insert(struct nl_memtrack *track, const struct block *block)
+{
+    size_t mask = track->size - 1;
+    size_t idx = slot_of(track, block->ptr);
+    while (track->blocks[idx].ptr != NULL) {
+        idx = (idx + 1) & mask;
+    }
+    track->blocks[idx] = *block;
+    track->count++;
+}
+
+static bool grow(struct nl_memtrack *track)
+{
+    struct block *old = track->blocks;
+    size_t old_size = track->size;
+
+    struct block *blocks = alloc_blocks(track, old_size * 2);
+    if (NULL == blocks) {
+        return false;
+    }
+    track->blocks = blocks;
+    track->size = old_size * 2;
+    track->count = 0;
+
+    size_t i;
+    for (i = 0; i < old_size; i++) {
+        if (old[i].ptr != NULL) {
+            insert(track, &old[i]);
+        }
+    }
+    track->deallocator(track->user_data, old, old_size * sizeof(*old), NL_ALIGN_DEFAULT);
+    return true;
+}
+
+/* Removes the block at `ptr` into `out`, shifting back the blocks that
+ * probed past it so no lookup is cut short */
+static bool remove_block(struct nl_memtrack *track, const void *ptr, struct block *out)
+{
+    size_t mask = track->size - 1;
+    size_t idx = slot_of(track, ptr);
+    while (track->blocks[idx].ptr != ptr) {
+        if (NULL == track->blocks[idx].ptr) {
+            return false;
+        }
+        idx = (idx + 1) & mask;
+    }
+    *out = track->blocks[idx];
+    track->count--;
+
+    size_t hole = idx;
+    size_t next = (idx + 1) & mask;
+    while (track->blocks[next].ptr != NULL) {
+        size_t home = slot_of(track, track->blocks[next].ptr);
+        /* move it into the hole unless its home lies cyclically in (hole, next] */
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            track->blocks[hole] = track->blocks[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    track->blocks[hole].ptr = NULL;
+    return true;
+}
+
+static void charge(struct nl_mem_usage *usage, size_t bytes)
+{
+    usage->allocs++;
+    usage->bytes += bytes;
+    usage->live += bytes;
+    if (usage->live > usage->peak) {
+        usage->peak = usage->live;
+    }
+}
+
+static void discharge(struct nl_mem_usage *usage, size_t bytes)
+{
+    usage->frees++;
+    usage->live -= bytes;
+}
+
+void nl_mem_track(struct nl_context* ctx, void* memory, void* block,
+        size_t bytes, int tag)
+{
+    struct nl_memtrack *track = ctx->mem;
+    assert(track != NULL);
+    assert(tag >= 0 && tag < NL_MEM_COUNT);
+
+    pthread_mutex_lock(&track->lock);
+    struct block old;
+    if (memory != NULL && remove_block(track, memory, &old)) {
+        discharge(&track->stats.tags[old.tag], old.bytes);
+        discharge(&track->stats.total, old.bytes);
+    }
+    if (track->count + 1 > track->size / 2 && !grow(track)) {
+        pthread_mutex_unlock(&track->lock);
+        return;     /* the block simply goes untracked */
+    }
+    insert(track, &(struct block){.ptr=block, .bytes=bytes, .tag=tag});
+    charge(&track->stats.tags[tag], bytes);
+    charge(&track->stats.total, bytes);
+    pthread_mutex_unlock(&track->lock);
+}
+
+void nl_mem_untrack(struct nl_context* ctx, void* memory, size_t bytes)
+{
+    struct nl_memtrack *track = ctx->mem;
+    assert(track != NULL);
+
+    pthread_mutex_lock(&track->lock);
+    struct block old;
+    if (remove_block(track, memory, &old)) {
+        /* catches callers passing the wrong size back */
+        assert(old.bytes == bytes);
+        discharge(&track->stats.tags[old.tag], old.bytes);
+        discharge(&track->stats.total, old.bytes);
+    }
+    pthread_mutex_unlock(&track->lock);
+}
+
+int nl_set_memory_tracking(struct nl_context* ctx, int enable)
+{
+    assert(ctx != NULL);
+
+    struct nl_memtrack *track = ctx->mem;
+    if (!enable) {
+        if (track != NULL) {
+            ctx->mem = NULL;
+            pthread_mutex_destroy(&track->lock);
+            track->deallocator(track->user_data, track->blocks,
+                    track->size * sizeof(*track->blocks), NL_ALIGN_DEFAULT);
+            track->deallocator(track->user_data, track, sizeof(*track), NL_ALIGN_DEFAULT);
+        }
+        return NL_NO_ERR;
+    }
+    if (track != NULL) {
+        return NL_NO_ERR;
+    }
+
+    track = ctx->allocator(ctx->user_data, NULL, 0, sizeof(*track),
+            NL_ALIGN_DEFAULT, NL_ALLOC_ZERO);
+    if (NULL == track) {
+        NL_ERROR(ctx, NL_ERR_MEM, "Failed to allocate memory tracker");
+        return NL_ERR_MEM;
+    }
+    track->allocator = ctx->allocator;
+    track->deallocator = ctx->deallocator;
+    track->user_data = ctx->user_data;
+    track->size = NL_MEMTRACK_INITIAL_SIZE;
+    track->blocks = alloc_blocks(track, track->size);
+    if (NULL == track->blocks) {
+        track->deallocator(track->user_data, track, sizeof(*track), NL_ALIGN_DEFAULT);
+        NL_ERROR(ctx, NL_ERR_MEM, "Failed to allocate memory tracker");
+        return NL_ERR_MEM;
+    }
+    pthread_mutex_init(&track->lock, NULL);
+    ctx->mem = track;
+    return NL_NO_ERR;
+}
+
+int nl_get_memory_stats(struct nl_context* ctx, struct nl_mem_stats* stats)
+{
+    assert(ctx != NULL);
+    assert(stats != NULL);
+
+    struct nl_memtrack *track = ctx->mem;
+    if (NULL == track) {
+        memset(stats, 0, sizeof(*stats));
+        return NL_NO_ERR;
+    }
+    pthread_mutex_lock(&track->lock);
+    memcpy(stats, &track->stats, sizeof(*stats));
+    pthread_mutex_unlock(&track->lock);
+    return NL_NO_ERR;
+}
+
+const char* nl_mem_tag_name(int tag)
+{
+    static const char* names[] = {
+        "other",
+        "source",
+        "lexer",
+        "parser",
+        "ast",
+        "strtab",
+        "symtab",
+        "types",
+        "analysis",
+        "jit",
+        "vm",
+    };
+    assert(sizeof(names) / sizeof(*names) == NL_MEM_COUNT);
+
+    if (tag < 0 || tag >= NL_MEM_COUNT) {
+        return NULL;
+    }
+    return names[tag];
+}
@@ -0,0 +1,45 @@
+#ifndef NOLLI_MEM_H
+#define NOLLI_MEM_H
+
+#include "nolli.h"
+
+#include <stddef.h>
+
+/** Alignment of blocks allocated without asking for one */
+#define NL_ALIGN_DEFAULT _Alignof(max_align_t)
+
+/**
+ * Allocates, or resizes `memory` (allocated with `old_bytes` bytes),
+ * through the context's allocator, and charges the block to subsystem
+ * `tag` (one of the `NL_MEM_*` constants) when the context tracks
+ * memory. `align` and `flags` are passed on to the allocator.
+ */
+void* nl_mem_alloc(struct nl_context* ctx, void* memory, size_t old_bytes,
+        size_t bytes, size_t align, int flags, int tag);
+
+/** Frees `memory`, allocated with `bytes` bytes and alignment `align` */
+void nl_mem_free(struct nl_context* ctx, void* memory, size_t bytes, size_t align);
+
+/** Like nl_alloc (zero-filled), charged to `tag` */
+#define nl_alloc_tagged(ctx, bytes, tag) \
+    nl_mem_alloc((ctx), NULL, 0, (bytes), NL_ALIGN_DEFAULT, NL_ALLOC_ZERO, (tag))
+
+/** Like nl_malloc (not initialized), charged to `tag` */
+#define nl_malloc_tagged(ctx, bytes, tag) \
+    nl_mem_alloc((ctx), NULL, 0, (bytes), NL_ALIGN_DEFAULT, 0, (tag))
+
+/** Like nl_realloc, charged to `tag` */
+#define nl_realloc_tagged(ctx, memory, old_bytes, bytes, tag) \
+    nl_mem_alloc((ctx), (memory), (old_bytes), (bytes), NL_ALIGN_DEFAULT, 0, (tag))
+
+/**
+ * Records that `memory` (NULL for a new allocation) was reallocated as
+ * `block` of `bytes` bytes, charged to `tag`.
+ */
+void nl_mem_track(struct nl_context* ctx, void* memory, void* block,
+        size_t bytes, int tag);
+
+/** Records that `memory`, of `bytes` bytes, was freed */
+void nl_mem_untrack(struct nl_context* ctx, void* memory, size_t bytes);
+
+#endif /* NOLLI_MEM_H */
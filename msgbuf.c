@@ -0,0 +1,119 @@
+#include "msgbuf.h"
+#include "arena.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static void append(struct nl_msgbuf *buf, int err, bool debug,
+        const char *fmt, va_list args)
+{
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    if (len < 0) {
+        return;
+    }
+
+    struct nl_msg *msg = NULL;
+    if (buf->arena != NULL) {
+        msg = nl_arena_alloc(buf->ctx, buf->arena, sizeof(*msg));
+        msg->text = nl_arena_alloc(buf->ctx, buf->arena, len + 1);
+    } else {
+        msg = nl_alloc(buf->ctx, sizeof(*msg));
+        msg->text = nl_malloc(buf->ctx, len + 1);
+    }
+    msg->err = err;
+    msg->debug = debug;
+    vsnprintf(msg->text, len + 1, fmt, args);
+
+    if (buf->tail != NULL) {
+        buf->tail->next = msg;
+    } else {
+        buf->head = msg;
+    }
+    buf->tail = msg;
+    if (!debug) {
+        buf->errors++;
+    }
+
+    struct nl_context *ctx = buf->ctx;
+    if (buf->echo && debug) {
+        ctx->debug_handler(ctx->user_data, "%s", msg->text);
+    } else if (buf->echo) {
+        ctx->error_handler(ctx->user_data, err, "%s", msg->text);
+    }
+}
+
+static void buffer_error(void *user_data, int err, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    append(user_data, err, false, fmt, args);
+    va_end(args);
+}
+
+static void buffer_debug(void *user_data, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    append(user_data, 0, true, fmt, args);
+    va_end(args);
+}
+
+/* the shadow context's user data is the buffer, so memory requests are
+ * forwarded with the real context's user data */
+static void *forward_alloc(void *user_data, void *memory, size_t old_bytes,
+        size_t bytes, size_t align, int flags)
+{
+    struct nl_context *ctx = ((struct nl_msgbuf*)user_data)->ctx;
+    return ctx->allocator(ctx->user_data, memory, old_bytes, bytes, align, flags);
+}
+
+static void forward_dealloc(void *user_data, void *memory, size_t bytes, size_t align)
+{
+    struct nl_context *ctx = ((struct nl_msgbuf*)user_data)->ctx;
+    ctx->deallocator(ctx->user_data, memory, bytes, align);
+}
+
+void nl_msgbuf_init(struct nl_msgbuf *buf, struct nl_context *ctx,
+        struct nl_context *shadow)
+{
+    memset(buf, 0, sizeof(*buf));
+    buf->ctx = ctx;
+
+    *shadow = *ctx;
+    shadow->user_data = buf;
+    shadow->error_handler = buffer_error;
+    shadow->debug_handler = buffer_debug;
+    shadow->allocator = forward_alloc;
+    shadow->deallocator = forward_dealloc;
+}
+
+void nl_msgbuf_replay(const struct nl_msgbuf *buf)
+{
+    struct nl_context *ctx = buf->ctx;
+    const struct nl_msg *msg = buf->head;
+    while (msg != NULL) {
+        if (msg->debug) {
+            ctx->debug_handler(ctx->user_data, "%s", msg->text);
+        } else {
+            ctx->error_handler(ctx->user_data, msg->err, "%s", msg->text);
+        }
+        msg = msg->next;
+    }
+}
+
+void nl_msgbuf_clear(struct nl_msgbuf *buf)
+{
+    struct nl_msg *msg = buf->arena != NULL ? NULL : buf->head;
+    while (msg != NULL) {
+        struct nl_msg *next = msg->next;
+        nl_free(buf->ctx, msg->text, strlen(msg->text) + 1);
+        nl_free(buf->ctx, msg, sizeof(*msg));
+        msg = next;
+    }
+    buf->head = buf->tail = NULL;
+    buf->errors = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef NOLLI_MSGBUF_H
+#define NOLLI_MSGBUF_H
+
+#include "nolli.h"
+
+#include <stdbool.h>
+
+struct nl_msg {
+    struct nl_msg *next;
+    int err;
+    bool debug;             /**< debug message rather than an error */
+    char *text;
+};
+
+/**
+ * Holds back the error and debug messages of work done on another
+ * thread, so they can be reported later in a deterministic order.
+ */
+struct nl_msgbuf {
+    struct nl_context *ctx;         /**< context the messages belong to */
+    struct nl_msg *head, *tail;
+    unsigned int errors;
+    bool echo;                      /**< also report messages as they arrive */
+    struct nl_arena *arena;         /**< if set, messages are allocated from it */
+};
+
+/**
+ * Makes `shadow` a copy of `ctx` whose messages are appended to `buf`
+ * instead of being reported. Memory is still managed by `ctx`.
+ */
+void nl_msgbuf_init(struct nl_msgbuf *buf, struct nl_context *ctx,
+        struct nl_context *shadow);
+
+/** Reports the buffered messages through the real context, keeping them */
+void nl_msgbuf_replay(const struct nl_msgbuf *buf);
+
+/**
+ * Frees the buffered messages. Messages allocated from an arena are
+ * only dropped, and freed when it is reset.
+ */
+void nl_msgbuf_clear(struct nl_msgbuf *buf);
+
+#endif /* NOLLI_MSGBUF_H */
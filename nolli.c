@@ -1,9 +1,16 @@
 #include "nolli.h"
 #include "strtab.h"
+#include "typetab.h"
+#include "instance.h"
 #include "ast.h"
+#include "stats.h"
+#include "trace.h"
+#include "mem.h"
+#include "arena.h"
 #include "debug.h"
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
@@ -11,8 +18,10 @@
 
 static void nl_default_error_handler(void* user_data, int err, const char* fmt, ...);
 static void nl_default_debug_handler(void* user_data, const char* fmt, ...);
-static void* nl_default_allocator(void* user_data, void* memory, size_t bytes);
-static void nl_default_deallocator(void* user_data, void* memory);
+static void* nl_default_allocator(void* user_data, void* memory, size_t old_bytes,
+        size_t bytes, size_t align, int flags);
+static void nl_default_deallocator(void* user_data, void* memory, size_t bytes,
+        size_t align);
 
 int nl_init(struct nl_context *ctx)
 {
@@ -23,12 +32,79 @@ int nl_init(struct nl_context *ctx)
     nl_set_allocator(ctx, nl_default_allocator);
     nl_set_deallocator(ctx, nl_default_deallocator);
 
-    ctx->strtab = nl_alloc(ctx, sizeof(*ctx->strtab));
+    ctx->stats = nl_alloc(ctx, sizeof(*ctx->stats));
+    nl_reset_stats(ctx);
+
+    static const int arena_tags[NL_ARENA_COUNT] = {
+        [NL_ARENA_FRONTEND] = NL_MEM_AST,
+        [NL_ARENA_ANALYSIS] = NL_MEM_ANALYSIS,
+        [NL_ARENA_CODEGEN] = NL_MEM_JIT,
+    };
+    ctx->arenas = nl_alloc(ctx, NL_ARENA_COUNT * sizeof(*ctx->arenas));
+    int i;
+    for (i = 0; i < NL_ARENA_COUNT; i++) {
+        nl_arena_init(nl_arena(ctx, i), arena_tags[i]);
+    }
+
+    ctx->strtab = nl_alloc_tagged(ctx, sizeof(*ctx->strtab), NL_MEM_STRTAB);
     nl_strtab_init(ctx, ctx->strtab);
 
+    ctx->typetab = nl_alloc_tagged(ctx, sizeof(*ctx->typetab), NL_MEM_TYPES);
+    nl_typetab_init(ctx, ctx->typetab);
+
+    ctx->instances = nl_alloc_tagged(ctx, sizeof(*ctx->instances), NL_MEM_TYPES);
+    nl_instance_cache_init(ctx, ctx->instances);
+
+    return NL_NO_ERR;
+}
+
+int nl_reset(struct nl_context *ctx)
+{
+    assert(ctx != NULL);
+
+    /* everything compiled lives in the arenas; the tables only need
+     * emptying, since their entries point into them */
+    ctx->ast_list = NULL;
+    nl_instance_cache_reset(ctx, ctx->instances);
+    nl_typetab_reset(ctx, ctx->typetab);
+    nl_strtab_reset(ctx, ctx->strtab);
+
+    int i;
+    for (i = 0; i < NL_ARENA_COUNT; i++) {
+        nl_arena_reset(ctx, nl_arena(ctx, i));
+    }
     return NL_NO_ERR;
 }
 
+void nl_destroy(struct nl_context *ctx)
+{
+    assert(ctx != NULL);
+
+    nl_reset(ctx);
+
+    nl_instance_cache_deinit(ctx, ctx->instances);
+    nl_free(ctx, ctx->instances, sizeof(*ctx->instances));
+    nl_typetab_deinit(ctx, ctx->typetab);
+    nl_free(ctx, ctx->typetab, sizeof(*ctx->typetab));
+    nl_strtab_deinit(ctx, ctx->strtab);
+    nl_free(ctx, ctx->strtab, sizeof(*ctx->strtab));
+
+    int i;
+    for (i = 0; i < NL_ARENA_COUNT; i++) {
+        nl_arena_deinit(ctx, nl_arena(ctx, i));
+    }
+    nl_free(ctx, ctx->arenas, NL_ARENA_COUNT * sizeof(*ctx->arenas));
+
+    nl_set_trace_file(ctx, NULL);
+    nl_set_cache_dir(ctx, NULL);
+    nl_set_target(ctx, NULL, NULL);
+    nl_free(ctx, ctx->stats, sizeof(*ctx->stats));
+    ctx->stats = NULL;
+    nl_set_memory_tracking(ctx, 0);
+
+    memset(ctx, 0, sizeof(*ctx));
+}
+
 void nl_set_error_handler(struct nl_context* ctx, nl_error_handler handler)
 {
     ctx->error_handler = nl_default_error_handler;
@@ -39,6 +115,56 @@ void nl_set_debug_handler(struct nl_context* ctx, nl_debug_handler handler)
     ctx->debug_handler = nl_default_debug_handler;
 }
 
+void nl_set_threads(struct nl_context* ctx, unsigned int threads)
+{
+    ctx->threads = threads;
+}
+
+void nl_set_opt_level(struct nl_context* ctx, unsigned int level)
+{
+    ctx->opt_level = level < 3 ? level : 3;
+}
+
+void nl_set_fast_math(struct nl_context* ctx, int enable)
+{
+    ctx->fast_math = enable != 0;
+}
+
+void nl_set_compile_ahead(struct nl_context* ctx, int enable)
+{
+    ctx->compile_ahead = enable != 0;
+}
+
+void nl_set_backend(struct nl_context* ctx, int backend)
+{
+    ctx->backend = backend;
+}
+
+/* replaces `*setting` with a copy of `value` */
+static void set_string(struct nl_context* ctx, char** setting, const char* value)
+{
+    if (*setting != NULL) {
+        nl_free(ctx, *setting, strlen(*setting) + 1);
+        *setting = NULL;
+    }
+    if (value != NULL) {
+        size_t len = strlen(value);
+        *setting = nl_malloc(ctx, len + 1);
+        memcpy(*setting, value, len + 1);
+    }
+}
+
+void nl_set_target(struct nl_context* ctx, const char* cpu, const char* features)
+{
+    set_string(ctx, &ctx->target_cpu, cpu);
+    set_string(ctx, &ctx->target_features, features);
+}
+
+void nl_set_dump(struct nl_context* ctx, int enable)
+{
+    ctx->dump = enable != 0;
+}
+
 void nl_set_allocator(struct nl_context* ctx, nl_allocator allocator)
 {
     ctx->allocator = allocator;
@@ -49,7 +175,7 @@ void nl_set_deallocator(struct nl_context* ctx, nl_deallocator deallocator)
     ctx->deallocator = deallocator;
 }
 
-char *nl_read_file(struct nl_context *ctx, const char *filename)
+static char *read_file(struct nl_context *ctx, const char *filename, size_t *size)
 {
     FILE *fin = NULL;
     if (!(fin = fopen(filename, "r"))) {
@@ -60,27 +186,38 @@ char *nl_read_file(struct nl_context *ctx, const char *filename)
     fseek(fin, 0, SEEK_END);
     long bytes = ftell(fin);
     rewind(fin);
-    char *buff = nl_alloc(ctx, bytes + 1);
+    char *buff = nl_malloc_tagged(ctx, bytes + 1, NL_MEM_SOURCE);
     if (fread(buff, 1, bytes, fin) < bytes) {
         NL_ERRORF(ctx, NL_ERR_IO, "Failed to read file %s", filename);
-        nl_free(ctx, buff);
+        nl_free(ctx, buff, bytes + 1);
         return NULL;
     }
 
     buff[bytes] = '\0';
+    NL_STATS_ADD(ctx, bytes, bytes);
 
     if (fclose(fin) != 0) {
         NL_ERRORF(ctx, NL_ERR_IO, "Failed to close file %s", filename);
-        nl_free(ctx, buff);
+        nl_free(ctx, buff, bytes + 1);
         return NULL;
     }
 
+    *size = bytes + 1;
+    return buff;
+}
+
+char *nl_read_file(struct nl_context *ctx, const char *filename, size_t *size)
+{
+    int phase = nl_stats_enter(ctx, NL_PHASE_READ);
+    char *buff = read_file(ctx, filename, size);
+    nl_stats_enter(ctx, phase);
     return buff;
 }
 
 /**
  * Add an AST to a context. A context can contain many ASTs
- * prior to compilation.
+ * prior to compilation. A unit parsed from the same source as an
+ * existing one takes its place.
  *
  * TODO: return error code
  */
@@ -93,6 +230,29 @@ void nl_add_ast(struct nl_context *ctx, struct nl_ast *ast)
         ctx->ast_list = nl_ast_make_list(ctx, NL_AST_LIST_UNITS, 0);
     }
 
+    if (NL_AST_UNIT == ast->tag && ast->unit.src != NULL) {
+        struct nl_ast_list *units = &ctx->ast_list->list;
+        struct nl_ast *prev = NULL;
+        struct nl_ast *cur = units->head;
+        while (cur != NULL) {
+            if (cur->unit.src == ast->unit.src) {
+                /* TODO: cleanup cur */
+                ast->next = cur->next;
+                if (prev != NULL) {
+                    prev->next = ast;
+                } else {
+                    units->head = ast;
+                }
+                if (units->tail == cur) {
+                    units->tail = ast;
+                }
+                return;
+            }
+            prev = cur;
+            cur = cur->next;
+        }
+    }
+
     ctx->ast_list = nl_ast_list_append(ctx->ast_list, ast);
 }
 
@@ -125,55 +285,103 @@ void *nl_get_user_data(struct nl_context *ctx)
 
 int nl_compile_file(struct nl_context *ctx, const char *filename)
 {
-    char *buff = nl_read_file(ctx, filename);
+    double start = nl_trace_begin(ctx);
+
+    size_t size = 0;
+    char *buff = nl_read_file(ctx, filename, &size);
     if (buff == NULL) {
+        nl_trace_end(ctx, "compile", filename, NULL, NULL, start);
         return NL_ERR_IO;
     }
 
     int err = nl_parse_string(ctx, buff, filename);
-    nl_free(ctx, buff);     /* TODO: who owns? */
+    nl_free(ctx, buff, size);     /* TODO: who owns? */
 
     if (err) {
         NL_ERROR(ctx, err, "Parse errors... cannot continue");
     }
 
+    nl_trace_end(ctx, "compile", filename, NULL, NULL, start);
     return err;
 }
 
 int nl_compile_string(struct nl_context *ctx, const char *s, const char *src)
 {
+    double start = nl_trace_begin(ctx);
     int err = nl_parse_string(ctx, s, src);
 
     if (err) {
         NL_ERROR(ctx, err, "Parse errors... cannot continue");
     }
 
+    nl_trace_end(ctx, "compile", src, NULL, NULL, start);
     return err;
 }
 
-void *nl_realloc(struct nl_context *ctx, void* block, size_t bytes)
+void *nl_mem_alloc(struct nl_context *ctx, void* memory, size_t old_bytes,
+        size_t bytes, size_t align, int flags, int tag)
 {
-    /* if (block == NULL) { */
-    /*     return calloc(1, bytes); */
-    /* } */
-
-    void *newblock = ctx->allocator(ctx->user_data, block, bytes);
-    if (newblock == NULL) {
-        if (ctx != NULL) {
-            NL_FATAL(ctx, NL_ERR_MEM, "realloc failed");
-        } else {
-            abort();    /* FIXME */
-        }
+    void *block = ctx->allocator(ctx->user_data, memory, old_bytes, bytes, align, flags);
+    if (block == NULL) {
+        NL_FATAL(ctx, NL_ERR_MEM, "allocation failed");
     } else {
-        memset(newblock, 0, bytes);
+        NL_STATS_ADD(ctx, allocs, 1);
+        NL_STATS_ADD(ctx, alloc_bytes, bytes);
+        if (ctx->mem != NULL) {
+            nl_mem_track(ctx, memory, block, bytes, tag);
+        }
     }
 
-    return newblock;
+    return block;
 }
 
-void nl_free(struct nl_context* ctx, void* block)
+void nl_mem_free(struct nl_context *ctx, void* memory, size_t bytes, size_t align)
 {
-    ctx->deallocator(ctx->user_data, block);
+    if (memory == NULL) {
+        return;
+    }
+    if (ctx->mem != NULL) {
+        nl_mem_untrack(ctx, memory, bytes);
+    }
+    ctx->deallocator(ctx->user_data, memory, bytes, align);
+}
+
+void *nl_malloc(struct nl_context *ctx, size_t bytes)
+{
+    return nl_malloc_tagged(ctx, bytes, NL_MEM_OTHER);
+}
+
+void *nl_calloc(struct nl_context *ctx, size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size) {
+        NL_FATAL(ctx, NL_ERR_MEM, "allocation size overflows");
+        return NULL;
+    }
+    return nl_alloc_tagged(ctx, count * size, NL_MEM_OTHER);
+}
+
+void *nl_alloc_aligned(struct nl_context *ctx, size_t bytes, size_t align)
+{
+    assert(align != 0 && (align & (align - 1)) == 0);
+    if (align < NL_ALIGN_DEFAULT) {
+        align = NL_ALIGN_DEFAULT;
+    }
+    return nl_mem_alloc(ctx, NULL, 0, bytes, align, 0, NL_MEM_OTHER);
+}
+
+void *nl_realloc(struct nl_context *ctx, void* memory, size_t old_bytes, size_t bytes)
+{
+    return nl_realloc_tagged(ctx, memory, old_bytes, bytes, NL_MEM_OTHER);
+}
+
+void nl_free(struct nl_context* ctx, void* memory, size_t bytes)
+{
+    nl_mem_free(ctx, memory, bytes, NL_ALIGN_DEFAULT);
+}
+
+void nl_free_aligned(struct nl_context* ctx, void* memory, size_t bytes, size_t align)
+{
+    nl_mem_free(ctx, memory, bytes, align < NL_ALIGN_DEFAULT ? NL_ALIGN_DEFAULT : align);
 }
 
 static void nl_default_error_handler(void *user_data, int err, const char *fmt, ...)
@@ -192,12 +400,43 @@ static void nl_default_debug_handler(void *user_data, const char *fmt, ...)
     va_end(arglist);
 }
 
-static void* nl_default_allocator(void* user_data, void* memory, size_t bytes)
+static void* nl_default_allocator(void* user_data, void* memory, size_t old_bytes,
+        size_t bytes, size_t align, int flags)
 {
-    return realloc(memory, bytes);
+    void *block = NULL;
+    if (align <= NL_ALIGN_DEFAULT) {
+        if (NULL == memory && (flags & NL_ALLOC_ZERO)) {
+            return calloc(1, bytes);
+        }
+        block = realloc(memory, bytes);
+    } else {
+#ifdef _WIN32
+        block = _aligned_realloc(memory, bytes, align);
+#else
+        if (posix_memalign(&block, align, bytes) != 0) {
+            return NULL;
+        }
+        if (memory != NULL) {
+            memcpy(block, memory, old_bytes < bytes ? old_bytes : bytes);
+            free(memory);
+        }
+#endif
+    }
+
+    if (block != NULL && (flags & NL_ALLOC_ZERO) && bytes > old_bytes) {
+        memset((char*)block + old_bytes, 0, bytes - old_bytes);
+    }
+    return block;
 }
 
-static void nl_default_deallocator(void* user_data, void* memory)
+static void nl_default_deallocator(void* user_data, void* memory, size_t bytes,
+        size_t align)
 {
+#ifdef _WIN32
+    if (align > NL_ALIGN_DEFAULT) {
+        _aligned_free(memory);
+        return;
+    }
+#endif
     free(memory);
 }
@@ -29,19 +29,127 @@ enum {
 typedef void (*nl_error_handler)(void* user_data, int err, const char* fmt, ...);
 /** nolli debug message handler function type */
 typedef void (*nl_debug_handler)(void* user_data, const char* fmt, ...);
-/** nolli allocator function type */
-typedef void* (*nl_allocator)(void* user_data, void* memory, size_t bytes);
-/** nolli deallocator function type */
-typedef void (*nl_deallocator)(void* user_data, void* memory);
+/** Flags of a request to a context's allocator */
+enum {
+    NL_ALLOC_ZERO = 1 << 0,     /**< zero-fill the new bytes */
+};
+
+/**
+ * nolli allocator function type.
+ *
+ * Allocates `bytes` bytes aligned to `align` (a power of two) or, if
+ * `memory` isn't NULL, resizes that block, which was allocated with
+ * `old_bytes` bytes and the same alignment, preserving its contents.
+ * With NL_ALLOC_ZERO in `flags` the bytes past `old_bytes` must be
+ * zero-filled; otherwise they may hold anything. Returns NULL on failure.
+ */
+typedef void* (*nl_allocator)(void* user_data, void* memory, size_t old_bytes,
+        size_t bytes, size_t align, int flags);
+/**
+ * nolli deallocator function type. Frees `memory`, which was allocated
+ * with `bytes` bytes and alignment `align`.
+ */
+typedef void (*nl_deallocator)(void* user_data, void* memory, size_t bytes,
+        size_t align);
+
+/** Compiler phases measured by a context's statistics */
+enum {
+    NL_PHASE_NONE,      /**< outside of any phase (e.g. initialization) */
+    NL_PHASE_READ,      /**< reading source files */
+    NL_PHASE_LEX,
+    NL_PHASE_PARSE,
+    NL_PHASE_ANALYZE,
+    NL_PHASE_BYTECODE,  /**< compiling functions for the interpreter */
+    NL_PHASE_IRGEN,     /**< generating LLVM IR */
+    NL_PHASE_VERIFY,    /**< verifying LLVM IR */
+    NL_PHASE_OPTIMIZE,  /**< optimizing LLVM IR */
+    NL_PHASE_CODEGEN,   /**< generating machine code */
+    NL_PHASE_COUNT
+};
+
+/** Counters of one compiler phase */
+struct nl_phase_stats {
+    double seconds;             /**< wall time spent in the phase */
+    unsigned long bytes;        /**< source bytes read or scanned */
+    unsigned long tokens;
+    unsigned long nodes;        /**< AST nodes created */
+    unsigned long symbols;      /**< symbols defined in symbol tables */
+    unsigned long strings;      /**< strings interned */
+    unsigned long lookups;      /**< string table lookups */
+    unsigned long probes;       /**< string table slots probed by those lookups */
+    unsigned long max_probes;   /**< longest string table probe sequence */
+    unsigned long allocs;       /**< calls to the context's allocator */
+    unsigned long alloc_bytes;  /**< bytes requested from the allocator */
+};
+
+/** Statistics of a context, accumulated since it was initialized */
+struct nl_stats {
+    struct nl_phase_stats phases[NL_PHASE_COUNT];
+};
+
+/** Subsystems that a context's memory tracking charges allocations to */
+enum {
+    NL_MEM_OTHER,
+    NL_MEM_SOURCE,      /**< source text read from files */
+    NL_MEM_LEXER,
+    NL_MEM_PARSER,      /**< the parser's own working memory */
+    NL_MEM_AST,
+    NL_MEM_STRTAB,      /**< interned strings */
+    NL_MEM_SYMTAB,      /**< symbol tables */
+    NL_MEM_TYPES,       /**< types, type tables and generic instances */
+    NL_MEM_ANALYSIS,    /**< package tables and dependency records */
+    NL_MEM_JIT,         /**< nolli's side of code generation (not LLVM's) */
+    NL_MEM_VM,          /**< the interpreter's stack */
+    NL_MEM_COUNT
+};
+
+/** How nl_run executes a program */
+enum {
+    NL_BACKEND_TIERED,  /**< interpret, and compile hot functions (the default) */
+    NL_BACKEND_JIT,     /**< compile every function on its first call */
+    NL_BACKEND_VM,      /**< only interpret */
+};
+
+/** Memory usage of one subsystem, or of a whole context */
+struct nl_mem_usage {
+    unsigned long live;         /**< bytes currently allocated */
+    unsigned long peak;         /**< most bytes allocated at once */
+    unsigned long bytes;        /**< bytes allocated in total */
+    unsigned long allocs;
+    unsigned long frees;
+};
+
+/** Memory usage of a context while it's tracked */
+struct nl_mem_stats {
+    struct nl_mem_usage tags[NL_MEM_COUNT];
+    struct nl_mem_usage total;
+};
 
 struct nl_context {
     struct nl_strtab* strtab;
+    struct nl_typetab* typetab;
+    struct nl_instance_cache* instances;
     struct nl_ast* ast_list;
     void* user_data;
     nl_error_handler error_handler;
     nl_debug_handler debug_handler;
     nl_allocator allocator;
     nl_deallocator deallocator;
+    unsigned int threads;
+    unsigned int opt_level;     /**< 0 to 3, see nl_set_opt_level */
+    int fast_math;
+    int compile_ahead;          /**< see nl_set_compile_ahead */
+    int backend;                /**< see nl_set_backend */
+    int dump;                   /**< see nl_set_dump */
+    char* cache_dir;            /**< see nl_set_cache_dir */
+    char* target_cpu;           /**< see nl_set_target */
+    char* target_features;
+    struct nl_stats* stats;
+    int phase;                  /**< phase being measured */
+    double phase_start;         /**< when it began, in seconds */
+    struct nl_trace* trace;
+    struct nl_memtrack* mem;
+    struct nl_arena* arenas;    /**< one per phase, see arena.h */
 };
 
 /**
@@ -51,6 +159,28 @@ struct nl_context {
  */
 int nl_init(struct nl_context* ctx);
 
+/**
+ * Drop everything compiled with a context: its ASTs, types, generic
+ * instances and interned strings, so it can compile something else.
+ *
+ * Settings, statistics, tracing and memory tracking are kept, as are
+ * warm caches: the interned builtins, the capacity of the context's
+ * tables and arenas, and the initialized LLVM target. Memory use stays
+ * flat however many times a context is reset and reused.
+ *
+ * @param ctx nolli context
+ * @returns error code
+ */
+int nl_reset(struct nl_context* ctx);
+
+/**
+ * Free everything held by a context, closing its trace file if any.
+ * The context must be initialized again before it is reused.
+ *
+ * @param ctx nolli context
+ */
+void nl_destroy(struct nl_context* ctx);
+
 /**
  * Parse a null-terminated string of nolli source code
  *
@@ -64,7 +194,10 @@ int nl_compile_file(struct nl_context* ctx, const char* filename);
 int nl_compile_string(struct nl_context* ctx, const char* s, const char* src);
 
 /**
- * Add an AST to a context
+ * Add an AST to a context. A unit whose source identifier matches a
+ * unit already in the context replaces it, so recompiling a changed
+ * file and calling nl_analyze again only re-checks what the change
+ * affects.
  *
  * @param ctx nolli context
  * @param ast root of AST
@@ -82,8 +215,14 @@ int nl_graph_ast(struct nl_context* ctx);
 /**
  * Perform semantic analysis on an AST
  *
+ * Analysis is incremental: declarations are collected again on every
+ * call, but a function body or global initializer that was checked
+ * before is only checked again if a name it refers to now resolves
+ * differently. Diagnostics of bodies that are skipped are reported
+ * again, so each call reports the same messages a full analysis would.
+ *
  * @param ctx nolli context
- * @param packages address of pointer to AST list of package nodes
+ * @param packages address of pointer to AST list of units
  * @returns error code
  */
 int nl_analyze(struct nl_context* ctx, struct nl_ast** packages);
@@ -91,13 +230,134 @@ int nl_analyze(struct nl_context* ctx, struct nl_ast** packages);
 /**
  * JIT-compile and execute the code in the given AST.
  *
+ * Functions are compiled lazily: each is optimized and compiled to
+ * machine code on its first call, so a run only pays for the code it
+ * actually executes.
+ *
  * @param ctx nolli context
- * @param packages an AST list of package nodes
+ * @param packages an AST list of units, as returned by nl_analyze
  * @param return_code return code of executed `main` function
  * @returns error code
  */
 int nl_jit(struct nl_context* ctx, struct nl_ast* packages, int* return_code);
 
+/**
+ * A JIT kept alive across compilations, for REPLs and plugins: code is
+ * added to it a little at a time, and can call the functions added
+ * before. A context may have several sessions.
+ */
+struct nl_session;
+
+/**
+ * Start a JIT session.
+ *
+ * A session refers to the context's types and interned strings, so it
+ * must be destroyed before the context is reset or destroyed.
+ *
+ * @param ctx nolli context
+ * @returns a new session, or NULL on error
+ */
+struct nl_session* nl_session_create(struct nl_context* ctx);
+
+/**
+ * Add the functions of the given AST that the session doesn't have
+ * yet. Functions it already has keep the code they were first compiled
+ * with. Like with nl_jit, new functions are compiled on their first call
+ * unless the context compiles ahead.
+ *
+ * After more code is compiled with nl_compile_string or nl_compile_file,
+ * pass what nl_analyze returns: only the new functions are lowered.
+ *
+ * @param session JIT session
+ * @param packages an AST list of units, as returned by nl_analyze
+ * @returns error code; functions that failed to compile aren't added
+ */
+int nl_session_add(struct nl_session* session, struct nl_ast* packages);
+
+/**
+ * Find a function of a session. It may be called any number of times,
+ * from any thread, until the session is destroyed.
+ *
+ * @param session JIT session
+ * @param name name of the function
+ * @returns address of the function (cast it to its type to call it), or
+ *      NULL after reporting an error
+ */
+void* nl_session_lookup(struct nl_session* session, const char* name);
+
+/**
+ * Free a session and all of its code.
+ *
+ * @param session JIT session, or NULL
+ * @returns error code
+ */
+int nl_session_destroy(struct nl_session* session);
+
+/** What nl_build writes */
+enum {
+    NL_BUILD_EXECUTABLE,    /**< a program, linked with the C compiler */
+    NL_BUILD_OBJECT,        /**< an object file, to link into one */
+};
+
+/**
+ * Compile the code in the given AST ahead of time, for the host, with
+ * the same code generation and optimization level as nl_jit. The whole
+ * program is optimized at once, so unlike with nl_jit, calls between
+ * functions can be inlined.
+ *
+ * An object file exports each function under its name prefixed with
+ * `nl_`, like `nl_main`, so none replaces a C library function of the
+ * same name. An executable only exports a C `main` returning what
+ * nolli's `main` returns, and is linked by the C compiler named by the
+ * `CC` environment variable, `cc` if unset.
+ *
+ * @param ctx nolli context
+ * @param packages an AST list of units, as returned by nl_analyze
+ * @param path file to write
+ * @param kind one of the `NL_BUILD_*` constants
+ * @returns error code
+ */
+int nl_build(struct nl_context* ctx, struct nl_ast* packages, const char* path, int kind);
+
+/**
+ * Execute the code in the given AST with the context's backend.
+ *
+ * The tiered backend starts running right away: functions are compiled
+ * to a compact bytecode on their first call and interpreted. A function
+ * called or looping often enough is compiled like nl_jit would, on a
+ * background thread, and runs natively from its next call on, or from
+ * the next iteration of the loop it's in. The VM backend interprets
+ * everything, and starts the fastest.
+ *
+ * Builds without LLVM (`NOLLI_WITH_LLVM=OFF`) only interpret: the tiered
+ * backend never compiles, and nl_jit, nl_build and nl_session_create
+ * report an error.
+ *
+ * @param ctx nolli context
+ * @param packages an AST list of units, as returned by nl_analyze
+ * @param return_code return code of executed `main` function
+ * @returns error code
+ */
+int nl_run(struct nl_context* ctx, struct nl_ast* packages, int* return_code);
+
+/**
+ * Choose how nl_run executes programs.
+ *
+ * @param ctx nolli context
+ * @param backend one of the `NL_BACKEND_*` constants
+ */
+void nl_set_backend(struct nl_context* ctx, int backend);
+
+/**
+ * Have the JIT write the LLVM IR of the functions it lowers to
+ * `dump.llc` in the current directory, for debugging. Each batch of
+ * new functions replaces the previous dump. Disabled by default.
+ *
+ * @param ctx nolli context
+ * @param enable nonzero to dump
+ */
+void nl_set_dump(struct nl_context* ctx, int enable);
+
 /**
  * Configure an error message handler for a context.
  *
@@ -117,6 +377,10 @@ void nl_set_debug_handler(struct nl_context* ctx, nl_debug_handler handler);
 /**
  * Configure a custom allocator for a context.
  *
+ * Blocks are always resized and freed with the exact size and alignment
+ * they were allocated with, so an allocator needn't record them, e.g.
+ * to serve small blocks from size-class pools.
+ *
  * @param ctx nolli context
  * @param allocator custom allocator function
  */
@@ -130,6 +394,164 @@ void nl_set_allocator(struct nl_context* ctx, nl_allocator allocator);
  */
 void nl_set_deallocator(struct nl_context* ctx, nl_deallocator deallocator);
 
+/**
+ * Track the memory a context allocates, charging each block to the
+ * subsystem that allocated it, e.g. to size memory limits from the peak
+ * usage of a compilation. Blocks allocated before tracking began aren't
+ * counted. Tracking costs a lock and a table lookup per allocation, and
+ * nothing while it's off.
+ *
+ * @param ctx nolli context
+ * @param enable nonzero to track allocations from now on, zero to stop
+ * @returns error code
+ */
+int nl_set_memory_tracking(struct nl_context* ctx, int enable);
+
+/**
+ * Retrieve the memory usage of a context, per subsystem and in total,
+ * since tracking began. Usage is all zero if it isn't tracked.
+ *
+ * @param ctx nolli context
+ * @param stats filled with a snapshot of the context's memory usage
+ * @returns error code
+ */
+int nl_get_memory_stats(struct nl_context* ctx, struct nl_mem_stats* stats);
+
+/**
+ * Name of a memory tracking subsystem, e.g. for reports.
+ *
+ * @param tag one of the `NL_MEM_*` constants
+ * @returns name of the subsystem, or NULL if there is no such subsystem
+ */
+const char* nl_mem_tag_name(int tag);
+
+/**
+ * Set the number of threads a context may use. Zero, the default, uses
+ * one thread per online CPU.
+ *
+ * Error and debug handlers are only ever called from the calling
+ * thread, but the allocator and deallocator must be thread-safe unless
+ * the context is limited to one thread.
+ *
+ * @param ctx nolli context
+ * @param threads maximum number of threads
+ */
+void nl_set_threads(struct nl_context* ctx, unsigned int threads);
+
+/**
+ * Set how much nl_jit optimizes each function before it first runs,
+ * from 0 (the default: no optimization) to 3, like a C compiler's `-O`
+ * levels.
+ *
+ * Level 1 promotes locals and parameters to registers and simplifies
+ * the code; level 2 adds global value numbering, loop invariant code
+ * motion and vectorization; level 3 optimizes more aggressively still.
+ * Higher levels take longer to compile. Functions are optimized one at
+ * a time, so calls between them are not inlined.
+ *
+ * @param ctx nolli context
+ * @param level optimization level, clamped to 3
+ */
+void nl_set_opt_level(struct nl_context* ctx, unsigned int level);
+
+/**
+ * Allow nl_jit to treat `real` arithmetic as associative and to assume
+ * it never involves NaNs, infinities or signed zeros, like a C
+ * compiler's `-ffast-math`. Results may differ from strict IEEE 754
+ * arithmetic. Disabled by default.
+ *
+ * @param ctx nolli context
+ * @param enable nonzero to allow fast-math optimizations
+ */
+void nl_set_fast_math(struct nl_context* ctx, int enable);
+
+/**
+ * Have nl_jit compile every function before the program starts, rather
+ * than each on its first call. The program is split into one partition
+ * per thread the context may use, each lowered to a separate LLVM
+ * module and optimized and compiled concurrently with the others.
+ * Disabled by default.
+ *
+ * @param ctx nolli context
+ * @param enable nonzero to compile ahead
+ */
+void nl_set_compile_ahead(struct nl_context* ctx, int enable);
+
+/**
+ * Keep the machine code the JIT compiles in a directory, and reuse it
+ * when the same function is compiled again, by this or a later process.
+ *
+ * Each function's object file is keyed by a hash of its LLVM IR, the
+ * target triple, CPU and features, the optimization level and fast-math,
+ * so changing any of them just misses. Entries are never evicted. The
+ * directory is created if it doesn't exist. Disabled by default.
+ *
+ * @param ctx nolli context
+ * @param path cache directory, or NULL to stop caching
+ * @returns error code
+ */
+int nl_set_cache_dir(struct nl_context* ctx, const char* path);
+
+/**
+ * Choose the CPU that nl_jit and nl_build generate code for. By default
+ * it's the host's, with every feature the host supports, so that
+ * vectorized loops use the widest SIMD instructions available.
+ *
+ * Fixing the CPU makes the generated code, and the cache entries keyed
+ * by it, the same on every machine. `features` is a comma-separated
+ * list of LLVM feature names, each prefixed with `+` or `-`, like
+ * "+avx2,-avx512f"; without it, a given CPU gets only the features it
+ * implies. A CPU or feature the target doesn't know is reported as an
+ * NL_ERR_JIT error, and code is generated for the host's CPU instead.
+ *
+ * @param ctx nolli context
+ * @param cpu LLVM CPU name like "x86-64-v3", or NULL for the host's
+ * @param features feature list, or NULL for the CPU's own
+ */
+void nl_set_target(struct nl_context* ctx, const char* cpu, const char* features);
+
+/**
+ * Retrieve the compiler statistics of a context, per phase.
+ *
+ * Time spent in a phase is counted once another phase begins, so a
+ * snapshot taken between calls to the compiler is exact. The lexer is
+ * driven by the parser, and their time is split token by token.
+ *
+ * @param ctx nolli context
+ * @param stats filled with a snapshot of the context's statistics
+ * @returns error code
+ */
+int nl_get_stats(struct nl_context* ctx, struct nl_stats* stats);
+
+/**
+ * Reset the compiler statistics of a context to zero.
+ *
+ * @param ctx nolli context
+ */
+void nl_reset_stats(struct nl_context* ctx);
+
+/**
+ * Name of a compiler phase, e.g. for exporting statistics.
+ *
+ * @param phase one of the `NL_PHASE_*` constants
+ * @returns name of the phase, or NULL if there is no such phase
+ */
+const char* nl_phase_name(int phase);
+
+/**
+ * Record a timeline of compilation to a file, as Chrome trace events
+ * (which chrome://tracing and Perfetto can load). Spans cover each
+ * compiled file, each analysis pass, each function body analyzed or
+ * JIT-compiled, LLVM's verification, the optimization and code
+ * generation of each function called, and running the program. A trace
+ * is complete once it is closed.
+ *
+ * @param ctx nolli context
+ * @param path file to write, or NULL to close the current trace
+ * @returns error code
+ */
+int nl_set_trace_file(struct nl_context* ctx, const char* path);
+
 /**
  * Store user data with a context.
  *
@@ -147,31 +569,76 @@ void nl_set_user_data(struct nl_context* ctx, void* user_data);
 void* nl_get_user_data(struct nl_context* ctx);
 
 /**
- * Equivalent to C-standard `realloc` using context's allocator.
+ * Equivalent to C-standard `malloc` using context's allocator. The
+ * memory is not initialized.
  *
  * @param ctx nolli context
- * @param memory existing memory to resize, or NULL for a new allocation
  * @param bytes size in bytes of requested memory
  * @returns pointer to allocated block of memory
  */
-void* nl_realloc(struct nl_context* ctx, void* memory, size_t bytes);
+void* nl_malloc(struct nl_context* ctx, size_t bytes);
 
 /**
- * Equivalent to C-standard `malloc` using context's allocator.
+ * Equivalent to C-standard `calloc` using context's allocator.
+ *
+ * @param ctx nolli context
+ * @param count number of elements
+ * @param size size in bytes of each element
+ * @returns pointer to allocated, zero-filled block of memory
+ */
+void* nl_calloc(struct nl_context* ctx, size_t count, size_t size);
+
+/**
+ * Allocate a zero-filled block using context's allocator.
+ *
+ * @param ctx nolli context
+ * @param bytes size in bytes of requested memory
+ * @returns pointer to allocated block of memory
+ */
+#define nl_alloc(ctx, bytes) nl_calloc((ctx), 1, (bytes))
+
+/**
+ * Allocate an uninitialized block with a given alignment using
+ * context's allocator. It must be freed with nl_free_aligned.
  *
  * @param ctx nolli context
  * @param bytes size in bytes of requested memory
+ * @param align alignment in bytes, a power of two
  * @returns pointer to allocated block of memory
  */
-#define nl_alloc(ctx, bytes) nl_realloc((ctx), NULL, (bytes))
+void* nl_alloc_aligned(struct nl_context* ctx, size_t bytes, size_t align);
+
+/**
+ * Equivalent to C-standard `realloc` using context's allocator. The
+ * contents are preserved up to the lesser of the two sizes; bytes past
+ * `old_bytes` are not initialized.
+ *
+ * @param ctx nolli context
+ * @param memory existing memory to resize, or NULL for a new allocation
+ * @param old_bytes size in bytes `memory` was allocated with
+ * @param bytes size in bytes of requested memory
+ * @returns pointer to allocated block of memory
+ */
+void* nl_realloc(struct nl_context* ctx, void* memory, size_t old_bytes, size_t bytes);
 
 /**
  * Equivalent to C-standard `free` using context's deallocator.
  *
  * @param ctx nolli context
- * @param memory block of memory to deallocate
+ * @param memory block of memory to deallocate, or NULL
+ * @param bytes size in bytes the block was allocated with
+ */
+void nl_free(struct nl_context* ctx, void* memory, size_t bytes);
+
+/**
+ * Free a block allocated by nl_alloc_aligned.
+ *
+ * @param ctx nolli context
+ * @param memory block of memory to deallocate, or NULL
+ * @param bytes size in bytes the block was allocated with
+ * @param align alignment the block was allocated with
  */
-void nl_free(struct nl_context* ctx, void* memory);
+void nl_free_aligned(struct nl_context* ctx, void* memory, size_t bytes, size_t align);
 
 /** @} */ /* user-api */
 
@@ -1,8 +1,11 @@
 #include "lexer.h"
 #include "ast.h"
 #include "strtab.h"
+#include "builtins.h"
 #include "debug.h"
 #include "nolli.h"
+#include "stats.h"
+#include "mem.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -90,7 +93,7 @@ static int init(struct nl_parser *parser, struct nl_context *ctx,
 
     parser->ctx = ctx;
     parser->source = src;
-    parser->lexer = nl_alloc(ctx, sizeof(*parser->lexer));
+    parser->lexer = nl_alloc_tagged(ctx, sizeof(*parser->lexer), NL_MEM_LEXER);
     nl_lexer_init(parser->lexer, ctx, buffer);
 
     /* DEBUGGING: lexer_scan_all(parser->lexer); */
@@ -101,7 +104,7 @@ static int init(struct nl_parser *parser, struct nl_context *ctx,
     return NL_NO_ERR;
 }
 
-int nl_parse_string(struct nl_context *ctx, const char *s, const char *src)
+static int parse_string(struct nl_context *ctx, const char *s, const char *src)
 {
     struct nl_parser parser;
     int err = init(&parser, ctx, s, src);
@@ -112,17 +115,31 @@ int nl_parse_string(struct nl_context *ctx, const char *s, const char *src)
     struct nl_ast *root = unit(&parser);
     expect(&parser, TOK_EOF);
 
+    nl_lexer_deinit(parser.lexer);
+    nl_free(ctx, parser.lexer, sizeof(*parser.lexer));
+
     /* DEBUG: dump all symbols/strings */
     /* nl_strtab_dump(parser->ctx->strtab, stdout); */
 
     if (root == NULL) {
         return NL_ERR_PARSE;
     } else {
+        if (src != NULL) {
+            root->unit.src = nl_strtab_wrap(ctx, ctx->strtab, src);
+        }
         nl_add_ast(ctx, root);
         return NL_NO_ERR;
     }
 }
 
+int nl_parse_string(struct nl_context *ctx, const char *s, const char *src)
+{
+    int phase = nl_stats_enter(ctx, NL_PHASE_PARSE);
+    int err = parse_string(ctx, s, src);
+    nl_stats_enter(ctx, phase);
+    return err;
+}
+
 static char *current_buffer(struct nl_parser *parser)
 {
     return parser->lexer->lastbuff;
@@ -162,8 +179,7 @@ static struct nl_ast *unit(struct nl_parser *parser)
         }
     }
 
-    nl_string_t gname = nl_strtab_wrap(parser->ctx, parser->ctx->strtab,
-            NL_GLOBAL_PACKAGE_NAME);
+    nl_string_t gname = nl_builtin_str(NL_BUILTIN_GLOBAL_PACKAGE);
     struct nl_ast *id = nl_ast_make_ident(parser->ctx, gname, 0);
     struct nl_ast *gpkg = nl_ast_make_package(parser->ctx, id, globals, 0);
     packages = nl_ast_list_append(packages, gpkg);
@@ -787,15 +803,17 @@ static int shunter_init(struct nl_context* ctx, struct shunter *shunter)
 {
     shunter->op_top = 0;
     shunter->op_size = 8;
-    shunter->op_stk = nl_alloc(ctx, shunter->op_size * sizeof(*shunter->op_stk));
+    shunter->op_stk = nl_malloc_tagged(ctx,
+            shunter->op_size * sizeof(*shunter->op_stk), NL_MEM_PARSER);
     if (shunter->op_stk == NULL) {
         return NL_ERR_MEM;
     }
     shunter->term_top = 0;
     shunter->term_size = 8;
-    shunter->term_stk = nl_alloc(ctx, shunter->term_size * sizeof(*shunter->term_stk));
+    shunter->term_stk = nl_malloc_tagged(ctx,
+            shunter->term_size * sizeof(*shunter->term_stk), NL_MEM_PARSER);
     if (shunter->term_stk == NULL) {
-        nl_free(ctx, shunter->op_stk);
+        nl_free(ctx, shunter->op_stk, shunter->op_size * sizeof(*shunter->op_stk));
         return NL_ERR_MEM;
     }
     return NL_NO_ERR;
@@ -803,8 +821,8 @@ static int shunter_init(struct nl_context* ctx, struct shunter *shunter)
 
 static void shunter_deinit(struct nl_context* ctx, struct shunter *shunter)
 {
-    nl_free(ctx, shunter->op_stk);
-    nl_free(ctx, shunter->term_stk);
+    nl_free(ctx, shunter->op_stk, shunter->op_size * sizeof(*shunter->op_stk));
+    nl_free(ctx, shunter->term_stk, shunter->term_size * sizeof(*shunter->term_stk));
 }
 
 static struct nl_ast *shunter_term_push(struct nl_context* ctx,
@@ -812,9 +830,10 @@ static struct nl_ast *shunter_term_push(struct nl_context* ctx,
 {
     shunter->term_stk[shunter->term_top++] = term;
     if (shunter->term_top >= shunter->term_size) {
+        size_t old_bytes = shunter->term_size * sizeof(*shunter->term_stk);
         shunter->term_size *= 2;
-        shunter->term_stk = nl_realloc(ctx, shunter->term_stk,
-                shunter->term_size * sizeof(*shunter->term_stk));
+        shunter->term_stk = nl_realloc_tagged(ctx, shunter->term_stk, old_bytes,
+                shunter->term_size * sizeof(*shunter->term_stk), NL_MEM_PARSER);
     }
     return term;
 }
@@ -828,9 +847,10 @@ static int shunter_op_push(struct nl_context* ctx, struct shunter *shunter, int
 {
     shunter->op_stk[shunter->op_top++] = op;
     if (shunter->op_top >= shunter->op_size) {
+        size_t old_bytes = shunter->op_size * sizeof(*shunter->op_stk);
         shunter->op_size *= 2;
-        shunter->op_stk = nl_realloc(ctx, shunter->op_stk,
-                shunter->op_size * sizeof(*shunter->op_stk));
+        shunter->op_stk = nl_realloc_tagged(ctx, shunter->op_stk, old_bytes,
+                shunter->op_size * sizeof(*shunter->op_stk), NL_MEM_PARSER);
         if (shunter->op_stk == NULL) {
             return NL_ERR_MEM;
         }
@@ -979,8 +999,12 @@ static struct nl_ast *ident(struct nl_parser *parser)
     if (!expect(parser, TOK_IDENT)) {
         PARSE_ERROR(parser, "Invalid identifier");
     } else {
-        nl_string_t s = nl_strtab_wrap(parser->ctx, parser->ctx->strtab,
-                current_buffer(parser));
+        /* the lexer already interned the identifier */
+        nl_string_t s = parser->lexer->lastsym;
+        if (s == NULL) {
+            s = nl_strtab_wrap(parser->ctx, parser->ctx->strtab,
+                    current_buffer(parser));
+        }
         assert(s);
         PARSE_DEBUGF(parser, "Parsed identifier: %s", s);
         id = nl_ast_make_ident(parser->ctx, s, lineno(parser));
@@ -1047,10 +1071,11 @@ static struct nl_ast *operand(struct nl_parser *parser)
         }
     } else if (accept(parser, TOK_BOOL)) {
         char *tmpbuff = current_buffer(parser);
-        if (strcmp(tmpbuff, "true") == 0) {
+        nl_string_t sym = parser->lexer->lastsym;
+        if (sym == nl_builtin_str(NL_BUILTIN_TRUE)) {
             PARSE_DEBUGF(parser, "Parsed bool literal: %s", tmpbuff);
             op = nl_ast_make_bool_lit(parser->ctx, true, lineno(parser));
-        } else if (strcmp(tmpbuff, "false") == 0) {
+        } else if (sym == nl_builtin_str(NL_BUILTIN_FALSE)) {
             PARSE_DEBUGF(parser, "Parsed bool literal: %s", tmpbuff);
             op = nl_ast_make_bool_lit(parser->ctx, false, lineno(parser));
         } else {
@@ -0,0 +1,74 @@
+#include "pool.h"
+#include "debug.h"
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+struct pool {
+    pthread_mutex_t lock;
+    unsigned int next;      /**< index of the next task to hand out */
+    unsigned int count;
+    nl_task_fn fn;
+    void *data;
+};
+
+static void *worker(void *arg)
+{
+    struct pool *pool = arg;
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        unsigned int idx = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (idx >= pool->count) {
+            break;
+        }
+        pool->fn(pool->data, idx);
+    }
+    return NULL;
+}
+
+unsigned int nl_pool_default_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned int)n : 1;
+}
+
+void nl_pool_run(struct nl_context* ctx, unsigned int threads,
+        unsigned int count, nl_task_fn fn, void *data)
+{
+    if (threads > count) {
+        threads = count;
+    }
+
+    struct pool pool = {.next=0, .count=count, .fn=fn, .data=data};
+
+    if (threads <= 1) {
+        worker(&pool);
+        return;
+    }
+
+    pthread_mutex_init(&pool.lock, NULL);
+
+    /* the calling thread works too */
+    pthread_t *workers = nl_malloc(ctx, (threads - 1) * sizeof(*workers));
+    unsigned int started = 0;
+    while (started < threads - 1) {
+        if (pthread_create(&workers[started], NULL, worker, &pool) != 0) {
+            NL_DEBUGF(ctx, "only started %u worker threads", started);
+            break;
+        }
+        started++;
+    }
+
+    worker(&pool);
+
+    unsigned int i;
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    nl_free(ctx, workers, (threads - 1) * sizeof(*workers));
+    pthread_mutex_destroy(&pool.lock);
+}
@@ -0,0 +1,20 @@
+#ifndef NOLLI_POOL_H
+#define NOLLI_POOL_H
+
+#include "nolli.h"
+
+typedef void (*nl_task_fn)(void *data, unsigned int idx);
+
+/** Number of threads to use when a context asks for "as many as useful" */
+unsigned int nl_pool_default_threads(void);
+
+/**
+ * Calls `fn(data, i)` for every i in [0, count) using up to `threads`
+ * worker threads, and returns once all tasks have finished. Tasks are
+ * handed out in index order; with one thread they simply run in order
+ * on the calling thread.
+ */
+void nl_pool_run(struct nl_context* ctx, unsigned int threads,
+        unsigned int count, nl_task_fn fn, void *data);
+
+#endif /* NOLLI_POOL_H */
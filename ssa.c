@@ -0,0 +1,491 @@
+#include "ssa.h"
+#include "mem.h"
+
+#include <string.h>
+#include <assert.h>
+
+enum { NL_SSA_MAP_MIN_SIZE = 64 };
+
+/** A phi of `var`, completed when its block is sealed */
+struct nl_ssa_phi {
+    struct nl_ssa_var* var;
+    LLVMValueRef phi;
+    struct nl_ssa_phi* next;
+};
+
+enum {
+    NL_SSA_FRAME_NEW,
+    NL_SSA_FRAME_WAITING,       /**< for its only predecessor */
+    NL_SSA_FRAME_MERGING        /**< the definitions of its predecessors */
+};
+
+/** A block whose predecessors are being searched for a definition */
+struct nl_ssa_frame {
+    struct nl_ssa_block* block;
+    int state;
+    unsigned int pred;          /**< whose definition is awaited */
+    unsigned int base;          /**< of the definitions found so far */
+    LLVMValueRef token;         /**< once a search led back to the block */
+    LLVMValueRef phi;           /**< once one is needed */
+};
+
+/* Defines a variable in a block being merged, until it's done */
+static const char pending_def;
+#define PENDING ((LLVMValueRef)&pending_def)
+
+static unsigned int slot_of(const struct nl_ssa_map* map, uint64_t key)
+{
+    uint64_t h = key * 0x9E3779B97F4A7C15ull;
+    return (unsigned int)(h >> 32) & (map->size - 1);
+}
+
+static unsigned int find_slot(const struct nl_ssa_map* map, uint64_t key)
+{
+    unsigned int mask = map->size - 1;
+    unsigned int idx = slot_of(map, key);
+    while (map->keys[idx] != 0 && map->keys[idx] != key) {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+static void* map_get(const struct nl_ssa_map* map, uint64_t key)
+{
+    if (map->count == 0) {
+        return NULL;
+    }
+    return map->values[find_slot(map, key)];
+}
+
+static void map_put(struct nl_ssa* ssa, struct nl_ssa_map* map, uint64_t key, void* value)
+{
+    assert(key != 0 && value != NULL);
+    if (2 * (map->count + 1) > map->size) {
+        struct nl_ssa_map old = *map;
+        map->size = old.size ? old.size * 2 : NL_SSA_MAP_MIN_SIZE;
+        map->keys = nl_arena_alloc(ssa->ctx, &ssa->arena, map->size * sizeof(*map->keys));
+        map->values = nl_arena_alloc(ssa->ctx, &ssa->arena, map->size * sizeof(*map->values));
+        unsigned int i;
+        for (i = 0; i < old.size; i++) {
+            if (old.keys[i] != 0) {
+                unsigned int idx = find_slot(map, old.keys[i]);
+                map->keys[idx] = old.keys[i];
+                map->values[idx] = old.values[i];
+            }
+        }
+    }
+
+    unsigned int idx = find_slot(map, key);
+    if (0 == map->keys[idx]) {
+        map->keys[idx] = key;
+        map->count++;
+    }
+    map->values[idx] = value;
+}
+
+static uint64_t def_key(const struct nl_ssa_block* block, const struct nl_ssa_var* var)
+{
+    return (uint64_t)block->id << 32 | var->id;
+}
+
+/* Follows removed phis to the value that replaced them */
+static LLVMValueRef resolve(const struct nl_ssa* ssa, LLVMValueRef value)
+{
+    LLVMValueRef next;
+    while ((next = map_get(&ssa->forward, (uintptr_t)value)) != NULL) {
+        value = next;
+    }
+    return value;
+}
+
+static LLVMValueRef lookup(struct nl_ssa* ssa, struct nl_ssa_var* var,
+        struct nl_ssa_block* block)
+{
+    LLVMValueRef value = map_get(&ssa->defs, def_key(block, var));
+    if (value != NULL && ssa->forward.count > 0) {
+        LLVMValueRef current = resolve(ssa, value);
+        if (current != value) {
+            map_put(ssa, &ssa->defs, def_key(block, var), current);
+        }
+        value = current;
+    }
+    return value;
+}
+
+void nl_ssa_init(struct nl_ssa* ssa, struct nl_context* ctx)
+{
+    memset(ssa, 0, sizeof(*ssa));
+    ssa->ctx = ctx;
+    nl_arena_init(&ssa->arena, NL_MEM_JIT);
+}
+
+void nl_ssa_deinit(struct nl_ssa* ssa)
+{
+    nl_arena_deinit(ssa->ctx, &ssa->arena);
+}
+
+void nl_ssa_begin(struct nl_ssa* ssa, LLVMBuilderRef builder)
+{
+    ssa->builder = builder;
+}
+
+void nl_ssa_end(struct nl_ssa* ssa)
+{
+    /* what used removed phis was rewritten to use their replacements,
+     * so they're unused by now */
+    unsigned int i;
+    for (i = 0; i < ssa->removed_count; i++) {
+        LLVMInstructionEraseFromParent(ssa->removed[i]);
+    }
+
+    nl_arena_reset(ssa->ctx, &ssa->arena);
+    ssa->builder = NULL;
+    ssa->var_count = 0;
+    ssa->block_count = 0;
+    ssa->defs = (struct nl_ssa_map){0};
+    ssa->forward = (struct nl_ssa_map){0};
+    ssa->tokens = (struct nl_ssa_map){0};
+    ssa->removed = NULL;
+    ssa->removed_count = ssa->removed_size = 0;
+    ssa->frames = NULL;
+    ssa->frame_size = 0;
+    ssa->values = NULL;
+    ssa->value_count = ssa->value_size = 0;
+    ssa->recheck = NULL;
+    ssa->recheck_count = ssa->recheck_size = 0;
+}
+
+struct nl_ssa_var* nl_ssa_var(struct nl_ssa* ssa, LLVMTypeRef type, const char* name)
+{
+    struct nl_ssa_var* var = nl_arena_alloc(ssa->ctx, &ssa->arena, sizeof(*var));
+    var->id = ++ssa->var_count;
+    var->type = type;
+    var->name = name;
+    return var;
+}
+
+struct nl_ssa_block* nl_ssa_block(struct nl_ssa* ssa, LLVMBasicBlockRef bb)
+{
+    struct nl_ssa_block* block = nl_arena_alloc(ssa->ctx, &ssa->arena, sizeof(*block));
+    block->bb = bb;
+    block->id = ++ssa->block_count;
+    return block;
+}
+
+void nl_ssa_add_pred(struct nl_ssa* ssa, struct nl_ssa_block* block,
+        struct nl_ssa_block* pred)
+{
+    assert(!block->sealed);
+    if (block->pred_count == block->pred_size) {
+        unsigned int size = block->pred_size ? block->pred_size * 2 : 2;
+        block->preds = nl_arena_realloc(ssa->ctx, &ssa->arena, block->preds,
+                block->pred_size * sizeof(*block->preds), size * sizeof(*block->preds));
+        block->pred_size = size;
+    }
+    block->preds[block->pred_count++] = pred;
+}
+
+void nl_ssa_write(struct nl_ssa* ssa, struct nl_ssa_var* var,
+        struct nl_ssa_block* block, LLVMValueRef value)
+{
+    map_put(ssa, &ssa->defs, def_key(block, var), value);
+}
+
+/* Inserts a phi at the top of `block`, leaving the builder where it was.
+ * It's only named once it's known to stay. */
+static LLVMValueRef new_phi(struct nl_ssa* ssa, const struct nl_ssa_var* var,
+        struct nl_ssa_block* block)
+{
+    LLVMBasicBlockRef current = LLVMGetInsertBlock(ssa->builder);
+    LLVMValueRef first = LLVMGetFirstInstruction(block->bb);
+    if (first != NULL) {
+        LLVMPositionBuilderBefore(ssa->builder, first);
+    } else {
+        LLVMPositionBuilderAtEnd(ssa->builder, block->bb);
+    }
+    LLVMValueRef phi = LLVMBuildPhi(ssa->builder, var->type, "");
+    LLVMPositionBuilderAtEnd(ssa->builder, current);
+    return phi;
+}
+
+static void push_removed(struct nl_ssa* ssa, LLVMValueRef phi)
+{
+    if (ssa->removed_count == ssa->removed_size) {
+        unsigned int size = ssa->removed_size ? ssa->removed_size * 2 : 16;
+        ssa->removed = nl_arena_realloc(ssa->ctx, &ssa->arena, ssa->removed,
+                ssa->removed_size * sizeof(*ssa->removed), size * sizeof(*ssa->removed));
+        ssa->removed_size = size;
+    }
+    ssa->removed[ssa->removed_count++] = phi;
+}
+
+static void push_recheck(struct nl_ssa* ssa, LLVMValueRef phi)
+{
+    if (ssa->recheck_count == ssa->recheck_size) {
+        unsigned int size = ssa->recheck_size ? ssa->recheck_size * 2 : 16;
+        ssa->recheck = nl_arena_realloc(ssa->ctx, &ssa->arena, ssa->recheck,
+                ssa->recheck_size * sizeof(*ssa->recheck), size * sizeof(*ssa->recheck));
+        ssa->recheck_size = size;
+    }
+    ssa->recheck[ssa->recheck_count++] = phi;
+}
+
+/* Replaces a complete phi that only merges one value (besides itself)
+ * with that value. Phis using it may have become trivial in turn; they
+ * are checked once no read is pending, when all phis are complete. */
+static LLVMValueRef try_remove_trivial(struct nl_ssa* ssa, LLVMValueRef phi)
+{
+    LLVMValueRef same = NULL;
+    unsigned int count = LLVMCountIncoming(phi);
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+        LLVMValueRef op = LLVMGetIncomingValue(phi, i);
+        if (op == same || op == phi) {
+            continue;
+        }
+        if (same != NULL) {
+            return phi;
+        }
+        same = op;
+    }
+    if (NULL == same) {
+        same = LLVMGetUndef(LLVMTypeOf(phi));     /* unreachable */
+    }
+
+    LLVMUseRef use;
+    for (use = LLVMGetFirstUse(phi); use != NULL; use = LLVMGetNextUse(use)) {
+        LLVMValueRef user = LLVMGetUser(use);
+        if (user != phi && LLVMIsAPHINode(user)) {
+            push_recheck(ssa, user);
+        }
+    }
+    LLVMReplaceAllUsesWith(phi, same);
+    map_put(ssa, &ssa->forward, (uintptr_t)phi, same);
+    push_removed(ssa, phi);
+    return same;
+}
+
+static void recheck(struct nl_ssa* ssa)
+{
+    while (ssa->recheck_count > 0) {
+        LLVMValueRef phi = ssa->recheck[--ssa->recheck_count];
+        if (NULL == map_get(&ssa->forward, (uintptr_t)phi)) {
+            try_remove_trivial(ssa, phi);
+        }
+    }
+}
+
+static struct nl_ssa_frame* push_frame(struct nl_ssa* ssa, unsigned int depth,
+        struct nl_ssa_block* block)
+{
+    if (depth == ssa->frame_size) {
+        unsigned int size = ssa->frame_size ? ssa->frame_size * 2 : 16;
+        ssa->frames = nl_arena_realloc(ssa->ctx, &ssa->arena, ssa->frames,
+                ssa->frame_size * sizeof(*ssa->frames), size * sizeof(*ssa->frames));
+        ssa->frame_size = size;
+    }
+    ssa->frames[depth] = (struct nl_ssa_frame){.block=block};
+    return &ssa->frames[depth];
+}
+
+static void push_value(struct nl_ssa* ssa, LLVMValueRef value)
+{
+    if (ssa->value_count == ssa->value_size) {
+        unsigned int size = ssa->value_size ? ssa->value_size * 2 : 16;
+        ssa->values = nl_arena_realloc(ssa->ctx, &ssa->arena, ssa->values,
+                ssa->value_size * sizeof(*ssa->values), size * sizeof(*ssa->values));
+        ssa->value_size = size;
+    }
+    ssa->values[ssa->value_count++] = value;
+}
+
+/* The search led back to a block being merged, around a loop. Its
+ * definition isn't known yet, so it's stood for by a token, which only
+ * becomes a phi if the merge needs one. */
+static LLVMValueRef pending_token(struct nl_ssa* ssa, struct nl_ssa_var* var,
+        struct nl_ssa_block* block, unsigned int depth)
+{
+    struct nl_ssa_frame* frame = NULL;
+    while (depth-- > 0) {
+        frame = &ssa->frames[depth];
+        if (frame->block == block && NL_SSA_FRAME_MERGING == frame->state) {
+            break;
+        }
+    }
+    assert(frame != NULL && frame->block == block);
+    if (NULL == frame->token) {
+        frame->token = nl_arena_alloc(ssa->ctx, &ssa->arena, 1);
+        map_put(ssa, &ssa->tokens, (uintptr_t)frame->token, (void*)(uintptr_t)(depth + 1));
+        nl_ssa_write(ssa, var, block, frame->token);
+    }
+    return frame->token;
+}
+
+/* Returns the phi of a pending merge, which the token stood for */
+static LLVMValueRef materialize(struct nl_ssa* ssa, struct nl_ssa_var* var,
+        LLVMValueRef value)
+{
+    uintptr_t depth = (uintptr_t)map_get(&ssa->tokens, (uintptr_t)value);
+    if (0 == depth) {
+        return value;
+    }
+    struct nl_ssa_frame* frame = &ssa->frames[depth - 1];
+    assert(frame->token == value && NULL == frame->phi);
+    frame->phi = new_phi(ssa, var, frame->block);
+    map_put(ssa, &ssa->forward, (uintptr_t)frame->token, frame->phi);
+    return frame->phi;
+}
+
+/* Merges the definitions found in the predecessors of `frame`'s block,
+ * which only takes a phi if they differ */
+static LLVMValueRef merge(struct nl_ssa* ssa, struct nl_ssa_var* var,
+        struct nl_ssa_frame* frame)
+{
+    struct nl_ssa_block* block = frame->block;
+    LLVMValueRef* values = &ssa->values[frame->base];
+    LLVMValueRef self = frame->phi != NULL ? frame->phi : frame->token;
+    LLVMValueRef same = NULL;
+    bool differ = false;
+    unsigned int i;
+    for (i = 0; i < block->pred_count && !differ; i++) {
+        values[i] = resolve(ssa, values[i]);
+        if (values[i] != self && values[i] != same) {
+            differ = same != NULL;
+            same = values[i];
+        }
+    }
+
+    if (!differ && NULL == frame->phi) {
+        if (NULL == same) {
+            same = LLVMGetUndef(var->type);     /* unreachable */
+        }
+        if (frame->token != NULL) {
+            map_put(ssa, &ssa->forward, (uintptr_t)frame->token, same);
+        }
+        return same;
+    }
+
+    if (NULL == frame->phi) {
+        frame->phi = new_phi(ssa, var, block);
+        if (frame->token != NULL) {
+            map_put(ssa, &ssa->forward, (uintptr_t)frame->token, frame->phi);
+        }
+    }
+    for (i = 0; i < block->pred_count; i++) {
+        LLVMValueRef value = materialize(ssa, var, resolve(ssa, values[i]));
+        LLVMAddIncoming(frame->phi, &value, &block->preds[i]->bb, 1);
+    }
+    LLVMValueRef value = try_remove_trivial(ssa, frame->phi);
+    if (value == frame->phi) {
+        LLVMSetValueName(value, var->name);
+    }
+    return value;
+}
+
+/* Searches the predecessors of blocks without a definition, depth
+ * first, caching what's found in each block on the way */
+static LLVMValueRef read_recursive(struct nl_ssa* ssa, struct nl_ssa_var* var,
+        struct nl_ssa_block* block)
+{
+    unsigned int depth = 0;
+    push_frame(ssa, depth++, block);
+    LLVMValueRef found = NULL;
+
+    while (depth > 0) {
+        struct nl_ssa_frame* frame = &ssa->frames[depth - 1];
+        struct nl_ssa_block* b = frame->block;
+
+        if (found != NULL) {
+            if (NL_SSA_FRAME_WAITING == frame->state) {
+                nl_ssa_write(ssa, var, b, found);
+                depth--;
+                continue;
+            }
+            push_value(ssa, found);
+            frame->pred++;
+            found = NULL;
+        } else if (NL_SSA_FRAME_NEW == frame->state) {
+            LLVMValueRef value = lookup(ssa, var, b);
+            if (PENDING == value) {
+                found = pending_token(ssa, var, b, --depth);
+                continue;
+            } else if (value != NULL) {
+                found = value;
+                depth--;
+                continue;
+            }
+            if (!b->sealed) {
+                struct nl_ssa_phi* incomplete = nl_arena_alloc(ssa->ctx, &ssa->arena,
+                        sizeof(*incomplete));
+                incomplete->var = var;
+                incomplete->phi = new_phi(ssa, var, b);
+                incomplete->next = b->incomplete;
+                b->incomplete = incomplete;
+                nl_ssa_write(ssa, var, b, incomplete->phi);
+                found = incomplete->phi;
+                depth--;
+                continue;
+            }
+            if (1 == b->pred_count) {
+                frame->state = NL_SSA_FRAME_WAITING;
+                push_frame(ssa, depth++, b->preds[0]);
+                continue;
+            }
+            /* marked first, so that cycles through `b` end here */
+            frame->state = NL_SSA_FRAME_MERGING;
+            frame->base = ssa->value_count;
+            nl_ssa_write(ssa, var, b, PENDING);
+        }
+
+        if (frame->pred < b->pred_count) {
+            push_frame(ssa, depth++, b->preds[frame->pred]);
+        } else {
+            found = merge(ssa, var, frame);
+            nl_ssa_write(ssa, var, b, found);
+            ssa->value_count = frame->base;
+            depth--;
+        }
+    }
+    return found;
+}
+
+LLVMValueRef nl_ssa_read(struct nl_ssa* ssa, struct nl_ssa_var* var,
+        struct nl_ssa_block* block)
+{
+    LLVMValueRef value = lookup(ssa, var, block);
+    if (value != NULL) {
+        return value;
+    }
+    value = read_recursive(ssa, var, block);
+    recheck(ssa);
+    return resolve(ssa, value);
+}
+
+void nl_ssa_seal(struct nl_ssa* ssa, struct nl_ssa_block* block)
+{
+    assert(!block->sealed);
+    struct nl_ssa_phi* incomplete = block->incomplete;
+    for (; incomplete != NULL; incomplete = incomplete->next) {
+        unsigned int i;
+        for (i = 0; i < block->pred_count; i++) {
+            LLVMValueRef value = lookup(ssa, incomplete->var, block->preds[i]);
+            if (NULL == value) {
+                value = resolve(ssa, read_recursive(ssa, incomplete->var, block->preds[i]));
+            }
+            LLVMAddIncoming(incomplete->phi, &value, &block->preds[i]->bb, 1);
+        }
+    }
+    block->sealed = true;
+
+    /* once complete, all of them can be checked */
+    for (incomplete = block->incomplete; incomplete != NULL; incomplete = incomplete->next) {
+        push_recheck(ssa, incomplete->phi);
+    }
+    recheck(ssa);
+    for (incomplete = block->incomplete; incomplete != NULL; incomplete = incomplete->next) {
+        if (NULL == map_get(&ssa->forward, (uintptr_t)incomplete->phi)) {
+            LLVMSetValueName(incomplete->phi, incomplete->var->name);
+        }
+    }
+    block->incomplete = NULL;
+}
@@ -0,0 +1,106 @@
+#ifndef NOLLI_SSA_H
+#define NOLLI_SSA_H
+
+#include "nolli.h"
+#include "arena.h"
+
+#include <llvm-c/Core.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Lowers local variables straight to SSA values, following Braun et
+ * al., "Simple and Efficient Construction of Static Single Assignment
+ * Form" (CC 2013): each block remembers the last value written to each
+ * variable, reads look through the block's predecessors, and phis are
+ * only placed where they're read. Phis that turn out to merge a single
+ * value are removed again.
+ *
+ * Blocks are "sealed" once all of their predecessors are known. Reads
+ * in blocks that aren't sealed yet, like the head of a loop whose body
+ * is being lowered, leave phis that get their operands when it's sealed.
+ */
+struct nl_ssa;
+
+/** A variable, which can hold values of a single LLVM type */
+struct nl_ssa_var {
+    unsigned int id;
+    LLVMTypeRef type;
+    const char* name;
+};
+
+/** Basic block of the function being lowered */
+struct nl_ssa_block {
+    LLVMBasicBlockRef bb;
+    unsigned int id;
+    bool sealed;
+    struct nl_ssa_block** preds;
+    unsigned int pred_count;
+    unsigned int pred_size;
+    struct nl_ssa_phi* incomplete;  /**< phis waiting for the block to be sealed */
+};
+
+/** Maps keys other than 0 to values other than NULL */
+struct nl_ssa_map {
+    uint64_t* keys;
+    void** values;
+    unsigned int count;
+    unsigned int size;
+};
+
+struct nl_ssa {
+    struct nl_context* ctx;
+    struct nl_arena arena;          /**< of the function being lowered */
+    LLVMBuilderRef builder;         /**< inserting the function's code */
+    unsigned int var_count;
+    unsigned int block_count;
+
+    struct nl_ssa_map defs;         /**< (block, variable) -> value */
+    struct nl_ssa_map forward;      /**< removed phi -> its replacement */
+    struct nl_ssa_map tokens;       /**< standing for a pending merge -> its frame */
+    LLVMValueRef* removed;          /**< phis to erase once done */
+    unsigned int removed_count;
+    unsigned int removed_size;
+
+    /* reads follow predecessors on an explicit stack, and phis whose
+     * operands were replaced are checked again once no read is pending */
+    struct nl_ssa_frame* frames;
+    unsigned int frame_size;
+    LLVMValueRef* values;           /**< found in the predecessors of frames */
+    unsigned int value_count;
+    unsigned int value_size;
+    LLVMValueRef* recheck;
+    unsigned int recheck_count;
+    unsigned int recheck_size;
+};
+
+void nl_ssa_init(struct nl_ssa* ssa, struct nl_context* ctx);
+void nl_ssa_deinit(struct nl_ssa* ssa);
+
+/** Starts a function, whose code `builder` inserts at the end of a block */
+void nl_ssa_begin(struct nl_ssa* ssa, LLVMBuilderRef builder);
+
+/** Erases the phis that were removed, and forgets the function's blocks and variables */
+void nl_ssa_end(struct nl_ssa* ssa);
+
+struct nl_ssa_var* nl_ssa_var(struct nl_ssa* ssa, LLVMTypeRef type, const char* name);
+
+/** Tracks `bb`, which has no predecessors yet */
+struct nl_ssa_block* nl_ssa_block(struct nl_ssa* ssa, LLVMBasicBlockRef bb);
+
+/** Records a branch from `pred` to unsealed `block` */
+void nl_ssa_add_pred(struct nl_ssa* ssa, struct nl_ssa_block* block,
+        struct nl_ssa_block* pred);
+
+/** Completes the phis of `block`, whose predecessors are all known */
+void nl_ssa_seal(struct nl_ssa* ssa, struct nl_ssa_block* block);
+
+void nl_ssa_write(struct nl_ssa* ssa, struct nl_ssa_var* var,
+        struct nl_ssa_block* block, LLVMValueRef value);
+
+/** Returns the value of `var` at the end of `block` */
+LLVMValueRef nl_ssa_read(struct nl_ssa* ssa, struct nl_ssa_var* var,
+        struct nl_ssa_block* block);
+
+#endif /* NOLLI_SSA_H */
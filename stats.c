@@ -0,0 +1,77 @@
+#include "stats.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+double nl_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void nl_stats_raise(unsigned long *counter, unsigned long n)
+{
+    unsigned long cur = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while (cur < n && !__atomic_compare_exchange_n(counter, &cur, n, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        /* `cur` now holds the value another thread stored */
+    }
+}
+
+int nl_stats_enter(struct nl_context* ctx, int phase)
+{
+    assert(phase >= 0 && phase < NL_PHASE_COUNT);
+
+    int prev = ctx->phase;
+    if (ctx->stats != NULL) {
+        double now = nl_clock();
+        ctx->stats->phases[prev].seconds += now - ctx->phase_start;
+        ctx->phase_start = now;
+    }
+    ctx->phase = phase;
+    return prev;
+}
+
+int nl_get_stats(struct nl_context* ctx, struct nl_stats* stats)
+{
+    assert(ctx != NULL);
+    assert(stats != NULL);
+
+    /* bring the running phase's time up to date */
+    nl_stats_enter(ctx, ctx->phase);
+    memcpy(stats, ctx->stats, sizeof(*stats));
+    return NL_NO_ERR;
+}
+
+void nl_reset_stats(struct nl_context* ctx)
+{
+    assert(ctx != NULL);
+
+    memset(ctx->stats, 0, sizeof(*ctx->stats));
+    ctx->phase_start = nl_clock();
+}
+
+const char* nl_phase_name(int phase)
+{
+    static const char* names[] = {
+        "none",
+        "read",
+        "lex",
+        "parse",
+        "analyze",
+        "bytecode",
+        "irgen",
+        "verify",
+        "optimize",
+        "codegen",
+    };
+    assert(sizeof(names) / sizeof(*names) == NL_PHASE_COUNT);
+
+    if (phase < 0 || phase >= NL_PHASE_COUNT) {
+        return NULL;
+    }
+    return names[phase];
+}
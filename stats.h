@@ -0,0 +1,38 @@
+#ifndef NOLLI_STATS_H
+#define NOLLI_STATS_H
+
+#include "nolli.h"
+
+/**
+ * Adds `n` to a counter of the phase being measured. Counters may be
+ * updated from several threads at once (e.g. while analyzing bodies).
+ */
+#define NL_STATS_ADD(ctx, counter, n) \
+    do { \
+        if ((ctx)->stats != NULL) { \
+            __atomic_fetch_add(&(ctx)->stats->phases[(ctx)->phase].counter, \
+                    (n), __ATOMIC_RELAXED); \
+        } \
+    } while (0)
+
+/** Raises a counter of the phase being measured to at least `n` */
+#define NL_STATS_MAX(ctx, counter, n) \
+    do { \
+        if ((ctx)->stats != NULL) { \
+            nl_stats_raise(&(ctx)->stats->phases[(ctx)->phase].counter, (n)); \
+        } \
+    } while (0)
+
+void nl_stats_raise(unsigned long *counter, unsigned long n);
+
+/** Seconds elapsed on a monotonic clock */
+double nl_clock(void);
+
+/**
+ * Starts measuring `phase`, charging the time since the last switch to
+ * the phase being measured until now. Returns that phase, so callers
+ * can restore it when they're done.
+ */
+int nl_stats_enter(struct nl_context* ctx, int phase);
+
+#endif /* NOLLI_STATS_H */
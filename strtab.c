@@ -1,6 +1,10 @@
 #include "strtab.h"
+#include "builtins.h"
 #include "nolli.h"
 #include "debug.h"
+#include "stats.h"
+#include "mem.h"
+#include "arena.h"
 
 #include <string.h>
 
@@ -19,7 +23,8 @@ static struct nl_strtab *nl_strtab_grow(struct nl_context* ctx,
 static nl_string_t nl_strtab_rewrap(struct nl_context* ctx,
         struct nl_strtab *tab, nl_string_t key);
 static nl_string_t nl_strtab_do(struct nl_context* ctx,
-        struct nl_strtab *tab, const char *key, int action);
+        struct nl_strtab *tab, const char *key, unsigned int hash0, int action);
+static void preload_builtins(struct nl_context* ctx, struct nl_strtab *tab);
 
 /** total number of possible hash table sizes */
 const unsigned int NL_MAX_STRTABLE_SIZE_OPTIONS = 28;
@@ -40,14 +45,50 @@ static unsigned int NL_STRTAB_SIZES[] = {
 
 int nl_strtab_init(struct nl_context* ctx, struct nl_strtab *tab)
 {
+    /* start large enough to hold every builtin without growing */
     tab->size_idx = 0;
+    while (NL_STRTAB_SIZES[tab->size_idx] * 0.60 <= NL_BUILTIN_COUNT) {
+        tab->size_idx++;
+    }
     tab->size = NL_STRTAB_SIZES[tab->size_idx];
+    tab->count = 0;
+    tab->collisions = 0;
 
-    tab->strings = nl_alloc(ctx, tab->size * sizeof(*tab->strings));
+    tab->strings = nl_alloc_tagged(ctx,
+            tab->size * sizeof(*tab->strings), NL_MEM_STRTAB);
+    preload_builtins(ctx, tab);
 
     return NL_NO_ERR;
 }
 
+void nl_strtab_reset(struct nl_context* ctx, struct nl_strtab *tab)
+{
+    /* the strings themselves are freed with the front end's arena;
+     * the table keeps its size */
+    memset(tab->strings, 0, tab->size * sizeof(*tab->strings));
+    tab->count = 0;
+    tab->collisions = 0;
+    preload_builtins(ctx, tab);
+}
+
+void nl_strtab_deinit(struct nl_context* ctx, struct nl_strtab *tab)
+{
+    nl_free(ctx, tab->strings, tab->size * sizeof(*tab->strings));
+    tab->strings = NULL;
+    tab->size = tab->count = 0;
+}
+
+/* preload the static builtin strings using their precomputed hashes */
+static void preload_builtins(struct nl_context* ctx, struct nl_strtab *tab)
+{
+    unsigned int i;
+    for (i = 0; i < NL_BUILTIN_COUNT; i++) {
+        nl_string_t s = nl_builtin_str(i);
+        assert(string_hash0(s) == nl_builtin_hashes[i]);
+        nl_strtab_do(ctx, tab, s, nl_builtin_hashes[i], NL_STRTAB_REWRAP);
+    }
+}
+
 static struct nl_strtab *nl_strtab_grow(struct nl_context* ctx, struct nl_strtab *tab)
 {
     assert(tab);
@@ -64,7 +105,8 @@ static struct nl_strtab *nl_strtab_grow(struct nl_context* ctx, struct nl_strtab
     tab->count = 0;
     tab->collisions = 0;
 
-    tab->strings = nl_alloc(ctx, tab->size * sizeof(*tab->strings));
+    tab->strings = nl_alloc_tagged(ctx,
+            tab->size * sizeof(*tab->strings), NL_MEM_STRTAB);
 
     unsigned int i;
     for (i = 0; i < old_size; i++) {
@@ -73,7 +115,7 @@ static struct nl_strtab *nl_strtab_grow(struct nl_context* ctx, struct nl_strtab
         }
     }
 
-    nl_free(ctx, old_keys);
+    nl_free(ctx, old_keys, old_size * sizeof(*old_keys));
 
     return tab;
 }
@@ -81,17 +123,23 @@ static struct nl_strtab *nl_strtab_grow(struct nl_context* ctx, struct nl_strtab
 nl_string_t nl_strtab_wrap(struct nl_context* ctx,
         struct nl_strtab *tab, const char *key)
 {
-    return nl_strtab_do(ctx, tab, key, NL_STRTAB_WRAP);
+    return nl_strtab_do(ctx, tab, key, string_hash0(key), NL_STRTAB_WRAP);
 }
 
 static nl_string_t nl_strtab_rewrap(struct nl_context* ctx,
         struct nl_strtab *tab, nl_string_t key)
 {
-    return nl_strtab_do(ctx, tab, key, NL_STRTAB_REWRAP);
+    return nl_strtab_do(ctx, tab, key, string_hash0(key), NL_STRTAB_REWRAP);
+}
+
+static void count_probes(struct nl_context* ctx, unsigned int probes)
+{
+    NL_STATS_ADD(ctx, probes, probes);
+    NL_STATS_MAX(ctx, max_probes, probes);
 }
 
 static nl_string_t nl_strtab_do(struct nl_context* ctx,
-        struct nl_strtab *tab, const char *key, int action)
+        struct nl_strtab *tab, const char *key, unsigned int hash0, int action)
 {
     assert(tab != NULL);
 
@@ -99,31 +147,31 @@ static nl_string_t nl_strtab_do(struct nl_context* ctx,
         tab = nl_strtab_grow(ctx, tab);
     }
 
-    unsigned int hash0 = string_hash0(key);
+    NL_STATS_ADD(ctx, lookups, 1);
 
     unsigned int i = 0;
     for (i = 0; i < tab->size; i++) {
         unsigned int idx = (hash0 + i) % tab->size;
         nl_string_t curkey = tab->strings[idx];
 
-
         if (NULL == curkey) {
+            count_probes(ctx, i + 1);
             nl_string_t ret = NULL;
             if (action == NL_STRTAB_REWRAP) {
                 /* add previously created nl_string to the table */
                 ret = (nl_string_t)key;
             } else {
                 /* add a new nl_string to the table */
-                ret = strdup(key);
-                if (ret == NULL) {
-                    fprintf(stderr, "failed to wrap string %s\n", ret); /* FIXME */
-                    return NULL;
-                }
+                size_t len = strlen(key);
+                ret = nl_arena_alloc(ctx, nl_arena(ctx, NL_ARENA_FRONTEND), len + 1);
+                memcpy(ret, key, len + 1);
+                NL_STATS_ADD(ctx, strings, 1);
             }
             tab->strings[idx] = ret;
             tab->count++;
             return ret;
         } else if (strcmp(curkey, key) == 0) {
+            count_probes(ctx, i + 1);
             /* return previously added nl_string from table */
             return curkey;
         }
@@ -15,6 +15,11 @@ struct nl_strtab {
 
 int nl_strtab_init(struct nl_context* ctx, struct nl_strtab *tab);
 
+/** Forgets every string but the builtins */
+void nl_strtab_reset(struct nl_context* ctx, struct nl_strtab *tab);
+
+void nl_strtab_deinit(struct nl_context* ctx, struct nl_strtab *tab);
+
 /**
  * Creates and stores and returns a string wrapper of the `char*`
  * or returns the existing wrapper in the table */
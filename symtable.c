@@ -1,23 +1,154 @@
 #include "symtable.h"
 #include "nolli.h"
+#include "stats.h"
+#include "mem.h"
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h> /* for dumping table */
 
-static struct nl_symbol *new_symbol(struct nl_context* ctx,
+enum {
+    NL_SYMTABLE_MIN_SIZE = 8,
+    NL_SYMSLAB_MIN_COUNT = 8,
+    NL_SYMSLAB_MAX_COUNT = 512
+};
+
+static size_t slab_bytes(unsigned int count)
+{
+    return sizeof(struct nl_symslab) + count * sizeof(struct nl_symbol);
+}
+
+static void free_slabs(struct nl_context* ctx, struct nl_symslab *slab)
+{
+    while (slab != NULL) {
+        struct nl_symslab *next = slab->next;
+        nl_free(ctx, slab, slab_bytes(slab->count));
+        slab = next;
+    }
+}
+
+/* Takes a record from the table's free list, or carves one from its
+ * newest slab. Slabs double in size so small tables stay small. */
+static struct nl_symbol *new_symbol(struct nl_context* ctx, struct nl_symtable *tab,
         const nl_string_t name, const void *value)
 {
-    struct nl_symbol *sym = nl_alloc(ctx, sizeof(*sym));
+    struct nl_symbol *sym = tab->free_symbols;
+    if (sym != NULL) {
+        tab->free_symbols = sym->next;
+    } else {
+        struct nl_symslab *slab = tab->slabs;
+        if (slab == NULL || slab->used == slab->count) {
+            unsigned int count = NL_SYMSLAB_MIN_COUNT;
+            if (slab != NULL && slab->count < NL_SYMSLAB_MAX_COUNT) {
+                count = slab->count * 2;
+            } else if (slab != NULL) {
+                count = slab->count;
+            }
+            slab = nl_malloc_tagged(ctx, slab_bytes(count), NL_MEM_SYMTAB);
+            slab->used = 0;
+            slab->count = count;
+            slab->next = tab->slabs;
+            tab->slabs = slab;
+        }
+        sym = &slab->symbols[slab->used++];
+    }
+
     *sym = (struct nl_symbol){.name=name, .value=value};
     return sym;
 }
 
+/* Names are interned, so the pointer itself is the key. Fibonacci
+ * hashing spreads the (aligned) pointer bits over the table. */
+static unsigned int slot_of(const struct nl_symtable *tab, const nl_string_t name)
+{
+    uint64_t h = (uint64_t)(uintptr_t)name * 0x9E3779B97F4A7C15ull;
+    return (unsigned int)(h >> 32) & (tab->size - 1);
+}
+
+/* Returns the index of the slot holding `name`, or of the empty slot
+ * where it would be inserted */
+static unsigned int find_slot(const struct nl_symtable *tab, const nl_string_t name)
+{
+    unsigned int mask = tab->size - 1;
+    unsigned int idx = slot_of(tab, name);
+    while (tab->slots[idx] != NULL && tab->slots[idx]->name != name) {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+static struct nl_symbol *lookup(const struct nl_symtable *tab, const nl_string_t name)
+{
+    if (tab->count == 0) {
+        return NULL;
+    }
+    return tab->slots[find_slot(tab, name)];
+}
+
+static const struct nl_symentry *lookup_frozen(const struct nl_symtable *tab,
+        const nl_string_t name)
+{
+    unsigned int mask = tab->size - 1;
+    unsigned int idx = slot_of(tab, name);
+    while (tab->frozen[idx].name != NULL) {
+        if (tab->frozen[idx].name == name) {
+            return &tab->frozen[idx];
+        }
+        idx = (idx + 1) & mask;
+    }
+    return NULL;
+}
+
+static void grow(struct nl_context* ctx, struct nl_symtable *tab)
+{
+    unsigned int old_size = tab->size;
+    struct nl_symbol **old_slots = tab->slots;
+
+    tab->size = old_size ? old_size * 2 : NL_SYMTABLE_MIN_SIZE;
+    tab->slots = nl_alloc_tagged(ctx, tab->size * sizeof(*tab->slots), NL_MEM_SYMTAB);
+
+    unsigned int i;
+    for (i = 0; i < old_size; i++) {
+        struct nl_symbol *sym = old_slots[i];
+        if (sym != NULL) {
+            tab->slots[find_slot(tab, sym->name)] = sym;
+        }
+    }
+
+    nl_free(ctx, old_slots, old_size * sizeof(*old_slots));
+}
+
+/* Backward-shift deletion keeps linear probe sequences intact
+ * without tombstones */
+static void remove_slot(struct nl_symtable *tab, unsigned int idx)
+{
+    unsigned int mask = tab->size - 1;
+    unsigned int cur = idx;
+    while (true) {
+        cur = (cur + 1) & mask;
+        struct nl_symbol *sym = tab->slots[cur];
+        if (sym == NULL) {
+            break;
+        }
+        unsigned int home = slot_of(tab, sym->name);
+        /* leave `sym` in place if its home lies cyclically in (idx, cur] */
+        bool in_place = (idx <= cur) ? (idx < home && home <= cur)
+                                     : (idx < home || home <= cur);
+        if (!in_place) {
+            tab->slots[idx] = sym;
+            idx = cur;
+        }
+    }
+    tab->slots[idx] = NULL;
+}
+
 struct nl_symtable *nl_symtable_create(struct nl_context* ctx,
         const struct nl_symtable *parent)
 {
-    struct nl_symtable *tab = nl_alloc(ctx, sizeof(*tab));
+    struct nl_symtable *tab = nl_alloc_tagged(ctx, sizeof(*tab), NL_MEM_SYMTAB);
     tab->parent = parent;
     return tab;
 }
@@ -26,32 +157,151 @@ struct nl_symtable *nl_symtable_destroy(struct nl_context* ctx,
         const struct nl_symtable* tab)
 {
     struct nl_symtable* parent = (struct nl_symtable*)tab->parent;
-    /* TODO: nl_free each symbol in the table! */
-    nl_free(ctx, (void*)tab);
+
+    /* every symbol record lives in one of the table's slabs */
+    free_slabs(ctx, tab->slabs);
+
+    /* a table has either slots or, once frozen, a snapshot of the same size */
+    nl_free(ctx, tab->slots, tab->size * sizeof(*tab->slots));
+    nl_free(ctx, tab->frozen, tab->size * sizeof(*tab->frozen));
+    nl_free(ctx, tab->scopes, tab->scopes_size * sizeof(*tab->scopes));
+    nl_free(ctx, (void*)tab, sizeof(*tab));
     return parent;
 }
 
+void nl_symtable_freeze(struct nl_context* ctx, struct nl_symtable *tab)
+{
+    assert(tab->frozen == NULL);
+    assert(tab->depth == 0);
+
+    /* keep the snapshot at most half full so probe runs stay short */
+    unsigned int size = NL_SYMTABLE_MIN_SIZE;
+    while (size < tab->count * 2) {
+        size *= 2;
+    }
+
+    unsigned int old_size = tab->size;
+    tab->size = size;
+    tab->frozen = nl_alloc_tagged(ctx, size * sizeof(*tab->frozen), NL_MEM_SYMTAB);
+
+    unsigned int i;
+    for (i = 0; i < old_size; i++) {
+        const struct nl_symbol *sym = tab->slots[i];
+        if (sym != NULL) {
+            unsigned int idx = slot_of(tab, sym->name);
+            while (tab->frozen[idx].name != NULL) {
+                idx = (idx + 1) & (size - 1);
+            }
+            tab->frozen[idx] = (struct nl_symentry){sym->name, sym->value};
+        }
+    }
+
+    /* the mutable representation is no longer needed */
+    free_slabs(ctx, tab->slabs);
+    tab->slabs = NULL;
+    tab->free_symbols = NULL;
+    nl_free(ctx, tab->slots, old_size * sizeof(*tab->slots));
+    tab->slots = NULL;
+    nl_free(ctx, tab->scopes, tab->scopes_size * sizeof(*tab->scopes));
+    tab->scopes = NULL;
+    tab->scopes_size = 0;
+}
+
+void nl_symtable_enter_scope(struct nl_context* ctx, struct nl_symtable *tab)
+{
+    assert(tab->frozen == NULL);
+    tab->depth++;
+    if (tab->depth >= tab->scopes_size) {
+        unsigned int size = tab->scopes_size ? tab->scopes_size * 2 : 8;
+        tab->scopes = nl_realloc_tagged(ctx, tab->scopes,
+                tab->scopes_size * sizeof(*tab->scopes), size * sizeof(*tab->scopes),
+                NL_MEM_SYMTAB);
+        tab->scopes_size = size;
+    }
+    tab->scopes[tab->depth] = NULL;
+}
+
+void nl_symtable_leave_scope(struct nl_context* ctx, struct nl_symtable *tab)
+{
+    assert(tab->depth > 0);
+
+    /* undo every symbol added in this scope, most recent first */
+    struct nl_symbol *head = tab->scopes[tab->depth];
+    struct nl_symbol *tail = NULL;
+    struct nl_symbol *sym = head;
+    while (sym != NULL) {
+        unsigned int idx = find_slot(tab, sym->name);
+        assert(tab->slots[idx] == sym);
+        if (sym->shadowed != NULL) {
+            tab->slots[idx] = sym->shadowed;
+        } else {
+            remove_slot(tab, idx);
+            tab->count--;
+        }
+        tail = sym;
+        sym = sym->next;
+    }
+
+    /* the scope's log is already a list, so it joins the pool whole */
+    if (tail != NULL) {
+        tail->next = tab->free_symbols;
+        tab->free_symbols = head;
+    }
+
+    tab->scopes[tab->depth] = NULL;
+    tab->depth--;
+}
+
 void *nl_symtable_search(const struct nl_symtable *tab, const nl_string_t name)
+{
+    return nl_symtable_find(tab, name, NULL);
+}
+
+void *nl_symtable_find(const struct nl_symtable *tab, const nl_string_t name,
+        const struct nl_symtable **owner)
 {
     const struct nl_symtable *cur = tab;
     while (cur != NULL) {
-        void *value = nl_symtable_get(cur, name);
-        if (value != NULL) {
-            return value;
+        const void *value = NULL;
+        bool found = false;
+        if (cur->frozen != NULL) {
+            const struct nl_symentry *entry = lookup_frozen(cur, name);
+            if (entry != NULL) {
+                value = entry->value;
+                found = true;
+            }
+        } else {
+            const struct nl_symbol *sym = lookup(cur, name);
+            if (sym != NULL) {
+                value = sym->value;
+                found = true;
+            }
+        }
+        if (found) {
+            if (owner != NULL) {
+                *owner = cur;
+            }
+            return (void*)value;
         }
         cur = cur->parent;
     }
+    if (owner != NULL) {
+        *owner = NULL;
+    }
     return NULL;
 }
 
 void *nl_symtable_get(const struct nl_symtable *tab, const nl_string_t name)
 {
-    const struct nl_symbol *sym = tab->head;
-    while (sym != NULL) {
-        if (name == sym->name) {
-            return (void*)sym->value;
-        }
-        sym = sym->next;
+    if (tab->frozen != NULL) {
+        const struct nl_symentry *entry = lookup_frozen(tab, name);
+        return entry ? (void*)entry->value : NULL;
+    }
+
+    /* only symbols defined in the current scope */
+    const struct nl_symbol *sym = lookup(tab, name);
+    if (sym != NULL && sym->scope == tab->depth) {
+        return (void*)sym->value;
     }
     return NULL;
 }
@@ -59,34 +309,75 @@ void *nl_symtable_get(const struct nl_symtable *tab, const nl_string_t name)
 void *nl_symtable_add(struct nl_context* ctx, struct nl_symtable* tab,
         const nl_string_t name, const void *value)
 {
-    struct nl_symbol **symp = &tab->head;
-    while (*symp != NULL) {
-        struct nl_symbol *sym = *symp;
-        if (sym->name == name) {
-            assert(strcmp(sym->name, name) == 0);
-            /* Symbol already exists in table */
-            const void *old_value = sym->value;
-            sym->value = value;
-            return (void*)old_value;
-        }
-        symp = (struct nl_symbol **)&sym->next;
+    assert(tab->frozen == NULL);
+    NL_STATS_ADD(ctx, symbols, 1);
+
+    unsigned int idx = 0;
+    struct nl_symbol *sym = NULL;
+    if (tab->size > 0) {
+        idx = find_slot(tab, name);
+        sym = tab->slots[idx];
+    }
+    if (sym != NULL && sym->scope == tab->depth) {
+        assert(strcmp(sym->name, name) == 0);
+        /* Symbol already exists in table. Replacing it in place keeps
+         * the table's layout, so iterating it stays valid */
+        const void *old_value = sym->value;
+        sym->value = value;
+        return (void*)old_value;
+    }
+
+    /* only a new name takes another slot */
+    if (NULL == sym && (tab->count + 1) * 4 > tab->size * 3) {
+        grow(ctx, tab);
+        idx = find_slot(tab, name);
     }
 
-    /* append symbol to end of table */
-    (*symp) = new_symbol(ctx, name, value);
-    tab->count++;
+    struct nl_symbol *newsym = new_symbol(ctx, tab, name, value);
+    newsym->scope = tab->depth;
+    newsym->shadowed = sym;
+    if (tab->depth > 0) {
+        /* log the symbol so leaving the scope can undo it */
+        newsym->next = tab->scopes[tab->depth];
+        tab->scopes[tab->depth] = newsym;
+    }
+    tab->slots[idx] = newsym;
+    if (sym == NULL) {
+        tab->count++;
+    }
 
     return (void*)value;
 }
 
+bool nl_symtable_iter(const struct nl_symtable *tab, unsigned int *idx,
+        nl_string_t *name, void **value)
+{
+    while (*idx < tab->size) {
+        unsigned int i = (*idx)++;
+        if (tab->frozen != NULL) {
+            if (tab->frozen[i].name != NULL) {
+                *name = tab->frozen[i].name;
+                *value = (void*)tab->frozen[i].value;
+                return true;
+            }
+        } else if (tab->slots[i] != NULL) {
+            *name = tab->slots[i]->name;
+            *value = (void*)tab->slots[i]->value;
+            return true;
+        }
+    }
+    return false;
+}
+
 void nl_symtable_dump(const struct nl_symtable *tab)
 {
     const struct nl_symtable *curtab = tab;
     while (curtab != NULL) {
-        const struct nl_symbol *sym = curtab->head;
-        while (sym != NULL) {
-            printf("%s: %p\n", sym->name, sym->value);
-            sym = sym->next;
+        unsigned int idx = 0;
+        nl_string_t name = NULL;
+        void *value = NULL;
+        while (nl_symtable_iter(curtab, &idx, &name, &value)) {
+            printf("%s: %p\n", name, value);
         }
         curtab = curtab->parent;
         printf("parent: %p\n", curtab);
@@ -3,26 +3,72 @@
 
 #include "strtab.h"
 
+#include <stdbool.h>
+
 struct nl_symbol {
-    const nl_string_t name;
+    nl_string_t name;
+    const void *value;
+    struct nl_symbol *shadowed; /**< symbol of same name in an outer scope */
+    struct nl_symbol *next;     /**< next symbol added in the same scope */
+    unsigned int scope;         /**< depth of the scope defining this symbol */
+};
+
+/** Slab of symbol records; a table's symbols are pooled in its slabs */
+struct nl_symslab {
+    struct nl_symslab *next;
+    unsigned int count;         /**< number of records in this slab */
+    unsigned int used;          /**< number of records handed out */
+    struct nl_symbol symbols[];
+};
+
+/** Name/value pair stored inline in a frozen table */
+struct nl_symentry {
+    nl_string_t name;
     const void *value;
-    const struct nl_symbol *next;
 };
 
+/**
+ * Open-addressing hash table keyed on interned string pointers.
+ *
+ * A table also holds a stack of nested scopes. Entering a scope starts
+ * a new undo log; leaving it removes the scope's symbols and restores
+ * any symbols they shadowed.
+ *
+ * A frozen table is an immutable snapshot: its pairs are packed inline
+ * in a sparse, read-only array and lookups never write to the table,
+ * so any number of threads may search it (e.g. as the parent of their
+ * own function scopes) without locking.
+ */
 struct nl_symtable {
     const struct nl_symtable *parent;
-    struct nl_symbol *head;
+    struct nl_symbol **slots;   /**< linear-probed slots of visible symbols */
+    unsigned int size;          /**< number of slots (zero or a power of two) */
     unsigned int count;         /**< current number of key/value pairs */
+    struct nl_symbol **scopes;  /**< undo log: symbols added in each scope */
+    unsigned int depth;         /**< current scope depth */
+    unsigned int scopes_size;   /**< allocated number of scope logs */
+    struct nl_symslab *slabs;   /**< symbol pool, freed with the table */
+    struct nl_symbol *free_symbols; /**< records returned by left scopes */
+    struct nl_symentry *frozen; /**< read-only pairs once frozen, else NULL */
 };
 
 struct nl_symtable* nl_symtable_create(struct nl_context* ctx,
         const struct nl_symtable *parent);
 struct nl_symtable* nl_symtable_destroy(struct nl_context* ctx,
         const struct nl_symtable*);
+void nl_symtable_enter_scope(struct nl_context* ctx, struct nl_symtable *);
+void nl_symtable_leave_scope(struct nl_context* ctx, struct nl_symtable *);
 void *nl_symtable_get(const struct nl_symtable *, const nl_string_t);
 void *nl_symtable_search(const struct nl_symtable *, const nl_string_t);
+/** Like nl_symtable_search, also setting `owner` to the table (this one
+ * or an ancestor) the symbol was found in, or NULL if it wasn't */
+void *nl_symtable_find(const struct nl_symtable *, const nl_string_t,
+        const struct nl_symtable **owner);
 void *nl_symtable_add(struct nl_context* ctx,
         struct nl_symtable *, const nl_string_t, const void *);
+void nl_symtable_freeze(struct nl_context* ctx, struct nl_symtable *);
+bool nl_symtable_iter(const struct nl_symtable *, unsigned int *idx,
+        nl_string_t *name, void **value);
 void nl_symtable_dump(const struct nl_symtable *tab);
 
 #endif /* NOLLI_SYMTABLE_H */
@@ -0,0 +1,37 @@
+#include "target.h"
+
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/TargetRegistry.h>
+
+#include <memory>
+#include <string>
+
+static std::unique_ptr<llvm::MCSubtargetInfo> subtarget(const char* triple,
+        const std::string& features)
+{
+    std::string error;
+    const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
+    if (nullptr == target) {
+        return nullptr;
+    }
+    return std::unique_ptr<llvm::MCSubtargetInfo>(
+            target->createMCSubtargetInfo(triple, "", features));
+}
+
+bool nl_target_has_cpu(const char* triple, const char* cpu)
+{
+    std::unique_ptr<llvm::MCSubtargetInfo> info = subtarget(triple, "");
+    return info != nullptr && info->isCPUStringValid(cpu);
+}
+
+/* The target's feature table isn't public, but enabling a feature it
+ * knows sets a bit that disabling it clears */
+bool nl_target_has_feature(const char* triple, const char* feature)
+{
+    std::unique_ptr<llvm::MCSubtargetInfo> on = subtarget(triple,
+            std::string("+") + feature);
+    std::unique_ptr<llvm::MCSubtargetInfo> off = subtarget(triple,
+            std::string("-") + feature);
+    return on != nullptr && off != nullptr &&
+        on->getFeatureBits() != off->getFeatureBits();
+}
@@ -0,0 +1,26 @@
+#ifndef NOLLI_TARGET_H
+#define NOLLI_TARGET_H
+
+#include <stdbool.h>
+
+/*
+ * LLVM's C API takes any CPU and feature names for a target machine,
+ * and aborts or silently ignores the ones its target doesn't know.
+ * These look them up in the target's own tables instead. The target for
+ * `triple` must be initialized.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Whether the target for `triple` knows the CPU `cpu` */
+bool nl_target_has_cpu(const char* triple, const char* cpu);
+
+/** Whether it knows the feature `feature`, named without a + or - */
+bool nl_target_has_feature(const char* triple, const char* feature);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NOLLI_TARGET_H */
@@ -0,0 +1,67 @@
+package graphics {
+class Canvas {
+    int width, height
+}
+class Pixel {
+    int x, y
+}
+class Color {
+    int rgb
+}
+class Tile {
+    int size
+}
+class Square {
+    int side
+}
+class Leaf {
+    int depth
+}
+class Brush {
+    int radius
+}
+class Sprite {
+    int frame
+}
+class Grid {
+    int rows, columns
+}
+class Shade {
+    int level
+}
+class Point {
+    int x, y
+}
+class Line {
+    int length
+}
+}
+
+# six aliases fill a table of eight slots, twelve one of sixteen
+package paint {
+alias graphics::Canvas canvas
+alias graphics::Pixel pixel
+alias graphics::Color color
+alias graphics::Tile tile
+alias graphics::Square square
+alias graphics::Leaf leaf
+}
+
+package test {
+alias graphics::Canvas canvas
+alias graphics::Pixel pixel
+alias graphics::Color color
+alias graphics::Tile tile
+alias graphics::Square square
+alias graphics::Leaf leaf
+alias graphics::Brush brush
+alias graphics::Sprite sprite
+alias graphics::Grid grid
+alias graphics::Shade shade
+alias graphics::Point point
+alias graphics::Line line
+
+func int () main {
+    return 0
+}
+}
@@ -0,0 +1,20 @@
+func<T> T (T a, T b) max {
+    if a > b {
+        return a
+    }
+    return b
+}
+
+func<T> T (T x) twice {
+    return x + x
+}
+
+func<T> T (T a, T b) pick {
+    return max(a, b)
+}
+
+func int () main {
+    var real r
+    r = max(1.5, 2.5) + twice(0.25)
+    return max(3, 4) + pick(1, 2) + twice(5)
+}
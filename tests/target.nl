@@ -0,0 +1,10 @@
+package test {
+func int (int n) triple {
+    return n * 3
+}
+
+func int () main {
+    printf("triple: %d\n", triple(14))
+    return 0
+}
+}
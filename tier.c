@@ -0,0 +1,132 @@
+#include "tier.h"
+#include "gen.h"
+#include "arena.h"
+#include "debug.h"
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <assert.h>
+
+struct request {
+    struct nl_vm_function* func;
+    struct nl_jit_entry* entry;
+    struct request* next;
+};
+
+struct nl_tier {
+    struct nl_context* ctx;
+    struct nl_jit_session* session;
+    bool threaded;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct request* head;           /**< oldest request first */
+    struct request** tail;
+    bool done;                      /**< drop what's left and exit */
+};
+
+static void publish(struct nl_vm_function* func, nl_native_entry native)
+{
+    __atomic_store_n(&func->native, native, __ATOMIC_RELEASE);
+}
+
+/* The thread only touches the requests and the session's JIT, never the
+ * program or the context's tables */
+static void* compile_requests(void* data)
+{
+    struct nl_tier* tier = data;
+
+    pthread_mutex_lock(&tier->lock);
+    for (;;) {
+        while (NULL == tier->head && !tier->done) {
+            pthread_cond_wait(&tier->wake, &tier->lock);
+        }
+        struct request* req = tier->head;
+        if (NULL == req) {
+            break;
+        }
+        tier->head = req->next;
+        if (NULL == tier->head) {
+            tier->tail = &tier->head;
+        }
+        bool done = tier->done;
+        pthread_mutex_unlock(&tier->lock);
+
+        if (done) {
+            nl_jit_session_discard_entry(req->entry);
+        } else {
+            publish(req->func, nl_jit_session_compile_entry(tier->session, req->entry));
+        }
+        pthread_mutex_lock(&tier->lock);
+    }
+    pthread_mutex_unlock(&tier->lock);
+    return NULL;
+}
+
+struct nl_tier* nl_tier_create(struct nl_context* ctx, struct nl_ast* packages)
+{
+    struct nl_jit_session* session = nl_jit_session_create(ctx,
+            nl_arena(ctx, NL_ARENA_CODEGEN));
+    if (NULL == session) {
+        return NULL;
+    }
+    if (nl_jit_session_add(session, packages, false) != NL_NO_ERR) {
+        nl_jit_session_destroy(session);
+        return NULL;
+    }
+
+    struct nl_tier* tier = nl_arena_alloc(ctx, nl_arena(ctx, NL_ARENA_CODEGEN),
+            sizeof(*tier));
+    tier->ctx = ctx;
+    tier->session = session;
+    tier->tail = &tier->head;
+    pthread_mutex_init(&tier->lock, NULL);
+    pthread_cond_init(&tier->wake, NULL);
+
+    tier->threaded = ctx->threads != 1;
+    if (tier->threaded && pthread_create(&tier->thread, NULL, compile_requests, tier) != 0) {
+        NL_DEBUGF(ctx, "%s", "compiling hot functions without a thread of their own");
+        tier->threaded = false;
+    }
+    return tier;
+}
+
+void nl_tier_promote(struct nl_tier* tier, struct nl_vm_function* func)
+{
+    assert(func->code != NULL);
+
+    struct nl_jit_entry* entry = nl_jit_session_lower_entry(tier->session,
+            func->name, func->decl, func->instance, func->code);
+    if (NULL == entry) {
+        return;
+    }
+    if (!tier->threaded) {
+        publish(func, nl_jit_session_compile_entry(tier->session, entry));
+        return;
+    }
+
+    struct request* req = nl_arena_alloc(tier->ctx,
+            nl_arena(tier->ctx, NL_ARENA_CODEGEN), sizeof(*req));
+    req->func = func;
+    req->entry = entry;
+
+    pthread_mutex_lock(&tier->lock);
+    *tier->tail = req;
+    tier->tail = &req->next;
+    pthread_cond_signal(&tier->wake);
+    pthread_mutex_unlock(&tier->lock);
+}
+
+void nl_tier_destroy(struct nl_tier* tier)
+{
+    if (tier->threaded) {
+        pthread_mutex_lock(&tier->lock);
+        tier->done = true;
+        pthread_cond_signal(&tier->wake);
+        pthread_mutex_unlock(&tier->lock);
+        pthread_join(tier->thread, NULL);
+    }
+    pthread_cond_destroy(&tier->wake);
+    pthread_mutex_destroy(&tier->lock);
+    nl_jit_session_destroy(tier->session);
+}
@@ -0,0 +1,28 @@
+#ifndef NOLLI_TIER_H
+#define NOLLI_TIER_H
+
+#include "nolli.h"
+#include "vm.h"
+
+/**
+ * The native tier of a program run by the interpreter: hot functions
+ * are lowered to LLVM IR by the interpreter's thread, and optimized and
+ * compiled on a thread of the tier's own while the interpreter goes on.
+ * A function's native entry is published once it's ready.
+ */
+struct nl_tier;
+
+/** Lowers the whole program. Returns NULL after reporting an error. */
+struct nl_tier* nl_tier_create(struct nl_context* ctx, struct nl_ast* packages);
+
+/**
+ * Compiles the native entry of `func`, in the background unless the
+ * context is limited to one thread
+ */
+void nl_tier_promote(struct nl_tier* tier, struct nl_vm_function* func);
+
+/** Drops the functions still waiting to be compiled, waits for the one
+ * being compiled, if any, and frees the tier */
+void nl_tier_destroy(struct nl_tier* tier);
+
+#endif /* NOLLI_TIER_H */
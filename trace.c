@@ -0,0 +1,111 @@
+#include "trace.h"
+#include "stats.h"
+#include "debug.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <assert.h>
+
+struct nl_trace {
+    FILE *fp;
+    pthread_mutex_t lock;
+    double start;           /**< when the trace began, in seconds */
+    bool first;             /**< no event written yet */
+};
+
+/* threads are numbered as they first record a span, so their tracks
+ * are shown in a stable order */
+static unsigned int next_tid = 1;
+static __thread unsigned int tid = 0;
+
+static void write_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s != '\0'; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+int nl_set_trace_file(struct nl_context* ctx, const char* path)
+{
+    assert(ctx != NULL);
+
+    struct nl_trace *trace = ctx->trace;
+    if (trace != NULL) {
+        ctx->trace = NULL;
+        fputs("\n]\n", trace->fp);
+        int err = fclose(trace->fp);
+        pthread_mutex_destroy(&trace->lock);
+        nl_free(ctx, trace, sizeof(*trace));
+        if (err != 0) {
+            NL_ERROR(ctx, NL_ERR_IO, "Failed to close trace file");
+            return NL_ERR_IO;
+        }
+    }
+
+    if (NULL == path) {
+        return NL_NO_ERR;
+    }
+
+    FILE *fp = fopen(path, "w");
+    if (NULL == fp) {
+        NL_ERRORF(ctx, NL_ERR_IO, "Can't write to trace file %s", path);
+        return NL_ERR_IO;
+    }
+    fputs("[", fp);
+
+    trace = nl_alloc(ctx, sizeof(*trace));
+    trace->fp = fp;
+    pthread_mutex_init(&trace->lock, NULL);
+    trace->start = nl_clock();
+    trace->first = true;
+    ctx->trace = trace;
+    return NL_NO_ERR;
+}
+
+double nl_trace_begin(struct nl_context* ctx)
+{
+    return ctx->trace != NULL ? nl_clock() : 0.0;
+}
+
+void nl_trace_end(struct nl_context* ctx, const char* cat, const char* name,
+        const char* key, const char* value, double start)
+{
+    struct nl_trace *trace = ctx->trace;
+    if (NULL == trace || start == 0.0) {
+        return;
+    }
+    double end = nl_clock();
+
+    if (0 == tid) {
+        tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&trace->lock);
+    FILE *fp = trace->fp;
+    fputs(trace->first ? "\n" : ",\n", fp);
+    trace->first = false;
+    fputs("{\"name\":", fp);
+    write_string(fp, name);
+    fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":1,\"tid\":%u", cat,
+            (start - trace->start) * 1e6, (end - start) * 1e6, tid);
+    if (key != NULL && value != NULL) {
+        fputs(",\"args\":{", fp);
+        write_string(fp, key);
+        fputc(':', fp);
+        write_string(fp, value);
+        fputc('}', fp);
+    }
+    fputc('}', fp);
+    pthread_mutex_unlock(&trace->lock);
+}
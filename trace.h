@@ -0,0 +1,21 @@
+#ifndef NOLLI_TRACE_H
+#define NOLLI_TRACE_H
+
+#include "nolli.h"
+
+/**
+ * Starts a span. Returns when it started, or 0 if the context isn't
+ * tracing, in which case the matching nl_trace_end does nothing.
+ */
+double nl_trace_begin(struct nl_context* ctx);
+
+/**
+ * Ends a span begun at `start`, recording it as `name` in category `cat`.
+ * `key` and `value`, if not NULL, are attached to the span (e.g. the
+ * function it covers). Spans may be ended from any thread, and are shown
+ * on that thread's track.
+ */
+void nl_trace_end(struct nl_context* ctx, const char* cat, const char* name,
+        const char* key, const char* value, double start);
+
+#endif /* NOLLI_TRACE_H */
@@ -1,5 +1,6 @@
 #include "type.h"
 #include "nolli.h"
+#include "arena.h"
 
 #include <stdlib.h>
 
@@ -51,24 +52,12 @@ struct nl_type nl_tmpl_placeholder_type = {
     .n = 0
 };
 
-struct nl_type* nl_type_new_func(struct nl_context* ctx, struct nl_type *ret_type,
-        struct nl_type *param_types_head, unsigned int count)
-{
-    struct nl_type* func = nl_alloc(ctx, sizeof(*func));
-    func->tag = NL_TYPE_FUNC;
-
-    func->func.ret_type = ret_type;
-    func->func.param_types_head = param_types_head;
-    func->func.param_count = count;
-
-    return func;
-}
-
 struct nl_type* nl_type_new_class(struct nl_context* ctx, const char *name,
         struct nl_symtable *tmpls, struct nl_symtable *members,
         struct nl_symtable *methods)
 {
-    struct nl_type* user_type = nl_alloc(ctx, sizeof(*user_type));
+    struct nl_type* user_type = nl_arena_alloc(ctx,
+            nl_arena(ctx, NL_ARENA_ANALYSIS), sizeof(*user_type));
     user_type->tag = NL_TYPE_CLASS;
     user_type->repr = name;
 
@@ -82,7 +71,8 @@ struct nl_type* nl_type_new_class(struct nl_context* ctx, const char *name,
 struct nl_type* nl_type_new_interface(struct nl_context* ctx,
         const char *name, struct nl_symtable *methods)
 {
-    struct nl_type* user_type = nl_alloc(ctx, sizeof(*user_type));
+    struct nl_type* user_type = nl_arena_alloc(ctx,
+            nl_arena(ctx, NL_ARENA_ANALYSIS), sizeof(*user_type));
     user_type->tag = NL_TYPE_INTERFACE;
     user_type->repr = name;
 
@@ -91,24 +81,38 @@ struct nl_type* nl_type_new_interface(struct nl_context* ctx,
     return user_type;
 }
 
-struct nl_type* nl_type_new_reference(struct nl_context* ctx,
-        nl_string_t package_name, nl_string_t type_name)
+struct nl_type* nl_type_new_placeholder(struct nl_context* ctx,
+        const char *name, struct nl_type *owner, unsigned int index)
+{
+    struct nl_type* tp = nl_arena_alloc(ctx,
+            nl_arena(ctx, NL_ARENA_ANALYSIS), sizeof(*tp));
+    tp->tag = NL_TYPE_TMPL_PLACEHOLDER;
+    tp->repr = name;
+
+    tp->placeholder.owner = owner;
+    tp->placeholder.index = index;
+
+    return tp;
+}
+
+struct nl_type* nl_type_new_generic(struct nl_context* ctx, const char *name,
+        struct nl_ast *decl, struct nl_symtable *tmpls, unsigned int count)
 {
-    struct nl_type* tp = nl_alloc(ctx, sizeof(*tp));
-    tp->tag = NL_TYPE_REFERENCE;
-    tp->repr = "reference";  /* FIXME */
+    struct nl_type* tp = nl_arena_alloc(ctx,
+            nl_arena(ctx, NL_ARENA_ANALYSIS), sizeof(*tp));
+    tp->tag = NL_TYPE_GENERIC;
+    tp->repr = name;
 
-    tp->reference.package_name = package_name;
-    tp->reference.type_name = type_name;
+    tp->generic.decl = decl;
+    tp->generic.tmpl_types = tmpls;
+    tp->generic.tmpl_count = count;
 
     return tp;
 }
 
 bool nl_types_equal(struct nl_type *tp1, struct nl_type *tp2)
 {
-    /* FIXME: actually compare types */
-    if (tp1 == tp2) {
-        return true;
-    }
-    return false;
+    /* structural types are interned and named types are unique,
+     * so identity is equality */
+    return tp1 == tp2;
 }
@@ -18,13 +18,15 @@ enum {
     NL_TYPE_REFERENCE,
 
     NL_TYPE_TMPL_PLACEHOLDER,
+    NL_TYPE_TMPL_INSTANCE,
+    NL_TYPE_GENERIC,
 
     NL_TYPE_end
 };
 
 struct nl_type_func {
     struct nl_type *ret_type;
-    struct nl_type *param_types_head;
+    struct nl_type **param_types;
     unsigned int param_count;
 };
 
@@ -42,19 +44,41 @@ struct nl_type_reference {
     nl_string_t package_name, type_name;
 };
 
+struct nl_type_placeholder {
+    struct nl_type *owner;      /**< generic function or class declaring it */
+    unsigned int index;         /**< position in the owner's template */
+};
+
+struct nl_type_generic {
+    struct nl_type *func;           /**< signature in terms of placeholders */
+    struct nl_symtable *tmpl_types; /**< template names -> placeholders */
+    unsigned int tmpl_count;
+    struct nl_ast *decl;            /**< the generic NL_AST_FUNCTION */
+};
+
+struct nl_type_tmpl_instance {
+    struct nl_type *tmpl;       /**< the generic class being instantiated */
+    struct nl_type **args;
+    unsigned int arg_count;
+};
+
 struct nl_type {
     union {
         struct nl_type_func func;
         struct nl_type_class clss;
         struct nl_type_interface interface;
         struct nl_type_reference reference;
+        struct nl_type_tmpl_instance instance;
+        struct nl_type_placeholder placeholder;
+        struct nl_type_generic generic;
     };
 
-    struct nl_type *next;
+    struct nl_type *next;       /**< chains interned types in a bucket */
     const char* repr;
 
     int tag;
     unsigned int n;
+    unsigned int hash;          /**< structural hash of an interned type */
 };
 
 extern struct nl_type nl_bool_type;
@@ -64,17 +88,19 @@ extern struct nl_type nl_real_type;
 extern struct nl_type nl_str_type;
 extern struct nl_type nl_tmpl_placeholder_type;
 
-/* TODO: all types should be hashed when they are first parsed! */
-struct nl_type* nl_type_new_func(struct nl_context* ctx, struct nl_type *ret_type,
-        struct nl_type *param_types_head, unsigned int count);
 struct nl_type* nl_type_new_class(struct nl_context* ctx, const char *name,
         struct nl_symtable *tmpls, struct nl_symtable *members,
         struct nl_symtable *methods);
 struct nl_type* nl_type_new_interface(struct nl_context* ctx, const char *name,
         struct nl_symtable *methods);
-struct nl_type* nl_type_new_reference(struct nl_context* ctx,
-        nl_string_t package_name, nl_string_t type_name);
-
+struct nl_type* nl_type_new_placeholder(struct nl_context* ctx, const char *name,
+        struct nl_type *owner, unsigned int index);
+struct nl_type* nl_type_new_generic(struct nl_context* ctx, const char *name,
+        struct nl_ast *decl, struct nl_symtable *tmpls, unsigned int count);
+
+/* Function, reference and template instance types are structural and
+ * must be obtained from the context's type table (see typetab.h) so
+ * that equal types are always the same object */
 bool nl_types_equal(struct nl_type *tp1, struct nl_type *tp2);
 
 #endif /* NOLLI_TYPE_H */
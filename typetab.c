@@ -0,0 +1,214 @@
+#include "typetab.h"
+#include "nolli.h"
+#include "mem.h"
+#include "arena.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <stdio.h> /* for dumping table */
+
+enum {
+    NL_TYPETAB_MIN_SIZE = 64
+};
+
+static unsigned int mix(unsigned int h, const void *p)
+{
+    uint64_t x = ((uint64_t)(uintptr_t)p ^ h) * 0x9E3779B97F4A7C15ull;
+    return (unsigned int)(x >> 32);
+}
+
+static unsigned int hash_list(unsigned int h, struct nl_type **types, unsigned int count)
+{
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+        h = mix(h, types[i]);
+    }
+    return mix(h, (void*)(uintptr_t)count);
+}
+
+static bool same_list(struct nl_type **a, struct nl_type **b, unsigned int count)
+{
+    return count == 0 || memcmp(a, b, count * sizeof(*a)) == 0;
+}
+
+/* `key` is a stack type holding the structure being looked up */
+static bool same_structure(const struct nl_type *tp, const struct nl_type *key)
+{
+    if (tp->tag != key->tag || tp->hash != key->hash) {
+        return false;
+    }
+
+    switch (key->tag) {
+        case NL_TYPE_FUNC:
+            return tp->func.ret_type == key->func.ret_type &&
+                tp->func.param_count == key->func.param_count &&
+                same_list(tp->func.param_types, key->func.param_types,
+                        key->func.param_count);
+        case NL_TYPE_REFERENCE:
+            return tp->reference.package_name == key->reference.package_name &&
+                tp->reference.type_name == key->reference.type_name;
+        case NL_TYPE_TMPL_INSTANCE:
+            return tp->instance.tmpl == key->instance.tmpl &&
+                tp->instance.arg_count == key->instance.arg_count &&
+                same_list(tp->instance.args, key->instance.args,
+                        key->instance.arg_count);
+        default:
+            assert(false);
+            return false;
+    }
+}
+
+static void grow(struct nl_context* ctx, struct nl_typetab *tab)
+{
+    unsigned int old_size = tab->size;
+    struct nl_type **old_buckets = tab->buckets;
+
+    tab->size = old_size * 2;
+    tab->buckets = nl_alloc_tagged(ctx, tab->size * sizeof(*tab->buckets), NL_MEM_TYPES);
+
+    unsigned int i;
+    for (i = 0; i < old_size; i++) {
+        struct nl_type *tp = old_buckets[i];
+        while (tp != NULL) {
+            struct nl_type *next = tp->next;
+            unsigned int idx = tp->hash & (tab->size - 1);
+            tp->next = tab->buckets[idx];
+            tab->buckets[idx] = tp;
+            tp = next;
+        }
+    }
+
+    nl_free(ctx, old_buckets, old_size * sizeof(*old_buckets));
+}
+
+static struct nl_type **copy_list(struct nl_context* ctx,
+        struct nl_type **types, unsigned int count)
+{
+    if (count == 0) {
+        return NULL;
+    }
+    struct nl_type **copy = nl_arena_alloc(ctx, nl_arena(ctx, NL_ARENA_ANALYSIS),
+            count * sizeof(*copy));
+    memcpy(copy, types, count * sizeof(*copy));
+    return copy;
+}
+
+/* Returns the interned equivalent of `key`, creating it if necessary */
+static struct nl_type *intern(struct nl_context* ctx, struct nl_typetab *tab,
+        const struct nl_type *key)
+{
+    pthread_mutex_lock(&tab->lock);
+
+    unsigned int idx = key->hash & (tab->size - 1);
+    struct nl_type *tp = tab->buckets[idx];
+    while (tp != NULL) {
+        if (same_structure(tp, key)) {
+            pthread_mutex_unlock(&tab->lock);
+            return tp;
+        }
+        tp = tp->next;
+    }
+
+    tp = nl_arena_alloc(ctx, nl_arena(ctx, NL_ARENA_ANALYSIS), sizeof(*tp));
+    *tp = *key;
+    switch (key->tag) {
+        case NL_TYPE_FUNC:
+            tp->func.param_types = copy_list(ctx, key->func.param_types,
+                    key->func.param_count);
+            break;
+        case NL_TYPE_TMPL_INSTANCE:
+            tp->instance.args = copy_list(ctx, key->instance.args,
+                    key->instance.arg_count);
+            break;
+        default:
+            break;
+    }
+
+    if (tab->count + 1 > tab->size) {
+        grow(ctx, tab);
+        idx = key->hash & (tab->size - 1);
+    }
+    tp->next = tab->buckets[idx];
+    tab->buckets[idx] = tp;
+    tab->count++;
+
+    pthread_mutex_unlock(&tab->lock);
+    return tp;
+}
+
+int nl_typetab_init(struct nl_context* ctx, struct nl_typetab *tab)
+{
+    tab->size = NL_TYPETAB_MIN_SIZE;
+    tab->count = 0;
+    tab->buckets = nl_alloc_tagged(ctx, tab->size * sizeof(*tab->buckets), NL_MEM_TYPES);
+    pthread_mutex_init(&tab->lock, NULL);
+
+    return NL_NO_ERR;
+}
+
+void nl_typetab_reset(struct nl_context* ctx, struct nl_typetab *tab)
+{
+    /* the types themselves are freed with the analysis arena */
+    memset(tab->buckets, 0, tab->size * sizeof(*tab->buckets));
+    tab->count = 0;
+}
+
+void nl_typetab_deinit(struct nl_context* ctx, struct nl_typetab *tab)
+{
+    nl_free(ctx, tab->buckets, tab->size * sizeof(*tab->buckets));
+    tab->buckets = NULL;
+    tab->size = tab->count = 0;
+    pthread_mutex_destroy(&tab->lock);
+}
+
+struct nl_type* nl_typetab_func(struct nl_context* ctx, struct nl_typetab *tab,
+        struct nl_type *ret_type, struct nl_type **param_types,
+        unsigned int count)
+{
+    struct nl_type key = {
+        .func = {ret_type, param_types, count},
+        .repr = "func",
+        .tag = NL_TYPE_FUNC
+    };
+    key.hash = hash_list(mix(NL_TYPE_FUNC, ret_type), param_types, count);
+    return intern(ctx, tab, &key);
+}
+
+struct nl_type* nl_typetab_reference(struct nl_context* ctx,
+        struct nl_typetab *tab, nl_string_t package_name, nl_string_t type_name)
+{
+    struct nl_type key = {
+        .reference = {package_name, type_name},
+        .repr = "reference",  /* FIXME */
+        .tag = NL_TYPE_REFERENCE
+    };
+    key.hash = mix(mix(NL_TYPE_REFERENCE, package_name), type_name);
+    return intern(ctx, tab, &key);
+}
+
+struct nl_type* nl_typetab_tmpl_instance(struct nl_context* ctx,
+        struct nl_typetab *tab, struct nl_type *tmpl, struct nl_type **args,
+        unsigned int count)
+{
+    struct nl_type key = {
+        .instance = {tmpl, args, count},
+        .repr = tmpl->repr,
+        .tag = NL_TYPE_TMPL_INSTANCE
+    };
+    key.hash = hash_list(mix(NL_TYPE_TMPL_INSTANCE, tmpl), args, count);
+    return intern(ctx, tab, &key);
+}
+
+void nl_typetab_dump(struct nl_typetab *tab)
+{
+    unsigned int i;
+    for (i = 0; i < tab->size; i++) {
+        const struct nl_type *tp = tab->buckets[i];
+        while (tp != NULL) {
+            printf("%u: %s (%p)\n", i, tp->repr, (void*)tp);
+            tp = tp->next;
+        }
+    }
+    printf("%u types in %u buckets\n", tab->count, tab->size);
+}
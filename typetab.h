@@ -0,0 +1,46 @@
+#ifndef NOLLI_TYPETAB_H
+#define NOLLI_TYPETAB_H
+
+#include "type.h"
+
+#include <pthread.h>
+
+/**
+ * Hash-consing table of structural types.
+ *
+ * Every function, package reference and template instance type is
+ * created through this table, so two structurally equal types are
+ * always the same `nl_type` and can be compared by pointer. The table
+ * may be used from several threads at once.
+ */
+struct nl_typetab {
+    struct nl_type **buckets;   /**< chains of types linked through `next` */
+    unsigned int size;          /**< number of buckets (a power of two) */
+    unsigned int count;         /**< number of interned types */
+    pthread_mutex_t lock;
+};
+
+int nl_typetab_init(struct nl_context* ctx, struct nl_typetab *tab);
+
+/** Forgets every interned type */
+void nl_typetab_reset(struct nl_context* ctx, struct nl_typetab *tab);
+
+void nl_typetab_deinit(struct nl_context* ctx, struct nl_typetab *tab);
+
+/** Returns the unique function type (`params` is copied) */
+struct nl_type* nl_typetab_func(struct nl_context* ctx, struct nl_typetab *tab,
+        struct nl_type *ret_type, struct nl_type **param_types,
+        unsigned int count);
+
+/** Returns the unique reference to type_name in package_name */
+struct nl_type* nl_typetab_reference(struct nl_context* ctx,
+        struct nl_typetab *tab, nl_string_t package_name, nl_string_t type_name);
+
+/** Returns the unique instance of a generic type (`args` is copied) */
+struct nl_type* nl_typetab_tmpl_instance(struct nl_context* ctx,
+        struct nl_typetab *tab, struct nl_type *tmpl, struct nl_type **args,
+        unsigned int count);
+
+void nl_typetab_dump(struct nl_typetab *tab);
+
+#endif /* NOLLI_TYPETAB_H */
@@ -0,0 +1,528 @@
+#include "vm.h"
+#include "tier.h"
+#include "symtable.h"
+#include "builtins.h"
+#include "walk.h"
+#include "stats.h"
+#include "trace.h"
+#include "mem.h"
+#include "arena.h"
+#include "debug.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+enum {
+    NL_VM_STACK_SIZE = 1 << 20,     /**< registers of all running frames */
+    NL_VM_HOT = 10000,              /**< calls and loop iterations before promotion */
+};
+
+struct nl_vm_call {
+    struct nl_vm_function* func;    /**< the caller */
+    const struct nl_insn* pc;       /**< where it resumes */
+    union nl_value* frame;
+};
+
+static struct nl_vm_function* new_function(struct nl_vm_program* program,
+        nl_string_t name, struct nl_ast* decl, struct nl_instance* inst)
+{
+    struct nl_context* ctx = program->ctx;
+    struct nl_vm_function* func = nl_arena_alloc(ctx, nl_arena(ctx, NL_ARENA_CODEGEN),
+            sizeof(*func));
+    func->name = name;
+    func->decl = decl;
+    func->instance = inst;
+    nl_symtable_add(ctx, program->functions, name, func);
+    return func;
+}
+
+struct nl_vm_function* nl_vm_function(struct nl_vm_program* program, nl_string_t name)
+{
+    return nl_symtable_get(program->functions, name);
+}
+
+struct nl_vm_function* nl_vm_instance(struct nl_vm_program* program,
+        struct nl_instance* inst)
+{
+    struct nl_vm_function* func = nl_symtable_get(program->functions, inst->name);
+    if (NULL == func) {
+        func = new_function(program, inst->name, inst->generic->generic.decl, inst);
+    }
+    return func;
+}
+
+/* Collects the functions of every package; generics get a function per
+ * instance once called (see nl_vm_instance) */
+static bool collect_function(struct nl_walk* walk, struct nl_walk_frame* frame)
+{
+    struct nl_vm_program* program = walk->data;
+    struct nl_ast* node = frame->node;
+
+    switch (node->tag) {
+    case NL_AST_FUNCTION:
+        if (NULL == node->function.type->func_type.tmpl) {
+            new_function(program, node->function.name->s, node, NULL);
+        }
+        return false;
+    case NL_AST_UNIT:
+    case NL_AST_PACKAGE:
+    case NL_AST_LIST_UNITS:
+    case NL_AST_LIST_PACKAGES:
+    case NL_AST_LIST_GLOBALS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Formats like C's printf, which the native tier calls with the same
+ * arguments: `int`s are 64 bits wide, so a conversion without a length
+ * modifier only sees the low half of one */
+static int64_t vm_printf(const union nl_value* args, unsigned int count)
+{
+    const char* fmt = args[0].s;
+    unsigned int next = 1;
+    int64_t written = 0;
+
+#define NEXT_ARG() (next < count ? args[next++] : (union nl_value){.i=0})
+
+    while (*fmt != '\0') {
+        const char* percent = strchr(fmt, '%');
+        size_t len = percent != NULL ? (size_t)(percent - fmt) : strlen(fmt);
+        fwrite(fmt, 1, len, stdout);
+        written += len;
+        if (NULL == percent) {
+            break;
+        }
+
+        /* copy the conversion, widening integers and filling in `*`s */
+        char spec[64] = "%";
+        size_t n = 1;
+        const char* p = percent + 1;
+        while (*p != '\0' && strchr("-+ #0'", *p) != NULL && n < 16) {
+            spec[n++] = *p++;
+        }
+        while (*p != '\0' && (strchr("0123456789.", *p) != NULL || *p == '*') && n < 40) {
+            if (*p == '*') {
+                n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)NEXT_ARG().i);
+                p++;
+            } else {
+                spec[n++] = *p++;
+            }
+        }
+        bool wide = false;
+        while (*p != '\0' && strchr("hlLqjzt", *p) != NULL) {
+            if (*p == 'h' && n < 44) {
+                spec[n++] = 'h';
+            } else if (*p != 'h' && *p != 'L') {
+                wide = true;
+            }
+            p++;
+        }
+        if (*p == '\0') {
+            fputs(percent, stdout);
+            written += strlen(percent);
+            break;
+        }
+        if (wide) {
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+        }
+        spec[n++] = *p;
+        spec[n] = '\0';
+
+        int out = 0;
+        switch (*p) {
+        case '%':
+            out = putchar('%') != EOF;
+            break;
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            if (wide) {
+                out = printf(spec, (long long)NEXT_ARG().i);
+            } else {
+                out = printf(spec, (int)NEXT_ARG().i);
+            }
+            break;
+        case 'c':
+            out = printf(spec, (int)NEXT_ARG().i);
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            out = printf(spec, NEXT_ARG().r);
+            break;
+        case 's':
+            out = printf(spec, NEXT_ARG().s);
+            break;
+        case 'p':
+            out = printf(spec, (void*)NEXT_ARG().s);
+            break;
+        case 'n':
+            NEXT_ARG();
+            break;
+        default:
+            out = printf("%.*s", (int)(p + 1 - percent), percent);
+            break;
+        }
+        if (out > 0) {
+            written += out;
+        }
+        fmt = p + 1;
+    }
+#undef NEXT_ARG
+    return written;
+}
+
+/* Compiles a function's bytecode on its first call */
+static bool prepare(struct nl_vm_program* program, struct nl_vm_function* func)
+{
+    if (func->code != NULL) {
+        return true;
+    }
+    int phase = nl_stats_enter(program->ctx, NL_PHASE_BYTECODE);
+    func->code = nl_bytecode_compile(program->ctx, program, func);
+    nl_stats_enter(program->ctx, phase);
+    return func->code != NULL;
+}
+
+/* Returns the native entry of a hot function, once it's compiled. The
+ * program's native tier is created when the first function gets hot. */
+static nl_native_entry hot(struct nl_vm_program* program, struct nl_vm_function* func)
+{
+#ifdef NOLLI_WITH_LLVM
+    if (!func->promoted) {
+        func->promoted = true;
+        if (NULL == program->tier) {
+            program->tier = nl_tier_create(program->ctx, program->packages);
+            program->tiering = program->tier != NULL;
+        }
+        if (program->tier != NULL) {
+            nl_tier_promote(program->tier, func);
+        }
+    }
+#endif
+    return __atomic_load_n(&func->native, __ATOMIC_ACQUIRE);
+}
+
+static struct nl_vm_call* push_call(struct nl_vm_program* program, unsigned int depth)
+{
+    if (depth == program->call_size) {
+        unsigned int size = program->call_size ? program->call_size * 2 : 64;
+        program->calls = nl_realloc_tagged(program->ctx, program->calls,
+                program->call_size * sizeof(*program->calls),
+                size * sizeof(*program->calls), NL_MEM_VM);
+        program->call_size = size;
+    }
+    return &program->calls[depth];
+}
+
+/* Where the compiler supports it, each handler jumps straight to the next
+ * instruction's through a table of labels, rather than back to a single
+ * switch whose branch the CPU can hardly predict */
+#if defined(__GNUC__) && !defined(NL_VM_SWITCH_DISPATCH)
+#define NL_VM_COMPUTED_GOTO
+#endif
+
+#ifdef NL_VM_COMPUTED_GOTO
+#define VM_SWITCH
+#define OP(name) op_##name
+#define DISPATCH() goto *dispatch[(i = pc++)->op]
+#else
+#define VM_SWITCH next: i = pc++; switch (i->op)
+#define OP(name) case NL_OP_##name
+#define DISPATCH() goto next
+#endif
+
+/* Runs `func`, whose arguments are at the bottom of the stack. Calls
+ * between interpreted functions don't nest on the C stack. */
+static int execute(struct nl_vm_program* program, struct nl_vm_function* func,
+        union nl_value* result)
+{
+    struct nl_context* ctx = program->ctx;
+    const union nl_value* stack_end = program->stack + program->stack_size;
+    union nl_value* r = program->stack;
+    unsigned int depth = 0;
+    union nl_value value;
+
+    if (!prepare(program, func)) {
+        return NL_ERR_JIT;
+    }
+    const struct nl_code* code = func->code;
+    const struct nl_insn* pc = code->insns;
+
+#ifdef NL_VM_COMPUTED_GOTO
+    static const void* const dispatch[NL_OP_COUNT] = {
+        [NL_OP_MOVE] = &&op_MOVE,
+        [NL_OP_LOADK] = &&op_LOADK,
+        [NL_OP_ADDI] = &&op_ADDI,
+        [NL_OP_SUBI] = &&op_SUBI,
+        [NL_OP_MULI] = &&op_MULI,
+        [NL_OP_DIVI] = &&op_DIVI,
+        [NL_OP_LTI] = &&op_LTI,
+        [NL_OP_LEI] = &&op_LEI,
+        [NL_OP_GTI] = &&op_GTI,
+        [NL_OP_GEI] = &&op_GEI,
+        [NL_OP_EQI] = &&op_EQI,
+        [NL_OP_NEI] = &&op_NEI,
+        [NL_OP_ADDR] = &&op_ADDR,
+        [NL_OP_SUBR] = &&op_SUBR,
+        [NL_OP_MULR] = &&op_MULR,
+        [NL_OP_DIVR] = &&op_DIVR,
+        [NL_OP_LTR] = &&op_LTR,
+        [NL_OP_LER] = &&op_LER,
+        [NL_OP_GTR] = &&op_GTR,
+        [NL_OP_GER] = &&op_GER,
+        [NL_OP_EQR] = &&op_EQR,
+        [NL_OP_NER] = &&op_NER,
+        [NL_OP_JMP] = &&op_JMP,
+        [NL_OP_JMPF] = &&op_JMPF,
+        [NL_OP_LOOP] = &&op_LOOP,
+        [NL_OP_CALL] = &&op_CALL,
+        [NL_OP_PRINTF] = &&op_PRINTF,
+        [NL_OP_RET] = &&op_RET,
+    };
+#endif
+    const struct nl_insn* i;
+    DISPATCH();
+    VM_SWITCH {
+        OP(MOVE):
+            r[i->a] = r[i->b];
+            DISPATCH();
+        OP(LOADK):
+            r[i->a] = code->constants[i->index];
+            DISPATCH();
+
+        /* `int` arithmetic wraps around, like the native tier's */
+        OP(ADDI):
+            r[i->a].i = (int64_t)((uint64_t)r[i->b].i + (uint64_t)r[i->c].i);
+            DISPATCH();
+        OP(SUBI):
+            r[i->a].i = (int64_t)((uint64_t)r[i->b].i - (uint64_t)r[i->c].i);
+            DISPATCH();
+        OP(MULI):
+            r[i->a].i = (int64_t)((uint64_t)r[i->b].i * (uint64_t)r[i->c].i);
+            DISPATCH();
+        OP(DIVI):
+            r[i->a].i = r[i->b].i / r[i->c].i;
+            DISPATCH();
+        OP(LTI):
+            r[i->a].i = r[i->b].i < r[i->c].i;
+            DISPATCH();
+        OP(LEI):
+            r[i->a].i = r[i->b].i <= r[i->c].i;
+            DISPATCH();
+        OP(GTI):
+            r[i->a].i = r[i->b].i > r[i->c].i;
+            DISPATCH();
+        OP(GEI):
+            r[i->a].i = r[i->b].i >= r[i->c].i;
+            DISPATCH();
+        OP(EQI):
+            r[i->a].i = r[i->b].i == r[i->c].i;
+            DISPATCH();
+        OP(NEI):
+            r[i->a].i = r[i->b].i != r[i->c].i;
+            DISPATCH();
+
+        OP(ADDR):
+            r[i->a].r = r[i->b].r + r[i->c].r;
+            DISPATCH();
+        OP(SUBR):
+            r[i->a].r = r[i->b].r - r[i->c].r;
+            DISPATCH();
+        OP(MULR):
+            r[i->a].r = r[i->b].r * r[i->c].r;
+            DISPATCH();
+        OP(DIVR):
+            r[i->a].r = r[i->b].r / r[i->c].r;
+            DISPATCH();
+        OP(LTR):
+            r[i->a].i = r[i->b].r < r[i->c].r;
+            DISPATCH();
+        OP(LER):
+            r[i->a].i = r[i->b].r <= r[i->c].r;
+            DISPATCH();
+        OP(GTR):
+            r[i->a].i = r[i->b].r > r[i->c].r;
+            DISPATCH();
+        OP(GER):
+            r[i->a].i = r[i->b].r >= r[i->c].r;
+            DISPATCH();
+        OP(EQR):
+            r[i->a].i = r[i->b].r == r[i->c].r;
+            DISPATCH();
+        OP(NER):
+            /* ordered, like the native tier's */
+            r[i->a].i = r[i->b].r < r[i->c].r || r[i->b].r > r[i->c].r;
+            DISPATCH();
+
+        OP(JMP):
+            pc = code->insns + i->target;
+            DISPATCH();
+        OP(JMPF):
+            if (!r[i->a].i) {
+                pc = code->insns + i->target;
+            }
+            DISPATCH();
+        OP(LOOP):
+            pc = code->insns + i->target;
+            if (program->tiering && ++func->hotness >= NL_VM_HOT) {
+                /* the native tier takes the frame over at the loop's head */
+                nl_native_entry native = hot(program, func);
+                if (native != NULL) {
+                    native(r, i->a, &value);
+                    goto leave;
+                }
+            }
+            DISPATCH();
+
+        OP(CALL): {
+            struct nl_vm_function* callee = code->callees[i->b];
+            union nl_value* frame = r + i->a;
+            if (!prepare(program, callee)) {
+                return NL_ERR_JIT;
+            }
+            if (frame + callee->code->register_count > stack_end) {
+                NL_ERRORF(ctx, NL_ERR_JIT, "stack overflow calling %s", callee->name);
+                return NL_ERR_JIT;
+            }
+            if (program->tiering && ++callee->hotness >= NL_VM_HOT) {
+                nl_native_entry native = hot(program, callee);
+                if (native != NULL) {
+                    native(frame, 0, &value);
+                    frame[0] = value;
+                    DISPATCH();
+                }
+            }
+            struct nl_vm_call* call = push_call(program, depth++);
+            call->func = func;
+            call->pc = pc;
+            call->frame = r;
+            func = callee;
+            code = callee->code;
+            pc = code->insns;
+            r = frame;
+            DISPATCH();
+        }
+        OP(PRINTF):
+            r[i->a].i = vm_printf(r + i->a, i->c);
+            DISPATCH();
+        OP(RET):
+            value = r[i->a];
+        leave: {
+            if (0 == depth) {
+                *result = value;
+                return NL_NO_ERR;
+            }
+            /* a callee's frame starts at the caller's result register */
+            r[0] = value;
+            struct nl_vm_call* call = &program->calls[--depth];
+            func = call->func;
+            code = func->code;
+            pc = call->pc;
+            r = call->frame;
+            DISPATCH();
+        }
+#ifndef NL_VM_COMPUTED_GOTO
+        default:
+            assert(false);
+            return NL_ERR_JIT;
+#endif
+    }
+}
+
+#undef VM_SWITCH
+#undef OP
+#undef DISPATCH
+
+#ifndef NOLLI_WITH_LLVM
+int nl_jit(struct nl_context* ctx, struct nl_ast* packages, int* return_code)
+{
+    NL_ERROR(ctx, NL_ERR_JIT, "nolli was built without LLVM");
+    return NL_ERR_JIT;
+}
+
+int nl_build(struct nl_context* ctx, struct nl_ast* packages, const char* path, int kind)
+{
+    NL_ERROR(ctx, NL_ERR_JIT, "nolli was built without LLVM");
+    return NL_ERR_JIT;
+}
+
+struct nl_session* nl_session_create(struct nl_context* ctx)
+{
+    NL_ERROR(ctx, NL_ERR_JIT, "nolli was built without LLVM");
+    return NULL;
+}
+
+int nl_session_add(struct nl_session* session, struct nl_ast* packages)
+{
+    return NL_ERR_JIT;
+}
+
+void* nl_session_lookup(struct nl_session* session, const char* name)
+{
+    return NULL;
+}
+
+int nl_session_destroy(struct nl_session* session)
+{
+    return NL_NO_ERR;
+}
+#endif
+
+int nl_run(struct nl_context* ctx, struct nl_ast* packages, int* return_code)
+{
+    assert(ctx);
+    assert(ctx->ast_list);
+
+    if (NL_BACKEND_JIT == ctx->backend) {
+        return nl_jit(ctx, packages, return_code);
+    }
+
+    struct nl_vm_program program = {
+        .ctx=ctx,
+        .packages=packages,
+        .functions=nl_symtable_create(ctx, NULL),
+        .printf_name=nl_builtin_str(NL_BUILTIN_PRINTF),
+        .stack_size=NL_VM_STACK_SIZE,
+#ifdef NOLLI_WITH_LLVM
+        .tiering=NL_BACKEND_TIERED == ctx->backend,
+#endif
+    };
+    program.stack = nl_malloc_tagged(ctx, program.stack_size * sizeof(*program.stack),
+            NL_MEM_VM);
+
+    struct nl_walk walk;
+    nl_walk_init(&walk, ctx, &program);
+    walk.pre = collect_function;
+    nl_walk(&walk, packages);
+    nl_walk_deinit(&walk);
+
+    int err = NL_NO_ERR;
+    struct nl_vm_function* main_func = nl_vm_function(&program,
+            nl_builtin_str(NL_BUILTIN_MAIN));
+    if (NULL == main_func) {
+        NL_ERROR(ctx, NL_ERR_JIT, "no main function");
+        err = NL_ERR_JIT;
+    } else {
+        double start = nl_trace_begin(ctx);
+        union nl_value result = {.i=0};
+        err = execute(&program, main_func, &result);
+        nl_trace_end(ctx, "run", "main", NULL, NULL, start);
+        if (NL_NO_ERR == err) {
+            *return_code = (int32_t)result.i;
+            NL_DEBUGF(ctx, "main evaluated to: %d", *return_code);
+        }
+    }
+
+#ifdef NOLLI_WITH_LLVM
+    if (program.tier != NULL) {
+        nl_tier_destroy(program.tier);
+    }
+#endif
+    nl_free(ctx, program.calls, program.call_size * sizeof(*program.calls));
+    nl_free(ctx, program.stack, program.stack_size * sizeof(*program.stack));
+    nl_symtable_destroy(ctx, program.functions);
+    nl_arena_reset(ctx, nl_arena(ctx, NL_ARENA_CODEGEN));
+    return err;
+}
@@ -0,0 +1,46 @@
+#ifndef NOLLI_VM_H
+#define NOLLI_VM_H
+
+#include "nolli.h"
+#include "bytecode.h"
+#include "gen.h"
+#include "instance.h"
+#include "strtab.h"
+
+#include <stdbool.h>
+
+/** A function of a program run by the interpreter */
+struct nl_vm_function {
+    nl_string_t name;
+    struct nl_ast* decl;            /**< its NL_AST_FUNCTION */
+    struct nl_instance* instance;   /**< of the generic `decl`, or NULL */
+    struct nl_code* code;           /**< NULL until first called */
+    unsigned long hotness;          /**< calls and loop iterations so far */
+    bool promoted;                  /**< handed to the native tier */
+    nl_native_entry native;         /**< set once the native tier compiled it */
+};
+
+struct nl_vm_call;
+struct nl_tier;
+
+struct nl_vm_program {
+    struct nl_context* ctx;
+    struct nl_ast* packages;
+    struct nl_symtable* functions;  /**< name -> struct nl_vm_function* */
+    nl_string_t printf_name;
+    union nl_value* stack;
+    unsigned int stack_size;
+    struct nl_vm_call* calls;       /**< frames of the functions running */
+    unsigned int call_size;
+    struct nl_tier* tier;           /**< NULL until a function gets hot */
+    bool tiering;                   /**< hot functions may be promoted */
+};
+
+/** Returns the function `name` of the program, or NULL */
+struct nl_vm_function* nl_vm_function(struct nl_vm_program* program, nl_string_t name);
+
+/** Returns the function for a (closed, current) generic instance */
+struct nl_vm_function* nl_vm_instance(struct nl_vm_program* program,
+        struct nl_instance* inst);
+
+#endif /* NOLLI_VM_H */
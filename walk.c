@@ -0,0 +1,245 @@
+#include "walk.h"
+
+#include <string.h>
+#include <assert.h>
+
+enum { NL_WALK_MAX_SLOTS = 4 };
+
+/* Fills `slots` with the (possibly NULL) children of a non-list node,
+ * in source order, and returns how many slots it has */
+static unsigned int children(struct nl_ast *node, struct nl_ast **slots)
+{
+    switch (node->tag) {
+    case NL_AST_CLASS_LIT:
+        slots[0] = node->class_lit.type;
+        slots[1] = node->class_lit.tmpl;
+        slots[2] = node->class_lit.items;
+        return 3;
+    case NL_AST_UNEXPR:
+        slots[0] = node->unexpr.expr;
+        return 1;
+    case NL_AST_BINEXPR:
+        slots[0] = node->binexpr.lhs;
+        slots[1] = node->binexpr.rhs;
+        return 2;
+    case NL_AST_CALL:
+    case NL_AST_CALL_STMT:
+        slots[0] = node->call.func;
+        slots[1] = node->call.args;
+        return 2;
+    case NL_AST_KEYVAL:
+        slots[0] = node->keyval.key;
+        slots[1] = node->keyval.val;
+        return 2;
+    case NL_AST_LOOKUP:
+        slots[0] = node->lookup.container;
+        slots[1] = node->lookup.index;
+        return 2;
+    case NL_AST_SELECTOR:
+        slots[0] = node->selector.parent;
+        slots[1] = node->selector.child;
+        return 2;
+    case NL_AST_PACKAGE_REF:
+        slots[0] = node->package_ref.package;
+        slots[1] = node->package_ref.name;
+        return 2;
+    case NL_AST_FUNCTION:
+        slots[0] = node->function.name;
+        slots[1] = node->function.type;
+        slots[2] = node->function.body;
+        return 3;
+    case NL_AST_TMPL_TYPE:
+        slots[0] = node->tmpl_type.name;
+        slots[1] = node->tmpl_type.tmpls;
+        return 2;
+    case NL_AST_QUAL_TYPE:
+        slots[0] = node->qual_type.package;
+        slots[1] = node->qual_type.name;
+        return 2;
+    case NL_AST_FUNC_TYPE:
+        slots[0] = node->func_type.tmpl;
+        slots[1] = node->func_type.ret_type;
+        slots[2] = node->func_type.params;
+        return 3;
+    case NL_AST_DECL:
+        slots[0] = node->decl.type;
+        slots[1] = node->decl.rhs;
+        return 2;
+    case NL_AST_INIT:
+        slots[0] = node->init.ident;
+        slots[1] = node->init.expr;
+        return 2;
+    case NL_AST_BIND:
+        slots[0] = node->bind.ident;
+        slots[1] = node->bind.expr;
+        return 2;
+    case NL_AST_ASSIGN:
+        slots[0] = node->assignment.lhs;
+        slots[1] = node->assignment.expr;
+        return 2;
+    case NL_AST_IFELSE:
+        slots[0] = node->ifelse.cond;
+        slots[1] = node->ifelse.if_body;
+        slots[2] = node->ifelse.else_body;
+        return 3;
+    case NL_AST_WHILE:
+        slots[0] = node->while_loop.cond;
+        slots[1] = node->while_loop.body;
+        return 2;
+    case NL_AST_FOR:
+        slots[0] = node->for_loop.var;
+        slots[1] = node->for_loop.range;
+        slots[2] = node->for_loop.body;
+        return 3;
+    case NL_AST_RETURN:
+        slots[0] = node->ret.expr;
+        return 1;
+    case NL_AST_ALIAS:
+        slots[0] = node->alias.type;
+        slots[1] = node->alias.name;
+        return 2;
+    case NL_AST_USING:
+        slots[0] = node->usings.names;
+        return 1;
+    case NL_AST_CLASS:
+        slots[0] = node->classdef.name;
+        slots[1] = node->classdef.tmpl;
+        slots[2] = node->classdef.members;
+        slots[3] = node->classdef.methods;
+        return 4;
+    case NL_AST_INTERFACE:
+        slots[0] = node->interface.name;
+        slots[1] = node->interface.methods;
+        return 2;
+    case NL_AST_PACKAGE:
+        slots[0] = node->package.name;
+        slots[1] = node->package.globals;
+        return 2;
+    case NL_AST_UNIT:
+        slots[0] = node->unit.packages;
+        return 1;
+    default:
+        /* literals, identifiers, break and continue */
+        return 0;
+    }
+}
+
+static bool is_list(const struct nl_ast *node)
+{
+    return node->tag == NL_AST_LIST_LIT || node->tag == NL_AST_MAP_LIT ||
+        node->tag > NL_AST_LIST_SENTINEL;
+}
+
+/* Returns the next child of the top frame to visit, or NULL */
+static struct nl_ast *next_child(struct nl_walk_frame *frame)
+{
+    struct nl_ast *node = frame->node;
+    if (is_list(node)) {
+        struct nl_ast *elem = frame->next;
+        if (elem != NULL) {
+            frame->next = elem->next;
+        }
+        return elem;
+    }
+
+    struct nl_ast *slots[NL_WALK_MAX_SLOTS];
+    unsigned int count = children(node, slots);
+    while (frame->index < count) {
+        struct nl_ast *child = slots[frame->index];
+        if (child != NULL) {
+            return child;
+        }
+        frame->index++;
+    }
+    return NULL;
+}
+
+static struct nl_walk_frame *push(struct nl_walk *walk, struct nl_ast *node)
+{
+    if (walk->depth == walk->size) {
+        unsigned int size = walk->size * 2;
+        struct nl_walk_frame *frames = nl_malloc(walk->ctx, size * sizeof(*frames));
+        memcpy(frames, walk->frames, walk->size * sizeof(*frames));
+        if (walk->frames != walk->inline_frames) {
+            nl_free(walk->ctx, walk->frames, walk->size * sizeof(*frames));
+        }
+        walk->frames = frames;
+        walk->size = size;
+    }
+
+    struct nl_walk_frame *frame = &walk->frames[walk->depth++];
+    *frame = (struct nl_walk_frame){.node=node};
+    if (is_list(node)) {
+        frame->next = node->list.head;
+    }
+    return frame;
+}
+
+void nl_walk_init(struct nl_walk *walk, struct nl_context *ctx, void *data)
+{
+    walk->ctx = ctx;
+    walk->pre = NULL;
+    walk->child = NULL;
+    walk->post = NULL;
+    walk->data = data;
+    walk->frames = walk->inline_frames;
+    walk->depth = 0;
+    walk->size = NL_WALK_INLINE_FRAMES;
+}
+
+void nl_walk_deinit(struct nl_walk *walk)
+{
+    if (walk->frames != walk->inline_frames) {
+        nl_free(walk->ctx, walk->frames, walk->size * sizeof(*walk->frames));
+    }
+    walk->frames = walk->inline_frames;
+    walk->depth = 0;
+    walk->size = NL_WALK_INLINE_FRAMES;
+}
+
+struct nl_walk_frame *nl_walk_parent(const struct nl_walk *walk,
+        const struct nl_walk_frame *frame)
+{
+    return frame > walk->frames ? (struct nl_walk_frame*)frame - 1 : NULL;
+}
+
+void nl_walk(struct nl_walk *walk, struct nl_ast *root)
+{
+    assert(root);
+    assert(walk->depth == 0);
+
+    struct nl_walk_frame *frame = push(walk, root);
+    if (walk->pre != NULL && !walk->pre(walk, frame)) {
+        walk->depth--;
+        return;
+    }
+
+    while (walk->depth > 0) {
+        frame = &walk->frames[walk->depth - 1];
+        struct nl_ast *child = next_child(frame);
+        if (child != NULL) {
+            struct nl_walk_frame *next = push(walk, child);
+            if (walk->pre == NULL || walk->pre(walk, next)) {
+                continue;
+            }
+            walk->depth--;
+        } else {
+            if (walk->post != NULL) {
+                walk->post(walk, frame);
+            }
+            walk->depth--;
+            if (walk->depth == 0) {
+                break;
+            }
+        }
+
+        /* a child has been walked (or skipped): tell its parent */
+        frame = &walk->frames[walk->depth - 1];
+        unsigned int index = frame->index++;
+        if (walk->child != NULL && !walk->child(walk, frame, index)) {
+            /* skip the remaining children */
+            frame->next = NULL;
+            frame->index = NL_WALK_MAX_SLOTS;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef NOLLI_WALK_H
+#define NOLLI_WALK_H
+
+#include "nolli.h"
+#include "ast.h"
+
+/** A node on the walk's stack */
+struct nl_walk_frame {
+    struct nl_ast *node;
+    struct nl_ast *next;    /**< next element to visit, when `node` is a list */
+    unsigned int index;     /**< slot of the next child to visit */
+    long value;             /**< visitor state, zeroed for each node */
+    void *state[3];         /**< visitor state, zeroed for each node */
+};
+
+enum { NL_WALK_INLINE_FRAMES = 16 };
+
+struct nl_walk;
+
+/**
+ * Called when a node is reached. Returning false skips its children
+ * and its post-visit.
+ */
+typedef bool (*nl_walk_pre_fn)(struct nl_walk *walk, struct nl_walk_frame *frame);
+
+/**
+ * Called after the child in slot `index` has been walked or skipped (list
+ * elements are numbered in order). Returning false skips the remaining
+ * children.
+ */
+typedef bool (*nl_walk_child_fn)(struct nl_walk *walk, struct nl_walk_frame *frame,
+        unsigned int index);
+
+/** Called once every child of a node has been walked */
+typedef void (*nl_walk_post_fn)(struct nl_walk *walk, struct nl_walk_frame *frame);
+
+/**
+ * Depth-first AST traversal on an explicit stack.
+ *
+ * Children are visited in source order, and missing (NULL) children
+ * are skipped. The walk only uses the C stack for the callbacks
+ * themselves, so arbitrarily deep trees can't overflow it. A walk can
+ * be reused for several roots; its stack is kept between them. Shallow
+ * trees are walked without allocating, so a walk must not be moved
+ * once initialized.
+ */
+struct nl_walk {
+    struct nl_context *ctx;
+    nl_walk_pre_fn pre;         /**< may be NULL */
+    nl_walk_child_fn child;     /**< may be NULL */
+    nl_walk_post_fn post;       /**< may be NULL */
+    void *data;                 /**< for the visitor */
+
+    struct nl_walk_frame *frames;
+    unsigned int depth;         /**< number of frames in use */
+    unsigned int size;
+    struct nl_walk_frame inline_frames[NL_WALK_INLINE_FRAMES];
+};
+
+void nl_walk_init(struct nl_walk *walk, struct nl_context *ctx, void *data);
+void nl_walk_deinit(struct nl_walk *walk);
+
+/** Walks the tree rooted at `root` */
+void nl_walk(struct nl_walk *walk, struct nl_ast *root);
+
+/** Returns the frame of the parent of `frame`'s node, or NULL at the root */
+struct nl_walk_frame *nl_walk_parent(const struct nl_walk *walk,
+        const struct nl_walk_frame *frame);
+
+#endif /* NOLLI_WALK_H */